@@ -0,0 +1,103 @@
+#pragma once
+
+#include <linux/bitmap.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "hashmap.h"
+
+/* writer lock stripes of a table, a power of two */
+#define CHASHMAP_LOCKS 256
+
+/*
+ * Bucket array of a struct chashmap. Bucket b is protected by
+ * locks[b % CHASHMAP_LOCKS]. While the map is being resized, future points
+ * to the next table and moved has a bit set for every stripe whose
+ * buckets were already moved there.
+ */
+struct chashmap_table {
+	size_t cap_bits;
+	struct chashmap_table __rcu *future;
+	DECLARE_BITMAP(moved, CHASHMAP_LOCKS);
+	spinlock_t locks[CHASHMAP_LOCKS];
+	struct hashmap_entry __rcu *buckets[];
+};
+
+/*
+ * Chained hashmap safe for concurrent use without any external locking:
+ * - lookups are lock-free, under RCU;
+ * - writers only take the spinlock of the stripe their bucket is in, with
+ *   interrupts disabled, so they may run in atomic context but not in NMI;
+ * - once the load factor is exceeded, a work item moves the entries into a
+ *   table twice as large one stripe at a time, while lookups and writers
+ *   keep going. Lookups missing in a table carry on in its future one.
+ *
+ * Keys, values, hash and equality callbacks, and insertion strategies
+ * are those of struct hashmap.
+ */
+struct chashmap {
+	hashmap_hash_fn hash_fn;
+	hashmap_equal_fn equal_fn;
+	void *ctx;
+
+	struct chashmap_table __rcu *tbl;
+	atomic_long_t sz;
+	int node;
+
+	/* serializes resizes */
+	struct mutex resize_lock;
+	struct work_struct resize;
+};
+
+struct chashmap *chashmap__new(hashmap_hash_fn hash_fn,
+			       hashmap_equal_fn equal_fn, void *ctx, int node);
+void chashmap__free(struct chashmap *map);
+
+size_t chashmap__size(const struct chashmap *map);
+size_t chashmap__capacity(const struct chashmap *map);
+
+/*
+ * Same semantics as hashmap_insert_ctx(). With MM_CTX_ATOMIC the entry
+ * comes from the atomic reserve, growing the map is always deferred to the
+ * resize work.
+ */
+size_t chashmap_insert(struct chashmap *map, long key, long value,
+		       enum hashmap_insert_strategy strategy, long *old_key,
+		       long *old_value, enum mm_alloc_ctx ctx);
+
+#define chashmap__insert(map, key, value, strategy, old_key, old_value)    \
+	chashmap_insert((map), (long)(key), (long)(value), (strategy),     \
+			hashmap_cast_ptr(old_key), hashmap_cast_ptr(old_value), \
+			MM_CTX_PROCESS)
+
+#define chashmap__add(map, key, value) \
+	chashmap__insert((map), (key), (value), HASHMAP_ADD, NULL, NULL)
+
+#define chashmap__set(map, key, value, old_key, old_value)              \
+	chashmap__insert((map), (key), (value), HASHMAP_SET, (old_key), \
+			 (old_value))
+
+#define chashmap__update(map, key, value, old_key, old_value)              \
+	chashmap__insert((map), (key), (value), HASHMAP_UPDATE, (old_key), \
+			 (old_value))
+
+#define chashmap__append(map, key, value) \
+	chashmap__insert((map), (key), (value), HASHMAP_APPEND, NULL, NULL)
+
+#define chashmap__add_atomic(map, key, value)                                 \
+	chashmap_insert((map), (long)(key), (long)(value), HASHMAP_ADD, NULL, \
+			NULL, MM_CTX_ATOMIC)
+
+bool chashmap_delete(struct chashmap *map, long key, long *old_key,
+		     long *old_value);
+
+#define chashmap__delete(map, key, old_key, old_value)                 \
+	chashmap_delete((map), (long)(key), hashmap_cast_ptr(old_key), \
+			hashmap_cast_ptr(old_value))
+
+/* lock-free, callable from any context including NMI */
+bool chashmap_find(const struct chashmap *map, long key, long *value);
+
+#define chashmap__find(map, key, value) \
+	chashmap_find((map), (long)(key), hashmap_cast_ptr(value))
@@ -0,0 +1,53 @@
+#pragma once
+#include <linux/atomic.h>
+#include <linux/slab.h>
+
+#include "debug.h"
+#include "reserve.h"
+#include "status.h"
+#include "xstdint.h"
+
+/*
+ * Collector buckets hold the pointers tracked under a memory tag.
+ * A bucket is a list of fixed size chunks, newest first: pushes reserve a
+ * slot in the head chunk with a cmpxchg on its tail index and a new chunk
+ * is only prepended once the head is full, so no push ever copies or
+ * reallocates what is already stored.
+ */
+
+//A chunk fills exactly one page
+#define MM_BUCKET_CHUNK_SLOTS \
+	((PAGE_SIZE - 2 * sizeof(void *)) / sizeof(void *))
+
+struct mm_bucket_chunk {
+	struct mm_bucket_chunk *next;
+	atomic_t tail;
+	void *slots[MM_BUCKET_CHUNK_SLOTS];
+};
+
+struct mm_bucket {
+	struct mm_bucket_chunk *head;
+	int node;
+};
+
+typedef void (*mm_bucket_release_fn)(void *p);
+
+struct mm_bucket *mm_bucket_new(int node);
+void mm_bucket_free(struct mm_bucket *bucket, mm_bucket_release_fn release);
+
+u64 mm_bucket_push(struct mm_bucket *bucket, void *p, enum mm_alloc_ctx ctx);
+void mm_bucket_drain(struct mm_bucket *bucket, mm_bucket_release_fn release);
+size_t mm_bucket_count(const struct mm_bucket *bucket);
+
+/*
+ * mm_bucket__for_each - iterate over the pointers stored in a bucket
+ * @bucket: bucket to iterate
+ * @chunk: struct mm_bucket_chunk * used as a chunk cursor
+ * @i: integer used as a slot cursor
+ * Slots reserved by a push still in flight may read as NULL.
+ */
+#define mm_bucket__for_each(bucket, chunk, i)                               \
+	for (chunk = READ_ONCE((bucket)->head); chunk; chunk = chunk->next) \
+		for (i = 0; i < min_t(int, atomic_read(&chunk->tail),         \
+				      MM_BUCKET_CHUNK_SLOTS);                 \
+		     i++)
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <linux/types.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+
+/*
+ * Header of an immutable, kvmalloc'ed table published under RCU, embedded
+ * first in the tables of range_map and snap_map. nr is the number of
+ * entries the table holds.
+ */
+struct cow_table {
+	struct rcu_head rcu;
+	size_t nr;
+};
+
+/*
+ * Current table of a copy-on-write structure. Readers dereference tbl
+ * under rcu_read_lock(); writers build a new table next to the current one
+ * and publish it under an irq safe spinlock, the old one is freed after a
+ * grace period.
+ */
+struct cow_ptr {
+	struct cow_table __rcu *tbl;
+	spinlock_t lock;
+	int node;
+};
+
+/* an empty table with room for n entries on node, NULL on failure */
+typedef struct cow_table *(*cow_table_alloc_fn)(int node, size_t n,
+						 gfp_t gfp);
+
+void cow_ptr__init(struct cow_ptr *ptr, int node);
+/* readers may still be running, the table is freed after a grace period */
+void cow_ptr__clear(struct cow_ptr *ptr);
+size_t cow_ptr__size(const struct cow_ptr *ptr);
+
+struct cow_table *cow_ptr_lock(struct cow_ptr *ptr, size_t *nr, long delta,
+			       cow_table_alloc_fn alloc, gfp_t gfp,
+			       unsigned long *flags);
+void cow_ptr_publish(struct cow_ptr *ptr, struct cow_table *tbl);
+/* replaces the current table whatever it holds, tbl may be NULL */
+void cow_ptr_replace(struct cow_ptr *ptr, struct cow_table *tbl);
+
+/* current table, ptr->lock must be held */
+static inline struct cow_table *cow_ptr_locked(struct cow_ptr *ptr)
+{
+	return rcu_dereference_protected(ptr->tbl, lockdep_is_held(&ptr->lock));
+}
+
+static inline void cow_ptr_unlock(struct cow_ptr *ptr, unsigned long flags)
+{
+	spin_unlock_irqrestore(&ptr->lock, flags);
+}
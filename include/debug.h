@@ -1,5 +1,10 @@
 #include "config.h"
 
+struct dentry;
+
+//xklib directory in debugfs, created on load and shared by every unit
+extern struct dentry *xklib_debugfs;
+
 #ifdef DEBUG_BUILD
 #ifndef ENABLE_EPT_PROTECTION
 
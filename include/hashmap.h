@@ -1,6 +1,10 @@
 #pragma once
 
 #include <linux/types.h>
+#include <linux/prefetch.h>
+#include <linux/string.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
 
 #include "status.h"
 #include "memory.h"
@@ -34,6 +38,98 @@ static inline size_t str_hash(const char *s)
 	return h;
 }
 
+/*
+ * Byte string hash, wyhash (final v4). Keys of up to 16 bytes are read in
+ * two overlapping halves. Longer ones are consumed 48 bytes at a time by
+ * three independent lanes, then 16 bytes at a time, and the last 16 bytes
+ * are folded in. Every step folds a full 64x64->128 bit product. With a
+ * random seed, inputs sharing long prefixes don't collide any more than
+ * others.
+ */
+#define BYTES_HASH_P0 0x2d358dccaa6c78a5ull
+#define BYTES_HASH_P1 0x8bb84b93962eacc9ull
+#define BYTES_HASH_P2 0x4b33a62ed433d4a3ull
+#define BYTES_HASH_P3 0x4d5a2da51de1aa47ull
+
+static inline u64 bytes_hash_mix(u64 a, u64 b)
+{
+	unsigned __int128 r = (unsigned __int128)a * b;
+
+	return (u64)r ^ (u64)(r >> 64);
+}
+
+static inline u64 bytes_hash_r8(const u8 *p)
+{
+	u64 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline u64 bytes_hash_r4(const u8 *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline u64 bytes_hash(const void *data, size_t len, u64 seed)
+{
+	const u8 *p = data;
+	unsigned __int128 r;
+	u64 a, b, see1, see2;
+	size_t i = len;
+
+	seed ^= bytes_hash_mix(seed ^ BYTES_HASH_P0, BYTES_HASH_P1);
+
+	if (likely(len <= 16)) {
+		if (likely(len >= 4)) {
+			a = (bytes_hash_r4(p) << 32) |
+			    bytes_hash_r4(p + ((len >> 3) << 2));
+			b = (bytes_hash_r4(p + len - 4) << 32) |
+			    bytes_hash_r4(p + len - 4 - ((len >> 3) << 2));
+		} else if (likely(len > 0)) {
+			a = ((u64)p[0] << 16) | ((u64)p[len >> 1] << 8) |
+			    p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		if (unlikely(i > 48)) {
+			see1 = seed;
+			see2 = seed;
+			do {
+				seed = bytes_hash_mix(
+					bytes_hash_r8(p) ^ BYTES_HASH_P1,
+					bytes_hash_r8(p + 8) ^ seed);
+				see1 = bytes_hash_mix(
+					bytes_hash_r8(p + 16) ^ BYTES_HASH_P2,
+					bytes_hash_r8(p + 24) ^ see1);
+				see2 = bytes_hash_mix(
+					bytes_hash_r8(p + 32) ^ BYTES_HASH_P3,
+					bytes_hash_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (likely(i > 48));
+			seed ^= see1 ^ see2;
+		}
+		while (unlikely(i > 16)) {
+			seed = bytes_hash_mix(bytes_hash_r8(p) ^ BYTES_HASH_P1,
+					      bytes_hash_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = bytes_hash_r8(p + i - 16);
+		b = bytes_hash_r8(p + i - 8);
+	}
+
+	r = (unsigned __int128)(a ^ BYTES_HASH_P1) * (b ^ seed);
+	return bytes_hash_mix((u64)r ^ BYTES_HASH_P0 ^ len,
+			      (u64)(r >> 64) ^ BYTES_HASH_P1);
+}
+
 static inline size_t long_hash(long l)
 {
 	return l ^ 11400714819323198485llu;
@@ -47,6 +143,23 @@ static inline bool long_cmp(long l1, long l2)
 typedef size_t (*hashmap_hash_fn)(long key, void *ctx);
 typedef bool (*hashmap_equal_fn)(long key1, long key2, void *ctx);
 
+/*
+ * Byte string key: maps set up with hashmap__init_bytes() take pointers to
+ * these as keys, hash them with bytes_hash() and compare them with memcmp.
+ * The descriptor and the bytes must outlive the entry, lookups can pass a
+ * temporary one, see hashmap__find_bytes().
+ */
+struct hashmap_bytes {
+	const void *data;
+	size_t len;
+};
+
+/* random seed of the byte string maps, set by hashmap_cache_init() */
+extern u64 hashmap_bytes_seed;
+
+size_t hashmap_bytes_hash(long key, void *ctx);
+bool hashmap_bytes_equal(long key1, long key2, void *ctx);
+
 /*
  * Hashmap interface is polymorphic, keys and values could be either
  * long-sized integers or pointers, this is achieved as follows:
@@ -73,6 +186,61 @@ struct hashmap_entry {
 	struct hashmap_entry *next;
 };
 
+/*
+ * Hashmap storage layout, selected with hashmap__set_layout() while the
+ * map is still empty:
+ * - HASHMAP_CHAINED - one allocation per entry, chained off an array of
+ *   buckets. Supports lock-free lookups through hashmap__find_rcu();
+ * - HASHMAP_OPEN - open addressing: keys and values are stored inline in
+ *   a flat slot array, next to one control byte per slot holding 7 bits of
+ *   the hash. Lookups filter a group of 8 control bytes at a time with
+ *   word-wide bit tricks before touching any key. No per entry
+ *   allocation and no pointer chasing, but no lock-free lookups either;
+ * - HASHMAP_DENSE - keys and values are packed at the start of a slot
+ *   array, in insertion order, and the buckets only index them. Iteration
+ *   is a linear scan of sz slots whatever the capacity, and the pairs can
+ *   be copied out in one go, see hashmap__dense_slots(). Deletes move the
+ *   last pair into the freed slot, which breaks the insertion order.
+ */
+enum hashmap_layout {
+	HASHMAP_CHAINED,
+	HASHMAP_OPEN,
+	HASHMAP_DENSE,
+};
+
+/*
+ * Inline key/value pair of HASHMAP_OPEN and HASHMAP_DENSE maps. Iteration
+ * hands slots out as struct hashmap_entry cursors, of which only the key
+ * and value members are valid.
+ */
+struct hashmap_slot {
+	union {
+		long key;
+		const void *pkey;
+	};
+	union {
+		long value;
+		void *pvalue;
+	};
+};
+
+#define HASHMAP_GROUP_WIDTH 8
+#define HASHMAP_CTRL_EMPTY ((u8)0x80)
+#define HASHMAP_CTRL_DELETED ((u8)0xfe)
+#define hashmap_ctrl_full(c) (!((c) & 0x80))
+
+/* HASHMAP_DENSE bucket: slot number plus one, 0 if empty, and hash bits */
+struct hashmap_index {
+	u32 idx;
+	u32 tag;
+};
+
+/*
+ * Removed entries and the bucket arrays replaced on resize are only freed
+ * after a grace period, so lookups can run under rcu_read_lock() through
+ * hashmap__find_rcu() while a writer modifies the map.
+ * Writers still have to be serialized by the caller.
+ */
 struct hashmap {
 	hashmap_hash_fn hash_fn;
 	hashmap_equal_fn equal_fn;
@@ -82,17 +250,96 @@ struct hashmap {
 	size_t cap;
 	size_t cap_bits;
 	size_t sz;
+	/* node buckets and entries are allocated on, NUMA_NO_NODE for local */
+	int node;
+	/* entries are embedded in caller objects, see hashmap_insert_entry() */
+	bool intrusive;
+	/* a delete happened since the last resize, see hashmap__reserve() */
+	bool may_shrink;
+
+	/*
+	 * HASHMAP_CHAINED maps are resized incrementally: entries of the
+	 * previous bucket array are moved over from rehash_idx onwards by
+	 * each insert, and lookups check both arrays meanwhile
+	 */
+	struct hashmap_entry **old_buckets;
+	size_t old_cap;
+	size_t old_cap_bits;
+	size_t rehash_idx;
+	/* bumped around the replacement of either array, for RCU readers */
+	seqcount_t seq;
+
+	enum hashmap_layout layout;
+	/* HASHMAP_OPEN storage, ctrl has HASHMAP_GROUP_WIDTH mirrored bytes */
+	struct hashmap_slot *slots;
+	u8 *ctrl;
+	size_t tombs;
+	/* HASHMAP_DENSE buckets, allocated right after the slots */
+	struct hashmap_index *index;
+
+	/* NULL unless enabled with hashmap__enable_stats() */
+	struct hashmap_stats *stats;
 };
 
 void hashmap__init(struct hashmap *map, hashmap_hash_fn hash_fn,
 		   hashmap_equal_fn equal_fn, void *ctx);
 struct hashmap *hashmap__new(hashmap_hash_fn hash_fn, hashmap_equal_fn equal_fn,
 			     void *ctx);
+struct hashmap *hashmap__new_node(hashmap_hash_fn hash_fn,
+				  hashmap_equal_fn equal_fn, void *ctx, int node);
 void hashmap__clear(struct hashmap *map);
 void hashmap__free(struct hashmap *map);
 
 size_t hashmap__size(const struct hashmap *map);
 size_t hashmap__capacity(const struct hashmap *map);
+size_t hashmap__set_layout(struct hashmap *map, enum hashmap_layout layout);
+size_t hashmap__set_intrusive(struct hashmap *map);
+
+/*
+ * Maps grow by doubling when more than 3/4 full. Once deletes brought them
+ * below 1/8, the next insert shrinks them to at most 3/8 full: deletes
+ * themselves never move entries, so that they stay safe under
+ * hashmap__for_each_entry_safe(). The delete that empties a map which had
+ * grown frees all of its storage.
+ * hashmap__reserve() sizes the map for n entries upfront, so that loading
+ * them takes a single allocation, and the capacity is kept until entries
+ * are deleted. hashmap__compact() sizes a map down to fit its current
+ * entries right away, finishing any incremental rehash and dropping the
+ * tombstones of the open layout, and frees all storage of an empty map.
+ */
+size_t hashmap__reserve(struct hashmap *map, size_t n);
+size_t hashmap__compact(struct hashmap *map);
+
+/*
+ * Optional statistics, see hashmap_stats.h. hashmap__stats_scan() walks
+ * the whole map to fill the chain histogram and, like writers, must be
+ * serialized with them.
+ */
+size_t hashmap__enable_stats(struct hashmap *map, const char *name);
+void hashmap__disable_stats(struct hashmap *map);
+void hashmap__stats_scan(struct hashmap *map);
+
+#define hashmap__init_bytes(map) \
+	hashmap__init((map), hashmap_bytes_hash, hashmap_bytes_equal, NULL)
+
+/*
+ * Entries of non intrusive maps come from a dedicated slab cache, set up
+ * by mm_init() before any map is used
+ */
+extern struct kmem_cache *hashmap_entry_cache;
+
+u64 hashmap_cache_init(void);
+void hashmap_cache_destroy(void);
+
+/*
+ * Benchmarks only: chained maps move their whole previous array on the
+ * first insert after a resize, as they did before incremental rehashing
+ */
+extern bool hashmap_rehash_oneshot;
+
+/* xklib/hashmap in debugfs, holding the files of hashmap__enable_stats() */
+void hashmap_debugfs_init(void);
+void hashmap_debugfs_destroy(void);
 
 /*
  * Hashmap insertion strategy:
@@ -136,6 +383,17 @@ size_t hashmap_insert(struct hashmap *map, long key, long value,
 		      enum hashmap_insert_strategy strategy, long *old_key,
 		      long *old_value);
 
+/*
+ * hashmap_insert_ctx() is hashmap_insert() callable from atomic context
+ * when ctx is MM_CTX_ATOMIC: the entry comes from the atomic reserve and
+ * the map is never grown, the next process context insert catches up.
+ * Bucket arrays are not pooled: a map that never saw a process context
+ * insert has no buckets yet and is refused with XKLIB_ENOMEM.
+ */
+size_t hashmap_insert_ctx(struct hashmap *map, long key, long value,
+			  enum hashmap_insert_strategy strategy, long *old_key,
+			  long *old_value, enum mm_alloc_ctx ctx);
+
 #define hashmap__insert(map, key, value, strategy, old_key, old_value) \
 	hashmap_insert((map), (long)(key), (long)(value), (strategy),  \
 		       hashmap_cast_ptr(old_key), hashmap_cast_ptr(old_value))
@@ -154,6 +412,15 @@ size_t hashmap_insert(struct hashmap *map, long key, long value,
 #define hashmap__append(map, key, value) \
 	hashmap__insert((map), (key), (value), HASHMAP_APPEND, NULL, NULL)
 
+#define hashmap__insert_atomic(map, key, value, strategy, old_key, old_value) \
+	hashmap_insert_ctx((map), (long)(key), (long)(value), (strategy),     \
+			   hashmap_cast_ptr(old_key),                         \
+			   hashmap_cast_ptr(old_value), MM_CTX_ATOMIC)
+
+#define hashmap__add_atomic(map, key, value)                              \
+	hashmap__insert_atomic((map), (key), (value), HASHMAP_ADD, NULL, \
+			       NULL)
+
 bool hashmap_delete(struct hashmap *map, long key, long *old_key,
 		    long *old_value);
 
@@ -161,20 +428,129 @@ bool hashmap_delete(struct hashmap *map, long key, long *old_key,
 	hashmap_delete((map), (long)(key), hashmap_cast_ptr(old_key), \
 		       hashmap_cast_ptr(old_value))
 
+/*
+ * Intrusive maps, set up with hashmap__set_intrusive() while empty, link
+ * struct hashmap_entry members embedded in the caller's own objects and
+ * never allocate nor free entries: the key and value are set by the
+ * caller before hashmap_insert_entry(), which takes the insertion
+ * strategies above and returns the entry it replaced or collided with
+ * through old_entry. Process context only, as the bucket array may grow.
+ *
+ * hashmap__delete() and hashmap_delete_entry() only unlink the entry,
+ * the caller must wait for a grace period before freeing it if
+ * hashmap__find_rcu() is used on the map.
+ */
+size_t hashmap_insert_entry(struct hashmap *map, struct hashmap_entry *entry,
+			    enum hashmap_insert_strategy strategy,
+			    struct hashmap_entry **old_entry);
+
+#define hashmap__add_entry(map, entry) \
+	hashmap_insert_entry((map), (entry), HASHMAP_ADD, NULL)
+
+bool hashmap_delete_entry(struct hashmap *map, struct hashmap_entry *entry);
+
 bool hashmap_find(const struct hashmap *map, long key, long *value);
 
 #define hashmap__find(map, key, value) \
 	hashmap_find((map), (long)(key), hashmap_cast_ptr(value))
 
+#define hashmap__find_bytes(map, data, len, value)                         \
+	hashmap__find((map), (&(struct hashmap_bytes){ (data), (len) }), \
+		      (value))
+
+#define hashmap__delete_bytes(map, data, len, old_key, old_value)            \
+	hashmap__delete((map), (&(struct hashmap_bytes){ (data), (len) }), \
+			(old_key), (old_value))
+
+/*
+ * Batched lookup and insert of arrays of keys. The buckets of several
+ * keys are prefetched before any of them is resolved, which pays off on
+ * maps much larger than the caches.
+ */
+size_t hashmap_find_batch(const struct hashmap *map, const long *keys,
+			  long *values, bool *found, size_t n);
+size_t hashmap_insert_batch(struct hashmap *map, const long *keys,
+			    const long *values, size_t n,
+			    enum hashmap_insert_strategy strategy, size_t *errs);
+
+#define hashmap__find_batch(map, keys, values, found, n)                   \
+	hashmap_find_batch((map), (const long *)hashmap_cast_ptr(keys),    \
+			   hashmap_cast_ptr(values), (found), (n))
+
+#define hashmap__insert_batch(map, keys, values, n, strategy, errs)        \
+	hashmap_insert_batch((map), (const long *)hashmap_cast_ptr(keys),  \
+			     (const long *)hashmap_cast_ptr(values), (n),  \
+			     (strategy), (errs))
+
+/*
+ * hashmap__find_rcu() is the lock-free counterpart of hashmap__find(), it
+ * must be called under rcu_read_lock(). It never misses a key that stays
+ * in the map while it runs, even if the key is being moved to a new
+ * bucket array, and it never touches freed memory. Not from NMI handlers
+ * that may interrupt a writer of the same map, which could then never
+ * finish its array switch.
+ */
+bool hashmap_find_rcu(const struct hashmap *map, long key, long *value);
+
+#define hashmap__find_rcu(map, key, value) \
+	hashmap_find_rcu((map), (long)(key), hashmap_cast_ptr(value))
+
+/* end of the bucket loop cursor of the iteration macros below */
+static inline size_t hashmap__iter_end(const struct hashmap *map)
+{
+	return map->layout == HASHMAP_DENSE ? map->sz :
+					      map->cap + map->old_cap;
+}
+
+static inline struct hashmap_entry *
+hashmap__bucket_first(const struct hashmap *map, size_t bkt)
+{
+	/* a delete emptying the map under a safe iteration frees its buckets */
+	if (bkt >= hashmap__iter_end(map))
+		return NULL;
+	/* dense slots are iterated directly, they are all occupied */
+	if (map->layout == HASHMAP_DENSE)
+		return (struct hashmap_entry *)&map->slots[bkt];
+	if (map->layout == HASHMAP_OPEN)
+		return hashmap_ctrl_full(map->ctrl[bkt]) ?
+			       (struct hashmap_entry *)&map->slots[bkt] :
+			       NULL;
+	/* buckets past cap are the ones of the array being migrated */
+	return bkt < map->cap ? map->buckets[bkt] :
+				map->old_buckets[bkt - map->cap];
+}
+
+static inline struct hashmap_entry *
+hashmap__bucket_next(const struct hashmap *map, struct hashmap_entry *cur)
+{
+	/* slots are buckets of exactly one entry */
+	return map->layout != HASHMAP_CHAINED ? NULL : cur->next;
+}
+
+/*
+ * Key/value pairs of a HASHMAP_DENSE map, hashmap__size() of them, e.g. to
+ * copy them all out at once. NULL for the other layouts.
+ */
+static inline const struct hashmap_slot *
+hashmap__dense_slots(const struct hashmap *map)
+{
+	return map->layout == HASHMAP_DENSE ? map->slots : NULL;
+}
+
+struct hashmap_entry *hashmap__key_first(const struct hashmap *map, long key);
+struct hashmap_entry *hashmap__key_next(const struct hashmap *map,
+					struct hashmap_entry *cur, long key);
+
 /*
  * hashmap__for_each_entry - iterate over all entries in hashmap
  * @map: hashmap to iterate
  * @cur: struct hashmap_entry * used as a loop cursor
  * @bkt: integer used as a bucket loop cursor
  */
-#define hashmap__for_each_entry(map, cur, bkt) \
-	for (bkt = 0; bkt < map->cap; bkt++)   \
-		for (cur = map->buckets[bkt]; cur; cur = cur->next)
+#define hashmap__for_each_entry(map, cur, bkt)                        \
+	for (bkt = 0; bkt < hashmap__iter_end(map); bkt++)            \
+		for (cur = hashmap__bucket_first((map), bkt); cur;    \
+		     cur = hashmap__bucket_next((map), cur))
 
 /*
  * hashmap__for_each_entry_safe - iterate over all entries in hashmap, safe
@@ -183,13 +559,17 @@ bool hashmap_find(const struct hashmap *map, long key, long *value);
  * @cur: struct hashmap_entry * used as a loop cursor
  * @tmp: struct hashmap_entry * used as a temporary next cursor storage
  * @bkt: integer used as a bucket loop cursor
+ *
+ * Buckets are walked backwards: removing a dense slot moves the last one,
+ * already visited, into its place.
  */
-#define hashmap__for_each_entry_safe(map, cur, tmp, bkt)               \
-	for (bkt = 0; bkt < map->cap; bkt++)                           \
-		for (cur = map->buckets[bkt]; cur && ({                \
-						      tmp = cur->next; \
-						      true;            \
-					      });                      \
+#define hashmap__for_each_entry_safe(map, cur, tmp, bkt)                     \
+	for (bkt = hashmap__iter_end(map); bkt-- > 0;)                      \
+		for (cur = hashmap__bucket_first((map), bkt);                \
+		     cur && ({                                               \
+			     tmp = hashmap__bucket_next((map), cur);         \
+			     true;                                           \
+		     });                                                     \
 		     cur = tmp)
 
 /*
@@ -198,22 +578,14 @@ bool hashmap_find(const struct hashmap *map, long key, long *value);
  * @cur: struct hashmap_entry * used as a loop cursor
  * @key: key to iterate entries for
  */
-#define hashmap__for_each_key_entry(map, cur, _key)                       \
-	for (cur = map->buckets ? map->buckets[hash_bits(                 \
-					  map->hash_fn((_key), map->ctx), \
-					  map->cap_bits)] :               \
-				  NULL;                                   \
-	     cur; cur = cur->next)                                        \
-		if (map->equal_fn(cur->key, (_key), map->ctx))
-
-#define hashmap__for_each_key_entry_safe(map, cur, tmp, _key)             \
-	for (cur = map->buckets ? map->buckets[hash_bits(                 \
-					  map->hash_fn((_key), map->ctx), \
-					  map->cap_bits)] :               \
-				  NULL;                                   \
-	     cur && ({                                                    \
-		     tmp = cur->next;                                     \
-		     true;                                                \
-	     });                                                          \
-	     cur = tmp)                                                   \
-		if (map->equal_fn(cur->key, (_key), map->ctx))
+#define hashmap__for_each_key_entry(map, cur, _key)                    \
+	for (cur = hashmap__key_first((map), (long)(_key)); cur;       \
+	     cur = hashmap__key_next((map), cur, (long)(_key)))
+
+#define hashmap__for_each_key_entry_safe(map, cur, tmp, _key)          \
+	for (cur = hashmap__key_first((map), (long)(_key));            \
+	     cur && ({                                                 \
+		     tmp = hashmap__key_next((map), cur, (long)(_key)); \
+		     true;                                             \
+	     });                                                       \
+	     cur = tmp)
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <linux/random.h>
+
+#include "hashmap.h"
+#include "hashmap_stats.h"
+
+/*
+ * Internals shared by the hashmap layouts, not meant for hashmap users.
+ * Allocations go through these helpers to keep the per node accounting
+ * right.
+ */
+
+void *hashmap_alloc_node(int node, size_t size, gfp_t gfp);
+void *hashmap_alloc(const struct hashmap *map, size_t size, gfp_t gfp);
+void hashmap_free(const void *p, size_t size);
+void hashmap_free_deferred(void *p, size_t size);
+struct hashmap_entry *hashmap_alloc_entry(int node, enum mm_alloc_ctx ctx);
+void hashmap_free_entry(struct hashmap_entry *entry);
+void hashmap_free_entry_rcu(struct hashmap_entry *entry);
+
+size_t hashmap_open_insert(struct hashmap *map, long key, long value,
+			   enum hashmap_insert_strategy strategy,
+			   long *old_key, long *old_value,
+			   enum mm_alloc_ctx ctx);
+bool hashmap_open_find(const struct hashmap *map, long key, long *value);
+bool hashmap_open_delete(struct hashmap *map, long key, long *old_key,
+			 long *old_value);
+size_t hashmap_open_reserve(struct hashmap *map, size_t n);
+size_t hashmap_open_compact(struct hashmap *map);
+void hashmap_open_clear(struct hashmap *map);
+struct hashmap_entry *hashmap_open_key_next(const struct hashmap *map,
+					    size_t from, long key);
+size_t hashmap_open_probe_len(const struct hashmap *map, long key);
+
+size_t hashmap_dense_insert(struct hashmap *map, long key, long value,
+			    enum hashmap_insert_strategy strategy,
+			    long *old_key, long *old_value,
+			    enum mm_alloc_ctx ctx);
+bool hashmap_dense_find(const struct hashmap *map, long key, long *value);
+bool hashmap_dense_delete(struct hashmap *map, long key, long *old_key,
+			  long *old_value);
+size_t hashmap_dense_reserve(struct hashmap *map, size_t n);
+size_t hashmap_dense_compact(struct hashmap *map);
+void hashmap_dense_clear(struct hashmap *map);
+struct hashmap_entry *hashmap_dense_key_next(const struct hashmap *map,
+					     size_t from, long key);
+size_t hashmap_dense_probe_len(const struct hashmap *map, long key);
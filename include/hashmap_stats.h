@@ -0,0 +1,72 @@
+#pragma once
+
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+
+#include "hashmap.h"
+
+/* last histogram bucket counts everything at or above it */
+#define HASHMAP_STATS_HIST 16
+/* load factor samples kept, oldest overwritten first */
+#define HASHMAP_STATS_SAMPLES 64
+
+struct hashmap_stats_sample {
+	u64 ns;
+	size_t sz;
+	size_t cap;
+};
+
+/*
+ * Statistics of a map, allocated by hashmap__enable_stats().
+ *
+ * probes is a histogram of the probe length of the lookups done through
+ * hashmap__find(): entries compared along the chains for HASHMAP_CHAINED,
+ * control groups loaded for HASHMAP_OPEN, index buckets visited for
+ * HASHMAP_DENSE. chains is filled by hashmap__stats_scan(): the length of
+ * every chain for HASHMAP_CHAINED, the probe length of every stored key
+ * for the other layouts. A load factor sample is taken on every resize
+ * and scan.
+ */
+struct hashmap_stats {
+	atomic_long_t probes[HASHMAP_STATS_HIST];
+	atomic_long_t lookups;
+
+	/* protects everything below, written by the map writer */
+	spinlock_t lock;
+	unsigned long chains[HASHMAP_STATS_HIST];
+	size_t max_chain;
+	u64 scan_ns;
+
+	unsigned long grows;
+	unsigned long shrinks;
+	unsigned long rehashes;
+	u64 resize_ns;
+	u64 resize_max_ns;
+
+	struct hashmap_stats_sample samples[HASHMAP_STATS_SAMPLES];
+	size_t nr_samples;
+
+	struct dentry *dentry;
+};
+
+void hashmap_stats_probe(const struct hashmap *map, long key);
+void hashmap_stats_resize(struct hashmap *map, size_t old_cap, u64 start);
+
+/* hooks of the layouts, free when the map has no statistics */
+static inline void hashmap_stats_lookup(const struct hashmap *map, long key)
+{
+	if (unlikely(map->stats))
+		hashmap_stats_probe(map, key);
+}
+
+static inline u64 hashmap_stats_start(const struct hashmap *map)
+{
+	return unlikely(map->stats) ? ktime_get_ns() : 0;
+}
+
+static inline void hashmap_stats_end(struct hashmap *map, size_t old_cap,
+				     u64 start)
+{
+	if (unlikely(map->stats))
+		hashmap_stats_resize(map, old_cap, start);
+}
@@ -1,9 +1,52 @@
 #include "xstdint.h"
 
+//Longest physical range a single read or scan may cover
+#define XKLIB_IOCTL_MAX_READ 0x1000
+#define XKLIB_IOCTL_MAX_SCAN 0x100000
+
+/*
+ * Every ioctl needs CAP_SYS_RAWIO. Physical addresses are only read or
+ * mapped behind pages the iomem tree calls RAM.
+ * Windows live in the address space of the caller until they are unmapped
+ * or the module unloads.
+ */
 typedef union _xklib_ioctl_data {
 	struct xklib_ioctl_init {
 		xuint64_t vmcall_key;
 	} init;
+	//Physical address behind va in the address space of the caller
+	struct xklib_ioctl_translate {
+		xuint64_t va;
+		xuint64_t pa;
+	} translate;
+	//Copies len bytes at pa to buf, without crossing a page
+	struct xklib_ioctl_read {
+		xuint64_t pa;
+		xuint64_t buf;
+		xuint64_t len;
+	} read;
+	//va keeps the page offset of pa
+	struct xklib_ioctl_map {
+		xuint64_t pa;
+		xuint64_t va;
+	} map;
+	struct xklib_ioctl_unmap {
+		xuint64_t va;
+	} unmap;
+	//Counts the aligned qwords equal to pattern in [pa, pa + len)
+	struct xklib_ioctl_scan {
+		xuint64_t pa;
+		xuint64_t len;
+		xuint64_t pattern;
+		xuint64_t hits;
+	} scan;
 } xklib_ioctl_data, *pxklib_ioctl_data;
 
-enum xklib_ioctl_code { xklib_init = _IOR(511, 1, xklib_ioctl_data *) };
\ No newline at end of file
+enum xklib_ioctl_code {
+	xklib_init = _IOR(511, 1, xklib_ioctl_data *),
+	xklib_translate = _IOWR(511, 2, xklib_ioctl_data *),
+	xklib_read = _IOWR(511, 3, xklib_ioctl_data *),
+	xklib_map = _IOWR(511, 4, xklib_ioctl_data *),
+	xklib_unmap = _IOWR(511, 5, xklib_ioctl_data *),
+	xklib_scan = _IOWR(511, 6, xklib_ioctl_data *),
+};
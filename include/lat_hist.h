@@ -0,0 +1,106 @@
+#pragma once
+
+/*
+ * Log-linear latency histogram in the style of HdrHistogram, shared by the
+ * kernel benchmarks and the userspace drivers.
+ * Values below LAT_HIST_SUB get a bucket each, above that every power of
+ * two is split in LAT_HIST_SUB buckets, so a bucket is never wider than
+ * 1/LAT_HIST_SUB of its lower bound (6.25%) whatever the magnitude.
+ * Recording is a couple of shifts, merging is a sum: one histogram per
+ * thread, merged once the run is over.
+ */
+#include "xstdint.h"
+
+#define LAT_HIST_SUB_BITS 4
+#define LAT_HIST_SUB (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BUCKETS ((64 - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB)
+
+struct lat_hist {
+	xuint64_t count;
+	xuint64_t sum;
+	xuint64_t min;
+	xuint64_t max;
+	xuint64_t buckets[LAT_HIST_BUCKETS];
+};
+
+static inline void lat_hist_reset(struct lat_hist *h)
+{
+	__builtin_memset(h, 0, sizeof(*h));
+	h->min = ~0UL;
+}
+
+static inline unsigned int lat_hist_index(xuint64_t v)
+{
+	unsigned int shift;
+
+	if (v < LAT_HIST_SUB)
+		return v;
+
+	shift = 63 - __builtin_clzl(v) - LAT_HIST_SUB_BITS;
+	return (shift + 1) * LAT_HIST_SUB + (v >> shift) - LAT_HIST_SUB;
+}
+
+/* smallest value that lands in bucket i */
+static inline xuint64_t lat_hist_lower(unsigned int i)
+{
+	unsigned int shift;
+
+	if (i < LAT_HIST_SUB)
+		return i;
+
+	shift = i / LAT_HIST_SUB - 1;
+	return (xuint64_t)(LAT_HIST_SUB + i % LAT_HIST_SUB) << shift;
+}
+
+/* largest value that lands in bucket i */
+static inline xuint64_t lat_hist_upper(unsigned int i)
+{
+	return i + 1 < LAT_HIST_BUCKETS ? lat_hist_lower(i + 1) - 1 : ~0UL;
+}
+
+static inline void lat_hist_record(struct lat_hist *h, xuint64_t v)
+{
+	h->buckets[lat_hist_index(v)]++;
+	h->count++;
+	h->sum += v;
+	if (v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+}
+
+static inline void lat_hist_merge(struct lat_hist *dst,
+				  const struct lat_hist *src)
+{
+	for (unsigned int i = 0; i < LAT_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/*
+ * Upper bound of the bucket holding the value at per_mille/1000 of the
+ * recorded ones, clamped to the largest value recorded
+ */
+static inline xuint64_t lat_hist_percentile(const struct lat_hist *h,
+					    unsigned int per_mille)
+{
+	xuint64_t rank = (h->count * per_mille + 999) / 1000, seen = 0;
+
+	if (!h->count)
+		return 0;
+	if (!rank)
+		rank = 1;
+
+	for (unsigned int i = 0; i < LAT_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			return lat_hist_upper(i) < h->max ? lat_hist_upper(i) :
+							    h->max;
+	}
+	return h->max;
+}
@@ -2,12 +2,22 @@
 #include <asm/io.h>
 #include <asm/page_64_types.h>
 #include <linux/mm.h>
+#include <linux/mmu_notifier.h>
+#include <linux/numa.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/sched/mm.h>
+#include <linux/workqueue.h>
 #include <linux/vmalloc.h>
 
+#include "collector.h"
 #include "debug.h"
 #include "ia32.h"
+#include "reserve.h"
 #include "xstdint.h"
 #include "hashmap.h"
+#include "pfn_map.h"
 
 /**
  * IMPORTANT:
@@ -16,7 +26,9 @@
  */
 
 #define MM_TAG_GENERIC ('XLIB')
-#define MM_BUCKET_MAX 512
+
+//Pointers queued per cpu before a single call_rcu releases all of them
+#define MM_DEFER_BATCH 62
 
 #define INVALID_PGD(pgd) (!((pml4e_64 *)pgd)->present)
 #define INVALID_PUD(pud) (!((pdpte_64 *)pud)->present)
@@ -38,6 +50,11 @@
 
 #define kmalloc_struct(var) kmalloc(sizeof(var), GFP_KERNEL)
 
+//Node owning the memory behind a kmalloc'd or kvmalloc'd pointer
+#define mm_ptr_node(p)						\
+	page_to_nid(is_vmalloc_addr(p) ? vmalloc_to_page(p) :	\
+					 virt_to_page(p))
+
 #define map_pud map_pdpte
 #define map_pmd map_pde
 
@@ -91,18 +108,69 @@ extern u64 kidentity_base;
 //Virtual address of the identity map used internally by xklib
 extern u64 xidentity_base;
 
+/*
+ * Per-node accounting of the memory owned by xklib.
+ * remote_tables counts table pages that were requested for a node but
+ * had to be served from another one.
+ */
+struct mm_node_stats {
+	atomic64_t table_pages;
+	atomic64_t remote_tables;
+	atomic64_t hashmap_bytes;
+};
+
+extern struct mm_node_stats mm_node_stats[MAX_NUMNODES];
+
+struct mm_defer_batch {
+	struct rcu_head rcu;
+	unsigned int nr;
+	void *ptrs[MM_DEFER_BATCH];
+};
+
+/*
+ * An xklib table hierarchy hooked into the root slot of an mm.
+ * It is the mmu notifier of xklib in that mm, which pins the mm so that
+ * its pgd can still be cleared at teardown. The hierarchy is taken down
+ * when the mm exits or by mm_destroy, whichever comes first.
+ * Every window map_physical hands out takes a pud slot of its own, at
+ * offset 0 of it: windows[pud_index(va)] holds the physical page behind the
+ * window, tagged with MM_WINDOW_VALID, or 0 if the slot has none.
+ */
+struct mm_root {
+	struct mmu_notifier mn;
+	struct rcu_head rcu;
+	pml4e_64 *ppml4e;
+	pdpte_64 *table;
+	u64 windows[PTRS_PER_PUD];
+};
+
+#define MM_WINDOW_VALID 1ULL
+
 typedef u64 xklib_error;
 
 xklib_error mm_init(void);
 void mm_destroy(void);
+void mm_dump_node_stats(void);
+
+struct mm_bucket *mm_collector_bucket(u64 tag);
+xklib_error mm_collect(u64 tag, void *p, enum mm_alloc_ctx ctx);
+
+void *mm_alloc_table(int nid, enum mm_alloc_ctx ctx);
+void mm_free_table(void *table);
+
+void mm_free_deferred(void *p);
+void mm_flush_deferred(void);
 
 last_pt_t get_last_pt(unsigned long addr);
-void map_pdpte(pml4e_64 *ppml4e, unsigned long addr,
-	       struct pt_permissions perms, virt_addr_map *paddr_map);
-void map_pde(pdpte_64 *ppdpte, unsigned long addr, struct pt_permissions perms,
-	     virt_addr_map *paddr_map);
-void map_pte(pde_64 *ppde, unsigned long addr, struct pt_permissions perms,
-	     virt_addr_map *paddr_map);
+xklib_error map_pdpte(pml4e_64 *ppml4e, unsigned long addr,
+		      struct pt_permissions perms, virt_addr_map *paddr_map,
+		      int nid, enum mm_alloc_ctx ctx);
+xklib_error map_pde(pdpte_64 *ppdpte, unsigned long addr,
+		    struct pt_permissions perms, virt_addr_map *paddr_map,
+		    int nid, enum mm_alloc_ctx ctx);
+xklib_error map_pte(pde_64 *ppde, unsigned long addr,
+		    struct pt_permissions perms, virt_addr_map *paddr_map,
+		    int nid, enum mm_alloc_ctx ctx);
 void fill_pte(pte_64 *ppte, unsigned long addr, struct pt_permissions perms,
 	      virt_addr_map *paddr_map);
 
@@ -111,4 +179,11 @@ u64 find_free_pmd(pmd_t *ppmd);
 u64 find_free_pte(pte_t *ppte);
 
 void *map_physical(unsigned long addr, struct pt_permissions perms);
-bool page_mapping_exist(unsigned long addr);
\ No newline at end of file
+void *map_physical_node(struct mm_struct *mm, unsigned long addr,
+			struct pt_permissions perms, int nid,
+			enum mm_alloc_ctx ctx);
+void *map_physical_atomic(struct mm_struct *mm, unsigned long addr,
+			  struct pt_permissions perms);
+xklib_error unmap_physical(void *va);
+bool page_mapping_exist(unsigned long addr);
+bool mm_window_find(unsigned long va, u64 *pa);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+
+#include "hashmap.h"
+
+typedef long (*pcpu_hashmap_merge_fn)(long acc, long value);
+
+static inline long pcpu_hashmap_sum(long acc, long value)
+{
+	return acc + value;
+}
+
+struct pcpu_hashmap_shard {
+	/* only contended by readers merging the shards */
+	struct mutex lock;
+	struct hashmap map;
+};
+
+/*
+ * Write mostly map sharded per cpu, for counters and registries updated
+ * far more often than they are read.
+ *
+ * pcpu_hashmap__add() folds a value into the shard of the current cpu with
+ * the merge callback, e.g. pcpu_hashmap_sum() for counters, so updates
+ * from different cpus never touch the same cache lines. Readers merge the
+ * values of a key across all shards:
+ * - pcpu_hashmap__find() looks the key up in every shard, lock-free;
+ * - pcpu_hashmap_merge() folds every shard into a regular hashmap, to be
+ *   iterated with hashmap__for_each_entry();
+ * - with pcpu_hashmap_start_fold(), a work item periodically publishes
+ *   such a merged map, which pcpu_hashmap__find_snapshot() then reads
+ *   with a single lock-free lookup, at the price of some staleness.
+ *
+ * Process context only, shards are serialized with a mutex.
+ */
+struct pcpu_hashmap {
+	hashmap_hash_fn hash_fn;
+	hashmap_equal_fn equal_fn;
+	pcpu_hashmap_merge_fn merge_fn;
+	void *ctx;
+
+	struct pcpu_hashmap_shard __percpu *shards;
+
+	struct hashmap __rcu *snapshot;
+	struct delayed_work fold;
+	unsigned long fold_interval;
+};
+
+struct pcpu_hashmap *pcpu_hashmap__new(hashmap_hash_fn hash_fn,
+				       hashmap_equal_fn equal_fn,
+				       pcpu_hashmap_merge_fn merge_fn,
+				       void *ctx);
+void pcpu_hashmap__free(struct pcpu_hashmap *map);
+
+size_t pcpu_hashmap_add(struct pcpu_hashmap *map, long key, long value);
+bool pcpu_hashmap_find(const struct pcpu_hashmap *map, long key, long *value);
+bool pcpu_hashmap_find_snapshot(const struct pcpu_hashmap *map, long key,
+				long *value);
+bool pcpu_hashmap_delete(struct pcpu_hashmap *map, long key);
+
+#define pcpu_hashmap__add(map, key, value) \
+	pcpu_hashmap_add((map), (long)(key), (long)(value))
+
+#define pcpu_hashmap__find(map, key, value) \
+	pcpu_hashmap_find((map), (long)(key), hashmap_cast_ptr(value))
+
+#define pcpu_hashmap__find_snapshot(map, key, value) \
+	pcpu_hashmap_find_snapshot((map), (long)(key), hashmap_cast_ptr(value))
+
+#define pcpu_hashmap__delete(map, key) pcpu_hashmap_delete((map), (long)(key))
+
+size_t pcpu_hashmap_merge(struct pcpu_hashmap *map, struct hashmap *dst);
+
+void pcpu_hashmap_start_fold(struct pcpu_hashmap *map, unsigned long interval);
+void pcpu_hashmap_stop_fold(struct pcpu_hashmap *map);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <asm/page.h>
+
+#include "status.h"
+
+enum pfn_class {
+	PFN_HOLE = 0,
+	PFN_RAM = 1,
+	PFN_RESERVED = 2,
+	PFN_MMIO = 3,
+};
+
+//Every 1 GiB chunk of the physical address space has a summary entry
+#define PFN_MAP_CHUNK_SHIFT 30
+#define PFN_MAP_CHUNK_PAGES (1UL << (PFN_MAP_CHUNK_SHIFT - PAGE_SHIFT))
+//2 bits per 4 KiB page, 32 pages per word
+#define PFN_MAP_PAGES_PER_WORD (BITS_PER_LONG / 2)
+#define PFN_MAP_LEAF_WORDS (PFN_MAP_CHUNK_PAGES / PFN_MAP_PAGES_PER_WORD)
+//Summary entries with this bit refer to a leaf instead of holding a class
+#define PFN_MAP_MIXED 0x80000000u
+
+/*
+ * Class of every physical page, built once by mm_init from the iomem
+ * resource tree.
+ *
+ * Chunks holding a single class are described by their summary entry
+ * alone. The others get a leaf of 2 bits per page, 64 KiB per chunk, and
+ * their summary entry holds the index of that leaf. Leaves share one
+ * allocation, so a lookup is one load for uniform chunks and two for
+ * mixed ones. On a 16 GiB machine with its memory map split over a
+ * handful of mixed chunks this is well under 0.01% of RAM.
+ *
+ * The map is not updated on memory hotplug.
+ */
+struct pfn_map {
+	u32 *summary;
+	unsigned long *leaves;
+	size_t nr_chunks;
+	size_t nr_leaves;
+};
+
+extern struct pfn_map pfn_map;
+
+size_t pfn_map_init(void);
+void pfn_map_destroy(void);
+
+static inline enum pfn_class pfn_map_class(u64 pa)
+{
+	u64 chunk = pa >> PFN_MAP_CHUNK_SHIFT;
+	size_t page;
+	u32 s;
+
+	if (unlikely(chunk >= pfn_map.nr_chunks))
+		return PFN_HOLE;
+
+	s = pfn_map.summary[chunk];
+	if (likely(!(s & PFN_MAP_MIXED)))
+		return s;
+
+	page = (pa >> PAGE_SHIFT) & (PFN_MAP_CHUNK_PAGES - 1);
+	return (pfn_map.leaves[(s & ~PFN_MAP_MIXED) * PFN_MAP_LEAF_WORDS +
+			       page / PFN_MAP_PAGES_PER_WORD] >>
+		(2 * (page % PFN_MAP_PAGES_PER_WORD))) &
+	       3;
+}
+
+//Whether pa is backed by anything at all, RAM, reserved memory or MMIO
+static inline bool pfn_map_valid(u64 pa)
+{
+	return pfn_map_class(pa) != PFN_HOLE;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <linux/types.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+
+#include "cow_table.h"
+#include "status.h"
+
+/* [start, end) */
+struct range_map_range {
+	u64 start;
+	u64 end;
+	union {
+		long value;
+		void *pvalue;
+	};
+};
+
+/*
+ * Immutable snapshot of a range map, replaced as a whole by writers.
+ * Ranges are sorted by start and may overlap. Searches run over a copy of
+ * the starts in Eytzinger (breadth first) order, where the next levels of
+ * a search share cache lines and can be prefetched ahead. max_end[i], the
+ * highest end among ranges[0..i], stops the backward scans for ranges
+ * containing an address.
+ */
+struct range_map_table {
+	struct cow_table cow;
+	struct range_map_range *ranges;
+	u64 *max_end;
+	/* 1-based, eytz[k] is the start of ranges[rank[k]] */
+	u64 *eytz;
+	u32 *rank;
+};
+
+/*
+ * Registry of address ranges answering "which ranges contain or overlap
+ * this address or range" in O(log n + matches) for mostly disjoint ranges.
+ *
+ * Readers are lock-free, any number of them may run alongside a writer.
+ * Writers copy the table, O(n) per insert or delete, which suits
+ * registries that are read far more often than they change; loading many
+ * ranges at once goes through range_map_build(). Writers allocate with the
+ * gfp they are given, so they can run from atomic context with GFP_ATOMIC.
+ */
+struct range_map {
+	struct cow_ptr cow;
+};
+
+void range_map__init(struct range_map *map, int node);
+void range_map__clear(struct range_map *map);
+size_t range_map__size(const struct range_map *map);
+
+size_t range_map_insert(struct range_map *map, u64 start, u64 end, long value,
+			gfp_t gfp);
+size_t range_map_delete(struct range_map *map, u64 start, u64 end,
+			long *value, gfp_t gfp);
+size_t range_map_build(struct range_map *map,
+		       const struct range_map_range *ranges, size_t n,
+		       gfp_t gfp);
+
+#define range_map__insert(map, start, end, value, gfp) \
+	range_map_insert((map), (start), (end), (long)(value), (gfp))
+
+/*
+ * The range containing addr with the highest start, i.e. the innermost
+ * one when ranges nest
+ */
+bool range_map_find(const struct range_map *map, u64 addr,
+		    struct range_map_range *range);
+
+typedef bool (*range_map_fn)(const struct range_map_range *range, void *data);
+
+/*
+ * Calls fn on every range overlapping [start, end), by decreasing start,
+ * until fn returns false. fn runs under rcu_read_lock(). Returns the
+ * number of ranges fn was called on.
+ */
+size_t range_map_for_each_overlap(const struct range_map *map, u64 start,
+				  u64 end, range_map_fn fn, void *data);
@@ -0,0 +1,57 @@
+#pragma once
+#include <linux/atomic.h>
+#include <linux/hardirq.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "debug.h"
+#include "status.h"
+#include "xstdint.h"
+
+/*
+ * Context an allocation is made from.
+ * MM_CTX_ATOMIC never sleeps: objects are taken from a reserve that is
+ * refilled from process context, and allocations fail fast once it runs
+ * dry. It is usable from interrupt, NMI and VM-exit handlers.
+ * Only page tables and hashmap entries are pooled. Hashmap bucket arrays
+ * are not, their size depends on the map: atomic inserts never grow a
+ * map and are refused until a process context insert gave it buckets.
+ */
+enum mm_alloc_ctx {
+	MM_CTX_PROCESS,
+	MM_CTX_ATOMIC,
+};
+
+#define MM_RESERVE_TABLES 64
+#define MM_RESERVE_ENTRIES 256
+
+/*
+ * Pool of preallocated objects of a single size, from cache or from
+ * kmalloc when cache is NULL. Objects handed out are released like any
+ * other object of their origin, the pool only keeps its own stock topped
+ * up.
+ */
+struct mm_reserve {
+	spinlock_t lock;
+	void **objs;
+	unsigned int nr;
+	unsigned int target;
+	size_t size;
+	struct kmem_cache *cache;
+	gfp_t gfp;
+	const char *name;
+	atomic64_t exhausted;
+	atomic64_t leaked;
+	struct work_struct refill;
+};
+
+extern struct mm_reserve mm_reserve_tables;
+extern struct mm_reserve mm_reserve_entries;
+
+u64 mm_reserve_init(struct mm_reserve *res, const char *name, size_t size,
+		    struct kmem_cache *cache, gfp_t gfp, unsigned int target);
+void mm_reserve_destroy(struct mm_reserve *res);
+
+void *mm_reserve_get(struct mm_reserve *res);
+void mm_reserve_put(struct mm_reserve *res, void *obj);
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <linux/cache.h>
+#include <linux/compiler.h>
+#include <linux/irqflags.h>
+#include <linux/smp.h>
+#include <asm/barrier.h>
+
+#include "status.h"
+
+/*
+ * Bounded lock-free rings of pointers, their size rounded up to a power
+ * of two. Producer and consumer indexes live on their own cache lines and
+ * only grow, positions are taken modulo the size.
+ *
+ * - ring_spsc: one producer, one consumer, both sides wait-free. Each side
+ *   caches the index of the other and only reloads it when the ring looks
+ *   full or empty, so most operations touch no shared line but the slot.
+ * - ring_mpsc: any number of producers, one consumer. Producers claim
+ *   positions with a single cmpxchg and publish each slot with a sequence
+ *   number, the consumer is wait-free. A producer stalled between claim
+ *   and publish holds back the consumer at its slot.
+ * - ring_pcpu: one ring_spsc per cpu, filled by the producers of that
+ *   cpu with interrupts disabled and drained round-robin by one consumer.
+ *   Enqueues are wait-free and never share a cache line across cpus.
+ *
+ * None of them can be used from NMI context. Batch operations move as
+ * many objects as fit and return how many they moved.
+ */
+
+struct ring_spsc {
+	unsigned long mask;
+
+	/* written by the producer */
+	unsigned long tail ____cacheline_aligned_in_smp;
+	unsigned long head_cache;
+
+	/* written by the consumer */
+	unsigned long head ____cacheline_aligned_in_smp;
+	unsigned long tail_cache;
+
+	void *slots[] ____cacheline_aligned_in_smp;
+};
+
+struct ring_mpsc_slot {
+	/* position + 1 once published, position + size once consumed */
+	unsigned long seq;
+	void *obj;
+};
+
+struct ring_mpsc {
+	unsigned long mask;
+
+	/* claimed by the producers */
+	unsigned long tail ____cacheline_aligned_in_smp;
+
+	/* written by the consumer */
+	unsigned long head ____cacheline_aligned_in_smp;
+
+	struct ring_mpsc_slot slots[] ____cacheline_aligned_in_smp;
+};
+
+struct ring_pcpu {
+	/* consumer side, the ring drained first by the next dequeue */
+	unsigned int next;
+	unsigned int nr_rings;
+	struct ring_spsc *rings[];
+};
+
+struct ring_spsc *ring_spsc__new(size_t size, int node, gfp_t gfp);
+void ring_spsc__free(struct ring_spsc *ring);
+struct ring_mpsc *ring_mpsc__new(size_t size, int node, gfp_t gfp);
+void ring_mpsc__free(struct ring_mpsc *ring);
+/* size is per cpu, each ring is allocated on the node of its cpu */
+struct ring_pcpu *ring_pcpu__new(size_t size, gfp_t gfp);
+void ring_pcpu__free(struct ring_pcpu *ring);
+
+static inline size_t ring_spsc_enqueue_batch(struct ring_spsc *ring,
+					     void *const *objs, size_t n)
+{
+	unsigned long tail = ring->tail;
+	size_t room = ring->mask + 1 - (tail - ring->head_cache);
+
+	if (unlikely(room < n)) {
+		ring->head_cache = smp_load_acquire(&ring->head);
+		room = ring->mask + 1 - (tail - ring->head_cache);
+		n = min_t(size_t, n, room);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		ring->slots[(tail + i) & ring->mask] = objs[i];
+	smp_store_release(&ring->tail, tail + n);
+
+	return n;
+}
+
+static inline size_t ring_spsc_dequeue_batch(struct ring_spsc *ring,
+					     void **objs, size_t n)
+{
+	unsigned long head = ring->head;
+	size_t avail = ring->tail_cache - head;
+
+	if (avail < n) {
+		ring->tail_cache = smp_load_acquire(&ring->tail);
+		avail = ring->tail_cache - head;
+		n = min_t(size_t, n, avail);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		objs[i] = ring->slots[(head + i) & ring->mask];
+	smp_store_release(&ring->head, head + n);
+
+	return n;
+}
+
+static inline bool ring_spsc_enqueue(struct ring_spsc *ring, void *obj)
+{
+	return ring_spsc_enqueue_batch(ring, &obj, 1);
+}
+
+static inline void *ring_spsc_dequeue(struct ring_spsc *ring)
+{
+	void *obj = NULL;
+
+	ring_spsc_dequeue_batch(ring, &obj, 1);
+	return obj;
+}
+
+/*
+ * Claims n positions at once when the last of them is free: the consumer
+ * frees slots in order, so all the ones before it are free as well
+ */
+static inline size_t ring_mpsc_enqueue_batch(struct ring_mpsc *ring,
+					     void *const *objs, size_t n)
+{
+	unsigned long pos = READ_ONCE(ring->tail), last;
+	struct ring_mpsc_slot *slot;
+	size_t room;
+	long dif;
+
+	while (n) {
+		last = pos + n - 1;
+		slot = &ring->slots[last & ring->mask];
+		dif = (long)(smp_load_acquire(&slot->seq) - last);
+		if (!dif) {
+			if (try_cmpxchg(&ring->tail, &pos, pos + n))
+				break;
+		} else if (dif < 0) {
+			/* last slot still queued, shrink to what is free */
+			room = ring->mask + 1 -
+			       (pos - smp_load_acquire(&ring->head));
+			n = min_t(size_t, n, room);
+		} else {
+			pos = READ_ONCE(ring->tail);
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		slot = &ring->slots[(pos + i) & ring->mask];
+		slot->obj = objs[i];
+		smp_store_release(&slot->seq, pos + i + 1);
+	}
+
+	return n;
+}
+
+static inline size_t ring_mpsc_dequeue_batch(struct ring_mpsc *ring,
+					     void **objs, size_t n)
+{
+	unsigned long head = ring->head;
+	struct ring_mpsc_slot *slot;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		slot = &ring->slots[(head + i) & ring->mask];
+		if (smp_load_acquire(&slot->seq) != head + i + 1)
+			break;
+		objs[i] = slot->obj;
+		smp_store_release(&slot->seq, head + i + ring->mask + 1);
+	}
+
+	if (i)
+		smp_store_release(&ring->head, head + i);
+	return i;
+}
+
+static inline bool ring_mpsc_enqueue(struct ring_mpsc *ring, void *obj)
+{
+	return ring_mpsc_enqueue_batch(ring, &obj, 1);
+}
+
+static inline void *ring_mpsc_dequeue(struct ring_mpsc *ring)
+{
+	void *obj = NULL;
+
+	ring_mpsc_dequeue_batch(ring, &obj, 1);
+	return obj;
+}
+
+static inline size_t ring_pcpu_enqueue_batch(struct ring_pcpu *ring,
+					     void *const *objs, size_t n)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	n = ring_spsc_enqueue_batch(ring->rings[smp_processor_id()], objs, n);
+	local_irq_restore(flags);
+
+	return n;
+}
+
+static inline bool ring_pcpu_enqueue(struct ring_pcpu *ring, void *obj)
+{
+	return ring_pcpu_enqueue_batch(ring, &obj, 1);
+}
+
+size_t ring_pcpu_dequeue_batch(struct ring_pcpu *ring, void **objs, size_t n);
+
+static inline void *ring_pcpu_dequeue(struct ring_pcpu *ring)
+{
+	void *obj = NULL;
+
+	ring_pcpu_dequeue_batch(ring, &obj, 1);
+	return obj;
+}
+
+struct dentry;
+
+/* ring_bench file in dir, compares the rings with kfifo and a list */
+void ring_bench_debugfs_init(struct dentry *dir);
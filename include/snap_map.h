@@ -0,0 +1,74 @@
+#pragma once
+
+#include <linux/types.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+
+#include "cow_table.h"
+#include "status.h"
+
+struct snap_map_pair {
+	long key;
+	union {
+		long value;
+		void *pvalue;
+	};
+};
+
+struct snap_map_index {
+	/* 1 + position of the pair, 0 when the bucket is empty */
+	u32 idx;
+	u32 tag;
+};
+
+/*
+ * Immutable snapshot of a snap map, replaced as a whole by writers.
+ *
+ * The pairs are packed, found through an open addressing index probed
+ * linearly. In front of it sits a bloom filter of at least 16 bits per
+ * key, blocked so that all the bits of a key live in one word: a lookup
+ * for a missing key is one load and three bit tests in most cases, and
+ * never reaches the index.
+ */
+struct snap_map_table {
+	struct cow_table cow;
+	size_t cap_bits;
+	size_t bloom_mask;
+	u64 *bloom;
+	struct snap_map_index *index;
+	struct snap_map_pair *pairs;
+};
+
+/*
+ * Map of long keys to long values for read-mostly data: readers are
+ * lock-free and take no atomics, a lookup is one dereference of the
+ * current snapshot under rcu_read_lock(). Writers copy the whole table,
+ * O(n) per change; they allocate with the gfp they are given so that they
+ * can run from atomic context. Replacing the whole content at once goes
+ * through snap_map_build().
+ */
+struct snap_map {
+	struct cow_ptr cow;
+};
+
+void snap_map__init(struct snap_map *map, int node);
+void snap_map__clear(struct snap_map *map);
+size_t snap_map__size(const struct snap_map *map);
+
+/* adds key or replaces its value */
+size_t snap_map_update(struct snap_map *map, long key, long value,
+		       gfp_t gfp);
+size_t snap_map_delete(struct snap_map *map, long key, long *value,
+		       gfp_t gfp);
+/* replaces the whole content of the map, keys must be unique */
+size_t snap_map_build(struct snap_map *map, const struct snap_map_pair *pairs,
+		      size_t n, gfp_t gfp);
+
+#define snap_map__update(map, key, value, gfp) \
+	snap_map_update((map), (long)(key), (long)(value), (gfp))
+
+bool snap_map_find(const struct snap_map *map, long key, long *value);
+
+#define snap_map__find(map, key, value) \
+	snap_map_find((map), (long)(key), (long *)(value))
+#define snap_map__contains(map, key) snap_map_find((map), (long)(key), NULL)
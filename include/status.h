@@ -17,4 +17,5 @@
 #define XKLIB_ENOMEM 0x80000100
 #define XKLIB_EEXIST 0x80000101
 #define XKLIB_ENOENT 0x80000102
-#define XKLIB_ENOCOLLECTOR 0x80000103
\ No newline at end of file
+#define XKLIB_ENOCOLLECTOR 0x80000103
+#define XKLIB_EINVAL 0x80000104
\ No newline at end of file
@@ -0,0 +1,326 @@
+#pragma once
+#include <linux/seqlock.h>
+
+#include "hashmap_impl.h"
+
+/*
+ * Type specialized chained hashmaps.
+ *
+ * DEFINE_XK_HASHMAP(name, key_t, val_t, hash, eq) generates struct name
+ * and its name##_* operations with the semantics of struct hashmap, but
+ * keys and values are stored with their own types and hash(key) and
+ * eq(key1, key2) are called directly, so the compiler can inline them
+ * where struct hashmap pays two indirect calls (retpolines included) per
+ * probed entry.
+ *
+ * Generated operations:
+ * - name##_init(map, node), name##_new(node), name##_clear(map),
+ *   name##_free(map);
+ * - name##_insert(map, key, value, strategy, old_key, old_value), with
+ *   name##_add() and name##_set() shorthands;
+ * - name##_find(map, key, value), name##_find_rcu(map, key, value) and
+ *   name##_delete(map, key, old_key, old_value);
+ * - iteration through xk_hashmap__for_each_entry().
+ *
+ * Like struct hashmap, removed entries and replaced bucket arrays are
+ * freed after a grace period so name##_find_rcu() can run lock-free, and
+ * writers must be serialized by the caller. Readers retry when a grow
+ * switched arrays under them, so name##_find_rcu() must not be called
+ * from NMI handlers that may interrupt a writer of the same map.
+ */
+
+/* array switches are a few stores, irqs stay off so readers never spin */
+static inline unsigned long xk_hashmap_write_begin(seqcount_t *seq)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	write_seqcount_begin(seq);
+	return flags;
+}
+
+static inline void xk_hashmap_write_end(seqcount_t *seq, unsigned long flags)
+{
+	write_seqcount_end(seq);
+	local_irq_restore(flags);
+}
+
+#define xk_hashmap__for_each_entry(map, cur, bkt) \
+	for (bkt = 0; bkt < (map)->cap; bkt++)    \
+		for (cur = (map)->buckets[bkt]; cur; cur = cur->next)
+
+#define xk_hashmap__for_each_entry_safe(map, cur, tmp, bkt)         \
+	for (bkt = 0; bkt < (map)->cap; bkt++)                      \
+		for (cur = (map)->buckets[bkt]; cur && ({           \
+							tmp = cur->next; \
+							true;            \
+						});                      \
+		     cur = tmp)
+
+#define DEFINE_XK_HASHMAP(name, key_t, val_t, hash, eq)                      \
+	struct name##_entry {                                                \
+		key_t key;                                                   \
+		val_t value;                                                 \
+		struct name##_entry *next;                                   \
+		struct rcu_head rcu;                                         \
+	};                                                                   \
+                                                                             \
+	struct name {                                                        \
+		struct name##_entry **buckets;                               \
+		/* array a grow is emptying, RCU readers search it first */  \
+		struct name##_entry **old_buckets;                           \
+		size_t cap;                                                  \
+		size_t cap_bits;                                             \
+		size_t old_cap_bits;                                         \
+		size_t sz;                                                   \
+		int node;                                                    \
+		/* pairs each array with its bits for RCU readers */         \
+		seqcount_t seq;                                              \
+	};                                                                   \
+                                                                             \
+	static inline void name##_init(struct name *map, int node)           \
+	{                                                                    \
+		map->buckets = map->old_buckets = NULL;                      \
+		map->cap = map->cap_bits = map->old_cap_bits = map->sz = 0;  \
+		map->node = node;                                            \
+		seqcount_init(&map->seq);                                    \
+	}                                                                    \
+                                                                             \
+	static inline struct name *name##_new(int node)                      \
+	{                                                                    \
+		struct name *map = kmalloc_node(sizeof(*map), GFP_KERNEL,    \
+						node);                       \
+                                                                             \
+		if (map)                                                     \
+			name##_init(map, node);                              \
+		return map;                                                  \
+	}                                                                    \
+                                                                             \
+	static inline void name##_clear(struct name *map)                    \
+	{                                                                    \
+		struct name##_entry *cur, *tmp;                              \
+		size_t bkt;                                                  \
+                                                                             \
+		xk_hashmap__for_each_entry_safe(map, cur, tmp, bkt)          \
+			hashmap_free(cur, sizeof(*cur));                     \
+		hashmap_free(map->buckets,                                   \
+			     map->cap * sizeof(map->buckets[0]));            \
+		map->buckets = NULL;                                         \
+		map->cap = map->cap_bits = map->old_cap_bits = map->sz = 0;  \
+	}                                                                    \
+                                                                             \
+	static inline void name##_free(struct name *map)                     \
+	{                                                                    \
+		if (IS_ERR_OR_NULL(map))                                     \
+			return;                                              \
+                                                                             \
+		name##_clear(map);                                           \
+		kfree(map);                                                  \
+	}                                                                    \
+                                                                             \
+	/*                                                                   \
+	 * The new array is published first, then entries leave the old      \
+	 * one tail first: each is linked in its new chain before it is      \
+	 * unlinked from the old one, so a reader searching the old array,   \
+	 * then the new one, never misses it.                                \
+	 */                                                                  \
+	static inline size_t name##_grow(struct name *map)                   \
+	{                                                                    \
+		struct name##_entry **new_buckets, **old_buckets;            \
+		struct name##_entry **pprev, *cur;                           \
+		size_t new_cap_bits, new_cap, old_cap, bkt, h;               \
+		unsigned long flags;                                         \
+                                                                             \
+		new_cap_bits = max_t(size_t, map->cap_bits + 1, 2);          \
+		new_cap = 1UL << new_cap_bits;                               \
+		new_buckets = hashmap_alloc_node(                            \
+			map->node, new_cap * sizeof(new_buckets[0]),         \
+			GFP_KERNEL | __GFP_ZERO);                            \
+		if (!new_buckets)                                            \
+			return XKLIB_ENOMEM;                                 \
+                                                                             \
+		old_buckets = map->buckets;                                  \
+		old_cap = map->cap;                                          \
+		flags = xk_hashmap_write_begin(&map->seq);                   \
+		rcu_assign_pointer(map->old_buckets, old_buckets);           \
+		WRITE_ONCE(map->old_cap_bits, map->cap_bits);                \
+		rcu_assign_pointer(map->buckets, new_buckets);               \
+		WRITE_ONCE(map->cap_bits, new_cap_bits);                     \
+		xk_hashmap_write_end(&map->seq, flags);                      \
+		map->cap = new_cap;                                          \
+                                                                             \
+		for (bkt = 0; bkt < old_cap; bkt++) {                        \
+			while (old_buckets[bkt]) {                           \
+				pprev = &old_buckets[bkt];                   \
+				while ((*pprev)->next)                       \
+					pprev = &(*pprev)->next;             \
+				cur = *pprev;                                \
+				h = hash_bits(hash(cur->key), new_cap_bits); \
+				WRITE_ONCE(cur->next, new_buckets[h]);       \
+				rcu_assign_pointer(new_buckets[h], cur);     \
+				WRITE_ONCE(*pprev, NULL);                    \
+			}                                                    \
+		}                                                            \
+                                                                             \
+		flags = xk_hashmap_write_begin(&map->seq);                   \
+		WRITE_ONCE(map->old_buckets, NULL);                          \
+		xk_hashmap_write_end(&map->seq, flags);                      \
+		hashmap_free_deferred(old_buckets,                           \
+				      old_cap * sizeof(old_buckets[0]));     \
+		return 0;                                                    \
+	}                                                                    \
+                                                                             \
+	static inline struct name##_entry **name##_lookup(                   \
+		const struct name *map, key_t key)                           \
+	{                                                                    \
+		struct name##_entry **pprev, *cur;                           \
+                                                                             \
+		if (!map->buckets)                                           \
+			return NULL;                                         \
+                                                                             \
+		pprev = &map->buckets[hash_bits(hash(key), map->cap_bits)];  \
+		for (cur = *pprev; cur; pprev = &cur->next, cur = cur->next) \
+			if (eq(cur->key, key))                               \
+				return pprev;                                \
+		return NULL;                                                 \
+	}                                                                    \
+                                                                             \
+	static inline size_t name##_insert(                                  \
+		struct name *map, key_t key, val_t value,                    \
+		enum hashmap_insert_strategy strategy, key_t *old_key,       \
+		val_t *old_value)                                            \
+	{                                                                    \
+		struct name##_entry **pprev, *entry;                         \
+		size_t err, h;                                               \
+                                                                             \
+		if (strategy != HASHMAP_APPEND &&                            \
+		    (pprev = name##_lookup(map, key))) {                     \
+			entry = *pprev;                                      \
+			if (old_key)                                         \
+				*old_key = entry->key;                       \
+			if (old_value)                                       \
+				*old_value = entry->value;                   \
+                                                                             \
+			if (strategy == HASHMAP_ADD)                         \
+				return XKLIB_EEXIST;                         \
+			WRITE_ONCE(entry->key, key);                         \
+			WRITE_ONCE(entry->value, value);                     \
+			return 0;                                            \
+		}                                                            \
+                                                                             \
+		if (strategy == HASHMAP_UPDATE)                              \
+			return XKLIB_ENOENT;                                 \
+                                                                             \
+		if (!map->cap || (map->sz + 1) * 4 / 3 > map->cap) {         \
+			err = name##_grow(map);                              \
+			if (err)                                             \
+				return err;                                  \
+		}                                                            \
+                                                                             \
+		entry = hashmap_alloc_node(map->node, sizeof(*entry),        \
+					   GFP_KERNEL);                      \
+		if (!entry)                                                  \
+			return XKLIB_ENOMEM;                                 \
+                                                                             \
+		entry->key = key;                                            \
+		entry->value = value;                                        \
+		h = hash_bits(hash(key), map->cap_bits);                     \
+		WRITE_ONCE(entry->next, map->buckets[h]);                    \
+		rcu_assign_pointer(map->buckets[h], entry);                  \
+		map->sz++;                                                   \
+		return 0;                                                    \
+	}                                                                    \
+                                                                             \
+	static inline size_t name##_add(struct name *map, key_t key,         \
+					val_t value)                         \
+	{                                                                    \
+		return name##_insert(map, key, value, HASHMAP_ADD, NULL,     \
+				     NULL);                                  \
+	}                                                                    \
+                                                                             \
+	static inline size_t name##_set(struct name *map, key_t key,         \
+					val_t value)                         \
+	{                                                                    \
+		return name##_insert(map, key, value, HASHMAP_SET, NULL,     \
+				     NULL);                                  \
+	}                                                                    \
+                                                                             \
+	static inline bool name##_find(const struct name *map, key_t key,    \
+				       val_t *value)                         \
+	{                                                                    \
+		struct name##_entry **pprev = name##_lookup(map, key);       \
+                                                                             \
+		if (!pprev)                                                  \
+			return false;                                        \
+		if (value)                                                   \
+			*value = (*pprev)->value;                            \
+		return true;                                                 \
+	}                                                                    \
+                                                                             \
+	static inline bool name##_find_chain_rcu(struct name##_entry *cur,   \
+						 key_t key, val_t *value)    \
+	{                                                                    \
+		for (; cur; cur = rcu_dereference(cur->next)) {              \
+			if (eq(cur->key, key)) {                             \
+				if (value)                                   \
+					*value = READ_ONCE(cur->value);      \
+				return true;                                 \
+			}                                                    \
+		}                                                            \
+		return false;                                                \
+	}                                                                    \
+                                                                             \
+	/* a miss retries if an array was switched in the meantime */        \
+	static inline bool name##_find_rcu(const struct name *map,           \
+					   key_t key, val_t *value)          \
+	{                                                                    \
+		struct name##_entry **buckets, **old, *cur;                  \
+		size_t bits, old_bits, h;                                    \
+		unsigned int seq;                                            \
+                                                                             \
+		h = hash(key);                                               \
+		do {                                                         \
+			seq = read_seqcount_begin(&map->seq);                \
+			buckets = rcu_dereference(map->buckets);             \
+			bits = READ_ONCE(map->cap_bits);                     \
+			old = rcu_dereference(map->old_buckets);             \
+			old_bits = READ_ONCE(map->old_cap_bits);             \
+			if (!buckets)                                        \
+				return false;                                \
+                                                                             \
+			if (old) {                                           \
+				cur = rcu_dereference(                       \
+					old[hash_bits(h, old_bits)]);        \
+				if (name##_find_chain_rcu(cur, key, value))  \
+					return true;                         \
+			}                                                    \
+			cur = rcu_dereference(buckets[hash_bits(h, bits)]);  \
+			if (name##_find_chain_rcu(cur, key, value))          \
+				return true;                                 \
+		} while (read_seqcount_retry(&map->seq, seq));               \
+		return false;                                                \
+	}                                                                    \
+                                                                             \
+	static inline bool name##_delete(struct name *map, key_t key,        \
+					 key_t *old_key, val_t *old_value)   \
+	{                                                                    \
+		struct name##_entry **pprev = name##_lookup(map, key);       \
+		struct name##_entry *entry;                                  \
+                                                                             \
+		if (!pprev)                                                  \
+			return false;                                        \
+                                                                             \
+		entry = *pprev;                                              \
+		if (old_key)                                                 \
+			*old_key = entry->key;                               \
+		if (old_value)                                               \
+			*old_value = entry->value;                           \
+                                                                             \
+		WRITE_ONCE(*pprev, entry->next);                             \
+		atomic64_sub(sizeof(*entry),                                 \
+			     &mm_node_stats[mm_ptr_node(entry)]              \
+				      .hashmap_bytes);                       \
+		kfree_rcu(entry, rcu);                                       \
+		map->sz--;                                                   \
+		return true;                                                 \
+	}
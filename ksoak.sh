@@ -0,0 +1,41 @@
+#!/bin/sh
+# Load/unload soak test: cycles xklib.ko and checks that unreclaimable
+# kernel memory stays flat, i.e. that mm_destroy releases everything.
+#
+# usage: ksoak.sh [cycles] [sample interval] [tolerance in kB]
+
+CYCLES=${1:-10000}
+INTERVAL=${2:-500}
+TOLERANCE=${3:-2048}
+
+sunreclaim() {
+	awk '/^SUnreclaim:/ { print $2 }' /proc/meminfo
+}
+
+# warm up slab caches before taking the baseline
+insmod xklib.ko && rmmod xklib || exit 1
+BASE=$(sunreclaim)
+echo "cycle 0: SUnreclaim ${BASE} kB"
+
+i=1
+while [ $i -le $CYCLES ]; do
+	insmod xklib.ko || { echo "insmod failed at cycle $i"; exit 1; }
+	rmmod xklib || { echo "rmmod failed at cycle $i"; exit 1; }
+
+	if [ $((i % INTERVAL)) -eq 0 ]; then
+		echo "cycle $i: SUnreclaim $(sunreclaim) kB"
+	fi
+	i=$((i + 1))
+done
+
+END=$(sunreclaim)
+DELTA=$((END - BASE))
+echo "SUnreclaim delta after ${CYCLES} cycles: ${DELTA} kB"
+
+if [ $DELTA -gt $TOLERANCE ]; then
+	echo "FAIL: memory footprint grew by more than ${TOLERANCE} kB"
+	dmesg | tail -n 20
+	exit 1
+fi
+
+echo "PASS"
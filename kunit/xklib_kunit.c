@@ -0,0 +1,610 @@
+#include <kunit/test.h>
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/sched/mm.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+
+#include "debug.h"
+#include "hashmap.h"
+#include "hashmap_stats.h"
+#include "memory.h"
+#include "pfn_map.h"
+
+/*
+ * KUnit suites of the hashmaps and of the mapper. Built as xklib_kunit.ko
+ * by make kunit, the suites run when it loads, or built in and run by
+ * kunit.py with kunit/.kunitconfig, see the Readme.
+ *
+ * The mapper needs an mm to map in, which test kthreads get from
+ * kunit_vm_mmap() since 6.10; older kernels skip those cases.
+ */
+
+static unsigned int stress_ms = 1000;
+module_param(stress_ms, uint, 0444);
+MODULE_PARM_DESC(stress_ms, "Duration of every stress case, 0 skips them");
+
+#define XK_TEST_KEYS 10000
+#define XK_TEST_WINDOWS 64
+#define XK_TEST_APPENDS 3
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+#define XK_TEST_HAS_MM 1
+#endif
+
+static size_t xk_test_hash(long key, void *ctx)
+{
+	return long_hash(key);
+}
+
+static bool xk_test_equal(long key1, long key2, void *ctx)
+{
+	return key1 == key2;
+}
+
+static const enum hashmap_layout xk_test_layouts[] = {
+	HASHMAP_CHAINED,
+	HASHMAP_OPEN,
+	HASHMAP_DENSE,
+};
+
+static void xk_test_layout_desc(const enum hashmap_layout *layout,
+				char *desc)
+{
+	static const char *const names[] = {
+		[HASHMAP_CHAINED] = "chained",
+		[HASHMAP_OPEN] = "open",
+		[HASHMAP_DENSE] = "dense",
+	};
+
+	strscpy(desc, names[*layout], KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(xk_test_layout, xk_test_layouts, xk_test_layout_desc);
+
+/* an empty map of the layout of the case, cleared when the case ends */
+static struct hashmap *xk_test_map(struct kunit *test)
+{
+	const enum hashmap_layout *layout = test->param_value;
+	struct hashmap *map;
+
+	map = kunit_kzalloc(test, sizeof(*map), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, map);
+	hashmap__init(map, xk_test_hash, xk_test_equal, NULL);
+	KUNIT_ASSERT_EQ(test, hashmap__set_layout(map, *layout), 0);
+	test->priv = map;
+	return map;
+}
+
+static void xk_hashmap_test_exit(struct kunit *test)
+{
+	if (!test->priv)
+		return;
+
+	hashmap__disable_stats(test->priv);
+	hashmap__clear(test->priv);
+}
+
+static void xk_test_expect_value(struct kunit *test, struct hashmap *map,
+				 long key, long expected)
+{
+	long value = 0;
+
+	KUNIT_EXPECT_TRUE(test, hashmap__find(map, key, &value));
+	KUNIT_EXPECT_EQ(test, value, expected);
+}
+
+static void xk_hashmap_add(struct kunit *test)
+{
+	struct hashmap *map = xk_test_map(test);
+
+	KUNIT_EXPECT_EQ(test, hashmap__add(map, 1, 10), 0);
+	KUNIT_EXPECT_EQ(test, hashmap__add(map, 1, 11), XKLIB_EEXIST);
+	KUNIT_EXPECT_EQ(test, hashmap__size(map), 1);
+	xk_test_expect_value(test, map, 1, 10);
+}
+
+static void xk_hashmap_set(struct kunit *test)
+{
+	struct hashmap *map = xk_test_map(test);
+	long old_key = -1, old_value = -1;
+
+	KUNIT_EXPECT_EQ(test, hashmap__set(map, 1, 10, &old_key, &old_value),
+			0);
+	KUNIT_EXPECT_EQ(test, old_key, 0);
+	KUNIT_EXPECT_EQ(test, old_value, 0);
+
+	KUNIT_EXPECT_EQ(test, hashmap__set(map, 1, 11, &old_key, &old_value),
+			0);
+	KUNIT_EXPECT_EQ(test, old_key, 1);
+	KUNIT_EXPECT_EQ(test, old_value, 10);
+	KUNIT_EXPECT_EQ(test, hashmap__size(map), 1);
+	xk_test_expect_value(test, map, 1, 11);
+}
+
+static void xk_hashmap_update(struct kunit *test)
+{
+	struct hashmap *map = xk_test_map(test);
+	long old_key = -1, old_value = -1;
+
+	KUNIT_EXPECT_EQ(test,
+			hashmap__update(map, 1, 10, &old_key, &old_value),
+			XKLIB_ENOENT);
+	KUNIT_EXPECT_EQ(test, hashmap__size(map), 0);
+	KUNIT_EXPECT_FALSE(test, hashmap__find(map, 1, NULL));
+
+	KUNIT_ASSERT_EQ(test, hashmap__add(map, 1, 10), 0);
+	KUNIT_EXPECT_EQ(test,
+			hashmap__update(map, 1, 11, &old_key, &old_value), 0);
+	KUNIT_EXPECT_EQ(test, old_key, 1);
+	KUNIT_EXPECT_EQ(test, old_value, 10);
+	KUNIT_EXPECT_EQ(test, hashmap__size(map), 1);
+	xk_test_expect_value(test, map, 1, 11);
+}
+
+/* a multimap: every value is kept and deleted one at a time */
+static void xk_hashmap_append(struct kunit *test)
+{
+	struct hashmap *map = xk_test_map(test);
+	struct hashmap_entry *cur;
+	unsigned int seen = 0;
+	long value = 0;
+
+	for (long i = 0; i < XK_TEST_APPENDS; i++)
+		KUNIT_EXPECT_EQ(test, hashmap__append(map, 1, 10 + i), 0);
+	KUNIT_EXPECT_EQ(test, hashmap__size(map), XK_TEST_APPENDS);
+
+	hashmap__for_each_key_entry(map, cur, 1) {
+		KUNIT_EXPECT_EQ(test, cur->key, 1);
+		KUNIT_EXPECT_GE(test, cur->value, 10);
+		KUNIT_EXPECT_LT(test, cur->value, 10 + XK_TEST_APPENDS);
+		seen |= 1 << (cur->value - 10);
+	}
+	KUNIT_EXPECT_EQ(test, seen, (1 << XK_TEST_APPENDS) - 1);
+
+	KUNIT_EXPECT_TRUE(test, hashmap__find(map, 1, &value));
+	KUNIT_EXPECT_GE(test, value, 10);
+
+	for (int i = 0; i < XK_TEST_APPENDS; i++)
+		KUNIT_EXPECT_TRUE(test, hashmap__delete(map, 1, NULL, NULL));
+	KUNIT_EXPECT_FALSE(test, hashmap__delete(map, 1, NULL, NULL));
+	KUNIT_EXPECT_EQ(test, hashmap__size(map), 0);
+}
+
+/* every strategy across growth, deletes and a compaction */
+static void xk_hashmap_grow(struct kunit *test)
+{
+	struct hashmap *map = xk_test_map(test);
+	long key;
+
+	for (long i = 0; i < XK_TEST_KEYS; i++) {
+		key = i * 0x9e3779b97f4a7c15L;
+		switch (i % 3) {
+		case 0:
+			KUNIT_ASSERT_EQ(test, hashmap__add(map, key, i), 0);
+			break;
+		case 1:
+			KUNIT_ASSERT_EQ(test,
+					hashmap__set(map, key, i, NULL, NULL),
+					0);
+			break;
+		default:
+			KUNIT_ASSERT_EQ(test, hashmap__append(map, key, i), 0);
+			break;
+		}
+		KUNIT_ASSERT_EQ(test,
+				hashmap__update(map, key, -i, NULL, NULL), 0);
+	}
+	KUNIT_EXPECT_EQ(test, hashmap__size(map), XK_TEST_KEYS);
+
+	for (long i = 0; i < XK_TEST_KEYS; i += 2)
+		KUNIT_EXPECT_TRUE(test,
+				  hashmap__delete(map,
+						  i * 0x9e3779b97f4a7c15L,
+						  NULL, NULL));
+	KUNIT_EXPECT_EQ(test, hashmap__compact(map), 0);
+	KUNIT_EXPECT_EQ(test, hashmap__size(map), XK_TEST_KEYS / 2);
+
+	for (long i = 0; i < XK_TEST_KEYS; i++) {
+		key = i * 0x9e3779b97f4a7c15L;
+		if (i % 2)
+			xk_test_expect_value(test, map, key, -i);
+		else
+			KUNIT_EXPECT_FALSE(test, hashmap__find(map, key, NULL));
+	}
+}
+
+/* a batch into an empty map is sized once, up front */
+static void xk_hashmap_batch(struct kunit *test)
+{
+	struct hashmap *map = xk_test_map(test);
+	long *keys;
+
+	keys = kunit_kcalloc(test, XK_TEST_KEYS, sizeof(*keys), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, keys);
+	for (long i = 0; i < XK_TEST_KEYS; i++)
+		keys[i] = i * 0x9e3779b97f4a7c15L;
+
+	KUNIT_ASSERT_EQ(test, hashmap__enable_stats(map, NULL), 0);
+	KUNIT_EXPECT_EQ(test,
+			hashmap__insert_batch(map, keys, keys, XK_TEST_KEYS,
+					      HASHMAP_ADD, NULL),
+			XK_TEST_KEYS);
+	KUNIT_EXPECT_EQ(test, hashmap__size(map), XK_TEST_KEYS);
+	KUNIT_EXPECT_EQ(test, map->stats->grows, 1);
+	KUNIT_EXPECT_EQ(test, map->stats->shrinks, 0);
+	KUNIT_EXPECT_EQ(test, map->stats->rehashes, 0);
+
+	for (long i = 0; i < XK_TEST_KEYS; i++)
+		xk_test_expect_value(test, map, keys[i], keys[i]);
+}
+
+/* the copy of the core puts its debugfs files under xklib_kunit/ */
+struct dentry *xklib_debugfs;
+
+static int xk_suite_init(struct kunit_suite *suite)
+{
+	xklib_debugfs = debugfs_create_dir("xklib_kunit", NULL);
+	if (mm_init()) {
+		debugfs_remove_recursive(xklib_debugfs);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void xk_suite_exit(struct kunit_suite *suite)
+{
+	mm_destroy();
+	debugfs_remove_recursive(xklib_debugfs);
+}
+
+static struct kunit_case xk_hashmap_cases[] = {
+	KUNIT_CASE_PARAM(xk_hashmap_add, xk_test_layout_gen_params),
+	KUNIT_CASE_PARAM(xk_hashmap_set, xk_test_layout_gen_params),
+	KUNIT_CASE_PARAM(xk_hashmap_update, xk_test_layout_gen_params),
+	KUNIT_CASE_PARAM(xk_hashmap_append, xk_test_layout_gen_params),
+	KUNIT_CASE_PARAM(xk_hashmap_grow, xk_test_layout_gen_params),
+	KUNIT_CASE_PARAM(xk_hashmap_batch, xk_test_layout_gen_params),
+	{}
+};
+
+static struct kunit_suite xk_hashmap_suite = {
+	.name = "xklib_hashmap",
+	.suite_init = xk_suite_init,
+	.suite_exit = xk_suite_exit,
+	.exit = xk_hashmap_test_exit,
+	.test_cases = xk_hashmap_cases,
+};
+
+#ifdef XK_TEST_HAS_MM
+/* the mapper works on current->mm, which kunit_vm_mmap() attaches */
+static int xk_mapper_test_init(struct kunit *test)
+{
+	unsigned long addr;
+
+	addr = kunit_vm_mmap(test, NULL, 0, PAGE_SIZE, PROT_READ | PROT_WRITE,
+			     MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (IS_ERR_VALUE(addr))
+		kunit_skip(test, "no mm to map in");
+	return 0;
+}
+
+/* physically contiguous pages, each qword holding its own address */
+static u64 *xk_test_pages(struct kunit *test, size_t nr)
+{
+	u64 *pages = kunit_kmalloc(test, nr * PAGE_SIZE, GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_NULL(test, pages);
+	for (size_t i = 0; i < nr * PAGE_SIZE / sizeof(u64); i++)
+		pages[i] = virt_to_phys(&pages[i]);
+	return pages;
+}
+
+/*
+ * Every window reads back what is at its physical address, from the page
+ * offset on, and the walker and the registry agree on the frame behind it
+ */
+static void xk_mapper_reads_back(struct kunit *test)
+{
+	struct pt_permissions perms = { .read = 1, .write = 1 };
+	u64 *pages = xk_test_pages(test, XK_TEST_WINDOWS);
+	void *vas[XK_TEST_WINDOWS];
+	last_pt_t last_pt;
+	u64 pa, found;
+
+	for (int i = 0; i < XK_TEST_WINDOWS; i++) {
+		/* 8 byte aligned offsets all over the page */
+		pa = virt_to_phys(pages) + i * PAGE_SIZE +
+		     (i * 0x1f8 & ~PAGE_MASK);
+		vas[i] = map_physical(pa, perms);
+		KUNIT_ASSERT_NOT_NULL(test, vas[i]);
+
+		KUNIT_EXPECT_EQ(test, *(u64 *)vas[i], pa);
+		last_pt = get_last_pt((unsigned long)vas[i]);
+		KUNIT_EXPECT_EQ(test, last_pt.pt_type, pt_type_pte);
+		KUNIT_EXPECT_EQ(test, pte_pfn(last_pt.pte), pa >> PAGE_SHIFT);
+		KUNIT_EXPECT_TRUE(test,
+				  mm_window_find((unsigned long)vas[i], &found));
+		KUNIT_EXPECT_EQ(test, found, pa);
+
+		/* writes through the direct map show up in the window */
+		pages[(pa - virt_to_phys(pages)) / sizeof(u64)] = ~pa;
+		KUNIT_EXPECT_EQ(test, READ_ONCE(*(u64 *)vas[i]), ~pa);
+	}
+
+	for (int i = 0; i < XK_TEST_WINDOWS; i++) {
+		KUNIT_EXPECT_EQ(test, unmap_physical(vas[i]), XKLIB_SUCCESS);
+		KUNIT_EXPECT_FALSE(test,
+				   page_mapping_exist((unsigned long)vas[i]));
+		KUNIT_EXPECT_FALSE(test,
+				   mm_window_find((unsigned long)vas[i], &found));
+	}
+}
+
+/* nothing behind holes of the physical address space is mapped */
+static void xk_mapper_refuses_holes(struct kunit *test)
+{
+	struct pt_permissions perms = { .read = 1 };
+	u64 end = (u64)pfn_map.nr_chunks << PFN_MAP_CHUNK_SHIFT;
+
+	KUNIT_EXPECT_NULL(test, map_physical(end, perms));
+	KUNIT_EXPECT_NULL(test, map_physical(end + PAGE_SIZE * 3 + 8, perms));
+	KUNIT_EXPECT_EQ(test, unmap_physical((void *)PAGE_SIZE),
+			XKLIB_EINVAL);
+}
+
+/* frame behind a user address according to the core mm */
+static bool xk_test_core_pfn(unsigned long addr, unsigned long *pfn)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
+	struct vm_area_struct *vma;
+	spinlock_t *ptl;
+	pte_t *ptep;
+	bool found = false;
+
+	mmap_read_lock(current->mm);
+	vma = vma_lookup(current->mm, addr);
+	if (vma && !follow_pte(vma, addr, &ptep, &ptl)) {
+		*pfn = pte_pfn(ptep_get(ptep));
+		pte_unmap_unlock(ptep, ptl);
+		found = true;
+	}
+	mmap_read_unlock(current->mm);
+	return found;
+#else
+	/* follow_pte() is gone, the page gup pins is the one mapped there */
+	struct page *page;
+
+	if (get_user_pages_fast(addr, 1, 0, &page) != 1)
+		return false;
+	*pfn = page_to_pfn(page);
+	put_page(page);
+	return true;
+#endif
+}
+
+/* the walker agrees with the core mm on plain user pages */
+static void xk_mapper_walker_matches(struct kunit *test)
+{
+	const size_t nr = 16;
+	unsigned long addr, pfn, core_pfn;
+	last_pt_t last_pt;
+
+	addr = kunit_vm_mmap(test, NULL, 0, nr * PAGE_SIZE,
+			     PROT_READ | PROT_WRITE,
+			     MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	KUNIT_ASSERT_FALSE(test, IS_ERR_VALUE(addr));
+
+	for (size_t i = 0; i < nr; i++) {
+		/* the page has to be faulted in to have a pte at all */
+		KUNIT_ASSERT_EQ(test,
+				put_user(i, (u64 __user *)(addr + i * PAGE_SIZE)),
+				0);
+		KUNIT_ASSERT_TRUE(test,
+				  xk_test_core_pfn(addr + i * PAGE_SIZE,
+						   &core_pfn));
+
+		last_pt = get_last_pt(addr + i * PAGE_SIZE);
+		if (last_pt.pt_type == pt_type_pmd)
+			pfn = pmd_pfn(last_pt.pmd) +
+			      ((addr + i * PAGE_SIZE) & ~PMD_MASK) / PAGE_SIZE;
+		else
+			pfn = pte_pfn(last_pt.pte);
+		KUNIT_EXPECT_NE(test, last_pt.pt_type, pt_type_invalid);
+		KUNIT_EXPECT_EQ(test, pfn, core_pfn);
+	}
+
+	KUNIT_EXPECT_EQ(test, get_last_pt(addr + nr * PAGE_SIZE).pt_type,
+			pt_type_invalid);
+}
+
+struct xk_stress {
+	struct mm_struct *mm;
+	/* va of every slot, remapped over and over by the test thread */
+	unsigned long vas[XK_TEST_WINDOWS];
+	u64 first;
+	u64 last;
+	struct hashmap map;
+	bool stop;
+	atomic_t errors;
+	atomic_long_t reads;
+};
+
+static void xk_stress_check_window(struct xk_stress *s, unsigned long va)
+{
+	last_pt_t last_pt;
+	u64 pa;
+
+	if (mm_window_find(va, &pa) && (pa < s->first || pa >= s->last))
+		atomic_inc(&s->errors);
+
+	last_pt = get_last_pt(va);
+	if (last_pt.pt_type == pt_type_pte &&
+	    (pte_pfn(last_pt.pte) < s->first >> PAGE_SHIFT ||
+	     pte_pfn(last_pt.pte) >= s->last >> PAGE_SHIFT))
+		atomic_inc(&s->errors);
+}
+
+/*
+ * Whatever a lock-free reader finds while the test thread remaps windows
+ * and rewrites the map must have been written by it: a window over the
+ * test pages, or the value that goes with the key
+ */
+static int xk_stress_reader(void *data)
+{
+	struct xk_stress *s = data;
+	long key, value;
+	u32 r;
+
+	kthread_use_mm(s->mm);
+	while (!READ_ONCE(s->stop)) {
+		r = get_random_u32();
+		xk_stress_check_window(
+			s, READ_ONCE(s->vas[r % XK_TEST_WINDOWS]));
+
+		key = r % XK_TEST_KEYS + 1;
+		rcu_read_lock();
+		if (hashmap__find_rcu(&s->map, key, &value) &&
+		    value != key * 3)
+			atomic_inc(&s->errors);
+		rcu_read_unlock();
+
+		atomic_long_inc(&s->reads);
+		cond_resched();
+	}
+	kthread_unuse_mm(s->mm);
+	return 0;
+}
+
+static void xk_stress_write(struct kunit *test, struct xk_stress *s,
+			    u64 *pages)
+{
+	struct pt_permissions perms = { .read = 1 };
+	u32 r = get_random_u32();
+	unsigned int slot = r % XK_TEST_WINDOWS;
+	long key = (r >> 8) % XK_TEST_KEYS + 1;
+	void *va;
+
+	if (s->vas[slot]) {
+		KUNIT_EXPECT_EQ(test, unmap_physical((void *)s->vas[slot]),
+				XKLIB_SUCCESS);
+		WRITE_ONCE(s->vas[slot], 0);
+	}
+	va = map_physical(virt_to_phys(pages) + (r % XK_TEST_WINDOWS) *
+						PAGE_SIZE, perms);
+	KUNIT_EXPECT_NOT_NULL(test, va);
+	WRITE_ONCE(s->vas[slot], (unsigned long)va);
+
+	if (r & 1)
+		hashmap__delete(&s->map, key, NULL, NULL);
+	else
+		KUNIT_EXPECT_EQ(test,
+				hashmap__set(&s->map, key, key * 3, NULL, NULL),
+				0);
+}
+
+static void xk_mapper_stress(struct kunit *test)
+{
+	struct task_struct **readers;
+	unsigned int nr_readers;
+	unsigned long timeout;
+	struct xk_stress *s;
+	u64 *pages;
+
+	if (!stress_ms)
+		kunit_skip(test, "stress_ms is 0");
+
+	nr_readers = max(num_online_cpus() - 1, 1U);
+	s = kunit_kzalloc(test, sizeof(*s), GFP_KERNEL);
+	readers = kunit_kcalloc(test, nr_readers, sizeof(*readers),
+				GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, s);
+	KUNIT_ASSERT_NOT_NULL(test, readers);
+
+	pages = xk_test_pages(test, XK_TEST_WINDOWS);
+	s->mm = current->mm;
+	s->first = virt_to_phys(pages);
+	s->last = s->first + XK_TEST_WINDOWS * PAGE_SIZE;
+	hashmap__init(&s->map, xk_test_hash, xk_test_equal, NULL);
+
+	for (unsigned int i = 0; i < nr_readers; i++) {
+		readers[i] = kthread_run(xk_stress_reader, s,
+					 "xklib_kunit/%u", i);
+		if (IS_ERR(readers[i])) {
+			readers[i] = NULL;
+			break;
+		}
+		get_task_struct(readers[i]);
+	}
+
+	timeout = jiffies + msecs_to_jiffies(stress_ms);
+	while (time_before(jiffies, timeout)) {
+		xk_stress_write(test, s, pages);
+		cond_resched();
+	}
+
+	WRITE_ONCE(s->stop, true);
+	for (unsigned int i = 0; i < nr_readers && readers[i]; i++) {
+		kthread_stop(readers[i]);
+		put_task_struct(readers[i]);
+	}
+
+	for (int i = 0; i < XK_TEST_WINDOWS; i++) {
+		if (s->vas[i])
+			unmap_physical((void *)s->vas[i]);
+	}
+	hashmap__clear(&s->map);
+
+	KUNIT_EXPECT_NOT_NULL(test, readers[0]);
+	KUNIT_EXPECT_GT(test, atomic_long_read(&s->reads), 0);
+	KUNIT_EXPECT_EQ(test, atomic_read(&s->errors), 0);
+}
+#else
+static int xk_mapper_test_init(struct kunit *test)
+{
+	kunit_skip(test, "kunit_vm_mmap() needs 6.10");
+	return 0;
+}
+
+static void xk_mapper_reads_back(struct kunit *test)
+{
+}
+
+static void xk_mapper_refuses_holes(struct kunit *test)
+{
+}
+
+static void xk_mapper_walker_matches(struct kunit *test)
+{
+}
+
+static void xk_mapper_stress(struct kunit *test)
+{
+}
+#endif
+
+static struct kunit_case xk_mapper_cases[] = {
+	KUNIT_CASE(xk_mapper_reads_back),
+	KUNIT_CASE(xk_mapper_refuses_holes),
+	KUNIT_CASE(xk_mapper_walker_matches),
+	KUNIT_CASE_SLOW(xk_mapper_stress),
+	{}
+};
+
+static struct kunit_suite xk_mapper_suite = {
+	.name = "xklib_mapper",
+	.suite_init = xk_suite_init,
+	.suite_exit = xk_suite_exit,
+	.init = xk_mapper_test_init,
+	.test_cases = xk_mapper_cases,
+};
+
+kunit_test_suites(&xk_hashmap_suite, &xk_mapper_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("cutecatsandvirtualmachines");
+MODULE_DESCRIPTION("xklib KUnit suites");
@@ -0,0 +1,104 @@
+#pragma once
+
+/*
+ * Clock, pinning and reporting helpers shared by the userspace drivers of
+ * /dev/xklib. Latencies are in ns, recorded in the histograms of
+ * lat_hist.h, one per thread and operation.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lat_hist.h"
+
+#define DRIVER_DEVICE "/dev/xklib"
+#define DRIVER_MAX_CPUS 1024
+//Sleeps end this early, the rest of the wait is spent spinning
+#define DRIVER_SPIN_NS 50000
+
+static inline xuint64_t driver_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static inline void driver_sleep_until(xuint64_t ns)
+{
+	struct timespec ts;
+
+	if (ns > DRIVER_SPIN_NS + driver_now()) {
+		ns -= DRIVER_SPIN_NS;
+		ts.tv_sec = ns / 1000000000UL;
+		ts.tv_nsec = ns % 1000000000UL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR)
+			;
+		ns += DRIVER_SPIN_NS;
+	}
+	while (driver_now() < ns)
+		;
+}
+
+/*
+ * Parses a cpu list such as 0,2,4-7, or "all" for every cpu the process
+ * may run on. Returns the number of cpus, 0 if the list is invalid.
+ */
+static inline int driver_parse_cpus(const char *list, int *cpus)
+{
+	cpu_set_t set;
+	int nr = 0, lo, hi;
+	char *end;
+
+	if (!strcmp(list, "all")) {
+		if (sched_getaffinity(0, sizeof(set), &set))
+			return 0;
+		for (int i = 0; i < CPU_SETSIZE && nr < DRIVER_MAX_CPUS; i++) {
+			if (CPU_ISSET(i, &set))
+				cpus[nr++] = i;
+		}
+		return nr;
+	}
+
+	while (*list) {
+		lo = hi = strtol(list, &end, 10);
+		if (end == list || lo < 0)
+			return 0;
+		if (*end == '-') {
+			list = end + 1;
+			hi = strtol(list, &end, 10);
+			if (end == list || hi < lo)
+				return 0;
+		}
+		for (int i = lo; i <= hi && nr < DRIVER_MAX_CPUS; i++)
+			cpus[nr++] = i;
+		if (*end && *end != ',')
+			return 0;
+		list = *end ? end + 1 : end;
+	}
+	return nr;
+}
+
+static inline void driver_print_header(const char *what)
+{
+	printf("%-12s %10s %8s %12s %10s %10s %10s %10s %10s\n", what, "ops",
+	       "errors", "ops/s", "mean", "p50", "p99", "p99.9", "max");
+}
+
+static inline void driver_print_hist(const char *name,
+				     const struct lat_hist *h,
+				     xuint64_t errors, xuint64_t ns)
+{
+	double secs = ns / 1e9;
+
+	printf("%-12s %10lu %8lu %12.0f %10lu %10lu %10lu %10lu %10lu\n", name,
+	       h->count, errors, secs > 0 ? h->count / secs : 0,
+	       h->count ? h->sum / h->count : 0, lat_hist_percentile(h, 500),
+	       lat_hist_percentile(h, 990), lat_hist_percentile(h, 999),
+	       h->count ? h->max : 0);
+}
@@ -1,29 +1,484 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
+#define _GNU_SOURCE
 #include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
 #include <sys/ioctl.h>
-#include <errno.h>
-#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "ioctl.h"
+#include "driver.h"
+#include "trace.h"
+
+/*
+ * Replays a trace of translate, read, map and scan requests against
+ * /dev/xklib, and writes synthetic ones:
+ *
+ *   runner -g trace.bin [-c records] [-m mix] [-r rate] [-b MiB] [-s seed]
+ *   runner [-t threads] [-r rate | -T] [-p cpus] [-l loops] trace.bin
+ *
+ * Thread i replays records i, i + threads... on its own fd, pinned round
+ * robin on the cpus of -p. Records go back to back by default, -r spreads
+ * them evenly at rate requests per second overall and -T replays them at
+ * their captured times. Paced latencies run from the time a request was
+ * due, so a replay that falls behind shows it in the tail.
+ */
+
+#define RUNNER_BUF_MB 64
+#define RUNNER_RECORDS 100000
+#define RUNNER_RATE 100000
+//Share of the requests that go to the first RUNNER_HOT_DIV-th of the buffer
+#define RUNNER_HOT_PERCENT 80
+#define RUNNER_HOT_DIV 16
+
+static const char *const runner_ops[TRACE_OPS] = {
+	[TRACE_TRANSLATE] = "translate",
+	[TRACE_READ] = "read",
+	[TRACE_MAP] = "map",
+	[TRACE_SCAN] = "scan",
+};
+
+struct runner {
+	const char *dev;
+	struct trace_record *records;
+	size_t nr;
+	unsigned int threads;
+	unsigned int loops;
+	double rate;
+	bool timed;
+	bool dry;
+	int cpus[DRIVER_MAX_CPUS];
+	int nr_cpus;
+	char *buf;
+	size_t buf_size;
+	xuint64_t start;
+};
+
+struct runner_thread {
+	struct runner *r;
+	pthread_t thread;
+	unsigned int id;
+	int fd;
+	xuint64_t end;
+	struct lat_hist hist[TRACE_OPS];
+	xuint64_t errors[TRACE_OPS];
+	char page[XKLIB_IOCTL_MAX_READ];
+};
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: runner [-d dev] [-t threads] [-r rate | -T] [-p cpus] "
+		"[-l loops]\n"
+		"              [-b MiB] [-k key] [-n] trace\n"
+		"       runner -g trace [-c records] [-m t,r,m,s] [-r rate] "
+		"[-b MiB] [-s seed]\n");
+	exit(2);
+}
+
+static xuint64_t runner_rand(xuint64_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+static int runner_generate(const char *path, size_t nr, const char *mix,
+			   double rate, size_t buf_size, xuint64_t seed)
+{
+	struct trace_header hdr = { TRACE_MAGIC, TRACE_VERSION, nr };
+	size_t pages = buf_size >> 12, page;
+	unsigned int weights[TRACE_OPS], total = 0, pick, len;
+	struct trace_record rec = { .flags = TRACE_REL };
+	double ts = 0;
+	FILE *f;
+
+	if (sscanf(mix, "%u,%u,%u,%u", &weights[0], &weights[1], &weights[2],
+		   &weights[3]) != TRACE_OPS)
+		usage();
+	for (int i = 0; i < TRACE_OPS; i++)
+		total += weights[i];
+	if (!total || !pages || rate <= 0)
+		usage();
+
+	f = fopen(path, "wb");
+	if (!f || fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+		perror(path);
+		return 1;
+	}
+
+	seed = seed ? seed : 1;
+	for (size_t i = 0; i < nr; i++) {
+		pick = runner_rand(&seed) % total;
+		for (rec.op = 0; pick >= weights[rec.op]; rec.op++)
+			pick -= weights[rec.op];
+
+		page = runner_rand(&seed);
+		if (page % 100 < RUNNER_HOT_PERCENT)
+			page = (page >> 8) % (pages / RUNNER_HOT_DIV ?: 1);
+		else
+			page = (page >> 8) % pages;
+
+		switch (rec.op) {
+		case TRACE_READ:
+			len = 8 << runner_rand(&seed) % 10;
+			rec.len = len;
+			rec.addr = runner_rand(&seed) % (4096 - len + 1) & ~7UL;
+			break;
+		case TRACE_SCAN:
+			rec.len = 4096;
+			rec.addr = 0;
+			break;
+		default:
+			rec.len = 0;
+			rec.addr = runner_rand(&seed) & 0xff8;
+			break;
+		}
+		rec.addr += page << 12;
+
+		//Poisson arrivals at rate requests per second
+		ts += -log((runner_rand(&seed) >> 11) * 0x1p-53 + 0x1p-54) /
+		      rate * 1e9;
+		rec.ts_ns = ts;
+		if (fwrite(&rec, sizeof(rec), 1, f) != 1) {
+			perror(path);
+			fclose(f);
+			return 1;
+		}
+	}
+
+	if (fclose(f)) {
+		perror(path);
+		return 1;
+	}
+	printf("%zu records over %.3f s written to %s\n", nr, ts / 1e9, path);
+	return 0;
+}
+
+static int runner_load(struct runner *r, const char *path)
+{
+	struct trace_header hdr;
+	FILE *f = fopen(path, "rb");
 
-int main() {
-	int dev = open("/dev/dummy", O_RDWR);
-	if(dev == -1) {
-		printf("Opening was not possible!\n");
+	if (!f || fread(&hdr, sizeof(hdr), 1, f) != 1) {
+		perror(path);
+		return -1;
+	}
+	if (hdr.magic != TRACE_MAGIC || hdr.version != TRACE_VERSION ||
+	    !hdr.nr) {
+		fprintf(stderr, "%s: not a version %d trace\n", path,
+			TRACE_VERSION);
+		fclose(f);
 		return -1;
 	}
 
-	printf("Opening was successfull!\n");
+	r->nr = hdr.nr;
+	r->records = calloc(r->nr, sizeof(*r->records));
+	if (!r->records ||
+	    fread(r->records, sizeof(*r->records), r->nr, f) != r->nr) {
+		fprintf(stderr, "%s: truncated trace\n", path);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
 
-	xklib_ioctl_data data = {0};
-	data.init.vmcall_key = 0xdeadbeef;
+	for (size_t i = 0; i < r->nr; i++) {
+		if (r->records[i].op >= TRACE_OPS) {
+			fprintf(stderr, "%s: record %zu: bad op %u\n", path, i,
+				r->records[i].op);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Turns the offsets of relative records into addresses in the buffer,
+ * faulted in and locked so that the physical pages behind it stay put
+ */
+static int runner_resolve(struct runner *r)
+{
+	size_t pages = r->buf_size >> 12, page;
+	xklib_ioctl_data data = { 0 };
+	struct trace_record *rec;
+	xuint64_t *pas;
+	int fd = -1;
+
+	r->buf = mmap(NULL, r->buf_size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	pas = calloc(pages, sizeof(*pas));
+	if (r->buf == MAP_FAILED || !pas) {
+		perror("buffer");
+		return -1;
+	}
+	if (mlock(r->buf, r->buf_size))
+		perror("mlock, physical pages may move");
+	for (size_t i = 0; i < r->buf_size; i += 8)
+		*(xuint64_t *)(r->buf + i) = i;
 
-	printf("Calling with IOCTL: 0x%llx\n", xklib_init);
-	printf("IOCTL result: %d\n", ioctl(dev, xklib_init, &data));
-	printf("Last error: %d\n", errno);
-	
-	close(dev);
+	if (!r->dry) {
+		fd = open(r->dev, O_RDWR);
+		if (fd < 0) {
+			perror(r->dev);
+			return -1;
+		}
+	}
+	for (size_t i = 0; i < pages; i++) {
+		data.translate.va = (xuint64_t)r->buf + (i << 12);
+		if (r->dry)
+			data.translate.pa = i << 12;
+		else if (ioctl(fd, xklib_translate, &data)) {
+			perror("translate");
+			close(fd);
+			return -1;
+		}
+		pas[i] = data.translate.pa;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	for (size_t i = 0; i < r->nr; i++) {
+		rec = &r->records[i];
+		if (!(rec->flags & TRACE_REL))
+			continue;
+
+		page = (rec->addr >> 12) % pages;
+		if (rec->op == TRACE_TRANSLATE) {
+			rec->addr = (xuint64_t)r->buf + (page << 12) +
+				    (rec->addr & 0xfff);
+		} else {
+			rec->addr = pas[page] + (rec->addr & 0xfff);
+			if ((rec->addr & 0xfff) + rec->len > 4096)
+				rec->len = 4096 - (rec->addr & 0xfff);
+		}
+		rec->flags &= ~TRACE_REL;
+	}
+	free(pas);
 	return 0;
-}
\ No newline at end of file
+}
+
+static int runner_op(struct runner_thread *t, const struct trace_record *rec)
+{
+	xklib_ioctl_data data = { 0 };
+
+	if (t->r->dry)
+		return 0;
+
+	switch (rec->op) {
+	case TRACE_TRANSLATE:
+		data.translate.va = rec->addr;
+		return ioctl(t->fd, xklib_translate, &data);
+	case TRACE_READ:
+		data.read.pa = rec->addr;
+		data.read.buf = (xuint64_t)t->page;
+		data.read.len = rec->len;
+		return ioctl(t->fd, xklib_read, &data);
+	case TRACE_MAP:
+		data.map.pa = rec->addr;
+		if (ioctl(t->fd, xklib_map, &data))
+			return -1;
+		data.unmap.va = data.map.va;
+		return ioctl(t->fd, xklib_unmap, &data);
+	default:
+		data.scan.pa = rec->addr;
+		data.scan.len = rec->len;
+		return ioctl(t->fd, xklib_scan, &data);
+	}
+}
+
+static void *runner_thread_fn(void *arg)
+{
+	struct runner_thread *t = arg;
+	struct runner *r = t->r;
+	xuint64_t span = r->records[r->nr - 1].ts_ns + 1, k, due, start;
+	const struct trace_record *rec;
+	xuint64_t lat;
+	int err;
+
+	driver_sleep_until(r->start);
+	for (unsigned int loop = 0; loop < r->loops; loop++) {
+		for (size_t i = t->id; i < r->nr; i += r->threads) {
+			rec = &r->records[i];
+			k = loop * r->nr + i;
+			if (r->rate > 0)
+				due = r->start + k * (1e9 / r->rate);
+			else if (r->timed)
+				due = r->start + loop * span + rec->ts_ns;
+			else
+				due = 0;
+
+			if (due) {
+				driver_sleep_until(due);
+				start = due;
+			} else {
+				start = driver_now();
+			}
+			err = runner_op(t, rec);
+			lat = driver_now() - start;
+			lat_hist_record(&t->hist[rec->op], lat);
+			t->errors[rec->op] += err != 0;
+		}
+	}
+
+	t->end = driver_now();
+	return NULL;
+}
+
+static int runner_replay(struct runner *r)
+{
+	struct runner_thread *threads = calloc(r->threads, sizeof(*threads));
+	struct lat_hist *all = malloc(sizeof(*all) * (TRACE_OPS + 1));
+	xuint64_t errors[TRACE_OPS] = { 0 }, end = 0, total = 0;
+	pthread_attr_t attr;
+	cpu_set_t set;
+	int err = 0;
+
+	if (!threads || !all) {
+		perror("threads");
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < r->threads; i++) {
+		threads[i].r = r;
+		threads[i].id = i;
+		threads[i].fd = r->dry ? -1 : open(r->dev, O_RDWR);
+		if (!r->dry && threads[i].fd < 0) {
+			perror(r->dev);
+			return 1;
+		}
+		for (int op = 0; op < TRACE_OPS; op++)
+			lat_hist_reset(&threads[i].hist[op]);
+	}
+
+	r->start = driver_now() + 10000000;
+	for (unsigned int i = 0; i < r->threads; i++) {
+		pthread_attr_init(&attr);
+		if (r->nr_cpus) {
+			CPU_ZERO(&set);
+			CPU_SET(r->cpus[i % r->nr_cpus], &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+		err = pthread_create(&threads[i].thread, &attr,
+				     runner_thread_fn, &threads[i]);
+		pthread_attr_destroy(&attr);
+		if (err) {
+			fprintf(stderr, "thread %u: %s\n", i, strerror(err));
+			exit(1);
+		}
+	}
+
+	for (int op = 0; op <= TRACE_OPS; op++)
+		lat_hist_reset(&all[op]);
+	for (unsigned int i = 0; i < r->threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].fd >= 0)
+			close(threads[i].fd);
+		end = threads[i].end > end ? threads[i].end : end;
+		for (int op = 0; op < TRACE_OPS; op++) {
+			lat_hist_merge(&all[op], &threads[i].hist[op]);
+			lat_hist_merge(&all[TRACE_OPS], &threads[i].hist[op]);
+			errors[op] += threads[i].errors[op];
+		}
+	}
+
+	printf("%zu records x %u loops, %u threads, %.3f s\n", r->nr, r->loops,
+	       r->threads, (end - r->start) / 1e9);
+	driver_print_header("op");
+	for (int op = 0; op < TRACE_OPS; op++) {
+		if (all[op].count)
+			driver_print_hist(runner_ops[op], &all[op], errors[op],
+					  end - r->start);
+		total += errors[op];
+	}
+	driver_print_hist("total", &all[TRACE_OPS], total, end - r->start);
+
+	free(threads);
+	free(all);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct runner r = { .dev = DRIVER_DEVICE, .threads = 1, .loops = 1 };
+	size_t buf_mb = RUNNER_BUF_MB, records = RUNNER_RECORDS;
+	const char *generate = NULL, *mix = "70,20,5,5";
+	xuint64_t seed = 1, key = 0;
+	xklib_ioctl_data data = { 0 };
+	bool init = false;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "b:c:d:g:k:l:m:np:r:s:t:T")) != -1) {
+		switch (opt) {
+		case 'b':
+			buf_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			records = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			r.dev = optarg;
+			break;
+		case 'g':
+			generate = optarg;
+			break;
+		case 'k':
+			key = strtoull(optarg, NULL, 0);
+			init = true;
+			break;
+		case 'l':
+			r.loops = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mix = optarg;
+			break;
+		case 'n':
+			r.dry = true;
+			break;
+		case 'p':
+			r.nr_cpus = driver_parse_cpus(optarg, r.cpus);
+			if (!r.nr_cpus)
+				usage();
+			break;
+		case 'r':
+			r.rate = strtod(optarg, NULL);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			r.threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			r.timed = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	r.buf_size = buf_mb << 20;
+
+	if (generate)
+		return runner_generate(generate, records, mix,
+				       r.rate > 0 ? r.rate : RUNNER_RATE,
+				       r.buf_size, seed);
+
+	if (optind != argc - 1 || !r.threads || !r.loops || !r.buf_size ||
+	    (r.timed && r.rate > 0))
+		usage();
+	if (runner_load(&r, argv[optind]) || runner_resolve(&r))
+		return 1;
+
+	if (init && !r.dry) {
+		fd = open(r.dev, O_RDWR);
+		data.init.vmcall_key = key;
+		if (fd < 0 || ioctl(fd, xklib_init, &data)) {
+			perror("init");
+			return 1;
+		}
+		close(fd);
+	}
+
+	return runner_replay(&r);
+}
@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "ioctl.h"
+#include "driver.h"
+
+/*
+ * Hammers /dev/xklib from many threads at once to show how its ioctls
+ * scale:
+ *
+ *   stress [-t threads] [-i ioctls] [-D seconds] [-r rate] [-p cpus] [-s]
+ *
+ * Every thread issues the ioctls of -i in turn, on a page of its own, for
+ * -D seconds: back to back (closed loop) or at rate requests per second
+ * each (-r, open loop, latencies run from the time a request was due).
+ * Threads open the device on their own unless -s makes them share one fd.
+ * The per thread table has the voluntary and involuntary context switches
+ * of the thread, sleeps on a contended lock show up in the first.
+ */
+
+#define STRESS_SECONDS 5
+#define STRESS_MAX_IOCTLS 16
+
+enum stress_op {
+	STRESS_INIT,
+	STRESS_TRANSLATE,
+	STRESS_READ,
+	STRESS_MAP,
+	STRESS_SCAN,
+	STRESS_OPS,
+};
+
+static const char *const stress_ops[STRESS_OPS] = {
+	[STRESS_INIT] = "init",
+	[STRESS_TRANSLATE] = "translate",
+	[STRESS_READ] = "read",
+	[STRESS_MAP] = "map",
+	[STRESS_SCAN] = "scan",
+};
+
+struct stress {
+	const char *dev;
+	unsigned int threads;
+	enum stress_op ioctls[STRESS_MAX_IOCTLS];
+	int nr_ioctls;
+	double seconds;
+	double rate;
+	bool shared;
+	bool dry;
+	bool buckets;
+	int cpus[DRIVER_MAX_CPUS];
+	int nr_cpus;
+	int fd;
+	xuint64_t start;
+	xuint64_t end;
+};
+
+struct stress_thread {
+	struct stress *s;
+	pthread_t thread;
+	unsigned int id;
+	int cpu;
+	int fd;
+	int err;
+	char *page;
+	xuint64_t pa;
+	long nvcsw;
+	long nivcsw;
+	struct lat_hist hist[STRESS_OPS];
+	xuint64_t errors[STRESS_OPS];
+};
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: stress [-d dev] [-t threads] [-i ioctl,...] "
+		"[-D seconds] [-r rate]\n"
+		"              [-p cpus] [-s] [-n] [-H]\n"
+		"ioctls: init translate read map scan\n");
+	exit(2);
+}
+
+static int stress_parse_ioctls(struct stress *s, char *list)
+{
+	char *name;
+
+	s->nr_ioctls = 0;
+	for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+		int op = 0;
+
+		while (op < STRESS_OPS && strcmp(name, stress_ops[op]))
+			op++;
+		if (op == STRESS_OPS || s->nr_ioctls == STRESS_MAX_IOCTLS)
+			return -1;
+		s->ioctls[s->nr_ioctls++] = op;
+	}
+	return s->nr_ioctls ? 0 : -1;
+}
+
+static int stress_op(struct stress_thread *t, enum stress_op op)
+{
+	xklib_ioctl_data data = { 0 };
+
+	if (t->s->dry)
+		return 0;
+
+	switch (op) {
+	case STRESS_INIT:
+		data.init.vmcall_key = t->id;
+		return ioctl(t->fd, xklib_init, &data);
+	case STRESS_TRANSLATE:
+		data.translate.va = (xuint64_t)t->page;
+		return ioctl(t->fd, xklib_translate, &data);
+	case STRESS_READ:
+		data.read.pa = t->pa;
+		data.read.buf = (xuint64_t)t->page + XKLIB_IOCTL_MAX_READ / 2;
+		data.read.len = XKLIB_IOCTL_MAX_READ / 2;
+		return ioctl(t->fd, xklib_read, &data);
+	case STRESS_MAP:
+		data.map.pa = t->pa;
+		if (ioctl(t->fd, xklib_map, &data))
+			return -1;
+		data.unmap.va = data.map.va;
+		return ioctl(t->fd, xklib_unmap, &data);
+	default:
+		data.scan.pa = t->pa;
+		data.scan.len = XKLIB_IOCTL_MAX_READ;
+		return ioctl(t->fd, xklib_scan, &data);
+	}
+}
+
+//A locked page of the thread, the physical requests all target it
+static int stress_setup(struct stress_thread *t)
+{
+	xklib_ioctl_data data = { 0 };
+
+	t->page = mmap(NULL, XKLIB_IOCTL_MAX_READ, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (t->page == MAP_FAILED)
+		return errno;
+	mlock(t->page, XKLIB_IOCTL_MAX_READ);
+	memset(t->page, t->id, XKLIB_IOCTL_MAX_READ);
+
+	if (t->s->dry)
+		return 0;
+	if (!t->s->shared) {
+		t->fd = open(t->s->dev, O_RDWR);
+		if (t->fd < 0)
+			return errno;
+	}
+	data.translate.va = (xuint64_t)t->page;
+	if (ioctl(t->fd, xklib_translate, &data))
+		return errno;
+	t->pa = data.translate.pa;
+	return 0;
+}
+
+static void *stress_thread_fn(void *arg)
+{
+	struct stress_thread *t = arg;
+	struct stress *s = t->s;
+	xuint64_t interval = s->rate > 0 ? 1e9 / s->rate : 0, due, start;
+	struct rusage before, after;
+	enum stress_op op;
+	int err;
+
+	t->err = stress_setup(t);
+	if (t->err)
+		return NULL;
+
+	driver_sleep_until(s->start);
+	getrusage(RUSAGE_THREAD, &before);
+	for (xuint64_t k = 0;; k++) {
+		op = s->ioctls[k % s->nr_ioctls];
+		if (interval) {
+			due = s->start + k * interval;
+			if (due >= s->end)
+				break;
+			driver_sleep_until(due);
+			start = due;
+		} else {
+			start = driver_now();
+			if (start >= s->end)
+				break;
+		}
+		err = stress_op(t, op);
+		lat_hist_record(&t->hist[op], driver_now() - start);
+		t->errors[op] += err != 0;
+	}
+	getrusage(RUSAGE_THREAD, &after);
+
+	t->nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+	t->nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+	t->cpu = sched_getcpu();
+	if (!s->shared && t->fd >= 0)
+		close(t->fd);
+	munmap(t->page, XKLIB_IOCTL_MAX_READ);
+	return NULL;
+}
+
+static void stress_print_buckets(const char *name, const struct lat_hist *h)
+{
+	for (unsigned int i = 0; i < LAT_HIST_BUCKETS; i++) {
+		if (h->buckets[i])
+			printf("%-12s %10lu %10lu %10lu\n", name,
+			       lat_hist_lower(i), lat_hist_upper(i),
+			       h->buckets[i]);
+	}
+}
+
+static void stress_report(struct stress *s, struct stress_thread *threads)
+{
+	struct lat_hist *all = malloc(sizeof(*all) * (STRESS_OPS + 1));
+	xuint64_t errors[STRESS_OPS] = { 0 }, ns = s->end - s->start, total;
+	long nvcsw = 0, nivcsw = 0;
+	struct stress_thread *t;
+	struct lat_hist *sum;
+
+	if (!all) {
+		perror("report");
+		return;
+	}
+	for (int op = 0; op <= STRESS_OPS; op++)
+		lat_hist_reset(&all[op]);
+	sum = &all[STRESS_OPS];
+
+	printf("%u threads, %s fd, %s loop, %.1f s\n", s->threads,
+	       s->shared ? "shared" : "own", s->rate > 0 ? "open" : "closed",
+	       ns / 1e9);
+	printf("%-6s %4s %10s %8s %12s %8s %8s %10s %10s %10s\n", "thread",
+	       "cpu", "ops", "errors", "ops/s", "vcsw", "ivcsw", "p50", "p99",
+	       "p99.9");
+	for (unsigned int i = 0; i < s->threads; i++) {
+		t = &threads[i];
+		lat_hist_reset(sum);
+		total = 0;
+		for (int op = 0; op < STRESS_OPS; op++) {
+			lat_hist_merge(sum, &t->hist[op]);
+			lat_hist_merge(&all[op], &t->hist[op]);
+			errors[op] += t->errors[op];
+			total += t->errors[op];
+		}
+		printf("%-6u %4d %10lu %8lu %12.0f %8ld %8ld "
+		       "%10lu %10lu %10lu\n", i, t->cpu, sum->count, total,
+		       sum->count / (ns / 1e9), t->nvcsw, t->nivcsw,
+		       lat_hist_percentile(sum, 500),
+		       lat_hist_percentile(sum, 990),
+		       lat_hist_percentile(sum, 999));
+		nvcsw += t->nvcsw;
+		nivcsw += t->nivcsw;
+	}
+	printf("context switches: %ld voluntary, %ld involuntary\n\n", nvcsw,
+	       nivcsw);
+
+	lat_hist_reset(sum);
+	total = 0;
+	driver_print_header("ioctl");
+	for (int op = 0; op < STRESS_OPS; op++) {
+		if (!all[op].count)
+			continue;
+		driver_print_hist(stress_ops[op], &all[op], errors[op], ns);
+		lat_hist_merge(sum, &all[op]);
+		total += errors[op];
+	}
+	driver_print_hist("total", sum, total, ns);
+
+	if (s->buckets) {
+		printf("\n%-12s %10s %10s %10s\n", "ioctl", "from", "to",
+		       "count");
+		for (int op = 0; op < STRESS_OPS; op++)
+			stress_print_buckets(stress_ops[op], &all[op]);
+	}
+	free(all);
+}
+
+int main(int argc, char **argv)
+{
+	struct stress s = {
+		.dev = DRIVER_DEVICE,
+		.threads = 1,
+		.ioctls = { STRESS_TRANSLATE },
+		.nr_ioctls = 1,
+		.seconds = STRESS_SECONDS,
+		.fd = -1,
+	};
+	struct stress_thread *threads;
+	pthread_attr_t attr;
+	cpu_set_t set;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "d:D:Hi:np:r:st:")) != -1) {
+		switch (opt) {
+		case 'd':
+			s.dev = optarg;
+			break;
+		case 'D':
+			s.seconds = strtod(optarg, NULL);
+			break;
+		case 'H':
+			s.buckets = true;
+			break;
+		case 'i':
+			if (stress_parse_ioctls(&s, optarg))
+				usage();
+			break;
+		case 'n':
+			s.dry = true;
+			break;
+		case 'p':
+			s.nr_cpus = driver_parse_cpus(optarg, s.cpus);
+			if (!s.nr_cpus)
+				usage();
+			break;
+		case 'r':
+			s.rate = strtod(optarg, NULL);
+			break;
+		case 's':
+			s.shared = true;
+			break;
+		case 't':
+			s.threads = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc || !s.threads || s.seconds <= 0)
+		usage();
+
+	if (s.shared && !s.dry) {
+		s.fd = open(s.dev, O_RDWR);
+		if (s.fd < 0) {
+			perror(s.dev);
+			return 1;
+		}
+	}
+
+	threads = calloc(s.threads, sizeof(*threads));
+	if (!threads) {
+		perror("threads");
+		return 1;
+	}
+
+	//Leave the threads time to set up before the clock starts
+	s.start = driver_now() + 100000000 + s.threads * 1000000UL;
+	s.end = s.start + s.seconds * 1e9;
+	for (unsigned int i = 0; i < s.threads; i++) {
+		threads[i].s = &s;
+		threads[i].id = i;
+		threads[i].fd = s.fd;
+		for (int op = 0; op < STRESS_OPS; op++)
+			lat_hist_reset(&threads[i].hist[op]);
+
+		pthread_attr_init(&attr);
+		if (s.nr_cpus) {
+			CPU_ZERO(&set);
+			CPU_SET(s.cpus[i % s.nr_cpus], &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+		err = pthread_create(&threads[i].thread, &attr,
+				     stress_thread_fn, &threads[i]);
+		pthread_attr_destroy(&attr);
+		if (err) {
+			fprintf(stderr, "thread %u: %s\n", i, strerror(err));
+			return 1;
+		}
+	}
+
+	err = 0;
+	for (unsigned int i = 0; i < s.threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].err) {
+			fprintf(stderr, "thread %u: %s\n", i,
+				strerror(threads[i].err));
+			err = 1;
+		}
+	}
+	if (s.fd >= 0)
+		close(s.fd);
+	if (!err)
+		stress_report(&s, threads);
+
+	free(threads);
+	return err;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+ * Binary traces of /dev/xklib requests, in the byte order of the host: a
+ * trace_header followed by nr trace_records sorted by ts_ns.
+ *
+ * Addresses of records with TRACE_REL are offsets into the buffer of the
+ * replaying process, which turns them into virtual addresses for
+ * translations and into the physical address of the buffer page for the
+ * other operations, so that synthetic traces replay on any host. The
+ * others are replayed as captured, physical requests that cross a page of
+ * the buffer are cut at the end of the page.
+ */
+#include "xstdint.h"
+
+#define TRACE_MAGIC 0x52544b58 /* "XKTR" */
+#define TRACE_VERSION 1
+
+//addr is an offset into the replay buffer
+#define TRACE_REL 0x1
+
+enum trace_op {
+	TRACE_TRANSLATE,
+	TRACE_READ,
+	//map and unmap of a window
+	TRACE_MAP,
+	TRACE_SCAN,
+	TRACE_OPS,
+};
+
+struct trace_header {
+	xuint32_t magic;
+	xuint32_t version;
+	xuint64_t nr;
+};
+
+struct trace_record {
+	//time since the start of the capture
+	xuint64_t ts_ns;
+	xuint64_t addr;
+	//bytes read or scanned
+	xuint32_t len;
+	xuint16_t op;
+	xuint16_t flags;
+};
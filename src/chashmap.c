@@ -0,0 +1,355 @@
+#include "chashmap.h"
+#include "hashmap_impl.h"
+
+/* start with 64 buckets, fewer than the lock stripes anyway */
+#define CHASHMAP_MIN_CAP_BITS 6
+
+static inline size_t chashmap_table_size(size_t cap_bits)
+{
+	return struct_size((struct chashmap_table *)NULL, buckets,
+			   1UL << cap_bits);
+}
+
+static struct chashmap_table *chashmap_table_alloc(int node, size_t cap_bits)
+{
+	struct chashmap_table *tbl;
+
+	tbl = hashmap_alloc_node(node, chashmap_table_size(cap_bits),
+				 GFP_KERNEL | __GFP_ZERO);
+	if (!tbl)
+		return NULL;
+
+	tbl->cap_bits = cap_bits;
+	for (size_t i = 0; i < CHASHMAP_LOCKS; i++)
+		spin_lock_init(&tbl->locks[i]);
+	return tbl;
+}
+
+static inline spinlock_t *chashmap_lock(struct chashmap_table *tbl,
+					size_t bkt)
+{
+	return &tbl->locks[bkt & (CHASHMAP_LOCKS - 1)];
+}
+
+/*
+ * Locks the bucket of hash h in the table writers currently use, following
+ * the future tables of the stripes already moved by a resize.
+ * Must be called under rcu_read_lock().
+ */
+static struct chashmap_table *chashmap_lock_bucket(struct chashmap *map,
+						   size_t h, size_t *bkt,
+						   unsigned long *flags)
+{
+	struct chashmap_table *tbl = rcu_dereference(map->tbl);
+	spinlock_t *lock;
+
+	for (;;) {
+		*bkt = hash_bits(h, tbl->cap_bits);
+		lock = chashmap_lock(tbl, *bkt);
+		spin_lock_irqsave(lock, *flags);
+		if (!test_bit(*bkt & (CHASHMAP_LOCKS - 1), tbl->moved))
+			return tbl;
+
+		spin_unlock_irqrestore(lock, *flags);
+		tbl = rcu_dereference(tbl->future);
+	}
+}
+
+static void chashmap_unlock_bucket(struct chashmap_table *tbl, size_t bkt,
+				   unsigned long flags)
+{
+	spin_unlock_irqrestore(chashmap_lock(tbl, bkt), flags);
+}
+
+static struct hashmap_entry **chashmap_lookup(const struct chashmap *map,
+					      struct chashmap_table *tbl,
+					      size_t bkt, long key)
+{
+	struct hashmap_entry **pprev, *cur;
+
+	for (pprev = &tbl->buckets[bkt], cur = *pprev; cur;
+	     pprev = &cur->next, cur = cur->next) {
+		if (map->equal_fn(cur->key, key, map->ctx))
+			return pprev;
+	}
+
+	return NULL;
+}
+
+/*
+ * Moves the entries of bucket bkt of old into new, last entry first: a
+ * reader walking the old chain then never loses the entries ahead of it,
+ * at worst it runs into the new chain and keeps comparing keys there.
+ * Every entry is linked in new before being unlinked from old, and lookups
+ * missing in old go on with new, so no entry ever disappears.
+ *
+ * Entries of a new bucket all come from the same old bucket, whose stripe
+ * lock is held, so no lock of new is needed.
+ */
+static void chashmap_move_bucket(struct chashmap *map,
+				 struct chashmap_table *old,
+				 struct chashmap_table *new, size_t bkt)
+{
+	struct hashmap_entry **pprev, *cur;
+	size_t h;
+
+	while (old->buckets[bkt]) {
+		for (pprev = &old->buckets[bkt]; (*pprev)->next;
+		     pprev = &(*pprev)->next)
+			;
+
+		cur = *pprev;
+		h = hash_bits(map->hash_fn(cur->key, map->ctx), new->cap_bits);
+		WRITE_ONCE(cur->next, new->buckets[h]);
+		rcu_assign_pointer(new->buckets[h], cur);
+		smp_wmb();
+		WRITE_ONCE(*pprev, NULL);
+	}
+}
+
+static size_t chashmap_grow(struct chashmap *map, struct chashmap_table *old)
+{
+	size_t cap = 1UL << old->cap_bits;
+	struct chashmap_table *new;
+
+	new = chashmap_table_alloc(map->node, old->cap_bits + 1);
+	if (!new)
+		return XKLIB_ENOMEM;
+
+	rcu_assign_pointer(old->future, new);
+
+	for (size_t s = 0; s < CHASHMAP_LOCKS; s++) {
+		spin_lock_irq(&old->locks[s]);
+		for (size_t bkt = s; bkt < cap; bkt += CHASHMAP_LOCKS)
+			chashmap_move_bucket(map, old, new, bkt);
+		set_bit(s, old->moved);
+		spin_unlock_irq(&old->locks[s]);
+
+		cond_resched();
+	}
+
+	rcu_assign_pointer(map->tbl, new);
+
+	/* old->future must stay valid for the readers still on old */
+	synchronize_rcu();
+	hashmap_free(old, chashmap_table_size(old->cap_bits));
+
+	return XKLIB_SUCCESS;
+}
+
+static bool chashmap_needs_grow(const struct chashmap *map,
+				const struct chashmap_table *tbl)
+{
+	return (size_t)atomic_long_read(&map->sz) * 4 / 3 >
+	       (1UL << tbl->cap_bits);
+}
+
+static void chashmap_resize(struct work_struct *work)
+{
+	struct chashmap *map = container_of(work, struct chashmap, resize);
+	struct chashmap_table *tbl;
+
+	mutex_lock(&map->resize_lock);
+	tbl = rcu_dereference_protected(map->tbl,
+					lockdep_is_held(&map->resize_lock));
+	if (chashmap_needs_grow(map, tbl) && chashmap_grow(map, tbl))
+		dbg_msg("Could not grow concurrent hashmap of %ld entries",
+			atomic_long_read(&map->sz));
+	mutex_unlock(&map->resize_lock);
+}
+
+struct chashmap *chashmap__new(hashmap_hash_fn hash_fn,
+			       hashmap_equal_fn equal_fn, void *ctx, int node)
+{
+	struct chashmap *map = kmalloc_node(sizeof(*map), GFP_KERNEL, node);
+
+	if (!map)
+		return NULL;
+
+	map->hash_fn = hash_fn;
+	map->equal_fn = equal_fn;
+	map->ctx = ctx;
+	map->node = node;
+	atomic_long_set(&map->sz, 0);
+	mutex_init(&map->resize_lock);
+	INIT_WORK(&map->resize, chashmap_resize);
+
+	/* a table is always there so writers never have to allocate one */
+	RCU_INIT_POINTER(map->tbl,
+			 chashmap_table_alloc(node, CHASHMAP_MIN_CAP_BITS));
+	if (!rcu_access_pointer(map->tbl)) {
+		kfree(map);
+		return NULL;
+	}
+
+	return map;
+}
+
+/* the map must not be used concurrently anymore */
+void chashmap__free(struct chashmap *map)
+{
+	struct hashmap_entry *cur, *tmp;
+	struct chashmap_table *tbl;
+
+	if (IS_ERR_OR_NULL(map))
+		return;
+
+	cancel_work_sync(&map->resize);
+
+	tbl = rcu_dereference_protected(map->tbl, true);
+	for (size_t bkt = 0; bkt < (1UL << tbl->cap_bits); bkt++) {
+		for (cur = tbl->buckets[bkt]; cur; cur = tmp) {
+			tmp = cur->next;
+			hashmap_free_entry(cur);
+		}
+	}
+	hashmap_free(tbl, chashmap_table_size(tbl->cap_bits));
+	kfree(map);
+}
+
+size_t chashmap__size(const struct chashmap *map)
+{
+	return atomic_long_read(&map->sz);
+}
+
+size_t chashmap__capacity(const struct chashmap *map)
+{
+	size_t cap_bits;
+
+	rcu_read_lock();
+	cap_bits = rcu_dereference(map->tbl)->cap_bits;
+	rcu_read_unlock();
+
+	return 1UL << cap_bits;
+}
+
+size_t chashmap_insert(struct chashmap *map, long key, long value,
+		       enum hashmap_insert_strategy strategy, long *old_key,
+		       long *old_value, enum mm_alloc_ctx ctx)
+{
+	struct hashmap_entry *entry = NULL, **pprev;
+	struct chashmap_table *tbl;
+	size_t h, bkt, err = XKLIB_SUCCESS;
+	unsigned long flags;
+	bool grow = false;
+
+	if (old_key)
+		*old_key = 0;
+	if (old_value)
+		*old_value = 0;
+
+	/* allocated upfront, no allocation happens under the bucket lock */
+	if (strategy != HASHMAP_UPDATE) {
+		entry = hashmap_alloc_entry(map->node, ctx);
+		if (!entry)
+			return XKLIB_ENOMEM;
+		entry->key = key;
+		entry->value = value;
+	}
+
+	h = map->hash_fn(key, map->ctx);
+
+	rcu_read_lock();
+	tbl = chashmap_lock_bucket(map, h, &bkt, &flags);
+
+	pprev = strategy != HASHMAP_APPEND ?
+			chashmap_lookup(map, tbl, bkt, key) :
+			NULL;
+	if (pprev) {
+		if (old_key)
+			*old_key = (*pprev)->key;
+		if (old_value)
+			*old_value = (*pprev)->value;
+
+		if (strategy == HASHMAP_ADD) {
+			err = XKLIB_EEXIST;
+		} else {
+			WRITE_ONCE((*pprev)->key, key);
+			WRITE_ONCE((*pprev)->value, value);
+		}
+	} else if (strategy == HASHMAP_UPDATE) {
+		err = XKLIB_ENOENT;
+	} else {
+		WRITE_ONCE(entry->next, tbl->buckets[bkt]);
+		rcu_assign_pointer(tbl->buckets[bkt], entry);
+		entry = NULL;
+
+		atomic_long_inc(&map->sz);
+		grow = !rcu_access_pointer(tbl->future) &&
+		       chashmap_needs_grow(map, tbl);
+	}
+
+	chashmap_unlock_bucket(tbl, bkt, flags);
+	rcu_read_unlock();
+
+	if (entry)
+		hashmap_free_entry(entry);
+	if (grow)
+		schedule_work(&map->resize);
+
+	return err;
+}
+
+bool chashmap_delete(struct chashmap *map, long key, long *old_key,
+		     long *old_value)
+{
+	struct hashmap_entry **pprev, *entry = NULL;
+	struct chashmap_table *tbl;
+	unsigned long flags;
+	size_t bkt;
+
+	rcu_read_lock();
+	tbl = chashmap_lock_bucket(map, map->hash_fn(key, map->ctx), &bkt,
+				   &flags);
+
+	pprev = chashmap_lookup(map, tbl, bkt, key);
+	if (pprev) {
+		entry = *pprev;
+		/* entry->next stays intact for the readers standing on it */
+		WRITE_ONCE(*pprev, entry->next);
+		atomic_long_dec(&map->sz);
+	}
+
+	chashmap_unlock_bucket(tbl, bkt, flags);
+	rcu_read_unlock();
+
+	if (!entry)
+		return false;
+
+	if (old_key)
+		*old_key = entry->key;
+	if (old_value)
+		*old_value = entry->value;
+
+	hashmap_free_entry_rcu(entry);
+	return true;
+}
+
+bool chashmap_find(const struct chashmap *map, long key, long *value)
+{
+	struct chashmap_table *tbl;
+	struct hashmap_entry *cur;
+	size_t h = map->hash_fn(key, map->ctx);
+	bool found = false;
+
+	rcu_read_lock();
+	for (tbl = rcu_dereference(map->tbl); tbl && !found;
+	     tbl = rcu_dereference(tbl->future)) {
+		for (cur = rcu_dereference(
+			     tbl->buckets[hash_bits(h, tbl->cap_bits)]);
+		     cur; cur = rcu_dereference(cur->next)) {
+			if (map->equal_fn(READ_ONCE(cur->key), key, map->ctx)) {
+				if (value)
+					*value = READ_ONCE(cur->value);
+				found = true;
+				break;
+			}
+		}
+
+		/* pairs with the smp_wmb() of chashmap_move_bucket() */
+		smp_rmb();
+	}
+	rcu_read_unlock();
+
+	return found;
+}
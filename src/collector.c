@@ -0,0 +1,110 @@
+#include "collector.h"
+
+static struct mm_bucket_chunk *mm_bucket_chunk_new(int node,
+						  enum mm_alloc_ctx ctx)
+{
+	BUILD_BUG_ON(sizeof(struct mm_bucket_chunk) > PAGE_SIZE);
+
+	//Reserve table pages are zeroed and exactly chunk sized
+	if (ctx == MM_CTX_ATOMIC)
+		return mm_reserve_get(&mm_reserve_tables);
+
+	return kmalloc_node(sizeof(struct mm_bucket_chunk),
+			    GFP_KERNEL | __GFP_ZERO, node);
+}
+
+struct mm_bucket *mm_bucket_new(int node)
+{
+	struct mm_bucket *bucket = kmalloc_node(sizeof(*bucket), GFP_KERNEL, node);
+
+	if (!bucket)
+		return NULL;
+
+	bucket->node = node;
+	bucket->head = mm_bucket_chunk_new(node, MM_CTX_PROCESS);
+	if (!bucket->head) {
+		kfree(bucket);
+		return NULL;
+	}
+
+	return bucket;
+}
+
+void mm_bucket_free(struct mm_bucket *bucket, mm_bucket_release_fn release)
+{
+	if (!bucket)
+		return;
+
+	mm_bucket_drain(bucket, release);
+	kfree(bucket->head);
+	kfree(bucket);
+}
+
+/*
+ * Stores p in the bucket, safe against concurrent pushes from any number
+ * of cpus. Only the push that finds the head chunk full allocates.
+ */
+u64 mm_bucket_push(struct mm_bucket *bucket, void *p, enum mm_alloc_ctx ctx)
+{
+	struct mm_bucket_chunk *chunk, *fresh;
+	int idx;
+
+	for (;;) {
+		chunk = smp_load_acquire(&bucket->head);
+
+		idx = atomic_read(&chunk->tail);
+		while (idx < MM_BUCKET_CHUNK_SLOTS) {
+			if (atomic_try_cmpxchg(&chunk->tail, &idx, idx + 1)) {
+				WRITE_ONCE(chunk->slots[idx], p);
+				return XKLIB_SUCCESS;
+			}
+		}
+
+		fresh = mm_bucket_chunk_new(bucket->node, ctx);
+		if (unlikely(!fresh))
+			return XKLIB_ENOMEM;
+
+		fresh->next = chunk;
+		//Lost the race, another cpu already installed a new head
+		if (cmpxchg(&bucket->head, chunk, fresh) != chunk)
+			kfree(fresh);
+	}
+}
+
+/*
+ * Hands every stored pointer to release and empties the bucket, keeping
+ * a single chunk around. Must not race with pushes.
+ */
+void mm_bucket_drain(struct mm_bucket *bucket, mm_bucket_release_fn release)
+{
+	struct mm_bucket_chunk *chunk, *next;
+	int i;
+
+	if (release) {
+		mm_bucket__for_each(bucket, chunk, i) {
+			if (chunk->slots[i])
+				release(chunk->slots[i]);
+		}
+	}
+
+	chunk = bucket->head;
+	for (next = chunk->next; next; next = chunk->next) {
+		chunk->next = next->next;
+		kfree(next);
+	}
+
+	memset(chunk->slots, 0, sizeof(chunk->slots));
+	atomic_set(&chunk->tail, 0);
+}
+
+size_t mm_bucket_count(const struct mm_bucket *bucket)
+{
+	struct mm_bucket_chunk *chunk;
+	size_t count = 0;
+
+	for (chunk = READ_ONCE(bucket->head); chunk; chunk = chunk->next)
+		count += min_t(int, atomic_read(&chunk->tail),
+			       MM_BUCKET_CHUNK_SLOTS);
+
+	return count;
+}
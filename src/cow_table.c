@@ -0,0 +1,86 @@
+#include <linux/err.h>
+#include <linux/slab.h>
+
+#include "cow_table.h"
+
+static void cow_table_free_rcu(struct rcu_head *head)
+{
+	kvfree(container_of(head, struct cow_table, rcu));
+}
+
+void cow_ptr__init(struct cow_ptr *ptr, int node)
+{
+	RCU_INIT_POINTER(ptr->tbl, NULL);
+	spin_lock_init(&ptr->lock);
+	ptr->node = node;
+}
+
+void cow_ptr__clear(struct cow_ptr *ptr)
+{
+	cow_ptr_replace(ptr, NULL);
+}
+
+size_t cow_ptr__size(const struct cow_ptr *ptr)
+{
+	struct cow_table *tbl;
+	size_t nr;
+
+	rcu_read_lock();
+	tbl = rcu_dereference(ptr->tbl);
+	nr = tbl ? tbl->nr : 0;
+	rcu_read_unlock();
+
+	return nr;
+}
+
+/*
+ * Takes ptr->lock with a new table for nr + delta entries, NULL if that
+ * is 0, where nr is the size of the current table. The table is allocated
+ * before taking the lock, for the size the structure had then; writers
+ * retry in the unlikely case another one changed it meanwhile.
+ */
+struct cow_table *cow_ptr_lock(struct cow_ptr *ptr, size_t *nr, long delta,
+			       cow_table_alloc_fn alloc, gfp_t gfp,
+			       unsigned long *flags)
+{
+	struct cow_table *tbl, *new;
+	long want;
+
+	for (;;) {
+		*nr = cow_ptr__size(ptr);
+		want = (long)*nr + delta;
+		new = NULL;
+		if (want > 0) {
+			new = alloc(ptr->node, want, gfp);
+			if (!new)
+				return ERR_PTR(-ENOMEM);
+		}
+
+		spin_lock_irqsave(&ptr->lock, *flags);
+		tbl = cow_ptr_locked(ptr);
+		if ((tbl ? tbl->nr : 0) == *nr)
+			return new;
+
+		spin_unlock_irqrestore(&ptr->lock, *flags);
+		kvfree(new);
+	}
+}
+
+/* ptr->lock must be held, tbl may be NULL for an empty structure */
+void cow_ptr_publish(struct cow_ptr *ptr, struct cow_table *tbl)
+{
+	struct cow_table *old = cow_ptr_locked(ptr);
+
+	rcu_assign_pointer(ptr->tbl, tbl);
+	if (old)
+		call_rcu(&old->rcu, cow_table_free_rcu);
+}
+
+void cow_ptr_replace(struct cow_ptr *ptr, struct cow_table *tbl)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ptr->lock, flags);
+	cow_ptr_publish(ptr, tbl);
+	spin_unlock_irqrestore(&ptr->lock, flags);
+}
@@ -1,20 +1,139 @@
-#include "hashmap.h"
+#include "hashmap_impl.h"
 
 /* start with 4 buckets */
 #define HASHMAP_MIN_CAP_BITS 2
 
+/* old buckets migrated by every insert while resizing */
+#define HASHMAP_REHASH_STEP 8
+/* empty old buckets skipped for the cost of a migrated one */
+#define HASHMAP_REHASH_EMPTY 8
+
+/* keys whose buckets are prefetched together by the batch operations */
+#define HASHMAP_BATCH 16
+
+/* bucket arrays of millions of entries are past what kmalloc hands out */
+void *hashmap_alloc_node(int node, size_t size, gfp_t gfp)
+{
+	void *p = kvmalloc_node(size, gfp, node);
+
+	if (p)
+		atomic64_add(size, &mm_node_stats[mm_ptr_node(p)].hashmap_bytes);
+	return p;
+}
+
+void *hashmap_alloc(const struct hashmap *map, size_t size, gfp_t gfp)
+{
+	return hashmap_alloc_node(map->node, size, gfp);
+}
+
+/*
+ * Entries are 24 bytes, which kmalloc rounds up to 32: a cache of their
+ * own packs 170 of them per page instead of 128
+ */
+struct kmem_cache *hashmap_entry_cache;
+u64 hashmap_bytes_seed;
+bool hashmap_rehash_oneshot;
+
+u64 hashmap_cache_init(void)
+{
+	hashmap_bytes_seed = get_random_u64();
+
+	hashmap_entry_cache = KMEM_CACHE(hashmap_entry, 0);
+	if (!hashmap_entry_cache)
+		return XKLIB_ENOMEM;
+
+	return XKLIB_SUCCESS;
+}
+
+/* every entry must have been freed, RCU callbacks included */
+void hashmap_cache_destroy(void)
+{
+	kmem_cache_destroy(hashmap_entry_cache);
+	hashmap_entry_cache = NULL;
+}
+
+struct hashmap_entry *hashmap_alloc_entry(int node, enum mm_alloc_ctx ctx)
+{
+	struct hashmap_entry *entry;
+
+	if (ctx != MM_CTX_ATOMIC)
+		entry = kmem_cache_alloc_node(hashmap_entry_cache, GFP_KERNEL,
+					      node);
+	else
+		entry = mm_reserve_get(&mm_reserve_entries);
+
+	if (entry)
+		atomic64_add(sizeof(*entry),
+			     &mm_node_stats[mm_ptr_node(entry)].hashmap_bytes);
+	return entry;
+}
+
+void hashmap_free_entry(struct hashmap_entry *entry)
+{
+	atomic64_sub(sizeof(*entry),
+		     &mm_node_stats[mm_ptr_node(entry)].hashmap_bytes);
+	kmem_cache_free(hashmap_entry_cache, entry);
+}
+
+void hashmap_free(const void *p, size_t size)
+{
+	if (!p)
+		return;
+
+	atomic64_sub(size, &mm_node_stats[mm_ptr_node(p)].hashmap_bytes);
+	kvfree(p);
+}
+
+void hashmap_free_deferred(void *p, size_t size)
+{
+	if (!p)
+		return;
+
+	atomic64_sub(size, &mm_node_stats[mm_ptr_node(p)].hashmap_bytes);
+	mm_free_deferred(p);
+}
+
+/*
+ * Entries carry no rcu_head of their own, they are queued with the bucket
+ * arrays. kfree() releases kmem_cache objects as well.
+ */
+void hashmap_free_entry_rcu(struct hashmap_entry *entry)
+{
+	atomic64_sub(sizeof(*entry),
+		     &mm_node_stats[mm_ptr_node(entry)].hashmap_bytes);
+	mm_free_deferred(entry);
+}
+
+size_t hashmap_bytes_hash(long key, void *ctx)
+{
+	const struct hashmap_bytes *k = (const struct hashmap_bytes *)key;
+
+	return bytes_hash(k->data, k->len, hashmap_bytes_seed);
+}
+
+bool hashmap_bytes_equal(long key1, long key2, void *ctx)
+{
+	const struct hashmap_bytes *k1 = (const struct hashmap_bytes *)key1;
+	const struct hashmap_bytes *k2 = (const struct hashmap_bytes *)key2;
+
+	return k1->len == k2->len && !memcmp(k1->data, k2->data, k1->len);
+}
+
 static void hashmap_add_entry(struct hashmap_entry **pprev,
 			      struct hashmap_entry *entry)
 {
-	entry->next = *pprev;
-	*pprev = entry;
+	WRITE_ONCE(entry->next, *pprev);
+	rcu_assign_pointer(*pprev, entry);
 }
 
+/*
+ * entry->next is left intact so that readers currently standing on the
+ * entry can still reach the rest of the chain
+ */
 static void hashmap_del_entry(struct hashmap_entry **pprev,
 			      struct hashmap_entry *entry)
 {
-	*pprev = entry->next;
-	entry->next = NULL;
+	WRITE_ONCE(*pprev, entry->next);
 }
 
 void hashmap__init(struct hashmap *map, hashmap_hash_fn hash_fn,
@@ -28,16 +147,43 @@ void hashmap__init(struct hashmap *map, hashmap_hash_fn hash_fn,
 	map->cap = 0;
 	map->cap_bits = 0;
 	map->sz = 0;
+	map->node = NUMA_NO_NODE;
+
+	map->old_buckets = NULL;
+	map->old_cap = 0;
+	map->old_cap_bits = 0;
+	map->rehash_idx = 0;
+	seqcount_init(&map->seq);
+
+	map->intrusive = false;
+	map->may_shrink = false;
+	map->layout = HASHMAP_CHAINED;
+	map->slots = NULL;
+	map->ctrl = NULL;
+	map->tombs = 0;
+	map->index = NULL;
+	map->stats = NULL;
 }
 
 struct hashmap *hashmap__new(hashmap_hash_fn hash_fn, hashmap_equal_fn equal_fn,
 			     void *ctx)
 {
-	struct hashmap *map = kmalloc(sizeof(*map), GFP_KERNEL);
+	return hashmap__new_node(hash_fn, equal_fn, ctx, NUMA_NO_NODE);
+}
+
+/*
+ * Creates a hashmap whose metadata, buckets and entries all live on node,
+ * which should be the node of the cpus doing most of the lookups.
+ */
+struct hashmap *hashmap__new_node(hashmap_hash_fn hash_fn,
+				  hashmap_equal_fn equal_fn, void *ctx, int node)
+{
+	struct hashmap *map = kmalloc_node(sizeof(*map), GFP_KERNEL, node);
 
 	if (!map)
 		return 0;
 	hashmap__init(map, hash_fn, equal_fn, ctx);
+	map->node = node;
 	return map;
 }
 
@@ -46,12 +192,28 @@ void hashmap__clear(struct hashmap *map)
 	struct hashmap_entry *cur, *tmp;
 	size_t bkt;
 
-	hashmap__for_each_entry_safe(map, cur, tmp, bkt) {
-		kfree(cur);
+	if (map->layout == HASHMAP_OPEN) {
+		hashmap_open_clear(map);
+		return;
+	}
+	if (map->layout == HASHMAP_DENSE) {
+		hashmap_dense_clear(map);
+		return;
+	}
+
+	if (!map->intrusive) {
+		hashmap__for_each_entry_safe(map, cur, tmp, bkt) {
+			hashmap_free_entry(cur);
+		}
 	}
-	kfree(map->buckets);
+	hashmap_free(map->old_buckets,
+		     map->old_cap * sizeof(map->old_buckets[0]));
+	map->old_buckets = NULL;
+	map->old_cap = map->old_cap_bits = map->rehash_idx = 0;
+	hashmap_free(map->buckets, map->cap * sizeof(map->buckets[0]));
 	map->buckets = NULL;
 	map->cap = map->cap_bits = map->sz = 0;
+	map->may_shrink = false;
 }
 
 void hashmap__free(struct hashmap *map)
@@ -59,6 +221,7 @@ void hashmap__free(struct hashmap *map)
 	if (IS_ERR_OR_NULL(map))
 		return;
 
+	hashmap__disable_stats(map);
 	hashmap__clear(map);
 	kfree(map);
 }
@@ -73,51 +236,230 @@ size_t hashmap__capacity(const struct hashmap *map)
 	return map->cap;
 }
 
+size_t hashmap__set_layout(struct hashmap *map, enum hashmap_layout layout)
+{
+	/* open addressing slots are handed out as entry cursors */
+	BUILD_BUG_ON(offsetof(struct hashmap_entry, key) !=
+		     offsetof(struct hashmap_slot, key));
+	BUILD_BUG_ON(offsetof(struct hashmap_entry, value) !=
+		     offsetof(struct hashmap_slot, value));
+
+	if (map->cap)
+		return XKLIB_EEXIST;
+	if (map->intrusive && layout != HASHMAP_CHAINED)
+		return XKLIB_EINVAL;
+
+	map->layout = layout;
+	return 0;
+}
+
+size_t hashmap__set_intrusive(struct hashmap *map)
+{
+	if (map->cap)
+		return XKLIB_EEXIST;
+	if (map->layout != HASHMAP_CHAINED)
+		return XKLIB_EINVAL;
+
+	map->intrusive = true;
+	return 0;
+}
+
 static bool hashmap_needs_to_grow(struct hashmap *map)
 {
 	/* grow if empty or more than 75% filled */
 	return (map->cap == 0) || ((map->sz + 1) * 4 / 3 > map->cap);
 }
 
-static size_t hashmap_grow(struct hashmap *map)
+/*
+ * Moves up to nr buckets of the array being retired into the current one,
+ * releasing it once it is empty. Empty buckets only count for a fraction
+ * of one, so that the sparse array of a shrinking map is retired quickly.
+ * Never allocates, so atomic inserts can make progress too.
+ * Entries leave an old chain tail first, and each one is linked in its new
+ * chain before it is unlinked from the old one. A reader walking the old
+ * chain either still finds it there or finds it in the current array,
+ * which hashmap_find_rcu() searches next. A reader standing on the moved
+ * entry is carried into its new chain, but had nothing left to see in the
+ * old one.
+ */
+static void hashmap_rehash_step(struct hashmap *map, size_t nr)
+{
+	size_t budget = nr * HASHMAP_REHASH_EMPTY;
+	struct hashmap_entry **old_buckets, **pprev, *cur;
+	size_t h;
+
+	while (map->old_buckets && budget) {
+		old_buckets = map->old_buckets;
+		budget -= min_t(size_t, budget,
+				old_buckets[map->rehash_idx] ?
+					HASHMAP_REHASH_EMPTY : 1);
+
+		while (old_buckets[map->rehash_idx]) {
+			pprev = &old_buckets[map->rehash_idx];
+			while ((*pprev)->next)
+				pprev = &(*pprev)->next;
+
+			cur = *pprev;
+			h = hash_bits(map->hash_fn(cur->key, map->ctx),
+				      map->cap_bits);
+			hashmap_add_entry(&map->buckets[h], cur);
+			smp_store_release(pprev, NULL);
+		}
+
+		if (++map->rehash_idx < map->old_cap)
+			continue;
+
+		WRITE_ONCE(map->old_buckets, NULL);
+		hashmap_free_deferred(old_buckets,
+				      map->old_cap * sizeof(old_buckets[0]));
+		map->old_cap = 0;
+		map->rehash_idx = 0;
+	}
+}
+
+static inline size_t hashmap_rehash_nr(const struct hashmap *map)
+{
+	return unlikely(hashmap_rehash_oneshot) ? map->old_cap :
+						  HASHMAP_REHASH_STEP;
+}
+
+/*
+ * Array switches are a handful of stores. Irqs stay off across them: a
+ * writer preempted or interrupted in the middle would leave the
+ * hashmap__find_rcu() callers of its cpu spinning on an odd sequence.
+ */
+static unsigned long hashmap_write_begin(struct hashmap *map)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	write_seqcount_begin(&map->seq);
+	return flags;
+}
+
+static void hashmap_write_end(struct hashmap *map, unsigned long flags)
+{
+	write_seqcount_end(&map->seq);
+	local_irq_restore(flags);
+}
+
+/*
+ * Installs a bucket array of 2^new_cap_bits buckets. Existing entries
+ * stay in the previous array, which is migrated a few buckets at a time
+ * by the following inserts, so no single operation pays for moving the
+ * whole map.
+ */
+static size_t hashmap_resize(struct hashmap *map, size_t new_cap_bits,
+			     gfp_t gfp)
 {
 	struct hashmap_entry **new_buckets;
-	struct hashmap_entry *cur, *tmp;
-	size_t new_cap_bits, new_cap;
-	size_t h, bkt;
+	unsigned long flags;
+	size_t new_cap, old_cap = map->cap;
+	u64 start = hashmap_stats_start(map);
 
-	new_cap_bits = map->cap_bits + 1;
-	if (new_cap_bits < HASHMAP_MIN_CAP_BITS)
-		new_cap_bits = HASHMAP_MIN_CAP_BITS;
+	/* only one array can be retired at a time */
+	hashmap_rehash_step(map, map->old_cap);
 
 	new_cap = 1UL << new_cap_bits;
-	new_buckets = kcalloc(new_cap, sizeof(new_buckets[0]), GFP_KERNEL);
+	new_buckets = hashmap_alloc(map, new_cap * sizeof(new_buckets[0]),
+				    gfp | __GFP_ZERO);
 	if (!new_buckets)
 		return XKLIB_ENOMEM;
 
-	hashmap__for_each_entry_safe(map, cur, tmp, bkt) {
-		h = hash_bits(map->hash_fn(cur->key, map->ctx), new_cap_bits);
-		hashmap_add_entry(&new_buckets[h], cur);
+	/*
+	 * Capacity moves both ways, RCU readers rely on the sequence count to
+	 * never pair an array with the bits of another one
+	 */
+	flags = hashmap_write_begin(map);
+	if (map->buckets) {
+		map->old_cap = map->cap;
+		map->rehash_idx = 0;
+		rcu_assign_pointer(map->old_buckets, map->buckets);
+		WRITE_ONCE(map->old_cap_bits, map->cap_bits);
 	}
-
+	rcu_assign_pointer(map->buckets, new_buckets);
+	WRITE_ONCE(map->cap_bits, new_cap_bits);
+	hashmap_write_end(map, flags);
 	map->cap = new_cap;
-	map->cap_bits = new_cap_bits;
-	kfree(map->buckets);
-	map->buckets = new_buckets;
+	map->may_shrink = false;
 
+	hashmap_stats_end(map, old_cap, start);
 	return 0;
 }
 
-static bool hashmap_find_entry(const struct hashmap *map, const long key,
-			       size_t hash, struct hashmap_entry ***pprev,
-			       struct hashmap_entry **entry)
+/* smallest bucket array holding n entries without growing */
+static size_t hashmap_fit_bits(size_t n)
 {
-	struct hashmap_entry *cur, **prev_ptr;
+	size_t bits = HASHMAP_MIN_CAP_BITS;
 
-	if (!map->buckets)
-		return false;
+	while ((1UL << bits) < n * 4 / 3)
+		bits++;
+	return bits;
+}
+
+static size_t hashmap_grow(struct hashmap *map)
+{
+	return hashmap_resize(map,
+			      max_t(size_t, map->cap_bits + 1,
+				    HASHMAP_MIN_CAP_BITS),
+			      GFP_KERNEL);
+}
+
+/*
+ * Shrinks the map once deletes left it less than 1/8 full, down to a load
+ * of at most 3/8 so that it takes many inserts to grow it back. Called on
+ * insert, a reserved map keeps its capacity until something is deleted.
+ * Opportunistic: it never sleeps and gives up if memory is short or a
+ * migration is in flight.
+ */
+static void hashmap_maybe_shrink(struct hashmap *map)
+{
+	if (!map->may_shrink || map->old_buckets ||
+	    map->cap <= (1UL << HASHMAP_MIN_CAP_BITS) ||
+	    map->sz * 8 >= map->cap || in_nmi())
+		return;
+
+	hashmap_resize(map, hashmap_fit_bits(map->sz * 2),
+		       GFP_NOWAIT | __GFP_NOWARN);
+}
+
+/*
+ * Frees both bucket arrays of an empty map. There is no entry left to
+ * move, so a delete under hashmap__for_each_entry_safe() may do it.
+ */
+static void hashmap_free_buckets(struct hashmap *map)
+{
+	struct hashmap_entry **buckets = map->buckets;
+	unsigned long flags;
+
+	/* nothing to migrate, RCU readers may still be on the arrays */
+	hashmap_rehash_step(map, map->old_cap);
+	flags = hashmap_write_begin(map);
+	WRITE_ONCE(map->buckets, NULL);
+	WRITE_ONCE(map->cap_bits, 0);
+	hashmap_write_end(map, flags);
+	hashmap_free_deferred(buckets, map->cap * sizeof(buckets[0]));
+	map->cap = 0;
+	map->may_shrink = false;
+}
+
+/* bookkeeping of a chained delete, shrinking is left to the next insert */
+static void hashmap_deleted(struct hashmap *map)
+{
+	map->sz--;
+	map->may_shrink = true;
+	if (!map->sz && map->cap > (1UL << HASHMAP_MIN_CAP_BITS))
+		hashmap_free_buckets(map);
+}
+
+static bool hashmap_find_in_chain(const struct hashmap *map,
+				  struct hashmap_entry **head, const long key,
+				  struct hashmap_entry ***pprev,
+				  struct hashmap_entry **entry)
+{
+	struct hashmap_entry *cur, **prev_ptr;
 
-	for (prev_ptr = &map->buckets[hash], cur = *prev_ptr; cur;
+	for (prev_ptr = head, cur = *prev_ptr; cur;
 	     prev_ptr = &cur->next, cur = cur->next) {
 		if (map->equal_fn(cur->key, key, map->ctx)) {
 			if (pprev)
@@ -130,12 +472,42 @@ static bool hashmap_find_entry(const struct hashmap *map, const long key,
 	return false;
 }
 
+/* looks key up in the current array, then in the one being migrated */
+static bool hashmap_find_entry(const struct hashmap *map, const long key,
+			       size_t hash, struct hashmap_entry ***pprev,
+			       struct hashmap_entry **entry)
+{
+	if (!map->buckets)
+		return false;
+
+	if (hashmap_find_in_chain(map,
+				  &map->buckets[hash_bits(hash, map->cap_bits)],
+				  key, pprev, entry))
+		return true;
+
+	return map->old_buckets &&
+	       hashmap_find_in_chain(
+		       map,
+		       &map->old_buckets[hash_bits(hash, map->old_cap_bits)],
+		       key, pprev, entry);
+}
+
 size_t hashmap_insert(struct hashmap *map, long key, long value,
 		      enum hashmap_insert_strategy strategy, long *old_key,
 		      long *old_value)
+{
+	return hashmap_insert_ctx(map, key, value, strategy, old_key,
+				  old_value, MM_CTX_PROCESS);
+}
+
+/* hashmap_insert_ctx() of a chained map, h being the hash of key */
+static size_t hashmap_insert_hashed(struct hashmap *map, long key, size_t h,
+				    long value,
+				    enum hashmap_insert_strategy strategy,
+				    long *old_key, long *old_value,
+				    enum mm_alloc_ctx ctx)
 {
 	struct hashmap_entry *entry;
-	size_t h;
 	size_t err;
 
 	if (old_key)
@@ -143,7 +515,10 @@ size_t hashmap_insert(struct hashmap *map, long key, long value,
 	if (old_value)
 		*old_value = 0;
 
-	h = hash_bits(map->hash_fn(key, map->ctx), map->cap_bits);
+	hashmap_rehash_step(map, hashmap_rehash_nr(map));
+	if (ctx == MM_CTX_PROCESS)
+		hashmap_maybe_shrink(map);
+
 	if (strategy != HASHMAP_APPEND &&
 	    hashmap_find_entry(map, key, h, NULL, &entry)) {
 		if (old_key)
@@ -152,8 +527,8 @@ size_t hashmap_insert(struct hashmap *map, long key, long value,
 			*old_value = entry->value;
 
 		if (strategy == HASHMAP_SET || strategy == HASHMAP_UPDATE) {
-			entry->key = key;
-			entry->value = value;
+			WRITE_ONCE(entry->key, key);
+			WRITE_ONCE(entry->value, value);
 			return 0;
 		} else if (strategy == HASHMAP_ADD) {
 			return XKLIB_EEXIST;
@@ -163,31 +538,168 @@ size_t hashmap_insert(struct hashmap *map, long key, long value,
 	if (strategy == HASHMAP_UPDATE)
 		return XKLIB_ENOENT;
 
-	if (hashmap_needs_to_grow(map)) {
+	if (ctx == MM_CTX_ATOMIC) {
+		if (unlikely(!map->buckets))
+			return XKLIB_ENOMEM;
+	} else if (hashmap_needs_to_grow(map)) {
 		err = hashmap_grow(map);
 		if (err)
 			return err;
-		h = hash_bits(map->hash_fn(key, map->ctx), map->cap_bits);
 	}
 
-	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	entry = hashmap_alloc_entry(map->node, ctx);
 	if (!entry)
 		return XKLIB_ENOMEM;
 
 	entry->key = key;
 	entry->value = value;
-	hashmap_add_entry(&map->buckets[h], entry);
+	hashmap_add_entry(&map->buckets[hash_bits(h, map->cap_bits)], entry);
 	map->sz++;
 
 	return 0;
 }
 
+size_t hashmap_insert_ctx(struct hashmap *map, long key, long value,
+			  enum hashmap_insert_strategy strategy, long *old_key,
+			  long *old_value, enum mm_alloc_ctx ctx)
+{
+	if (map->layout == HASHMAP_OPEN)
+		return hashmap_open_insert(map, key, value, strategy, old_key,
+					   old_value, ctx);
+	if (map->layout == HASHMAP_DENSE)
+		return hashmap_dense_insert(map, key, value, strategy, old_key,
+					    old_value, ctx);
+
+	/* the map would have no way to free the entry */
+	if (WARN_ON_ONCE(map->intrusive))
+		return XKLIB_EINVAL;
+
+	return hashmap_insert_hashed(map, key, map->hash_fn(key, map->ctx),
+				     value, strategy, old_key, old_value, ctx);
+}
+
+/*
+ * First pass of a batch: hash every key and prefetch its bucket heads.
+ * Keys are hashed even when the map has no buckets yet, the inserts of
+ * the batch may allocate them.
+ */
+static void hashmap_batch_hash(const struct hashmap *map, const long *keys,
+			       size_t *hashes, size_t nr)
+{
+	for (size_t i = 0; i < nr; i++) {
+		hashes[i] = map->hash_fn(keys[i], map->ctx);
+		if (!map->buckets)
+			continue;
+
+		prefetch(&map->buckets[hash_bits(hashes[i], map->cap_bits)]);
+		if (map->old_buckets)
+			prefetch(&map->old_buckets[hash_bits(
+				hashes[i], map->old_cap_bits)]);
+	}
+}
+
+/*
+ * Resolves n keys HASHMAP_BATCH at a time: all their buckets are
+ * prefetched, then the first entry of every chain, and only then are the
+ * chains walked, so the cache misses of a batch overlap instead of adding
+ * up. found and values, either of which may be NULL, receive the result
+ * for every key. Returns the number of keys found.
+ */
+size_t hashmap_find_batch(const struct hashmap *map, const long *keys,
+			  long *values, bool *found, size_t n)
+{
+	size_t hashes[HASHMAP_BATCH], nr, hits = 0;
+	struct hashmap_entry *entry;
+	bool hit;
+
+	for (size_t base = 0; base < n; base += nr) {
+		nr = min_t(size_t, n - base, HASHMAP_BATCH);
+
+		if (map->layout == HASHMAP_CHAINED) {
+			hashmap_batch_hash(map, &keys[base], hashes, nr);
+			for (size_t i = 0; map->buckets && i < nr; i++)
+				prefetch(map->buckets[hash_bits(
+					hashes[i], map->cap_bits)]);
+		}
+
+		for (size_t i = base; i < base + nr; i++) {
+			if (map->layout != HASHMAP_CHAINED) {
+				hit = hashmap_find(map, keys[i],
+						   values ? &values[i] : NULL);
+			} else {
+				hit = hashmap_find_entry(map, keys[i],
+							 hashes[i - base],
+							 NULL, &entry);
+				if (hit && values)
+					values[i] = entry->value;
+			}
+
+			if (found)
+				found[i] = hit;
+			hits += hit;
+		}
+	}
+
+	return hits;
+}
+
+/*
+ * Inserts n key/value pairs with one strategy, growing the map once for
+ * the whole batch and prefetching the buckets of HASHMAP_BATCH keys
+ * before inserting them. errs, if not NULL, receives the status of every
+ * insert. Returns the number of pairs that were inserted or updated.
+ */
+size_t hashmap_insert_batch(struct hashmap *map, const long *keys,
+			    const long *values, size_t n,
+			    enum hashmap_insert_strategy strategy, size_t *errs)
+{
+	size_t hashes[HASHMAP_BATCH], nr, err, done = 0;
+
+	if (WARN_ON_ONCE(map->intrusive))
+		return 0;
+
+	/* on failure the inserts themselves retry and report it */
+	if (strategy != HASHMAP_UPDATE)
+		hashmap__reserve(map, map->sz + n);
+
+	for (size_t base = 0; base < n; base += nr) {
+		nr = min_t(size_t, n - base, HASHMAP_BATCH);
+
+		if (map->layout == HASHMAP_CHAINED)
+			hashmap_batch_hash(map, &keys[base], hashes, nr);
+
+		for (size_t i = base; i < base + nr; i++) {
+			if (map->layout != HASHMAP_CHAINED)
+				err = hashmap_insert(map, keys[i], values[i],
+						     strategy, NULL, NULL);
+			else
+				err = hashmap_insert_hashed(
+					map, keys[i], hashes[i - base],
+					values[i], strategy, NULL, NULL,
+					MM_CTX_PROCESS);
+
+			if (errs)
+				errs[i] = err;
+			done += !err;
+		}
+	}
+
+	return done;
+}
+
 bool hashmap_find(const struct hashmap *map, long key, long *value)
 {
 	struct hashmap_entry *entry;
 	size_t h;
 
-	h = hash_bits(map->hash_fn(key, map->ctx), map->cap_bits);
+	hashmap_stats_lookup(map, key);
+
+	if (map->layout == HASHMAP_OPEN)
+		return hashmap_open_find(map, key, value);
+	if (map->layout == HASHMAP_DENSE)
+		return hashmap_dense_find(map, key, value);
+
+	h = map->hash_fn(key, map->ctx);
 	if (!hashmap_find_entry(map, key, h, NULL, &entry))
 		return false;
 
@@ -196,13 +708,77 @@ bool hashmap_find(const struct hashmap *map, long key, long *value)
 	return true;
 }
 
+static bool hashmap_find_chain_rcu(const struct hashmap *map,
+				   struct hashmap_entry *cur, long key,
+				   long *value)
+{
+	for (; cur; cur = rcu_dereference(cur->next)) {
+		if (map->equal_fn(cur->key, key, map->ctx)) {
+			if (value)
+				*value = READ_ONCE(cur->value);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool hashmap_find_rcu(const struct hashmap *map, long key, long *value)
+{
+	struct hashmap_entry **buckets, **old_buckets, *head;
+	size_t cap_bits, old_cap_bits, h;
+	unsigned int seq;
+
+	/* the other layouts move pairs around in place */
+	if (WARN_ON_ONCE(map->layout != HASHMAP_CHAINED))
+		return false;
+
+	h = map->hash_fn(key, map->ctx);
+	do {
+		do {
+			seq = read_seqcount_begin(&map->seq);
+			buckets = rcu_dereference(map->buckets);
+			cap_bits = READ_ONCE(map->cap_bits);
+			old_buckets = rcu_dereference(map->old_buckets);
+			old_cap_bits = READ_ONCE(map->old_cap_bits);
+		} while (read_seqcount_retry(&map->seq, seq));
+
+		if (!buckets)
+			return false;
+
+		/* entries only move from the old array to the current one */
+		if (old_buckets) {
+			head = rcu_dereference(
+				old_buckets[hash_bits(h, old_cap_bits)]);
+			if (hashmap_find_chain_rcu(map, head, key, value))
+				return true;
+		}
+		head = rcu_dereference(buckets[hash_bits(h, cap_bits)]);
+		if (hashmap_find_chain_rcu(map, head, key, value))
+			return true;
+
+		/* entries may have moved on to an array installed since */
+	} while (read_seqcount_retry(&map->seq, seq));
+
+	return false;
+}
+
 bool hashmap_delete(struct hashmap *map, long key, long *old_key,
 		    long *old_value)
 {
 	struct hashmap_entry **pprev, *entry;
 	size_t h;
 
-	h = hash_bits(map->hash_fn(key, map->ctx), map->cap_bits);
+	if (map->layout == HASHMAP_OPEN)
+		return hashmap_open_delete(map, key, old_key, old_value);
+	if (map->layout == HASHMAP_DENSE)
+		return hashmap_dense_delete(map, key, old_key, old_value);
+
+	/*
+	 * No rehash step here: moving entries would hide them from, or show
+	 * them twice to, a hashmap__for_each_entry_safe() walk that deletes
+	 */
+	h = map->hash_fn(key, map->ctx);
 	if (!hashmap_find_entry(map, key, h, &pprev, &entry))
 		return false;
 
@@ -212,8 +788,202 @@ bool hashmap_delete(struct hashmap *map, long key, long *old_key,
 		*old_value = entry->value;
 
 	hashmap_del_entry(pprev, entry);
-	kfree(entry);
-	map->sz--;
+	if (!map->intrusive)
+		hashmap_free_entry_rcu(entry);
+	hashmap_deleted(map);
 
 	return true;
-}
\ No newline at end of file
+}
+
+size_t hashmap__reserve(struct hashmap *map, size_t n)
+{
+	size_t bits;
+
+	if (map->layout == HASHMAP_OPEN)
+		return hashmap_open_reserve(map, n);
+	if (map->layout == HASHMAP_DENSE)
+		return hashmap_dense_reserve(map, n);
+
+	bits = hashmap_fit_bits(n);
+	if (map->cap && bits <= map->cap_bits) {
+		/* big enough already, keep it that way until a delete */
+		map->may_shrink = false;
+		return 0;
+	}
+
+	return hashmap_resize(map, bits, GFP_KERNEL);
+}
+
+size_t hashmap__compact(struct hashmap *map)
+{
+	size_t bits, err;
+
+	if (map->layout == HASHMAP_OPEN)
+		return hashmap_open_compact(map);
+	if (map->layout == HASHMAP_DENSE)
+		return hashmap_dense_compact(map);
+
+	if (!map->sz) {
+		hashmap_free_buckets(map);
+		return 0;
+	}
+
+	bits = hashmap_fit_bits(map->sz);
+	if (bits < map->cap_bits) {
+		err = hashmap_resize(map, bits, GFP_KERNEL);
+		if (err)
+			return err;
+	}
+
+	hashmap_rehash_step(map, map->old_cap);
+	return 0;
+}
+
+size_t hashmap_insert_entry(struct hashmap *map, struct hashmap_entry *entry,
+			    enum hashmap_insert_strategy strategy,
+			    struct hashmap_entry **old_entry)
+{
+	struct hashmap_entry **pprev, *cur;
+	size_t h, err;
+
+	if (old_entry)
+		*old_entry = NULL;
+
+	if (WARN_ON_ONCE(!map->intrusive))
+		return XKLIB_EINVAL;
+
+	hashmap_rehash_step(map, hashmap_rehash_nr(map));
+	hashmap_maybe_shrink(map);
+
+	h = map->hash_fn(entry->key, map->ctx);
+	if (strategy != HASHMAP_APPEND &&
+	    hashmap_find_entry(map, entry->key, h, &pprev, &cur)) {
+		if (old_entry)
+			*old_entry = cur;
+		if (strategy == HASHMAP_ADD)
+			return XKLIB_EEXIST;
+
+		/* readers standing on cur still reach the rest of the chain */
+		WRITE_ONCE(entry->next, cur->next);
+		rcu_assign_pointer(*pprev, entry);
+		return 0;
+	}
+
+	if (strategy == HASHMAP_UPDATE)
+		return XKLIB_ENOENT;
+
+	if (hashmap_needs_to_grow(map)) {
+		err = hashmap_grow(map);
+		if (err)
+			return err;
+	}
+
+	hashmap_add_entry(&map->buckets[hash_bits(h, map->cap_bits)], entry);
+	map->sz++;
+
+	return 0;
+}
+
+static struct hashmap_entry **hashmap_chain_pprev(struct hashmap_entry **pprev,
+						  struct hashmap_entry *entry)
+{
+	for (; *pprev; pprev = &(*pprev)->next) {
+		if (*pprev == entry)
+			return pprev;
+	}
+	return NULL;
+}
+
+bool hashmap_delete_entry(struct hashmap *map, struct hashmap_entry *entry)
+{
+	struct hashmap_entry **pprev = NULL;
+	size_t h;
+
+	if (WARN_ON_ONCE(!map->intrusive) || !map->buckets)
+		return false;
+
+	h = map->hash_fn(entry->key, map->ctx);
+	pprev = hashmap_chain_pprev(
+		&map->buckets[hash_bits(h, map->cap_bits)], entry);
+	if (!pprev && map->old_buckets)
+		pprev = hashmap_chain_pprev(
+			&map->old_buckets[hash_bits(h, map->old_cap_bits)],
+			entry);
+	if (!pprev)
+		return false;
+
+	hashmap_del_entry(pprev, entry);
+	hashmap_deleted(map);
+
+	return true;
+}
+
+static struct hashmap_entry *hashmap_key_in_chain(const struct hashmap *map,
+						  struct hashmap_entry *cur,
+						  long key)
+{
+	for (; cur; cur = cur->next) {
+		if (map->equal_fn(cur->key, key, map->ctx))
+			break;
+	}
+	return cur;
+}
+
+static struct hashmap_entry *hashmap_key_old_chain(const struct hashmap *map,
+						   long key)
+{
+	if (!map->old_buckets)
+		return NULL;
+
+	return hashmap_key_in_chain(
+		map,
+		map->old_buckets[hash_bits(map->hash_fn(key, map->ctx),
+					   map->old_cap_bits)],
+		key);
+}
+
+struct hashmap_entry *hashmap__key_first(const struct hashmap *map, long key)
+{
+	struct hashmap_entry *cur;
+
+	if (map->layout == HASHMAP_OPEN)
+		return hashmap_open_key_next(map, map->cap, key);
+	if (map->layout == HASHMAP_DENSE)
+		return hashmap_dense_key_next(map, map->cap, key);
+
+	if (!map->buckets)
+		return NULL;
+
+	cur = hashmap_key_in_chain(
+		map,
+		map->buckets[hash_bits(map->hash_fn(key, map->ctx),
+				       map->cap_bits)],
+		key);
+	return cur ? cur : hashmap_key_old_chain(map, key);
+}
+
+struct hashmap_entry *hashmap__key_next(const struct hashmap *map,
+					struct hashmap_entry *cur, long key)
+{
+	struct hashmap_entry *next, *pos;
+
+	if (map->layout == HASHMAP_OPEN)
+		return hashmap_open_key_next(
+			map, (struct hashmap_slot *)cur - map->slots, key);
+	if (map->layout == HASHMAP_DENSE)
+		return hashmap_dense_key_next(
+			map, (struct hashmap_slot *)cur - map->slots, key);
+
+	next = hashmap_key_in_chain(map, cur->next, key);
+	if (next || !map->old_buckets)
+		return next;
+
+	/* end of a chain: carry on in the old array if cur was in the new one */
+	for (pos = map->buckets[hash_bits(map->hash_fn(key, map->ctx),
+					  map->cap_bits)];
+	     pos; pos = pos->next) {
+		if (pos == cur)
+			return hashmap_key_old_chain(map, key);
+	}
+	return NULL;
+}
@@ -0,0 +1,346 @@
+#include "hashmap_impl.h"
+
+/*
+ * Dense layout of struct hashmap.
+ *
+ * Key/value pairs are kept packed in slots[0, sz), in insertion order
+ * until the first delete, which moves the last pair into the hole. The
+ * buckets are an open addressing index of cap entries probed linearly,
+ * each holding the position of a pair plus 32 bits of its hash: probes
+ * only compare keys whose hash bits match, and the index is rebuilt on
+ * resize without hashing a single key. Deleting from the index shifts
+ * the following entries back instead of leaving tombstones.
+ *
+ * Slots and index share one allocation, slots first.
+ */
+
+/* a quarter of the index always stays free to keep probes short */
+#define HASHMAP_DENSE_MIN_CAP_BITS 3
+
+static inline size_t hashmap_dense_slots(size_t cap)
+{
+	return cap - cap / 4;
+}
+
+static inline size_t hashmap_dense_size(size_t cap)
+{
+	return hashmap_dense_slots(cap) * sizeof(struct hashmap_slot) +
+	       cap * sizeof(struct hashmap_index);
+}
+
+static inline u32 hashmap_dense_tag(const struct hashmap *map, long key)
+{
+	return (map->hash_fn(key, map->ctx) * 11400714819323198485llu) >> 32;
+}
+
+static inline size_t hashmap_dense_home(size_t cap_bits, u32 tag)
+{
+	return tag >> (32 - cap_bits);
+}
+
+/* index position of the first pair holding key, probing from pos */
+static bool hashmap_dense_probe(const struct hashmap *map, long key, u32 tag,
+				size_t *pos)
+{
+	size_t mask = map->cap - 1;
+	struct hashmap_index *ix;
+
+	for (; (ix = &map->index[*pos])->idx; *pos = (*pos + 1) & mask) {
+		if (ix->tag == tag &&
+		    map->equal_fn(map->slots[ix->idx - 1].key, key, map->ctx))
+			return true;
+	}
+
+	return false;
+}
+
+static bool hashmap_dense_find_pos(const struct hashmap *map, long key,
+				   size_t *pos)
+{
+	u32 tag;
+
+	if (!map->cap)
+		return false;
+
+	tag = hashmap_dense_tag(map, key);
+	*pos = hashmap_dense_home(map->cap_bits, tag);
+	return hashmap_dense_probe(map, key, tag, pos);
+}
+
+/* index position referring to slot i */
+static size_t hashmap_dense_slot_pos(const struct hashmap *map, size_t i)
+{
+	size_t mask = map->cap - 1, pos;
+
+	pos = hashmap_dense_home(map->cap_bits,
+				 hashmap_dense_tag(map, map->slots[i].key));
+	while (map->index[pos].idx != i + 1)
+		pos = (pos + 1) & mask;
+	return pos;
+}
+
+static void hashmap_dense_link(struct hashmap_index *index, size_t cap_bits,
+			       u32 idx, u32 tag)
+{
+	size_t mask = (1UL << cap_bits) - 1;
+	size_t pos = hashmap_dense_home(cap_bits, tag);
+
+	while (index[pos].idx)
+		pos = (pos + 1) & mask;
+	index[pos].idx = idx;
+	index[pos].tag = tag;
+}
+
+/*
+ * Empties index position pos, moving back every following entry of the
+ * probe run that may live there, so that no probe ever stops too early
+ */
+static void hashmap_dense_unlink(struct hashmap *map, size_t pos)
+{
+	size_t mask = map->cap - 1, hole = pos, home;
+
+	for (pos = (pos + 1) & mask; map->index[pos].idx;
+	     pos = (pos + 1) & mask) {
+		home = hashmap_dense_home(map->cap_bits, map->index[pos].tag);
+		if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+			map->index[hole] = map->index[pos];
+			hole = pos;
+		}
+	}
+	map->index[hole].idx = 0;
+}
+
+static size_t hashmap_dense_resize(struct hashmap *map, size_t new_cap_bits,
+				   gfp_t gfp)
+{
+	size_t new_cap = 1UL << new_cap_bits, old_cap = map->cap;
+	u64 start = hashmap_stats_start(map);
+	struct hashmap_index *new_index;
+	struct hashmap_slot *new_slots;
+
+	new_slots = hashmap_alloc(map, hashmap_dense_size(new_cap),
+				  gfp | __GFP_ZERO);
+	if (!new_slots)
+		return XKLIB_ENOMEM;
+
+	new_index = (struct hashmap_index *)(new_slots +
+					     hashmap_dense_slots(new_cap));
+	/* an empty map may have no slots at all yet */
+	if (map->sz)
+		memcpy(new_slots, map->slots, map->sz * sizeof(new_slots[0]));
+	for (size_t pos = 0; pos < map->cap; pos++) {
+		if (map->index[pos].idx)
+			hashmap_dense_link(new_index, new_cap_bits,
+					   map->index[pos].idx,
+					   map->index[pos].tag);
+	}
+
+	hashmap_free(map->slots, hashmap_dense_size(map->cap));
+	map->slots = new_slots;
+	map->index = new_index;
+	map->cap = new_cap;
+	map->cap_bits = new_cap_bits;
+	map->may_shrink = false;
+
+	hashmap_stats_end(map, old_cap, start);
+	return 0;
+}
+
+/* smallest index holding n pairs */
+static size_t hashmap_dense_fit_bits(size_t n)
+{
+	size_t bits = HASHMAP_DENSE_MIN_CAP_BITS;
+
+	while (hashmap_dense_slots(1UL << bits) < n)
+		bits++;
+	return bits;
+}
+
+/*
+ * Same hysteresis as the other layouts, best effort. Deletes never resize,
+ * so that they don't move the slots under a safe iteration.
+ */
+static void hashmap_dense_maybe_shrink(struct hashmap *map)
+{
+	if (map->may_shrink && map->cap > (1UL << HASHMAP_DENSE_MIN_CAP_BITS) &&
+	    map->sz * 8 < map->cap && !in_nmi())
+		hashmap_dense_resize(map, hashmap_dense_fit_bits(map->sz * 2),
+				     GFP_NOWAIT | __GFP_NOWARN);
+}
+
+size_t hashmap_dense_insert(struct hashmap *map, long key, long value,
+			    enum hashmap_insert_strategy strategy,
+			    long *old_key, long *old_value,
+			    enum mm_alloc_ctx ctx)
+{
+	struct hashmap_slot *slot;
+	size_t pos, err;
+
+	if (old_key)
+		*old_key = 0;
+	if (old_value)
+		*old_value = 0;
+
+	if (ctx == MM_CTX_PROCESS)
+		hashmap_dense_maybe_shrink(map);
+
+	if (strategy != HASHMAP_APPEND &&
+	    hashmap_dense_find_pos(map, key, &pos)) {
+		slot = &map->slots[map->index[pos].idx - 1];
+		if (old_key)
+			*old_key = slot->key;
+		if (old_value)
+			*old_value = slot->value;
+
+		if (strategy == HASHMAP_ADD)
+			return XKLIB_EEXIST;
+
+		slot->key = key;
+		slot->value = value;
+		return 0;
+	}
+
+	if (strategy == HASHMAP_UPDATE)
+		return XKLIB_ENOENT;
+
+	if (map->sz == hashmap_dense_slots(map->cap)) {
+		if (ctx == MM_CTX_ATOMIC)
+			return XKLIB_ENOMEM;
+
+		err = hashmap_dense_resize(
+			map,
+			max_t(size_t, map->cap_bits + 1,
+			      HASHMAP_DENSE_MIN_CAP_BITS),
+			GFP_KERNEL);
+		if (err)
+			return err;
+	}
+
+	map->slots[map->sz].key = key;
+	map->slots[map->sz].value = value;
+	map->sz++;
+	hashmap_dense_link(map->index, map->cap_bits, map->sz,
+			   hashmap_dense_tag(map, key));
+
+	return 0;
+}
+
+bool hashmap_dense_find(const struct hashmap *map, long key, long *value)
+{
+	size_t pos;
+
+	if (!hashmap_dense_find_pos(map, key, &pos))
+		return false;
+
+	if (value)
+		*value = map->slots[map->index[pos].idx - 1].value;
+	return true;
+}
+
+bool hashmap_dense_delete(struct hashmap *map, long key, long *old_key,
+			  long *old_value)
+{
+	size_t pos, i, last;
+
+	if (!hashmap_dense_find_pos(map, key, &pos))
+		return false;
+
+	i = map->index[pos].idx - 1;
+	if (old_key)
+		*old_key = map->slots[i].key;
+	if (old_value)
+		*old_value = map->slots[i].value;
+
+	hashmap_dense_unlink(map, pos);
+
+	/* keep the slots packed, the last pair takes the freed slot */
+	last = map->sz - 1;
+	if (i != last) {
+		map->index[hashmap_dense_slot_pos(map, last)].idx = i + 1;
+		map->slots[i] = map->slots[last];
+	}
+	map->sz--;
+
+	/* shrinking is left to the next insert, nothing moves on delete */
+	map->may_shrink = true;
+	if (!map->sz && map->cap > (1UL << HASHMAP_DENSE_MIN_CAP_BITS))
+		hashmap_dense_clear(map);
+
+	return true;
+}
+
+void hashmap_dense_clear(struct hashmap *map)
+{
+	hashmap_free(map->slots, hashmap_dense_size(map->cap));
+	map->slots = NULL;
+	map->index = NULL;
+	map->cap = map->cap_bits = map->sz = 0;
+	map->may_shrink = false;
+}
+
+size_t hashmap_dense_reserve(struct hashmap *map, size_t n)
+{
+	size_t bits = hashmap_dense_fit_bits(n);
+
+	if (map->cap && bits <= map->cap_bits) {
+		map->may_shrink = false;
+		return 0;
+	}
+
+	return hashmap_dense_resize(map, bits, GFP_KERNEL);
+}
+
+size_t hashmap_dense_compact(struct hashmap *map)
+{
+	size_t bits;
+
+	if (!map->sz) {
+		hashmap_dense_clear(map);
+		return 0;
+	}
+
+	bits = hashmap_dense_fit_bits(map->sz);
+	if (bits >= map->cap_bits)
+		return 0;
+
+	return hashmap_dense_resize(map, bits, GFP_KERNEL);
+}
+
+/*
+ * Next pair holding key after slot from, or the first one if from is
+ * map->cap, in probe order
+ */
+struct hashmap_entry *hashmap_dense_key_next(const struct hashmap *map,
+					     size_t from, long key)
+{
+	size_t mask = map->cap - 1, pos;
+	u32 tag;
+
+	if (!map->cap)
+		return NULL;
+
+	tag = hashmap_dense_tag(map, key);
+	if (from == map->cap)
+		pos = hashmap_dense_home(map->cap_bits, tag);
+	else
+		pos = (hashmap_dense_slot_pos(map, from) + 1) & mask;
+
+	if (!hashmap_dense_probe(map, key, tag, &pos))
+		return NULL;
+
+	return (struct hashmap_entry *)&map->slots[map->index[pos].idx - 1];
+}
+
+/* index buckets visited by a lookup of key, the ending empty one included */
+size_t hashmap_dense_probe_len(const struct hashmap *map, long key)
+{
+	size_t pos, start;
+
+	if (!map->cap)
+		return 0;
+
+	pos = start = hashmap_dense_home(map->cap_bits,
+					 hashmap_dense_tag(map, key));
+	hashmap_dense_probe(map, key, hashmap_dense_tag(map, key), &pos);
+	return ((pos - start) & (map->cap - 1)) + 1;
+}
@@ -0,0 +1,390 @@
+#include "hashmap_impl.h"
+
+/*
+ * Open addressing layout of struct hashmap.
+ *
+ * Every slot has a control byte: HASHMAP_CTRL_EMPTY, HASHMAP_CTRL_DELETED
+ * or, for a full slot, the 7 bits of the hash just below the ones picking
+ * the home slot. Probing is linear, a group of HASHMAP_GROUP_WIDTH control
+ * bytes at a time: a single 64 bit load and a few arithmetic operations
+ * tell which slots of the group may hold the key and whether the group
+ * has an empty slot ending the probe. The kernel can't use SSE2 without
+ * kernel_fpu_begin(), so groups are matched with plain word arithmetic.
+ *
+ * The first HASHMAP_GROUP_WIDTH control bytes are mirrored past the end of
+ * the array, so a group load never needs to wrap around.
+ */
+
+/* a full group fits in the smallest table */
+#define HASHMAP_OPEN_MIN_CAP_BITS 3
+
+#define HASHMAP_LSBS 0x0101010101010101ULL
+#define HASHMAP_MSBS 0x8080808080808080ULL
+
+static inline u64 group_load(const u8 *ctrl)
+{
+	u64 group;
+
+	memcpy(&group, ctrl, sizeof(group));
+	return group;
+}
+
+/* high bit set for every control byte equal to h2, may false positive */
+static inline u64 group_match(u64 group, u8 h2)
+{
+	u64 x = group ^ (HASHMAP_LSBS * h2);
+
+	return (x - HASHMAP_LSBS) & ~x & HASHMAP_MSBS;
+}
+
+static inline u64 group_match_empty(u64 group)
+{
+	return group & (~group << 6) & HASHMAP_MSBS;
+}
+
+static inline u64 group_match_empty_or_deleted(u64 group)
+{
+	return group & (~group << 7) & HASHMAP_MSBS;
+}
+
+static inline size_t group_first(u64 match)
+{
+	return __ffs(match) >> 3;
+}
+
+static inline size_t hashmap_open_size(size_t cap)
+{
+	return cap * sizeof(struct hashmap_slot) + cap + HASHMAP_GROUP_WIDTH;
+}
+
+static void hashmap_open_hash(const struct hashmap *map, size_t cap_bits,
+			      long key, size_t *pos, u8 *h2)
+{
+	size_t h = map->hash_fn(key, map->ctx) * 11400714819323198485llu;
+
+	*pos = h >> (__SIZEOF_LONG_LONG__ * 8 - cap_bits);
+	*h2 = (h >> (__SIZEOF_LONG_LONG__ * 8 - cap_bits - 7)) & 0x7f;
+}
+
+static void set_ctrl(u8 *ctrl, size_t cap, size_t i, u8 c)
+{
+	ctrl[i] = c;
+	if (i < HASHMAP_GROUP_WIDTH)
+		ctrl[cap + i] = c;
+}
+
+static size_t find_insert_slot(const u8 *ctrl, size_t cap, size_t pos)
+{
+	u64 match;
+
+	for (;;) {
+		match = group_match_empty_or_deleted(group_load(&ctrl[pos]));
+		if (match)
+			return (pos + group_first(match)) & (cap - 1);
+		pos = (pos + HASHMAP_GROUP_WIDTH) & (cap - 1);
+	}
+}
+
+static bool hashmap_open_find_slot(const struct hashmap *map, long key,
+				   size_t *idx)
+{
+	size_t pos, i, mask = map->cap - 1;
+	u64 group, match;
+	u8 h2;
+
+	if (!map->cap)
+		return false;
+
+	hashmap_open_hash(map, map->cap_bits, key, &pos, &h2);
+	for (size_t probed = 0; probed < map->cap;
+	     probed += HASHMAP_GROUP_WIDTH) {
+		group = group_load(&map->ctrl[pos]);
+		for (match = group_match(group, h2); match;
+		     match &= match - 1) {
+			i = (pos + group_first(match)) & mask;
+			if (map->equal_fn(map->slots[i].key, key, map->ctx)) {
+				*idx = i;
+				return true;
+			}
+		}
+		if (group_match_empty(group))
+			return false;
+		pos = (pos + HASHMAP_GROUP_WIDTH) & mask;
+	}
+
+	return false;
+}
+
+/*
+ * Moves every live slot into a table of 2^new_cap_bits slots, dropping
+ * the tombstones on the way
+ */
+static size_t hashmap_open_rehash(struct hashmap *map, size_t new_cap_bits,
+				  gfp_t gfp)
+{
+	size_t new_cap = 1UL << new_cap_bits, old_cap = map->cap;
+	u64 start = hashmap_stats_start(map);
+	struct hashmap_slot *new_slots;
+	u8 *new_ctrl;
+	size_t pos, i;
+	u8 h2;
+
+	new_slots = hashmap_alloc(map, hashmap_open_size(new_cap), gfp);
+	if (!new_slots)
+		return XKLIB_ENOMEM;
+
+	new_ctrl = (u8 *)(new_slots + new_cap);
+	memset(new_ctrl, HASHMAP_CTRL_EMPTY, new_cap + HASHMAP_GROUP_WIDTH);
+
+	for (size_t bkt = 0; bkt < map->cap; bkt++) {
+		if (!hashmap_ctrl_full(map->ctrl[bkt]))
+			continue;
+
+		hashmap_open_hash(map, new_cap_bits, map->slots[bkt].key, &pos,
+				  &h2);
+		i = find_insert_slot(new_ctrl, new_cap, pos);
+		set_ctrl(new_ctrl, new_cap, i, h2);
+		new_slots[i] = map->slots[bkt];
+	}
+
+	hashmap_free(map->slots, hashmap_open_size(map->cap));
+	map->slots = new_slots;
+	map->ctrl = new_ctrl;
+	map->cap = new_cap;
+	map->cap_bits = new_cap_bits;
+	map->tombs = 0;
+	map->may_shrink = false;
+
+	hashmap_stats_end(map, old_cap, start);
+	return 0;
+}
+
+/* keep at least one empty slot in 8 so that every probe terminates early */
+static bool hashmap_open_needs_rehash(const struct hashmap *map)
+{
+	return (map->cap == 0) ||
+	       ((map->sz + map->tombs + 1) * 8 > map->cap * 7);
+}
+
+/* smallest table holding n entries without a rehash */
+static size_t hashmap_open_fit_bits(size_t n)
+{
+	size_t bits = HASHMAP_OPEN_MIN_CAP_BITS;
+
+	while ((n + 1) * 8 > (1UL << bits) * 7)
+		bits++;
+	return bits;
+}
+
+static size_t hashmap_open_rehash_bits(const struct hashmap *map)
+{
+	/* mostly tombstones: rebuild in place rather than grow */
+	if (map->cap && (map->sz + 1) * 16 <= map->cap * 7)
+		return map->cap_bits;
+
+	return max_t(size_t, map->cap_bits + 1, HASHMAP_OPEN_MIN_CAP_BITS);
+}
+
+/*
+ * Same hysteresis as the chained layout, best effort. Checked on insert
+ * rather than on delete so that deleting while iterating never moves slots.
+ */
+static void hashmap_open_maybe_shrink(struct hashmap *map)
+{
+	if (map->may_shrink &&
+	    map->cap > (1UL << HASHMAP_OPEN_MIN_CAP_BITS) &&
+	    map->sz * 8 < map->cap && !in_nmi())
+		hashmap_open_rehash(map, hashmap_open_fit_bits(map->sz * 2),
+				    GFP_NOWAIT | __GFP_NOWARN);
+}
+
+size_t hashmap_open_insert(struct hashmap *map, long key, long value,
+			   enum hashmap_insert_strategy strategy,
+			   long *old_key, long *old_value,
+			   enum mm_alloc_ctx ctx)
+{
+	size_t pos, i;
+	size_t err;
+	u8 h2;
+
+	if (old_key)
+		*old_key = 0;
+	if (old_value)
+		*old_value = 0;
+
+	if (ctx == MM_CTX_PROCESS)
+		hashmap_open_maybe_shrink(map);
+
+	if (strategy != HASHMAP_APPEND &&
+	    hashmap_open_find_slot(map, key, &i)) {
+		if (old_key)
+			*old_key = map->slots[i].key;
+		if (old_value)
+			*old_value = map->slots[i].value;
+
+		if (strategy == HASHMAP_SET || strategy == HASHMAP_UPDATE) {
+			map->slots[i].key = key;
+			map->slots[i].value = value;
+			return 0;
+		} else if (strategy == HASHMAP_ADD) {
+			return XKLIB_EEXIST;
+		}
+	}
+
+	if (strategy == HASHMAP_UPDATE)
+		return XKLIB_ENOENT;
+
+	if (hashmap_open_needs_rehash(map)) {
+		/* atomic inserts may only eat into the last free slots */
+		if (ctx == MM_CTX_ATOMIC) {
+			if (map->sz + map->tombs + 1 >= map->cap)
+				return XKLIB_ENOMEM;
+		} else {
+			err = hashmap_open_rehash(map,
+						  hashmap_open_rehash_bits(map),
+						  GFP_KERNEL);
+			if (err)
+				return err;
+		}
+	}
+
+	hashmap_open_hash(map, map->cap_bits, key, &pos, &h2);
+	i = find_insert_slot(map->ctrl, map->cap, pos);
+	if (map->ctrl[i] == HASHMAP_CTRL_DELETED)
+		map->tombs--;
+
+	set_ctrl(map->ctrl, map->cap, i, h2);
+	map->slots[i].key = key;
+	map->slots[i].value = value;
+	map->sz++;
+
+	return 0;
+}
+
+bool hashmap_open_find(const struct hashmap *map, long key, long *value)
+{
+	size_t i;
+
+	if (!hashmap_open_find_slot(map, key, &i))
+		return false;
+
+	if (value)
+		*value = map->slots[i].value;
+	return true;
+}
+
+bool hashmap_open_delete(struct hashmap *map, long key, long *old_key,
+			 long *old_value)
+{
+	size_t i;
+
+	if (!hashmap_open_find_slot(map, key, &i))
+		return false;
+
+	if (old_key)
+		*old_key = map->slots[i].key;
+	if (old_value)
+		*old_value = map->slots[i].value;
+
+	/* probes for other keys may run through this slot, leave a tombstone */
+	set_ctrl(map->ctrl, map->cap, i, HASHMAP_CTRL_DELETED);
+	map->sz--;
+	map->tombs++;
+
+	/* shrinking is left to the next insert, nothing moves on delete */
+	map->may_shrink = true;
+	if (!map->sz && map->cap > (1UL << HASHMAP_OPEN_MIN_CAP_BITS))
+		hashmap_open_clear(map);
+
+	return true;
+}
+
+size_t hashmap_open_reserve(struct hashmap *map, size_t n)
+{
+	size_t bits = hashmap_open_fit_bits(n + map->tombs);
+
+	if (map->cap && bits <= map->cap_bits) {
+		map->may_shrink = false;
+		return 0;
+	}
+
+	return hashmap_open_rehash(map, hashmap_open_fit_bits(n), GFP_KERNEL);
+}
+
+size_t hashmap_open_compact(struct hashmap *map)
+{
+	if (!map->sz) {
+		hashmap_open_clear(map);
+		return 0;
+	}
+
+	return hashmap_open_rehash(map, hashmap_open_fit_bits(map->sz),
+				   GFP_KERNEL);
+}
+
+void hashmap_open_clear(struct hashmap *map)
+{
+	hashmap_free(map->slots, hashmap_open_size(map->cap));
+	map->slots = NULL;
+	map->ctrl = NULL;
+	map->cap = map->cap_bits = map->sz = map->tombs = 0;
+	map->may_shrink = false;
+}
+
+/*
+ * Next slot holding key after slot from, or the first one if from is
+ * map->cap. Probing is linear and every key sits between its home slot
+ * and the first empty slot, so the scan resumes right after from.
+ */
+struct hashmap_entry *hashmap_open_key_next(const struct hashmap *map,
+					    size_t from, long key)
+{
+	size_t pos, mask = map->cap - 1;
+	u8 h2, c;
+
+	if (!map->cap)
+		return NULL;
+
+	hashmap_open_hash(map, map->cap_bits, key, &pos, &h2);
+	if (from != map->cap)
+		pos = (from + 1) & mask;
+
+	for (; (c = map->ctrl[pos]) != HASHMAP_CTRL_EMPTY;
+	     pos = (pos + 1) & mask) {
+		if (c == h2 && map->equal_fn(map->slots[pos].key, key, map->ctx))
+			return (struct hashmap_entry *)&map->slots[pos];
+	}
+
+	return NULL;
+}
+
+/* control groups loaded by a lookup of key */
+size_t hashmap_open_probe_len(const struct hashmap *map, long key)
+{
+	size_t pos, len = 0, mask = map->cap - 1;
+	u64 group, match;
+	u8 h2;
+
+	if (!map->cap)
+		return 0;
+
+	hashmap_open_hash(map, map->cap_bits, key, &pos, &h2);
+	for (size_t probed = 0; probed < map->cap;
+	     probed += HASHMAP_GROUP_WIDTH) {
+		group = group_load(&map->ctrl[pos]);
+		len++;
+		for (match = group_match(group, h2); match;
+		     match &= match - 1) {
+			if (map->equal_fn(
+				    map->slots[(pos + group_first(match)) & mask]
+					    .key,
+				    key, map->ctx))
+				return len;
+		}
+		if (group_match_empty(group))
+			break;
+		pos = (pos + HASHMAP_GROUP_WIDTH) & mask;
+	}
+
+	return len;
+}
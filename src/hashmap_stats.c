@@ -0,0 +1,413 @@
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "debug.h"
+#include "hashmap_impl.h"
+
+/* keys of every key set run by the hash_quality file */
+#define HASHMAP_QUALITY_KEYS (1UL << 16)
+
+static struct dentry *hashmap_debugfs;
+
+static const char *const hashmap_layout_names[] = {
+	[HASHMAP_CHAINED] = "chained",
+	[HASHMAP_OPEN] = "open",
+	[HASHMAP_DENSE] = "dense",
+};
+
+static inline size_t hashmap_stats_bucket(size_t len)
+{
+	return min_t(size_t, len, HASHMAP_STATS_HIST - 1);
+}
+
+/* entries compared along chain before reaching key, all of them if absent */
+static bool hashmap_chain_probe_len(const struct hashmap *map,
+				    struct hashmap_entry *cur, long key,
+				    size_t *len)
+{
+	for (; cur; cur = cur->next) {
+		(*len)++;
+		if (map->equal_fn(cur->key, key, map->ctx))
+			return true;
+	}
+	return false;
+}
+
+static size_t hashmap_chained_probe_len(const struct hashmap *map, long key)
+{
+	size_t h, len = 0;
+
+	if (!map->buckets)
+		return 0;
+
+	h = map->hash_fn(key, map->ctx);
+	if (hashmap_chain_probe_len(map,
+				    map->buckets[hash_bits(h, map->cap_bits)],
+				    key, &len) ||
+	    !map->old_buckets)
+		return len;
+
+	hashmap_chain_probe_len(
+		map, map->old_buckets[hash_bits(h, map->old_cap_bits)], key,
+		&len);
+	return len;
+}
+
+static size_t hashmap_probe_len(const struct hashmap *map, long key)
+{
+	if (map->layout == HASHMAP_OPEN)
+		return hashmap_open_probe_len(map, key);
+	if (map->layout == HASHMAP_DENSE)
+		return hashmap_dense_probe_len(map, key);
+	return hashmap_chained_probe_len(map, key);
+}
+
+/*
+ * Walks the probe sequence of key a second time rather than instrumenting
+ * the lookups themselves, which stay untouched when statistics are off
+ */
+void hashmap_stats_probe(const struct hashmap *map, long key)
+{
+	struct hashmap_stats *stats = map->stats;
+
+	atomic_long_inc(
+		&stats->probes[hashmap_stats_bucket(hashmap_probe_len(map, key))]);
+	atomic_long_inc(&stats->lookups);
+}
+
+/* stats->lock must be held */
+static void hashmap_stats_sample(struct hashmap *map)
+{
+	struct hashmap_stats *stats = map->stats;
+	struct hashmap_stats_sample *sample;
+
+	sample = &stats->samples[stats->nr_samples++ % HASHMAP_STATS_SAMPLES];
+	sample->ns = ktime_get_ns();
+	sample->sz = map->sz;
+	sample->cap = map->cap;
+}
+
+void hashmap_stats_resize(struct hashmap *map, size_t old_cap, u64 start)
+{
+	struct hashmap_stats *stats = map->stats;
+	u64 ns = ktime_get_ns() - start;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stats->lock, flags);
+	if (map->cap > old_cap)
+		stats->grows++;
+	else if (map->cap < old_cap)
+		stats->shrinks++;
+	else
+		stats->rehashes++;
+	stats->resize_ns += ns;
+	stats->resize_max_ns = max(stats->resize_max_ns, ns);
+	hashmap_stats_sample(map);
+	spin_unlock_irqrestore(&stats->lock, flags);
+}
+
+void hashmap__stats_scan(struct hashmap *map)
+{
+	unsigned long chains[HASHMAP_STATS_HIST] = { 0 };
+	struct hashmap_stats *stats = map->stats;
+	struct hashmap_entry *cur;
+	size_t bkt, len, max_len = 0;
+	unsigned long flags;
+	u64 start;
+
+	if (!stats)
+		return;
+
+	start = ktime_get_ns();
+	if (map->layout == HASHMAP_CHAINED) {
+		for (bkt = 0; bkt < map->cap + map->old_cap; bkt++) {
+			len = 0;
+			for (cur = hashmap__bucket_first(map, bkt); cur;
+			     cur = cur->next)
+				len++;
+			chains[hashmap_stats_bucket(len)]++;
+			max_len = max(max_len, len);
+		}
+	} else {
+		hashmap__for_each_entry(map, cur, bkt) {
+			len = hashmap_probe_len(map, cur->key);
+			chains[hashmap_stats_bucket(len)]++;
+			max_len = max(max_len, len);
+		}
+	}
+
+	spin_lock_irqsave(&stats->lock, flags);
+	memcpy(stats->chains, chains, sizeof(chains));
+	stats->max_chain = max_len;
+	stats->scan_ns = ktime_get_ns() - start;
+	hashmap_stats_sample(map);
+	spin_unlock_irqrestore(&stats->lock, flags);
+}
+
+/* average probe length of the recorded lookups, in hundredths */
+static unsigned long hashmap_stats_avg_probe(const struct hashmap_stats *stats)
+{
+	unsigned long sum = 0, lookups = atomic_long_read(&stats->lookups);
+
+	for (size_t i = 0; i < HASHMAP_STATS_HIST; i++)
+		sum += i * atomic_long_read(&stats->probes[i]);
+	return lookups ? sum * 100 / lookups : 0;
+}
+
+static void hashmap_stats_hist(struct seq_file *m, const char *name,
+			       const unsigned long *hist)
+{
+	seq_printf(m, "%s", name);
+	for (size_t i = 0; i < HASHMAP_STATS_HIST; i++)
+		seq_printf(m, " %lu", hist[i]);
+	seq_putc(m, '\n');
+}
+
+static int hashmap_stats_show(struct seq_file *m, void *v)
+{
+	struct hashmap *map = m->private;
+	struct hashmap_stats *stats = map->stats;
+	unsigned long probes[HASHMAP_STATS_HIST], flags;
+	struct hashmap_stats_sample *sample;
+	size_t first;
+
+	for (size_t i = 0; i < HASHMAP_STATS_HIST; i++)
+		probes[i] = atomic_long_read(&stats->probes[i]);
+
+	seq_printf(m, "layout %s size %zu capacity %zu\n",
+		   hashmap_layout_names[map->layout],
+		   READ_ONCE(map->sz), READ_ONCE(map->cap));
+	seq_printf(m, "lookups %ld avg_probe %lu.%02lu\n",
+		   atomic_long_read(&stats->lookups),
+		   hashmap_stats_avg_probe(stats) / 100,
+		   hashmap_stats_avg_probe(stats) % 100);
+	hashmap_stats_hist(m, "probes", probes);
+
+	spin_lock_irqsave(&stats->lock, flags);
+	hashmap_stats_hist(m, "chains", stats->chains);
+	seq_printf(m, "max_chain %zu scan_ns %llu\n", stats->max_chain,
+		   stats->scan_ns);
+	seq_printf(m, "grows %lu shrinks %lu rehashes %lu\n", stats->grows,
+		   stats->shrinks, stats->rehashes);
+	seq_printf(m, "resize_ns %llu resize_max_ns %llu\n", stats->resize_ns,
+		   stats->resize_max_ns);
+
+	/* load factor over time, oldest sample first, in per mille */
+	first = stats->nr_samples > HASHMAP_STATS_SAMPLES ?
+			stats->nr_samples - HASHMAP_STATS_SAMPLES :
+			0;
+	for (size_t i = first; i < stats->nr_samples; i++) {
+		sample = &stats->samples[i % HASHMAP_STATS_SAMPLES];
+		seq_printf(m, "load %llu %zu %zu %zu\n", sample->ns, sample->sz,
+			   sample->cap,
+			   sample->cap ? sample->sz * 1000 / sample->cap : 0);
+	}
+	spin_unlock_irqrestore(&stats->lock, flags);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hashmap_stats);
+
+/*
+ * Starts collecting statistics on map. With a name, they are also exposed
+ * as xklib/hashmap/<name> in debugfs. Embedded maps must be detached with
+ * hashmap__disable_stats() before they go away, hashmap__free() does it.
+ */
+size_t hashmap__enable_stats(struct hashmap *map, const char *name)
+{
+	struct hashmap_stats *stats;
+
+	if (map->stats)
+		return XKLIB_EEXIST;
+
+	stats = kzalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return XKLIB_ENOMEM;
+
+	spin_lock_init(&stats->lock);
+	map->stats = stats;
+
+	if (name && !IS_ERR_OR_NULL(hashmap_debugfs))
+		stats->dentry = debugfs_create_file(name, 0400, hashmap_debugfs,
+						    map, &hashmap_stats_fops);
+	return 0;
+}
+
+void hashmap__disable_stats(struct hashmap *map)
+{
+	if (!map->stats)
+		return;
+
+	/* waits for the readers of the file */
+	debugfs_remove(map->stats->dentry);
+	kfree(map->stats);
+	map->stats = NULL;
+}
+
+/*
+ * Key sets of the hash_quality file, shaped like the keys xklib maps
+ * actually see
+ */
+struct hashmap_keyset {
+	const char *name;
+	size_t (*fill)(long *keys, size_t n);
+	void (*release)(long *keys, size_t n);
+};
+
+/* physically contiguous pages, from 4G on */
+static size_t hashmap_keys_pa_contig(long *keys, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		keys[i] = (0x100000UL + i) << PAGE_SHIFT;
+	return 0;
+}
+
+/* pages scattered over the first 1T */
+static size_t hashmap_keys_pa_sparse(long *keys, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		keys[i] = (get_random_u64() & ((1UL << 28) - 1)) << PAGE_SHIFT;
+	return 0;
+}
+
+/* 2M pages, 21 low bits clear */
+static size_t hashmap_keys_pa_huge(long *keys, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		keys[i] = (long)i << PMD_SHIFT;
+	return 0;
+}
+
+static size_t hashmap_keys_pid(long *keys, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		keys[i] = i + 1;
+	return 0;
+}
+
+/* kmalloc-64 objects, as allocated by the module itself */
+static size_t hashmap_keys_kptr(long *keys, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		keys[i] = (long)kmalloc(64, GFP_KERNEL);
+		if (!keys[i])
+			return XKLIB_ENOMEM;
+	}
+	return 0;
+}
+
+static void hashmap_keys_kptr_release(long *keys, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		kfree((void *)keys[i]);
+}
+
+static const struct hashmap_keyset hashmap_keysets[] = {
+	{ "pa_contig", hashmap_keys_pa_contig },
+	{ "pa_sparse", hashmap_keys_pa_sparse },
+	{ "pa_huge", hashmap_keys_pa_huge },
+	{ "pid", hashmap_keys_pid },
+	{ "kptr", hashmap_keys_kptr, hashmap_keys_kptr_release },
+};
+
+static size_t hashmap_quality_hash(long key, void *ctx)
+{
+	return long_hash(key);
+}
+
+static bool hashmap_quality_equal(long key1, long key2, void *ctx)
+{
+	return long_cmp(key1, key2);
+}
+
+static void hashmap_quality_run(struct seq_file *m, const char *name,
+				enum hashmap_layout layout, const long *keys,
+				size_t n)
+{
+	struct hashmap map;
+	u64 start, ns;
+
+	hashmap__init(&map, hashmap_quality_hash, hashmap_quality_equal, NULL);
+	hashmap__set_layout(&map, layout);
+
+	for (size_t i = 0; i < n; i++) {
+		if (hashmap__set(&map, keys[i], i, NULL, NULL)) {
+			seq_printf(m, "%-10s %-7s out of memory\n", name,
+				   hashmap_layout_names[layout]);
+			goto out;
+		}
+	}
+
+	/* timed before statistics double the cost of every lookup */
+	start = ktime_get_ns();
+	for (size_t i = 0; i < n; i++)
+		hashmap__find(&map, keys[i], NULL);
+	ns = ktime_get_ns() - start;
+
+	if (hashmap__enable_stats(&map, NULL))
+		goto out;
+	for (size_t i = 0; i < n; i++)
+		hashmap__find(&map, keys[i], NULL);
+	hashmap__stats_scan(&map);
+
+	seq_printf(m, "%-10s %-7s %7zu %7zu %4lu.%02lu %5zu %5llu", name,
+		   hashmap_layout_names[layout], map.sz, map.cap,
+		   hashmap_stats_avg_probe(map.stats) / 100,
+		   hashmap_stats_avg_probe(map.stats) % 100,
+		   map.stats->max_chain, n ? ns / n : 0);
+	hashmap_stats_hist(m, "", map.stats->chains);
+
+	hashmap__disable_stats(&map);
+out:
+	hashmap__clear(&map);
+}
+
+/*
+ * Hashes every key set with long_hash() into a map of every layout and
+ * reports how evenly the keys spread: average and maximum probe length,
+ * lookup time and the chain histogram described in hashmap_stats.h
+ */
+static int hashmap_quality_show(struct seq_file *m, void *v)
+{
+	const struct hashmap_keyset *set;
+	long *keys;
+
+	keys = kvmalloc_array(HASHMAP_QUALITY_KEYS, sizeof(*keys),
+			      GFP_KERNEL | __GFP_ZERO);
+	if (!keys)
+		return -ENOMEM;
+
+	seq_puts(m, "keys layout size capacity avg_probe max_probe ns chains\n");
+	for (size_t i = 0; i < ARRAY_SIZE(hashmap_keysets); i++) {
+		set = &hashmap_keysets[i];
+		if (!set->fill(keys, HASHMAP_QUALITY_KEYS)) {
+			hashmap_quality_run(m, set->name, HASHMAP_CHAINED, keys,
+					    HASHMAP_QUALITY_KEYS);
+			hashmap_quality_run(m, set->name, HASHMAP_OPEN, keys,
+					    HASHMAP_QUALITY_KEYS);
+			hashmap_quality_run(m, set->name, HASHMAP_DENSE, keys,
+					    HASHMAP_QUALITY_KEYS);
+		}
+		if (set->release)
+			set->release(keys, HASHMAP_QUALITY_KEYS);
+		memset(keys, 0, HASHMAP_QUALITY_KEYS * sizeof(*keys));
+	}
+
+	kvfree(keys);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hashmap_quality);
+
+void hashmap_debugfs_init(void)
+{
+	hashmap_debugfs = debugfs_create_dir("hashmap", xklib_debugfs);
+	debugfs_create_file("hash_quality", 0400, hashmap_debugfs, NULL,
+			    &hashmap_quality_fops);
+}
+
+/* maps with statistics must have been detached */
+void hashmap_debugfs_destroy(void)
+{
+	debugfs_remove_recursive(hashmap_debugfs);
+	hashmap_debugfs = NULL;
+}
@@ -1,8 +1,101 @@
 #include "memory.h"
+#include "xk_hashmap.h"
+
+//Tag -> bucket registry, specialized so that tag lookups inline long_hash
+DEFINE_XK_HASHMAP(mm_collector, u64, struct mm_bucket *, long_hash, long_cmp)
 
 u64 kidentity_base = 0;
 u64 xidentity_base = 0;
-struct hashmap *collector = 0;
+struct mm_collector *collector = 0;
+struct mm_node_stats mm_node_stats[MAX_NUMNODES];
+
+static DEFINE_PER_CPU(struct mm_defer_batch *, mm_defer_batches);
+//Taken when a new batch can't be allocated, refilled from process context
+static DEFINE_PER_CPU(struct mm_defer_batch *, mm_defer_spares);
+static atomic64_t mm_defer_leaked;
+
+static void mm_defer_refill(struct work_struct *work);
+static DECLARE_WORK(mm_defer_refill_work, mm_defer_refill);
+
+static DEFINE_MUTEX(mm_collector_lock);
+
+/*
+ * Roots installed so far. Writers hold mm_roots_lock: they publish a
+ * larger copy to add a root, and remove one by moving the last root over
+ * its slot before dropping it from nr, so that a concurrent scan still
+ * meets every other root. Readers only need rcu_read_lock() and can't be
+ * made to wait on a writer they interrupted, NMIs included.
+ */
+struct mm_root_set {
+	struct rcu_head rcu;
+	unsigned int nr;
+	struct mm_root *roots[];
+};
+
+static struct mm_root_set __rcu *mm_roots;
+static DEFINE_MUTEX(mm_roots_lock);
+
+//Called under rcu_read_lock(), a handful of roots at most
+static struct mm_root *mm_root_find(struct mm_struct *mm)
+{
+	struct mm_root_set *set = rcu_dereference(mm_roots);
+	struct mm_root *root;
+
+	if (!set)
+		return NULL;
+	for (unsigned int i = 0; i < READ_ONCE(set->nr); i++) {
+		root = READ_ONCE(set->roots[i]);
+		if (root->mn.mm == mm)
+			return root;
+	}
+	return NULL;
+}
+
+static xklib_error mm_root_add(struct mm_root *root)
+{
+	struct mm_root_set *old, *set;
+	unsigned int nr;
+
+	mutex_lock(&mm_roots_lock);
+	old = rcu_dereference_protected(mm_roots,
+					lockdep_is_held(&mm_roots_lock));
+	nr = old ? old->nr : 0;
+	set = kmalloc(struct_size(set, roots, nr + 1), GFP_KERNEL);
+	if (!set) {
+		mutex_unlock(&mm_roots_lock);
+		return XKLIB_ENOMEM;
+	}
+	if (old)
+		memcpy(set->roots, old->roots, nr * sizeof(set->roots[0]));
+	set->roots[nr] = root;
+	set->nr = nr + 1;
+	rcu_assign_pointer(mm_roots, set);
+	mutex_unlock(&mm_roots_lock);
+
+	if (old)
+		kfree_rcu(old, rcu);
+	return XKLIB_SUCCESS;
+}
+
+//Under mm_roots_lock, false if root is not in the set anymore
+static bool mm_root_del(struct mm_root *root)
+{
+	struct mm_root_set *set;
+	unsigned int i;
+
+	set = rcu_dereference_protected(mm_roots,
+					lockdep_is_held(&mm_roots_lock));
+	if (!set)
+		return false;
+	for (i = 0; i < set->nr && set->roots[i] != root; i++)
+		;
+	if (i == set->nr)
+		return false;
+
+	WRITE_ONCE(set->roots[i], set->roots[set->nr - 1]);
+	WRITE_ONCE(set->nr, set->nr - 1);
+	return true;
+}
 
 xklib_error mm_init()
 {
@@ -10,25 +103,372 @@ xklib_error mm_init()
 	kidentity_base = p - virt_to_phys(p);
 	kfree(p);
 
-	collector = hashmap__new(long_hash, long_cmp, 0);
-	u64 err = hashmap__add(collector, MM_TAG_GENERIC,
-			       kmalloc_array(MM_BUCKET_MAX, sizeof(void *),
-					     GFP_KERNEL));
-
+	u64 err = hashmap_cache_init();
+	hashmap_debugfs_init();
+	if (!err)
+		err = mm_reserve_init(&mm_reserve_tables, "tables", PAGE_SIZE,
+				      NULL, GFP_KERNEL | __GFP_ZERO,
+				      MM_RESERVE_TABLES);
+	if (!err)
+		err = mm_reserve_init(&mm_reserve_entries, "entries",
+				      sizeof(struct hashmap_entry),
+				      hashmap_entry_cache, GFP_KERNEL,
+				      MM_RESERVE_ENTRIES);
+	if (!err)
+		err = pfn_map_init();
 	if (err) {
-		dbg_msg("Memory namespace initialization failed: 0x%llx", err);
-		return XKLIB_ENOCOLLECTOR;
+		dbg_msg("Memory namespace setup failed: 0x%llx", err);
+		goto fail;
+	}
+
+	collector = mm_collector_new(NUMA_NO_NODE);
+	if (!collector) {
+		err = XKLIB_ENOCOLLECTOR;
+		goto fail;
+	}
+
+	struct mm_bucket *bucket = mm_collector_bucket(MM_TAG_GENERIC);
+	if (!bucket) {
+		dbg_msg("Memory namespace initialization failed");
+		err = XKLIB_ENOCOLLECTOR;
+		goto fail;
 	}
 
-	u64 bucket = 0;
-	hashmap__find(collector, MM_TAG_GENERIC, &bucket);
 	dbg_msg("Default collector bucket at: 0x%llx", bucket);
 
+	mm_defer_refill(NULL);
 	return XKLIB_SUCCESS;
+
+fail:
+	mm_destroy();
+	return err;
+}
+
+static void mm_free_tables(pde_64 *table, int level)
+{
+	if (level > 1) {
+		for (int i = 0; i < PT_MAX; i++) {
+			if (INVALID_PMD(&table[i]) || !XKLIB_PT(&table[i]))
+				continue;
+			mm_free_tables(phys_to_virt(table[i].pageframenumber
+						    << PAGE_SHIFT),
+				       level - 1);
+		}
+	}
+	mm_free_table(table);
+}
+
+//Only clears the slot if nobody replaced our table meanwhile
+static void mm_root_unhook(struct mm_root *root)
+{
+	u64 pfn = virt_to_phys(root->table) >> PAGE_SHIFT;
+
+	if (root->ppml4e->present && root->ppml4e->pageframenumber == pfn)
+		WRITE_ONCE(root->ppml4e->flags, 0);
+}
+
+static struct mmu_notifier *mm_root_alloc(struct mm_struct *mm)
+{
+	struct mm_root *root = kzalloc(sizeof(*root), GFP_KERNEL);
+
+	return root ? &root->mn : ERR_PTR(-ENOMEM);
+}
+
+//Lock-free readers may have found the root just before it went away
+static void mm_root_free(struct mmu_notifier *mn)
+{
+	struct mm_root *root = container_of(mn, struct mm_root, mn);
+
+	kfree_rcu(root, rcu);
 }
 
+/*
+ * The mm is going away, its windows go with it unless mm_destroy took the
+ * root first. Under mm_roots_lock, so that mm_destroy can't finish while
+ * the tables are still being freed.
+ */
+static void mm_root_exit(struct mmu_notifier *mn, struct mm_struct *mm)
+{
+	struct mm_root *root = container_of(mn, struct mm_root, mn);
+
+	mutex_lock(&mm_roots_lock);
+	if (mm_root_del(root)) {
+		mm_root_unhook(root);
+		flush_tlb_mm(mm);
+		mm_free_tables((pde_64 *)root->table, 3);
+		mmu_notifier_put(mn);
+	}
+	mutex_unlock(&mm_roots_lock);
+}
+
+static const struct mmu_notifier_ops mm_root_ops = {
+	.release = mm_root_exit,
+	.alloc_notifier = mm_root_alloc,
+	.free_notifier = mm_root_free,
+};
+
+/*
+ * Unhooks every xklib hierarchy still installed from its mm, then
+ * releases all of their tables behind a single tlb flush
+ */
+static void mm_release_roots(void)
+{
+	struct mm_root_set *set;
+
+	mutex_lock(&mm_roots_lock);
+	set = rcu_dereference_protected(mm_roots,
+					lockdep_is_held(&mm_roots_lock));
+	RCU_INIT_POINTER(mm_roots, NULL);
+	mutex_unlock(&mm_roots_lock);
+
+	if (set) {
+		for (unsigned int i = 0; i < set->nr; i++)
+			mm_root_unhook(set->roots[i]);
+
+		flush_tlb_all();
+
+		for (unsigned int i = 0; i < set->nr; i++) {
+			mm_free_tables((pde_64 *)set->roots[i]->table, 3);
+			mmu_notifier_put(&set->roots[i]->mn);
+		}
+		kfree_rcu(set, rcu);
+	}
+
+	//The roots and the mms they pin are released asynchronously
+	mmu_notifier_synchronize();
+}
+
+/*
+ * Releases everything owned by the memory namespace, whatever point
+ * mm_init reached
+ */
 void mm_destroy()
 {
+	struct mm_collector_entry *cur;
+	size_t bkt;
+	int cpu;
+
+	mm_release_roots();
+	if (collector) {
+		xk_hashmap__for_each_entry(collector, cur, bkt)
+			mm_bucket_free(cur->value, kfree);
+		mm_collector_free(collector);
+		collector = NULL;
+	}
+
+	pfn_map_destroy();
+	mm_reserve_destroy(&mm_reserve_entries);
+	mm_reserve_destroy(&mm_reserve_tables);
+	cancel_work_sync(&mm_defer_refill_work);
+	mm_flush_deferred();
+	for_each_possible_cpu(cpu)
+		kfree(xchg(per_cpu_ptr(&mm_defer_spares, cpu), NULL));
+	if (atomic64_read(&mm_defer_leaked))
+		dbg_msg("Leaked %lld deferred frees",
+			atomic64_read(&mm_defer_leaked));
+	hashmap_debugfs_destroy();
+	hashmap_cache_destroy();
+	mm_dump_node_stats();
+}
+
+/*
+ * Returns the collector bucket of tag, creating it on first use.
+ * Process context only.
+ */
+struct mm_bucket *mm_collector_bucket(u64 tag)
+{
+	struct mm_bucket *bucket = NULL;
+
+	mutex_lock(&mm_collector_lock);
+	if (!mm_collector_find(collector, tag, &bucket)) {
+		bucket = mm_bucket_new(NUMA_NO_NODE);
+		if (bucket && mm_collector_add(collector, tag, bucket)) {
+			mm_bucket_free(bucket, NULL);
+			bucket = NULL;
+		}
+	}
+	mutex_unlock(&mm_collector_lock);
+
+	return bucket;
+}
+
+/*
+ * Hands p over to the collector, it will be kfree()d by mm_destroy.
+ * From atomic context the bucket of tag must already exist.
+ */
+xklib_error mm_collect(u64 tag, void *p, enum mm_alloc_ctx ctx)
+{
+	struct mm_bucket *bucket = NULL;
+
+	rcu_read_lock();
+	mm_collector_find_rcu(collector, tag, &bucket);
+	rcu_read_unlock();
+
+	if (unlikely(!bucket)) {
+		if (ctx == MM_CTX_ATOMIC)
+			return XKLIB_ENOCOLLECTOR;
+
+		bucket = mm_collector_bucket(tag);
+		if (!bucket)
+			return XKLIB_ENOMEM;
+	}
+
+	return mm_bucket_push(bucket, p, ctx);
+}
+
+void mm_dump_node_stats()
+{
+	int nid;
+
+	for_each_online_node(nid) {
+		dbg_msg("Node %d: %lld table pages (%lld remote), %lld hashmap bytes",
+			nid, atomic64_read(&mm_node_stats[nid].table_pages),
+			atomic64_read(&mm_node_stats[nid].remote_tables),
+			atomic64_read(&mm_node_stats[nid].hashmap_bytes));
+	}
+}
+
+/*
+ * Allocates a zeroed page table on the requested node, NUMA_NO_NODE
+ * meaning the node of the calling cpu.
+ * Walks of the table will mostly come from there, so a page on any other
+ * node is only accepted as a fallback and accounted as remote.
+ * MM_CTX_ATOMIC requests are served from the reserve, wherever it lives.
+ */
+void *mm_alloc_table(int nid, enum mm_alloc_ctx ctx)
+{
+	void *table;
+	int got;
+
+	if (nid == NUMA_NO_NODE)
+		nid = numa_node_id();
+
+	if (ctx == MM_CTX_ATOMIC)
+		table = mm_reserve_get(&mm_reserve_tables);
+	else
+		table = kmalloc_node(PAGE_SIZE, GFP_KERNEL | __GFP_ZERO, nid);
+	if (unlikely(!table))
+		return NULL;
+
+	got = mm_ptr_node(table);
+	atomic64_inc(&mm_node_stats[got].table_pages);
+	if (unlikely(got != nid))
+		atomic64_inc(&mm_node_stats[nid].remote_tables);
+
+	return table;
+}
+
+/*
+ * Releases a table page once every walker that could still be looking at
+ * it has left its rcu read side section
+ */
+void mm_free_table(void *table)
+{
+	if (!table)
+		return;
+
+	atomic64_dec(&mm_node_stats[mm_ptr_node(table)].table_pages);
+	mm_free_deferred(table);
+}
+
+/*
+ * Releases a table that never got linked into the page tables, so no
+ * walker can be looking at it. Atomic callers may be in NMI context,
+ * where the deferred free can't run: their table goes back to the reserve.
+ */
+static void mm_drop_table(void *table, enum mm_alloc_ctx ctx)
+{
+	if (ctx != MM_CTX_ATOMIC) {
+		mm_free_table(table);
+		return;
+	}
+
+	atomic64_dec(&mm_node_stats[mm_ptr_node(table)].table_pages);
+	mm_reserve_put(&mm_reserve_tables, table);
+}
+
+static void mm_defer_batch_free(struct rcu_head *rcu)
+{
+	struct mm_defer_batch *batch =
+		container_of(rcu, struct mm_defer_batch, rcu);
+
+	for (unsigned int i = 0; i < batch->nr; i++)
+		kvfree(batch->ptrs[i]);
+	kfree(batch);
+}
+
+static void mm_defer_refill(struct work_struct *work)
+{
+	struct mm_defer_batch *spare;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (per_cpu(mm_defer_spares, cpu))
+			continue;
+		spare = kmalloc(sizeof(*spare), GFP_KERNEL);
+		if (spare && cmpxchg(per_cpu_ptr(&mm_defer_spares, cpu), NULL,
+				     spare))
+			kfree(spare);
+	}
+}
+
+/*
+ * kvfree()s p after a grace period.
+ * Pointers are collected in a per cpu batch so that a single rcu callback
+ * amortizes the cost of the grace period across MM_DEFER_BATCH frees.
+ * Callable from any context but NMI, it never sleeps: when no batch can
+ * be allocated the spare of the cpu is used, and if that is gone as well
+ * p is leaked rather than freed under a reader.
+ */
+void mm_free_deferred(void *p)
+{
+	struct mm_defer_batch **pbatch, *batch;
+	unsigned long flags;
+
+	if (!p)
+		return;
+
+	local_irq_save(flags);
+	pbatch = this_cpu_ptr(&mm_defer_batches);
+	batch = *pbatch;
+	if (unlikely(!batch)) {
+		batch = kmalloc(sizeof(*batch), GFP_ATOMIC | __GFP_NOWARN);
+		if (unlikely(!batch)) {
+			batch = this_cpu_xchg(mm_defer_spares, NULL);
+			schedule_work(&mm_defer_refill_work);
+		}
+		if (unlikely(!batch)) {
+			local_irq_restore(flags);
+			atomic64_inc(&mm_defer_leaked);
+			return;
+		}
+		batch->nr = 0;
+		*pbatch = batch;
+	}
+
+	batch->ptrs[batch->nr++] = p;
+	if (batch->nr == MM_DEFER_BATCH) {
+		*pbatch = NULL;
+		call_rcu(&batch->rcu, mm_defer_batch_free);
+	}
+	local_irq_restore(flags);
+}
+
+/*
+ * Submits the partially filled batches of every cpu and waits for all the
+ * pending callbacks, must be called before the module text goes away
+ */
+void mm_flush_deferred()
+{
+	struct mm_defer_batch *batch;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		batch = xchg(per_cpu_ptr(&mm_defer_batches, cpu), NULL);
+		if (batch)
+			call_rcu(&batch->rcu, mm_defer_batch_free);
+	}
+	rcu_barrier();
 }
 
 last_pt_t get_last_pt(unsigned long addr)
@@ -39,6 +479,10 @@ last_pt_t get_last_pt(unsigned long addr)
 	pud_t *pud;
 	pte_t *pte;
 	struct mm_struct *mm = current->mm;
+
+	//xklib tables are freed after a grace period, keep them alive while
+	//walking
+	rcu_read_lock();
 	pgd = pgd_offset(mm, addr);
 	if (INVALID_PGD(pgd))
 		goto end;
@@ -62,23 +506,32 @@ last_pt_t get_last_pt(unsigned long addr)
 
 	last_pt.pt_type = pt_type_pte;
 	last_pt.pte = *pte;
+	rcu_read_unlock();
 	return last_pt;
 end:
+	rcu_read_unlock();
 	last_pt.pt_type = pt_type_invalid;
 	return last_pt;
 }
 
-void map_pdpte(pml4e_64 *ppml4e, unsigned long addr,
-	       struct pt_permissions perms, virt_addr_map *paddr_map)
+xklib_error map_pdpte(pml4e_64 *ppml4e, unsigned long addr,
+		      struct pt_permissions perms, virt_addr_map *paddr_map,
+		      int nid, enum mm_alloc_ctx ctx)
 {
 	const u64 table_idx = 0;
+	xklib_error err;
 
 	pml4e_64 pml4e = { 0 };
-	pdpte_64 *ppdpte = kmalloc(PAGE_SIZE, GFP_KERNEL);
-	memset(ppdpte, 0, PAGE_SIZE);
+	pdpte_64 *ppdpte = mm_alloc_table(nid, ctx);
+	if (unlikely(!ppdpte))
+		return XKLIB_ENOMEM;
 
 	paddr_map->level3 = table_idx;
-	map_pmd(ppdpte, addr, perms, paddr_map);
+	err = map_pmd(ppdpte, addr, perms, paddr_map, nid, ctx);
+	if (unlikely(err)) {
+		mm_drop_table(ppdpte, ctx);
+		return err;
+	}
 
 	//Must atomically set page table flags
 	pml4e.flags = ppml4e->flags;
@@ -89,19 +542,28 @@ void map_pdpte(pml4e_64 *ppml4e, unsigned long addr,
 	pml4e.pageframenumber = PAGE_ALIGN(virt_to_phys(ppdpte)) >> PAGE_SHIFT;
 	pml4e.ignored1 = 3;
 	ppml4e->flags = pml4e.flags;
+
+	return XKLIB_SUCCESS;
 }
 
-void map_pde(pdpte_64 *ppdpte, unsigned long addr, struct pt_permissions perms,
-	     virt_addr_map *paddr_map)
+xklib_error map_pde(pdpte_64 *ppdpte, unsigned long addr,
+		    struct pt_permissions perms, virt_addr_map *paddr_map,
+		    int nid, enum mm_alloc_ctx ctx)
 {
 	const u64 table_idx = 0;
+	xklib_error err;
 
 	pdpte_64 pdpte = { 0 };
-	pde_64 *ppde = kmalloc(PAGE_SIZE, GFP_KERNEL);
-	memset(ppde, 0, PAGE_SIZE);
+	pde_64 *ppde = mm_alloc_table(nid, ctx);
+	if (unlikely(!ppde))
+		return XKLIB_ENOMEM;
 
 	paddr_map->level2 = table_idx;
-	map_pte(ppde, addr, perms, paddr_map);
+	err = map_pte(ppde, addr, perms, paddr_map, nid, ctx);
+	if (unlikely(err)) {
+		mm_drop_table(ppde, ctx);
+		return err;
+	}
 	pdpte.flags = ppdpte->flags;
 
 	pdpte.present = true;
@@ -111,16 +573,20 @@ void map_pde(pdpte_64 *ppdpte, unsigned long addr, struct pt_permissions perms,
 	pdpte.pageframenumber = PAGE_ALIGN(virt_to_phys(ppde)) >> PAGE_SHIFT;
 	pdpte.ignored1 = 3;
 	ppdpte->flags = pdpte.flags;
+
+	return XKLIB_SUCCESS;
 }
 
-void map_pte(pde_64 *ppde, unsigned long addr, struct pt_permissions perms,
-	     virt_addr_map *paddr_map)
+xklib_error map_pte(pde_64 *ppde, unsigned long addr,
+		    struct pt_permissions perms, virt_addr_map *paddr_map,
+		    int nid, enum mm_alloc_ctx ctx)
 {
 	const u64 table_idx = 0;
 
 	pde_64 pde = { 0 };
-	pte_64 *ppte = kmalloc(PAGE_SIZE, GFP_KERNEL);
-	memset(ppte, 0, PAGE_SIZE);
+	pte_64 *ppte = mm_alloc_table(nid, ctx);
+	if (unlikely(!ppte))
+		return XKLIB_ENOMEM;
 
 	paddr_map->level1 = table_idx;
 	fill_pte(ppte, addr, perms, paddr_map);
@@ -133,6 +599,8 @@ void map_pte(pde_64 *ppde, unsigned long addr, struct pt_permissions perms,
 	pde.pageframenumber = PAGE_ALIGN(virt_to_phys(ppte)) >> PAGE_SHIFT;
 	pde.ignored1 = 3;
 	ppde->flags = pde.flags;
+
+	return XKLIB_SUCCESS;
 }
 
 void fill_pte(pte_64 *ppte, unsigned long addr, struct pt_permissions perms,
@@ -145,7 +613,7 @@ void fill_pte(pte_64 *ppte, unsigned long addr, struct pt_permissions perms,
 	pte.write = perms.write;
 	pte.executedisable = !perms.exec;
 	pte.supervisor = MAP_ALLOW_USER_ACCESS;
-	pte.pageframenumber = PAGE_ALIGN(addr) >> PAGE_SHIFT;
+	pte.pageframenumber = addr >> PAGE_SHIFT;
 	ppte->flags = pte.flags;
 
 	paddr_map->offset = addr & ~PAGE_MASK;
@@ -178,15 +646,115 @@ u64 find_free_pte(pte_t *ppte)
 	return PT_INVALID;
 }
 
+/*
+ * Builds a new hierarchy in the root slot of mm and registers it as the
+ * root of mm, so that mm_destroy or the exit of mm can take it down again.
+ * Roots are only created from process context, atomic mappings extend
+ * existing ones.
+ */
+static xklib_error mm_install_root(struct mm_struct *mm, pml4e_64 *ppml4e,
+				   unsigned long addr,
+				   struct pt_permissions perms,
+				   virt_addr_map *paddr_map, int nid,
+				   enum mm_alloc_ctx ctx)
+{
+	struct mmu_notifier *mn;
+	struct mm_root *root;
+	xklib_error err;
+
+	if (ctx == MM_CTX_ATOMIC)
+		return XKLIB_ENOMEM;
+
+	mn = mmu_notifier_get(&mm_root_ops, mm);
+	if (IS_ERR(mn))
+		return XKLIB_ENOMEM;
+	root = container_of(mn, struct mm_root, mn);
+
+	//mm still has a root, somebody else cleared its slot
+	if (root->table) {
+		mmu_notifier_put(mn);
+		return XKLIB_EEXIST;
+	}
+
+	err = map_pud(ppml4e, addr, perms, paddr_map, nid, ctx);
+	if (err) {
+		mmu_notifier_put(mn);
+		return err;
+	}
+
+	root->ppml4e = ppml4e;
+	root->table = phys_to_virt(ppml4e->pageframenumber << PAGE_SHIFT);
+
+	//Nothing would take an unregistered hierarchy down
+	err = mm_root_add(root);
+	if (unlikely(err)) {
+		dbg_msg("Could not register root of mm 0x%llx", mm);
+		mm_root_unhook(root);
+		flush_tlb_mm(mm);
+		mm_free_tables((pde_64 *)root->table, 3);
+		mmu_notifier_put(mn);
+	}
+
+	return err;
+}
+
+/*
+ * Records a window in the registry of its mm. The root lookup never waits
+ * on a writer and the record is a single store into the pud slot of the
+ * window, so it works from any context, NMIs included.
+ */
+static void mm_register_window(struct mm_struct *mm, unsigned long va,
+			       unsigned long pa)
+{
+	struct mm_root *root;
+
+	rcu_read_lock();
+	root = mm_root_find(mm);
+	if (root)
+		WRITE_ONCE(root->windows[pud_index(va)],
+			   (pa & PAGE_MASK) | MM_WINDOW_VALID);
+	rcu_read_unlock();
+}
+
 void *map_physical(unsigned long addr, struct pt_permissions perms)
 {
-	struct pml4t *ppml4t = kmalloc_struct(ppml4t);
+	return map_physical_node(current->mm, addr, perms, NUMA_NO_NODE,
+				 MM_CTX_PROCESS);
+}
+
+/*
+ * Never sleeps, missing page tables are taken from the atomic reserve.
+ * current is whoever was interrupted in irq, NMI or VM-exit context, so
+ * the address space to map into is given by the caller.
+ */
+void *map_physical_atomic(struct mm_struct *mm, unsigned long addr,
+			  struct pt_permissions perms)
+{
+	return map_physical_node(mm, addr, perms, NUMA_NO_NODE, MM_CTX_ATOMIC);
+}
+
+/*
+ * Same as map_physical, but the window is created in mm and the page
+ * tables created for the mapping are placed on nid, which should be the
+ * node of the cpus that will access the window the most.
+ */
+void *map_physical_node(struct mm_struct *mm, unsigned long addr,
+			struct pt_permissions perms, int nid,
+			enum mm_alloc_ctx ctx)
+{
 	virt_addr_map addr_map = { 0 };
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
-	struct mm_struct *mm = current->mm;
+
+	//Kernel threads have no address space of their own
+	if (unlikely(!mm))
+		return NULL;
+
+	//Nothing to map behind holes of the physical address space
+	if (unlikely(!pfn_map_valid(addr)))
+		return NULL;
 
 	addr_map.signext = 0xffff;
 	addr_map.level4 = ROOT_MAP_INDEX;
@@ -194,7 +762,9 @@ void *map_physical(unsigned long addr, struct pt_permissions perms)
 	pgd = PGD;
 	pgd = &pgd[ROOT_MAP_INDEX];
 	if (unlikely(INVALID_PGD(pgd))) {
-		map_pud(pgd, addr, perms, &addr_map);
+		if (unlikely(mm_install_root(mm, (pml4e_64 *)pgd, addr, perms,
+					     &addr_map, nid, ctx)))
+			addr_map.flags = 0;
 		goto end;
 	}
 
@@ -208,7 +778,8 @@ void *map_physical(unsigned long addr, struct pt_permissions perms)
 	addr_map.level3 = pud_idx;
 	pud = &pud[pud_idx];
 	if (unlikely(!XKLIB_PT(pud))) {
-		map_pmd(pud, addr, perms, &addr_map);
+		if (unlikely(map_pmd(pud, addr, perms, &addr_map, nid, ctx)))
+			addr_map.flags = 0;
 		goto end;
 	}
 
@@ -222,7 +793,8 @@ void *map_physical(unsigned long addr, struct pt_permissions perms)
 	addr_map.level2 = pmd_idx;
 	pmd = &pmd[pmd_idx];
 	if (unlikely(!XKLIB_PT(pmd))) {
-		map_pte(pmd, addr, perms, &addr_map);
+		if (unlikely(map_pte(pmd, addr, perms, &addr_map, nid, ctx)))
+			addr_map.flags = 0;
 		goto end;
 	}
 
@@ -238,6 +810,8 @@ void *map_physical(unsigned long addr, struct pt_permissions perms)
 	fill_pte(pte, addr, perms, &addr_map);
 
 end:
+	if (addr_map.flags)
+		mm_register_window(mm, addr_map.flags, addr);
 	return (void *)addr_map.flags;
 }
 
@@ -248,4 +822,69 @@ bool page_mapping_exist(unsigned long addr)
 	if (unlikely(last_pt.pt_type == pt_type_invalid))
 		return false;
 	return true;
-}
\ No newline at end of file
+}
+
+/*
+ * Physical address behind va, if va lies in a window map_physical handed
+ * out to the current mm. Lock-free.
+ */
+bool mm_window_find(unsigned long va, u64 *pa)
+{
+	struct mm_root *root;
+	u64 window = 0;
+
+	if (pgd_index(va) != ROOT_MAP_INDEX || (va & ~PUD_MASK) >= PAGE_SIZE)
+		return false;
+
+	rcu_read_lock();
+	root = mm_root_find(current->mm);
+	if (root)
+		window = READ_ONCE(root->windows[pud_index(va)]);
+	rcu_read_unlock();
+
+	if (!(window & MM_WINDOW_VALID))
+		return false;
+	if (pa)
+		*pa = (window & PAGE_MASK) + (va & ~PAGE_MASK);
+	return true;
+}
+
+/*
+ * Takes down a window map_physical handed out in the current mm: its pud
+ * slot is cleared and the tables behind it are freed after a grace period.
+ * Process context only, and not concurrently with map_physical on the
+ * same mm, which picks free slots without a lock.
+ */
+xklib_error unmap_physical(void *va)
+{
+	unsigned long addr = (unsigned long)va;
+	struct mm_root *root;
+	pdpte_64 *pud;
+	pde_64 *pmd;
+
+	if (pgd_index(addr) != ROOT_MAP_INDEX)
+		return XKLIB_EINVAL;
+
+	//The root of a live mm only goes away with mm_destroy
+	rcu_read_lock();
+	root = mm_root_find(current->mm);
+	rcu_read_unlock();
+	if (!root)
+		return XKLIB_ENOENT;
+
+	pud = &root->table[pud_index(addr)];
+	if (INVALID_PUD(pud) || !XKLIB_PT(pud))
+		return XKLIB_ENOENT;
+
+	//Unregistered windows are torn down all the same
+	WRITE_ONCE(root->windows[pud_index(addr)], 0);
+
+	pmd = phys_to_virt(pud->pageframenumber << PAGE_SHIFT);
+	WRITE_ONCE(pud->flags, 0);
+	//Only the cpus running the mm can hold the page or its tables
+	flush_tlb_mm_range(root->mn.mm, addr & PAGE_MASK,
+			   (addr & PAGE_MASK) + PAGE_SIZE, PAGE_SHIFT, true);
+	mm_free_tables(pmd, 2);
+
+	return XKLIB_SUCCESS;
+}
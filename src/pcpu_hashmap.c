@@ -0,0 +1,203 @@
+#include "pcpu_hashmap.h"
+
+static void pcpu_hashmap_fold(struct work_struct *work);
+
+struct pcpu_hashmap *pcpu_hashmap__new(hashmap_hash_fn hash_fn,
+				       hashmap_equal_fn equal_fn,
+				       pcpu_hashmap_merge_fn merge_fn,
+				       void *ctx)
+{
+	struct pcpu_hashmap_shard *shard;
+	struct pcpu_hashmap *map;
+	int cpu;
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return NULL;
+
+	map->shards = alloc_percpu(struct pcpu_hashmap_shard);
+	if (!map->shards) {
+		kfree(map);
+		return NULL;
+	}
+
+	map->hash_fn = hash_fn;
+	map->equal_fn = equal_fn;
+	map->merge_fn = merge_fn;
+	map->ctx = ctx;
+	RCU_INIT_POINTER(map->snapshot, NULL);
+	INIT_DELAYED_WORK(&map->fold, pcpu_hashmap_fold);
+
+	for_each_possible_cpu(cpu) {
+		shard = per_cpu_ptr(map->shards, cpu);
+		mutex_init(&shard->lock);
+		hashmap__init(&shard->map, hash_fn, equal_fn, ctx);
+		shard->map.node = cpu_to_node(cpu);
+	}
+
+	return map;
+}
+
+void pcpu_hashmap__free(struct pcpu_hashmap *map)
+{
+	int cpu;
+
+	if (IS_ERR_OR_NULL(map))
+		return;
+
+	pcpu_hashmap_stop_fold(map);
+	hashmap__free(rcu_dereference_protected(map->snapshot, true));
+
+	for_each_possible_cpu(cpu)
+		hashmap__clear(&per_cpu_ptr(map->shards, cpu)->map);
+	free_percpu(map->shards);
+	kfree(map);
+}
+
+/* merges value into the entry of key in map, adding it if needed */
+static size_t pcpu_hashmap_fold_into(struct pcpu_hashmap *map,
+				     struct hashmap *dst, long key, long value)
+{
+	struct hashmap_entry *entry = hashmap__key_first(dst, key);
+
+	if (!entry)
+		return hashmap__add(dst, key, value);
+
+	WRITE_ONCE(entry->value, map->merge_fn(entry->value, value));
+	return 0;
+}
+
+/*
+ * The shard of the current cpu. The task may migrate right after, which
+ * is harmless as the shard lock, not the cpu, guarantees exclusion.
+ */
+size_t pcpu_hashmap_add(struct pcpu_hashmap *map, long key, long value)
+{
+	struct pcpu_hashmap_shard *shard = raw_cpu_ptr(map->shards);
+	size_t err;
+
+	mutex_lock(&shard->lock);
+	err = pcpu_hashmap_fold_into(map, &shard->map, key, value);
+	mutex_unlock(&shard->lock);
+
+	return err;
+}
+
+bool pcpu_hashmap_find(const struct pcpu_hashmap *map, long key, long *value)
+{
+	long acc = 0, v;
+	bool found = false;
+	int cpu;
+
+	rcu_read_lock();
+	for_each_possible_cpu(cpu) {
+		if (!hashmap__find_rcu(&per_cpu_ptr(map->shards, cpu)->map,
+				       key, &v))
+			continue;
+
+		acc = found ? map->merge_fn(acc, v) : v;
+		found = true;
+	}
+	rcu_read_unlock();
+
+	if (found && value)
+		*value = acc;
+	return found;
+}
+
+bool pcpu_hashmap_find_snapshot(const struct pcpu_hashmap *map, long key,
+				long *value)
+{
+	struct hashmap *snapshot;
+	bool found = false;
+
+	rcu_read_lock();
+	snapshot = rcu_dereference(map->snapshot);
+	if (snapshot)
+		found = hashmap__find_rcu(snapshot, key, value);
+	rcu_read_unlock();
+
+	return found;
+}
+
+bool pcpu_hashmap_delete(struct pcpu_hashmap *map, long key)
+{
+	struct pcpu_hashmap_shard *shard;
+	bool deleted = false;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		shard = per_cpu_ptr(map->shards, cpu);
+		mutex_lock(&shard->lock);
+		deleted |= hashmap__delete(&shard->map, key, NULL, NULL);
+		mutex_unlock(&shard->lock);
+	}
+
+	return deleted;
+}
+
+/*
+ * Folds every shard into dst, which should be empty and use the same hash
+ * and equality callbacks. Shards are locked one at a time, so updates
+ * racing with the merge may or may not be part of it.
+ */
+size_t pcpu_hashmap_merge(struct pcpu_hashmap *map, struct hashmap *dst)
+{
+	struct pcpu_hashmap_shard *shard;
+	struct hashmap_entry *cur;
+	size_t bkt, err = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		shard = per_cpu_ptr(map->shards, cpu);
+		mutex_lock(&shard->lock);
+		hashmap__for_each_entry(&shard->map, cur, bkt) {
+			err = pcpu_hashmap_fold_into(map, dst, cur->key,
+						     cur->value);
+			if (err)
+				break;
+		}
+		mutex_unlock(&shard->lock);
+
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static void pcpu_hashmap_fold(struct work_struct *work)
+{
+	struct pcpu_hashmap *map =
+		container_of(to_delayed_work(work), struct pcpu_hashmap, fold);
+	struct hashmap *snapshot, *old;
+
+	snapshot = hashmap__new(map->hash_fn, map->equal_fn, map->ctx);
+	if (!snapshot)
+		goto out;
+
+	if (pcpu_hashmap_merge(map, snapshot)) {
+		hashmap__free(snapshot);
+		goto out;
+	}
+
+	old = rcu_dereference_protected(map->snapshot, true);
+	rcu_assign_pointer(map->snapshot, snapshot);
+	synchronize_rcu();
+	hashmap__free(old);
+
+out:
+	schedule_delayed_work(&map->fold, map->fold_interval);
+}
+
+/* publishes a merged snapshot of the map every interval jiffies */
+void pcpu_hashmap_start_fold(struct pcpu_hashmap *map, unsigned long interval)
+{
+	map->fold_interval = interval;
+	mod_delayed_work(system_wq, &map->fold, 0);
+}
+
+void pcpu_hashmap_stop_fold(struct pcpu_hashmap *map)
+{
+	cancel_delayed_work_sync(&map->fold);
+}
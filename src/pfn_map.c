@@ -0,0 +1,214 @@
+#include <linux/ioport.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#include "debug.h"
+#include "pfn_map.h"
+
+struct pfn_map pfn_map;
+
+/* leaves are allocated one by one while marking, then packed together */
+struct pfn_map_builder {
+	u32 *summary;
+	unsigned long **leaves;
+	size_t nr_chunks;
+	size_t nr_leaves;
+	enum pfn_class class;
+};
+
+/* sets the class of pages [lo, hi) of a leaf */
+static void pfn_map_fill(unsigned long *leaf, size_t lo, size_t hi,
+			 enum pfn_class class)
+{
+	unsigned long pattern = class * (~0UL / 3), mask;
+	size_t w, shift, n;
+
+	while (lo < hi) {
+		w = lo / PFN_MAP_PAGES_PER_WORD;
+		shift = 2 * (lo % PFN_MAP_PAGES_PER_WORD);
+		n = min(hi - lo, PFN_MAP_PAGES_PER_WORD -
+					 lo % PFN_MAP_PAGES_PER_WORD);
+		mask = ~0UL;
+		if (n < PFN_MAP_PAGES_PER_WORD)
+			mask = ((1UL << (2 * n)) - 1) << shift;
+		leaf[w] = (leaf[w] & ~mask) | (pattern & mask);
+		lo += n;
+	}
+}
+
+/* marks [start, end) as b->class, rounded out to whole pages */
+static int pfn_map_mark(struct resource *res, void *arg)
+{
+	struct pfn_map_builder *b = arg;
+	u64 first = res->start >> PAGE_SHIFT;
+	u64 last = min_t(u64, DIV_ROUND_UP((u64)res->end + 1, PAGE_SIZE),
+			 b->nr_chunks * PFN_MAP_CHUNK_PAGES);
+	unsigned long *leaf;
+	size_t chunk, lo, hi;
+	u32 s;
+
+	for (; first < last; first = (chunk + 1) * PFN_MAP_CHUNK_PAGES) {
+		chunk = first / PFN_MAP_CHUNK_PAGES;
+		lo = first % PFN_MAP_CHUNK_PAGES;
+		hi = min_t(u64, last - chunk * PFN_MAP_CHUNK_PAGES,
+			   PFN_MAP_CHUNK_PAGES);
+		s = b->summary[chunk];
+
+		if (!(s & PFN_MAP_MIXED)) {
+			if (s == b->class)
+				continue;
+			if (!lo && hi == PFN_MAP_CHUNK_PAGES) {
+				b->summary[chunk] = b->class;
+				continue;
+			}
+
+			leaf = kvmalloc_array(PFN_MAP_LEAF_WORDS, sizeof(*leaf),
+					      GFP_KERNEL);
+			if (!leaf)
+				return -ENOMEM;
+			pfn_map_fill(leaf, 0, PFN_MAP_CHUNK_PAGES, s);
+			b->leaves[b->nr_leaves] = leaf;
+			s = b->summary[chunk] = PFN_MAP_MIXED | b->nr_leaves++;
+		}
+
+		pfn_map_fill(b->leaves[s & ~PFN_MAP_MIXED], lo, hi, b->class);
+	}
+
+	return 0;
+}
+
+static int pfn_map_span(struct resource *res, void *arg)
+{
+	u64 *end = arg;
+
+	*end = max_t(u64, *end, (u64)res->end + 1);
+	return 0;
+}
+
+/* whether every page of leaf has the same class, stored in class */
+static bool pfn_map_uniform(const unsigned long *leaf, enum pfn_class *class)
+{
+	unsigned long pattern;
+
+	*class = leaf[0] & 3;
+	pattern = *class * (~0UL / 3);
+	for (size_t w = 0; w < PFN_MAP_LEAF_WORDS; w++) {
+		if (leaf[w] != pattern)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Folds the leaves that ended up uniform back into the summary and copies
+ * the others into a single allocation
+ */
+static size_t pfn_map_pack(struct pfn_map_builder *b)
+{
+	unsigned long *leaf;
+	enum pfn_class class;
+	size_t nr = 0;
+	u32 s;
+
+	for (size_t c = 0; c < b->nr_chunks; c++) {
+		s = b->summary[c];
+		if (!(s & PFN_MAP_MIXED))
+			continue;
+
+		leaf = b->leaves[s & ~PFN_MAP_MIXED];
+		if (pfn_map_uniform(leaf, &class)) {
+			b->summary[c] = class;
+			continue;
+		}
+		nr++;
+	}
+
+	if (nr) {
+		pfn_map.leaves = kvmalloc_array(nr * PFN_MAP_LEAF_WORDS,
+						sizeof(*pfn_map.leaves),
+						GFP_KERNEL);
+		if (!pfn_map.leaves)
+			return XKLIB_ENOMEM;
+	}
+
+	for (size_t c = 0; c < b->nr_chunks; c++) {
+		s = b->summary[c];
+		if (!(s & PFN_MAP_MIXED))
+			continue;
+
+		memcpy(&pfn_map.leaves[pfn_map.nr_leaves * PFN_MAP_LEAF_WORDS],
+		       b->leaves[s & ~PFN_MAP_MIXED],
+		       PFN_MAP_LEAF_WORDS * sizeof(*pfn_map.leaves));
+		b->summary[c] = PFN_MAP_MIXED | pfn_map.nr_leaves++;
+	}
+
+	return XKLIB_SUCCESS;
+}
+
+/*
+ * Every memory resource starts out as MMIO, then reserved ranges and
+ * finally system RAM are marked over it: a page claimed by a driver
+ * inside RAM, such as the kernel image, stays RAM
+ */
+size_t pfn_map_init(void)
+{
+	struct pfn_map_builder b = { 0 };
+	size_t err = XKLIB_ENOMEM;
+	u64 end = 0;
+
+	walk_iomem_res_desc(IORES_DESC_NONE, IORESOURCE_MEM, 0, -1, &end,
+			    pfn_map_span);
+	if (!end) {
+		dbg_msg("No memory resource found for the physical frame map");
+		return XKLIB_EINVAL;
+	}
+
+	b.nr_chunks = DIV_ROUND_UP(end, 1ULL << PFN_MAP_CHUNK_SHIFT);
+	b.summary = kvcalloc(b.nr_chunks, sizeof(*b.summary), GFP_KERNEL);
+	b.leaves = kvcalloc(b.nr_chunks, sizeof(*b.leaves), GFP_KERNEL);
+	if (!b.summary || !b.leaves)
+		goto out;
+
+	b.class = PFN_MMIO;
+	if (walk_iomem_res_desc(IORES_DESC_NONE, IORESOURCE_MEM, 0, -1, &b,
+				pfn_map_mark) == -ENOMEM)
+		goto out;
+	b.class = PFN_RESERVED;
+	if (walk_iomem_res_desc(IORES_DESC_RESERVED, IORESOURCE_MEM, 0, -1, &b,
+				pfn_map_mark) == -ENOMEM)
+		goto out;
+	b.class = PFN_RAM;
+	if (walk_system_ram_res(0, -1, &b, pfn_map_mark) == -ENOMEM)
+		goto out;
+
+	err = pfn_map_pack(&b);
+	if (err)
+		goto out;
+
+	pfn_map.summary = b.summary;
+	pfn_map.nr_chunks = b.nr_chunks;
+	b.summary = NULL;
+
+	dbg_msg("Physical frame map: %zu GiB, %zu mixed, %zu bytes",
+		pfn_map.nr_chunks, pfn_map.nr_leaves,
+		pfn_map.nr_chunks * sizeof(*pfn_map.summary) +
+			pfn_map.nr_leaves * PFN_MAP_LEAF_WORDS *
+				sizeof(*pfn_map.leaves));
+
+out:
+	for (size_t i = 0; i < b.nr_leaves; i++)
+		kvfree(b.leaves[i]);
+	kvfree(b.leaves);
+	kvfree(b.summary);
+	return err;
+}
+
+void pfn_map_destroy(void)
+{
+	pfn_map.nr_chunks = 0;
+	kvfree(pfn_map.summary);
+	kvfree(pfn_map.leaves);
+	pfn_map.summary = NULL;
+	pfn_map.leaves = NULL;
+	pfn_map.nr_leaves = 0;
+}
@@ -0,0 +1,267 @@
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/prefetch.h>
+
+#include "range_map.h"
+
+/* starts per cache line, i.e. how many levels below a search prefetches */
+#define RANGE_MAP_PREFETCH (L1_CACHE_BYTES / sizeof(u64))
+
+static inline size_t range_map_table_size(size_t nr)
+{
+	return ALIGN(sizeof(struct range_map_table), L1_CACHE_BYTES) +
+	       (nr + 1) * (sizeof(u64) + sizeof(u32)) +
+	       nr * (sizeof(struct range_map_range) + sizeof(u64));
+}
+
+/* eytz first, at a cache line offset, so prefetches cover whole levels */
+static struct range_map_table *range_map_table_alloc(int node, size_t nr,
+						     gfp_t gfp)
+{
+	struct range_map_table *tbl;
+
+	tbl = kvmalloc_node(range_map_table_size(nr), gfp, node);
+	if (!tbl)
+		return NULL;
+
+	tbl->cow.nr = nr;
+	tbl->eytz = (u64 *)((char *)tbl + ALIGN(sizeof(*tbl), L1_CACHE_BYTES));
+	tbl->max_end = tbl->eytz + nr + 1;
+	tbl->ranges = (struct range_map_range *)(tbl->max_end + nr);
+	tbl->rank = (u32 *)(tbl->ranges + nr);
+	return tbl;
+}
+
+static struct cow_table *range_map_cow_alloc(int node, size_t nr, gfp_t gfp)
+{
+	struct range_map_table *tbl = range_map_table_alloc(node, nr, gfp);
+
+	return tbl ? &tbl->cow : NULL;
+}
+
+static inline struct range_map_table *range_map_table(struct cow_table *cow)
+{
+	return cow ? container_of(cow, struct range_map_table, cow) : NULL;
+}
+
+/* lays out eytz[k..] from ranges[i..] in order, returns the next range */
+static size_t range_map_eytz(struct range_map_table *tbl, size_t i, size_t k)
+{
+	if (k > tbl->cow.nr)
+		return i;
+
+	i = range_map_eytz(tbl, i, 2 * k);
+	tbl->eytz[k] = tbl->ranges[i].start;
+	tbl->rank[k] = i;
+	return range_map_eytz(tbl, i + 1, 2 * k + 1);
+}
+
+/* derives the search structures from the sorted ranges */
+static void range_map_table_index(struct range_map_table *tbl)
+{
+	u64 max_end = 0;
+
+	for (size_t i = 0; i < tbl->cow.nr; i++) {
+		max_end = max(max_end, tbl->ranges[i].end);
+		tbl->max_end[i] = max_end;
+	}
+	range_map_eytz(tbl, 0, 1);
+}
+
+/* number of ranges starting at or before addr */
+static size_t range_map_rank(const struct range_map_table *tbl, u64 addr)
+{
+	size_t k = 1;
+
+	while (k <= tbl->cow.nr) {
+		prefetch(&tbl->eytz[RANGE_MAP_PREFETCH * k]);
+		k = 2 * k + (tbl->eytz[k] <= addr);
+	}
+
+	/* climb back to the last left turn, the first start past addr */
+	k >>= __ffs(~k) + 1;
+	return k ? tbl->rank[k] : tbl->cow.nr;
+}
+
+void range_map__init(struct range_map *map, int node)
+{
+	cow_ptr__init(&map->cow, node);
+}
+
+/* readers may still be running, the table is freed after a grace period */
+void range_map__clear(struct range_map *map)
+{
+	cow_ptr__clear(&map->cow);
+}
+
+size_t range_map__size(const struct range_map *map)
+{
+	return cow_ptr__size(&map->cow);
+}
+
+size_t range_map_insert(struct range_map *map, u64 start, u64 end, long value,
+			gfp_t gfp)
+{
+	struct range_map_table *tbl, *new;
+	struct cow_table *cow;
+	unsigned long flags;
+	size_t nr, pos;
+
+	if (start >= end)
+		return XKLIB_EINVAL;
+
+	cow = cow_ptr_lock(&map->cow, &nr, 1, range_map_cow_alloc, gfp, &flags);
+	if (IS_ERR(cow))
+		return XKLIB_ENOMEM;
+
+	new = range_map_table(cow);
+	tbl = range_map_table(cow_ptr_locked(&map->cow));
+	pos = tbl ? range_map_rank(tbl, start) : 0;
+	if (pos)
+		memcpy(new->ranges, tbl->ranges, pos * sizeof(new->ranges[0]));
+	new->ranges[pos].start = start;
+	new->ranges[pos].end = end;
+	new->ranges[pos].value = value;
+	if (nr > pos)
+		memcpy(&new->ranges[pos + 1], &tbl->ranges[pos],
+		       (nr - pos) * sizeof(new->ranges[0]));
+
+	range_map_table_index(new);
+	cow_ptr_publish(&map->cow, cow);
+	cow_ptr_unlock(&map->cow, flags);
+
+	return XKLIB_SUCCESS;
+}
+
+/*
+ * Removes one range spanning exactly [start, end). The smaller table is
+ * allocated too, so a delete can fail with -ENOMEM.
+ */
+size_t range_map_delete(struct range_map *map, u64 start, u64 end,
+			long *value, gfp_t gfp)
+{
+	struct range_map_table *tbl, *new;
+	struct cow_table *cow;
+	unsigned long flags;
+	size_t nr, pos;
+
+	cow = cow_ptr_lock(&map->cow, &nr, -1, range_map_cow_alloc, gfp,
+			   &flags);
+	if (IS_ERR(cow))
+		return XKLIB_ENOMEM;
+	if (!nr) {
+		cow_ptr_unlock(&map->cow, flags);
+		return XKLIB_ENOENT;
+	}
+
+	new = range_map_table(cow);
+	tbl = range_map_table(cow_ptr_locked(&map->cow));
+	for (pos = range_map_rank(tbl, start); pos-- > 0;) {
+		if (tbl->ranges[pos].start != start)
+			break;
+		if (tbl->ranges[pos].end != end)
+			continue;
+
+		if (value)
+			*value = tbl->ranges[pos].value;
+		if (new) {
+			memcpy(new->ranges, tbl->ranges,
+			       pos * sizeof(new->ranges[0]));
+			memcpy(&new->ranges[pos], &tbl->ranges[pos + 1],
+			       (nr - pos - 1) * sizeof(new->ranges[0]));
+			range_map_table_index(new);
+		}
+		cow_ptr_publish(&map->cow, cow);
+		cow_ptr_unlock(&map->cow, flags);
+		return XKLIB_SUCCESS;
+	}
+
+	cow_ptr_unlock(&map->cow, flags);
+	kvfree(new);
+	return XKLIB_ENOENT;
+}
+
+/*
+ * Replaces the whole content of the map with n ranges sorted by start,
+ * in O(n)
+ */
+size_t range_map_build(struct range_map *map,
+		       const struct range_map_range *ranges, size_t n,
+		       gfp_t gfp)
+{
+	struct range_map_table *new = NULL;
+
+	for (size_t i = 0; i < n; i++) {
+		if (ranges[i].start >= ranges[i].end ||
+		    (i && ranges[i].start < ranges[i - 1].start))
+			return XKLIB_EINVAL;
+	}
+
+	if (n) {
+		new = range_map_table_alloc(map->cow.node, n, gfp);
+		if (!new)
+			return XKLIB_ENOMEM;
+
+		memcpy(new->ranges, ranges, n * sizeof(ranges[0]));
+		range_map_table_index(new);
+	}
+
+	cow_ptr_replace(&map->cow, new ? &new->cow : NULL);
+
+	return XKLIB_SUCCESS;
+}
+
+bool range_map_find(const struct range_map *map, u64 addr,
+		    struct range_map_range *range)
+{
+	struct range_map_table *tbl;
+	bool found = false;
+
+	rcu_read_lock();
+	tbl = range_map_table(rcu_dereference(map->cow.tbl));
+	if (!tbl)
+		goto out;
+
+	for (size_t i = range_map_rank(tbl, addr);
+	     i-- > 0 && tbl->max_end[i] > addr;) {
+		if (tbl->ranges[i].end > addr) {
+			if (range)
+				*range = tbl->ranges[i];
+			found = true;
+			break;
+		}
+	}
+
+out:
+	rcu_read_unlock();
+	return found;
+}
+
+size_t range_map_for_each_overlap(const struct range_map *map, u64 start,
+				  u64 end, range_map_fn fn, void *data)
+{
+	struct range_map_table *tbl;
+	size_t n = 0;
+
+	if (start >= end)
+		return 0;
+
+	rcu_read_lock();
+	tbl = range_map_table(rcu_dereference(map->cow.tbl));
+	if (!tbl)
+		goto out;
+
+	for (size_t i = range_map_rank(tbl, end - 1);
+	     i-- > 0 && tbl->max_end[i] > start;) {
+		if (tbl->ranges[i].end <= start)
+			continue;
+
+		n++;
+		if (!fn(&tbl->ranges[i], data))
+			break;
+	}
+
+out:
+	rcu_read_unlock();
+	return n;
+}
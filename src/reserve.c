@@ -0,0 +1,160 @@
+#include "reserve.h"
+
+struct mm_reserve mm_reserve_tables;
+struct mm_reserve mm_reserve_entries;
+
+static void *mm_reserve_alloc(struct mm_reserve *res)
+{
+	if (res->cache)
+		return kmem_cache_alloc(res->cache, res->gfp);
+	return kmalloc(res->size, res->gfp);
+}
+
+static void mm_reserve_free(struct mm_reserve *res, void *obj)
+{
+	if (res->cache)
+		kmem_cache_free(res->cache, obj);
+	else
+		kfree(obj);
+}
+
+static void mm_reserve_refill(struct work_struct *work)
+{
+	struct mm_reserve *res = container_of(work, struct mm_reserve, refill);
+	unsigned long flags;
+	void *obj;
+
+	while (READ_ONCE(res->nr) < res->target) {
+		obj = mm_reserve_alloc(res);
+		if (!obj)
+			break;
+
+		spin_lock_irqsave(&res->lock, flags);
+		if (res->nr < res->target) {
+			res->objs[res->nr++] = obj;
+			obj = NULL;
+		}
+		spin_unlock_irqrestore(&res->lock, flags);
+
+		//Somebody else topped it up in the meantime
+		if (obj) {
+			mm_reserve_free(res, obj);
+			break;
+		}
+	}
+}
+
+u64 mm_reserve_init(struct mm_reserve *res, const char *name, size_t size,
+		    struct kmem_cache *cache, gfp_t gfp, unsigned int target)
+{
+	spin_lock_init(&res->lock);
+	INIT_WORK(&res->refill, mm_reserve_refill);
+	atomic64_set(&res->exhausted, 0);
+	atomic64_set(&res->leaked, 0);
+	res->name = name;
+	res->size = size;
+	res->cache = cache;
+	res->gfp = gfp;
+	res->target = target;
+	res->nr = 0;
+
+	res->objs = kmalloc_array(target, sizeof(void *), GFP_KERNEL);
+	if (!res->objs)
+		return XKLIB_ENOMEM;
+
+	mm_reserve_refill(&res->refill);
+	if (res->nr < target) {
+		mm_reserve_destroy(res);
+		return XKLIB_ENOMEM;
+	}
+
+	return XKLIB_SUCCESS;
+}
+
+void mm_reserve_destroy(struct mm_reserve *res)
+{
+	if (!res->objs)
+		return;
+
+	cancel_work_sync(&res->refill);
+	while (res->nr)
+		mm_reserve_free(res, res->objs[--res->nr]);
+	kfree(res->objs);
+	res->objs = NULL;
+
+	dbg_msg("Reserve %s ran dry %lld times, leaked %lld objects", res->name,
+		atomic64_read(&res->exhausted), atomic64_read(&res->leaked));
+}
+
+/*
+ * Takes an object out of the reserve without sleeping.
+ * In NMI context the lock is only tried, as the interrupted code may be
+ * holding it, and no refill can be queued from there: the next regular
+ * caller does it.
+ */
+void *mm_reserve_get(struct mm_reserve *res)
+{
+	unsigned long flags;
+	void *obj = NULL;
+	bool nmi = in_nmi();
+	unsigned int left;
+
+	if (unlikely(nmi)) {
+		if (!spin_trylock_irqsave(&res->lock, flags))
+			goto out;
+	} else {
+		spin_lock_irqsave(&res->lock, flags);
+	}
+
+	if (likely(res->nr))
+		obj = res->objs[--res->nr];
+	left = res->nr;
+	spin_unlock_irqrestore(&res->lock, flags);
+
+	if (!nmi && left < res->target / 2)
+		schedule_work(&res->refill);
+
+out:
+	if (unlikely(!obj))
+		atomic64_inc(&res->exhausted);
+	return obj;
+}
+
+/*
+ * Gives back an object taken with mm_reserve_get that was never published,
+ * for the error paths of atomic callers.
+ * Outside of NMIs an object that doesn't fit back is freed. In NMI context
+ * nothing can be freed, so it is leaked and counted.
+ */
+void mm_reserve_put(struct mm_reserve *res, void *obj)
+{
+	unsigned long flags;
+	bool nmi = in_nmi();
+
+	if (!obj)
+		return;
+
+	if (res->gfp & __GFP_ZERO)
+		memset(obj, 0, res->size);
+
+	if (unlikely(nmi)) {
+		if (!spin_trylock_irqsave(&res->lock, flags))
+			goto full;
+	} else {
+		spin_lock_irqsave(&res->lock, flags);
+	}
+
+	if (likely(res->nr < res->target)) {
+		res->objs[res->nr++] = obj;
+		obj = NULL;
+	}
+	spin_unlock_irqrestore(&res->lock, flags);
+	if (likely(!obj))
+		return;
+
+full:
+	if (unlikely(nmi))
+		atomic64_inc(&res->leaked);
+	else
+		kfree(obj);
+}
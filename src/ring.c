@@ -0,0 +1,100 @@
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/topology.h>
+
+#include "ring.h"
+
+static inline size_t ring_size(size_t size)
+{
+	return roundup_pow_of_two(max_t(size_t, size, 2));
+}
+
+struct ring_spsc *ring_spsc__new(size_t size, int node, gfp_t gfp)
+{
+	struct ring_spsc *ring;
+
+	size = ring_size(size);
+	ring = kvzalloc_node(struct_size(ring, slots, size), gfp, node);
+	if (!ring)
+		return NULL;
+
+	ring->mask = size - 1;
+	return ring;
+}
+
+void ring_spsc__free(struct ring_spsc *ring)
+{
+	kvfree(ring);
+}
+
+struct ring_mpsc *ring_mpsc__new(size_t size, int node, gfp_t gfp)
+{
+	struct ring_mpsc *ring;
+
+	size = ring_size(size);
+	ring = kvzalloc_node(struct_size(ring, slots, size), gfp, node);
+	if (!ring)
+		return NULL;
+
+	ring->mask = size - 1;
+	for (size_t i = 0; i < size; i++)
+		ring->slots[i].seq = i;
+	return ring;
+}
+
+void ring_mpsc__free(struct ring_mpsc *ring)
+{
+	kvfree(ring);
+}
+
+struct ring_pcpu *ring_pcpu__new(size_t size, gfp_t gfp)
+{
+	struct ring_pcpu *ring;
+	int cpu;
+
+	ring = kzalloc(struct_size(ring, rings, nr_cpu_ids), gfp);
+	if (!ring)
+		return NULL;
+
+	ring->nr_rings = nr_cpu_ids;
+	for_each_possible_cpu(cpu) {
+		ring->rings[cpu] = ring_spsc__new(size, cpu_to_node(cpu), gfp);
+		if (!ring->rings[cpu]) {
+			ring_pcpu__free(ring);
+			return NULL;
+		}
+	}
+
+	return ring;
+}
+
+void ring_pcpu__free(struct ring_pcpu *ring)
+{
+	if (!ring)
+		return;
+
+	for (unsigned int i = 0; i < ring->nr_rings; i++)
+		ring_spsc__free(ring->rings[i]);
+	kfree(ring);
+}
+
+/*
+ * Drains the cpu rings one after the other, each call starting one ring
+ * further so that a busy cpu can't starve the others
+ */
+size_t ring_pcpu_dequeue_batch(struct ring_pcpu *ring, void **objs, size_t n)
+{
+	unsigned int start = ring->next, i = start;
+	size_t done = 0;
+
+	do {
+		if (ring->rings[i])
+			done += ring_spsc_dequeue_batch(ring->rings[i],
+							objs + done, n - done);
+		if (++i == ring->nr_rings)
+			i = 0;
+	} while (i != start && done < n);
+
+	ring->next = start + 1 == ring->nr_rings ? 0 : start + 1;
+	return done;
+}
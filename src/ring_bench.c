@@ -0,0 +1,329 @@
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/kfifo.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/sched/task.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+
+#include "ring.h"
+
+/* objects moved by every run, split between the producers */
+#define RING_BENCH_OBJS (1UL << 19)
+#define RING_BENCH_SIZE 4096
+#define RING_BENCH_BATCH 32
+#define RING_BENCH_MAX_PRODUCERS 64
+
+enum ring_bench_queue {
+	/* only run with a single producer */
+	RING_BENCH_SPSC,
+	RING_BENCH_MPSC,
+	RING_BENCH_PCPU,
+	/* kfifo only has one producer, the others serialize on a spinlock */
+	RING_BENCH_KFIFO,
+	/* list_head queue under a spinlock, spliced whole by the consumer */
+	RING_BENCH_LIST,
+	RING_BENCH_QUEUES,
+};
+
+static const char *const ring_bench_names[] = {
+	[RING_BENCH_SPSC] = "spsc",
+	[RING_BENCH_MPSC] = "mpsc",
+	[RING_BENCH_PCPU] = "pcpu",
+	[RING_BENCH_KFIFO] = "kfifo",
+	[RING_BENCH_LIST] = "list",
+};
+
+struct ring_bench {
+	enum ring_bench_queue queue;
+	size_t per_producer;
+	size_t total;
+	bool go;
+	/* set before go when not every thread could be started */
+	bool abort;
+
+	struct ring_spsc *spsc;
+	struct ring_mpsc *mpsc;
+	struct ring_pcpu *pcpu;
+	DECLARE_KFIFO_PTR(fifo, void *);
+	spinlock_t lock;
+	struct list_head list;
+
+	/* the objects queued, one list_head each for RING_BENCH_LIST */
+	struct list_head *objs;
+	struct completion done;
+};
+
+struct ring_bench_thread {
+	struct ring_bench *bench;
+	struct task_struct *task;
+	size_t id;
+};
+
+static bool ring_bench_push(struct ring_bench *b, struct list_head *obj)
+{
+	switch (b->queue) {
+	case RING_BENCH_SPSC:
+		return ring_spsc_enqueue(b->spsc, obj);
+	case RING_BENCH_MPSC:
+		return ring_mpsc_enqueue(b->mpsc, obj);
+	case RING_BENCH_PCPU:
+		return ring_pcpu_enqueue(b->pcpu, obj);
+	case RING_BENCH_KFIFO:
+		return kfifo_in_spinlocked(&b->fifo, (void **)&obj, 1,
+					   &b->lock);
+	default:
+		spin_lock(&b->lock);
+		list_add_tail(obj, &b->list);
+		spin_unlock(&b->lock);
+		return true;
+	}
+}
+
+static size_t ring_bench_pop(struct ring_bench *b, void **objs)
+{
+	struct list_head *pos;
+	LIST_HEAD(local);
+	size_t n = 0;
+
+	switch (b->queue) {
+	case RING_BENCH_SPSC:
+		return ring_spsc_dequeue_batch(b->spsc, objs, RING_BENCH_BATCH);
+	case RING_BENCH_MPSC:
+		return ring_mpsc_dequeue_batch(b->mpsc, objs, RING_BENCH_BATCH);
+	case RING_BENCH_PCPU:
+		return ring_pcpu_dequeue_batch(b->pcpu, objs, RING_BENCH_BATCH);
+	case RING_BENCH_KFIFO:
+		return kfifo_out(&b->fifo, objs, RING_BENCH_BATCH);
+	default:
+		spin_lock(&b->lock);
+		list_splice_init(&b->list, &local);
+		spin_unlock(&b->lock);
+		list_for_each(pos, &local)
+			n++;
+		return n;
+	}
+}
+
+/* false when the run was aborted */
+static bool ring_bench_wait(struct ring_bench *b)
+{
+	while (!smp_load_acquire(&b->go))
+		cond_resched();
+	return !b->abort;
+}
+
+/* the consumer gets a cpu of its own when there is more than one */
+static int ring_bench_cpu(const int *cpus, int nr_cpus, size_t i)
+{
+	if (!i || nr_cpus == 1)
+		return cpus[0];
+	return cpus[1 + (i - 1) % (nr_cpus - 1)];
+}
+
+static int ring_bench_producer(void *data)
+{
+	struct ring_bench_thread *t = data;
+	struct ring_bench *b = t->bench;
+	struct list_head *obj = &b->objs[t->id * b->per_producer];
+
+	if (!ring_bench_wait(b))
+		return 0;
+	for (size_t i = 0; i < b->per_producer; i++) {
+		while (!ring_bench_push(b, &obj[i]))
+			cond_resched();
+	}
+
+	return 0;
+}
+
+static int ring_bench_consumer(void *data)
+{
+	struct ring_bench_thread *t = data;
+	struct ring_bench *b = t->bench;
+	void *objs[RING_BENCH_BATCH];
+	size_t n, seen = 0;
+
+	if (!ring_bench_wait(b))
+		return 0;
+	while (seen < b->total) {
+		n = ring_bench_pop(b, objs);
+		if (!n)
+			cond_resched();
+		seen += n;
+	}
+
+	complete(&b->done);
+	return 0;
+}
+
+static int ring_bench_queue_init(struct ring_bench *b)
+{
+	switch (b->queue) {
+	case RING_BENCH_SPSC:
+		b->spsc = ring_spsc__new(RING_BENCH_SIZE, NUMA_NO_NODE,
+					 GFP_KERNEL);
+		return b->spsc ? 0 : -ENOMEM;
+	case RING_BENCH_MPSC:
+		b->mpsc = ring_mpsc__new(RING_BENCH_SIZE, NUMA_NO_NODE,
+					 GFP_KERNEL);
+		return b->mpsc ? 0 : -ENOMEM;
+	case RING_BENCH_PCPU:
+		b->pcpu = ring_pcpu__new(RING_BENCH_SIZE, GFP_KERNEL);
+		return b->pcpu ? 0 : -ENOMEM;
+	case RING_BENCH_KFIFO:
+		return kfifo_alloc(&b->fifo, RING_BENCH_SIZE, GFP_KERNEL);
+	default:
+		INIT_LIST_HEAD(&b->list);
+		return 0;
+	}
+}
+
+static void ring_bench_queue_destroy(struct ring_bench *b)
+{
+	switch (b->queue) {
+	case RING_BENCH_SPSC:
+		ring_spsc__free(b->spsc);
+		break;
+	case RING_BENCH_MPSC:
+		ring_mpsc__free(b->mpsc);
+		break;
+	case RING_BENCH_PCPU:
+		ring_pcpu__free(b->pcpu);
+		break;
+	case RING_BENCH_KFIFO:
+		kfifo_free(&b->fifo);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Moves RING_BENCH_OBJS objects from producer threads to one consumer,
+ * the consumer pinned to the first online cpu and the producers spread
+ * over the others, more than one per cpu when they outnumber the cpus.
+ * Returns the time taken in ns, or a negative error.
+ */
+static s64 ring_bench_run(struct ring_bench *b, const int *cpus, int nr_cpus,
+			  size_t producers)
+{
+	struct ring_bench_thread *threads, *t;
+	s64 ret;
+	u64 start;
+	size_t i;
+
+	b->per_producer = RING_BENCH_OBJS / producers;
+	b->total = b->per_producer * producers;
+	b->go = b->abort = false;
+	init_completion(&b->done);
+	spin_lock_init(&b->lock);
+
+	ret = ring_bench_queue_init(b);
+	if (ret)
+		return ret;
+
+	threads = kcalloc(producers + 1, sizeof(*threads), GFP_KERNEL);
+	if (!threads) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* threads[0] is the consumer */
+	for (i = 0; i <= producers; i++) {
+		t = &threads[i];
+		t->bench = b;
+		t->id = i - 1;
+		t->task = kthread_create(i ? ring_bench_producer :
+					     ring_bench_consumer,
+					 t, "xklib_ring/%zu", i);
+		if (IS_ERR(t->task)) {
+			ret = PTR_ERR(t->task);
+			t->task = NULL;
+			break;
+		}
+
+		get_task_struct(t->task);
+		kthread_bind(t->task, ring_bench_cpu(cpus, nr_cpus, i));
+		wake_up_process(t->task);
+	}
+
+	b->abort = ret != 0;
+	start = ktime_get_ns();
+	smp_store_release(&b->go, true);
+	if (!ret) {
+		wait_for_completion(&b->done);
+		ret = ktime_get_ns() - start;
+	}
+
+	for (i = 0; i <= producers && threads[i].task; i++) {
+		kthread_stop(threads[i].task);
+		put_task_struct(threads[i].task);
+	}
+
+	kfree(threads);
+out:
+	ring_bench_queue_destroy(b);
+	return ret;
+}
+
+static int ring_bench_show(struct seq_file *m, void *v)
+{
+	struct ring_bench *b;
+	int *cpus, nr_cpus = 0, cpu;
+	s64 ns;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	cpus = kcalloc(nr_cpu_ids, sizeof(*cpus), GFP_KERNEL);
+	if (b)
+		b->objs = kvmalloc_array(RING_BENCH_OBJS, sizeof(*b->objs),
+					 GFP_KERNEL);
+	if (!b || !cpus || !b->objs) {
+		if (b)
+			kvfree(b->objs);
+		kfree(cpus);
+		kfree(b);
+		return -ENOMEM;
+	}
+
+	cpus_read_lock();
+	for_each_online_cpu(cpu)
+		cpus[nr_cpus++] = cpu;
+
+	seq_puts(m, "queue producers objects ns mops\n");
+	for (size_t producers = 1; producers <= RING_BENCH_MAX_PRODUCERS;
+	     producers *= 2) {
+		for (b->queue = 0; b->queue < RING_BENCH_QUEUES; b->queue++) {
+			if (b->queue == RING_BENCH_SPSC && producers > 1)
+				continue;
+
+			ns = ring_bench_run(b, cpus, nr_cpus, producers);
+			if (ns < 0) {
+				seq_printf(m, "%s %zu error %lld\n",
+					   ring_bench_names[b->queue],
+					   producers, ns);
+				continue;
+			}
+			seq_printf(m, "%s %zu %zu %lld %llu\n",
+				   ring_bench_names[b->queue], producers,
+				   b->total, ns,
+				   b->total * 1000 / max_t(u64, ns, 1));
+		}
+	}
+	cpus_read_unlock();
+
+	kvfree(b->objs);
+	kfree(cpus);
+	kfree(b);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ring_bench);
+
+void ring_bench_debugfs_init(struct dentry *dir)
+{
+	if (!IS_ERR_OR_NULL(dir))
+		debugfs_create_file("ring_bench", 0400, dir, NULL,
+				    &ring_bench_fops);
+}
@@ -0,0 +1,246 @@
+#include <linux/err.h>
+#include <linux/slab.h>
+
+#include "snap_map.h"
+
+/* at least twice as many index buckets as pairs */
+#define SNAP_MAP_MIN_CAP_BITS 3
+/* bloom bits per key, rounded up to a power of two number of words */
+#define SNAP_MAP_BLOOM_BITS 16
+
+static inline u64 snap_map_hash(long key)
+{
+	u64 h = key;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* the three bits of a key in its bloom word, the top half is the tag */
+static inline u64 snap_map_bloom_bits(u64 h)
+{
+	return (1ULL << (h & 63)) | (1ULL << ((h >> 6) & 63)) |
+	       (1ULL << ((h >> 12) & 63));
+}
+
+static inline u64 *snap_map_bloom_word(const struct snap_map_table *tbl,
+				       u64 h)
+{
+	return &tbl->bloom[(h >> 18) & tbl->bloom_mask];
+}
+
+static size_t snap_map_fit_bits(size_t n, size_t min_bits)
+{
+	size_t bits = min_bits;
+
+	while ((1UL << bits) < n)
+		bits++;
+	return bits;
+}
+
+/* a table able to hold n pairs, empty */
+static struct snap_map_table *snap_map_table_alloc(int node, size_t n,
+						   gfp_t gfp)
+{
+	size_t cap_bits = snap_map_fit_bits(2 * n, SNAP_MAP_MIN_CAP_BITS);
+	size_t bloom_words, size;
+	struct snap_map_table *tbl;
+
+	bloom_words = 1UL << snap_map_fit_bits(
+			      DIV_ROUND_UP(n * SNAP_MAP_BLOOM_BITS, 64), 0);
+	size = ALIGN(sizeof(*tbl), L1_CACHE_BYTES) + bloom_words * sizeof(u64) +
+	       (sizeof(struct snap_map_index) << cap_bits) +
+	       n * sizeof(struct snap_map_pair);
+
+	tbl = kvmalloc_node(size, gfp | __GFP_ZERO, node);
+	if (!tbl)
+		return NULL;
+
+	tbl->cap_bits = cap_bits;
+	tbl->bloom_mask = bloom_words - 1;
+	tbl->bloom = (u64 *)((char *)tbl + ALIGN(sizeof(*tbl), L1_CACHE_BYTES));
+	tbl->index = (struct snap_map_index *)(tbl->bloom + bloom_words);
+	tbl->pairs = (struct snap_map_pair *)(tbl->index + (1UL << cap_bits));
+	return tbl;
+}
+
+static struct cow_table *snap_map_cow_alloc(int node, size_t n, gfp_t gfp)
+{
+	struct snap_map_table *tbl = snap_map_table_alloc(node, n, gfp);
+
+	return tbl ? &tbl->cow : NULL;
+}
+
+static inline struct snap_map_table *snap_map_table(struct cow_table *cow)
+{
+	return cow ? container_of(cow, struct snap_map_table, cow) : NULL;
+}
+
+static struct snap_map_pair *snap_map_lookup(const struct snap_map_table *tbl,
+					     long key, u64 h)
+{
+	size_t mask = (1UL << tbl->cap_bits) - 1;
+	size_t pos = (u32)(h >> 32) >> (32 - tbl->cap_bits);
+	const struct snap_map_index *ix;
+
+	for (; (ix = &tbl->index[pos])->idx; pos = (pos + 1) & mask) {
+		if (ix->tag == (u32)(h >> 32) &&
+		    tbl->pairs[ix->idx - 1].key == key)
+			return &tbl->pairs[ix->idx - 1];
+	}
+
+	return NULL;
+}
+
+/* tbl must have room for one more pair and not hold key yet */
+static void snap_map_table_add(struct snap_map_table *tbl, long key,
+			       long value)
+{
+	size_t mask = (1UL << tbl->cap_bits) - 1;
+	u64 h = snap_map_hash(key);
+	size_t pos = (u32)(h >> 32) >> (32 - tbl->cap_bits);
+
+	tbl->pairs[tbl->cow.nr].key = key;
+	tbl->pairs[tbl->cow.nr].value = value;
+	tbl->cow.nr++;
+
+	while (tbl->index[pos].idx)
+		pos = (pos + 1) & mask;
+	tbl->index[pos].idx = tbl->cow.nr;
+	tbl->index[pos].tag = h >> 32;
+	*snap_map_bloom_word(tbl, h) |= snap_map_bloom_bits(h);
+}
+
+void snap_map__init(struct snap_map *map, int node)
+{
+	cow_ptr__init(&map->cow, node);
+}
+
+/* readers may still be running, the table is freed after a grace period */
+void snap_map__clear(struct snap_map *map)
+{
+	cow_ptr__clear(&map->cow);
+}
+
+size_t snap_map__size(const struct snap_map *map)
+{
+	return cow_ptr__size(&map->cow);
+}
+
+size_t snap_map_update(struct snap_map *map, long key, long value, gfp_t gfp)
+{
+	struct snap_map_table *tbl, *new;
+	struct snap_map_pair *pair;
+	struct cow_table *cow;
+	unsigned long flags;
+	size_t nr;
+
+	cow = cow_ptr_lock(&map->cow, &nr, 1, snap_map_cow_alloc, gfp, &flags);
+	if (IS_ERR(cow))
+		return XKLIB_ENOMEM;
+
+	new = snap_map_table(cow);
+	tbl = snap_map_table(cow_ptr_locked(&map->cow));
+	for (size_t i = 0; i < nr; i++) {
+		pair = &tbl->pairs[i];
+		snap_map_table_add(new, pair->key,
+				   pair->key == key ? value : pair->value);
+	}
+	if (!tbl || !snap_map_lookup(tbl, key, snap_map_hash(key)))
+		snap_map_table_add(new, key, value);
+
+	cow_ptr_publish(&map->cow, cow);
+	cow_ptr_unlock(&map->cow, flags);
+
+	return XKLIB_SUCCESS;
+}
+
+/*
+ * The smaller table is allocated too, so a delete can fail with
+ * XKLIB_ENOMEM
+ */
+size_t snap_map_delete(struct snap_map *map, long key, long *value, gfp_t gfp)
+{
+	struct snap_map_table *tbl, *new;
+	struct snap_map_pair *pair;
+	struct cow_table *cow;
+	unsigned long flags;
+	size_t nr;
+
+	cow = cow_ptr_lock(&map->cow, &nr, -1, snap_map_cow_alloc, gfp, &flags);
+	if (IS_ERR(cow))
+		return XKLIB_ENOMEM;
+
+	new = snap_map_table(cow);
+	tbl = snap_map_table(cow_ptr_locked(&map->cow));
+	pair = tbl ? snap_map_lookup(tbl, key, snap_map_hash(key)) : NULL;
+	if (!pair) {
+		cow_ptr_unlock(&map->cow, flags);
+		kvfree(new);
+		return XKLIB_ENOENT;
+	}
+
+	if (value)
+		*value = pair->value;
+	for (size_t i = 0; new && i < nr; i++) {
+		if (tbl->pairs[i].key != key)
+			snap_map_table_add(new, tbl->pairs[i].key,
+					   tbl->pairs[i].value);
+	}
+
+	cow_ptr_publish(&map->cow, cow);
+	cow_ptr_unlock(&map->cow, flags);
+
+	return XKLIB_SUCCESS;
+}
+
+size_t snap_map_build(struct snap_map *map, const struct snap_map_pair *pairs,
+		      size_t n, gfp_t gfp)
+{
+	struct snap_map_table *new = NULL;
+
+	if (n) {
+		new = snap_map_table_alloc(map->cow.node, n, gfp);
+		if (!new)
+			return XKLIB_ENOMEM;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (snap_map_lookup(new, pairs[i].key,
+				    snap_map_hash(pairs[i].key))) {
+			kvfree(new);
+			return XKLIB_EEXIST;
+		}
+		snap_map_table_add(new, pairs[i].key, pairs[i].value);
+	}
+
+	cow_ptr_replace(&map->cow, new ? &new->cow : NULL);
+
+	return XKLIB_SUCCESS;
+}
+
+bool snap_map_find(const struct snap_map *map, long key, long *value)
+{
+	struct snap_map_table *tbl;
+	struct snap_map_pair *pair = NULL;
+	u64 h = snap_map_hash(key), bits;
+
+	rcu_read_lock();
+	tbl = snap_map_table(rcu_dereference(map->cow.tbl));
+	if (!tbl)
+		goto out;
+
+	bits = snap_map_bloom_bits(h);
+	if ((*snap_map_bloom_word(tbl, h) & bits) != bits)
+		goto out;
+
+	pair = snap_map_lookup(tbl, key, h);
+	if (pair && value)
+		*value = pair->value;
+
+out:
+	rcu_read_unlock();
+	return pair;
+}
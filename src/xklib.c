@@ -1,6 +1,243 @@
+#include <linux/capability.h>
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/version.h>
+
 #include "xklib.h"
 
 bool bXklibInit = false;
+struct dentry *xklib_debugfs;
+
+static u64 xklib_vmcall_key;
+
+static dev_t xklib_devt;
+static struct cdev xklib_cdev;
+static struct class *xklib_class;
+
+/*
+ * map_physical and unmap_physical pick and free the window slots of an mm
+ * without a lock, callers sharing an address space must not race
+ */
+static DEFINE_MUTEX(xklib_map_lock);
+
+static long xklib_errno(xklib_error err)
+{
+	switch (err) {
+	case XKLIB_SUCCESS:
+		return 0;
+	case XKLIB_ENOMEM:
+		return -ENOMEM;
+	case XKLIB_EEXIST:
+		return -EEXIST;
+	case XKLIB_ENOENT:
+		return -ENOENT;
+	case XKLIB_EINVAL:
+		return -EINVAL;
+	default:
+		return -EIO;
+	}
+}
+
+static long xklib_ioctl_translate(struct xklib_ioctl_translate *t)
+{
+	last_pt_t last_pt = get_last_pt(t->va);
+
+	switch (last_pt.pt_type) {
+	case pt_type_pte:
+		t->pa = pte_pfn(last_pt.pte) << PAGE_SHIFT |
+			(t->va & ~PAGE_MASK);
+		return 0;
+	case pt_type_pmd:
+		t->pa = pmd_pfn(last_pt.pmd) << PAGE_SHIFT |
+			(t->va & ~PMD_MASK);
+		return 0;
+	default:
+		return -ENOENT;
+	}
+}
+
+static long xklib_ioctl_read(struct xklib_ioctl_read *r)
+{
+	struct pt_permissions perms = { .read = 1 };
+	long ret = 0;
+	void *va;
+
+	if (!r->len || r->len > XKLIB_IOCTL_MAX_READ ||
+	    (r->pa & ~PAGE_MASK) + r->len > PAGE_SIZE)
+		return -EINVAL;
+	//Reads of MMIO have side effects
+	if (pfn_map_class(r->pa) != PFN_RAM)
+		return -ENXIO;
+
+	mutex_lock(&xklib_map_lock);
+	va = map_physical(r->pa, perms);
+	if (va) {
+		if (copy_to_user((void __user *)r->buf, va, r->len))
+			ret = -EFAULT;
+		unmap_physical(va);
+	} else {
+		ret = -ENOMEM;
+	}
+	mutex_unlock(&xklib_map_lock);
+
+	return ret;
+}
+
+static long xklib_ioctl_map(struct xklib_ioctl_map *m)
+{
+	struct pt_permissions perms = { .read = 1, .write = 1 };
+	void *va;
+
+	//Windows are write-back and writable, MMIO must not get one
+	if (pfn_map_class(m->pa) != PFN_RAM)
+		return -ENXIO;
+
+	mutex_lock(&xklib_map_lock);
+	va = map_physical(m->pa, perms);
+	mutex_unlock(&xklib_map_lock);
+	if (!va)
+		return -ENOMEM;
+
+	m->va = (u64)va;
+	return 0;
+}
+
+static long xklib_ioctl_unmap(struct xklib_ioctl_unmap *u)
+{
+	xklib_error err;
+
+	mutex_lock(&xklib_map_lock);
+	err = unmap_physical((void *)u->va);
+	mutex_unlock(&xklib_map_lock);
+
+	return xklib_errno(err);
+}
+
+//Pages that are not RAM are skipped, one window at a time for the others
+static long xklib_ioctl_scan(struct xklib_ioctl_scan *s)
+{
+	struct pt_permissions perms = { .read = 1 };
+	u64 pa = ALIGN(s->pa, sizeof(u64)), end = s->pa + s->len, next;
+	u64 *p, nr;
+	void *va;
+
+	if (!s->len || s->len > XKLIB_IOCTL_MAX_SCAN)
+		return -EINVAL;
+
+	s->hits = 0;
+	for (; pa + sizeof(u64) <= end; pa = next) {
+		next = min_t(u64, (pa & PAGE_MASK) + PAGE_SIZE, end);
+		if (pfn_map_class(pa) != PFN_RAM)
+			continue;
+
+		mutex_lock(&xklib_map_lock);
+		va = map_physical(pa, perms);
+		if (!va) {
+			mutex_unlock(&xklib_map_lock);
+			return -ENOMEM;
+		}
+		nr = (next - pa) / sizeof(u64);
+		for (p = va; nr--; p++)
+			s->hits += READ_ONCE(*p) == s->pattern;
+		unmap_physical(va);
+		mutex_unlock(&xklib_map_lock);
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static long xklib_ioctl(struct file *file, unsigned int cmd,
+			unsigned long arg)
+{
+	xklib_ioctl_data data;
+	long ret;
+
+	//Every request reads, maps or locates physical memory
+	if (!capable(CAP_SYS_RAWIO))
+		return -EPERM;
+
+	if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
+		return -EFAULT;
+
+	switch (cmd) {
+	case xklib_init:
+		xklib_vmcall_key = data.init.vmcall_key;
+		return 0;
+	case xklib_translate:
+		ret = xklib_ioctl_translate(&data.translate);
+		break;
+	case xklib_read:
+		return xklib_ioctl_read(&data.read);
+	case xklib_map:
+		ret = xklib_ioctl_map(&data.map);
+		break;
+	case xklib_unmap:
+		return xklib_ioctl_unmap(&data.unmap);
+	case xklib_scan:
+		ret = xklib_ioctl_scan(&data.scan);
+		break;
+	default:
+		return -ENOTTY;
+	}
+
+	if (!ret && copy_to_user((void __user *)arg, &data, sizeof(data)))
+		return -EFAULT;
+	return ret;
+}
+
+static const struct file_operations xklib_fops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = xklib_ioctl,
+};
+
+static int xklib_dev_create(void)
+{
+	struct device *dev;
+	int err;
+
+	err = alloc_chrdev_region(&xklib_devt, 0, 1, DEVICE_NAME);
+	if (err)
+		return err;
+
+	cdev_init(&xklib_cdev, &xklib_fops);
+	err = cdev_add(&xklib_cdev, xklib_devt, 1);
+	if (err)
+		goto unregister;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	xklib_class = class_create(CLASS_NAME);
+#else
+	xklib_class = class_create(THIS_MODULE, CLASS_NAME);
+#endif
+	if (IS_ERR(xklib_class)) {
+		err = PTR_ERR(xklib_class);
+		goto del;
+	}
+
+	dev = device_create(xklib_class, NULL, xklib_devt, NULL, DEVICE_NAME);
+	if (IS_ERR(dev)) {
+		err = PTR_ERR(dev);
+		goto destroy_class;
+	}
+	return 0;
+
+destroy_class:
+	class_destroy(xklib_class);
+del:
+	cdev_del(&xklib_cdev);
+unregister:
+	unregister_chrdev_region(xklib_devt, 1);
+	return err;
+}
+
+static void xklib_dev_destroy(void)
+{
+	device_destroy(xklib_class, xklib_devt);
+	class_destroy(xklib_class);
+	cdev_del(&xklib_cdev);
+	unregister_chrdev_region(xklib_devt, 1);
+}
 
 static int __init ModuleInit(void)
 {
@@ -11,16 +248,31 @@ static int __init ModuleInit(void)
 
 	dbg_msg("XKLib initializing...");
 
+	xklib_debugfs = debugfs_create_dir("xklib", NULL);
 	xklib_error err = mm_init();
+	if (err) {
+		debugfs_remove_recursive(xklib_debugfs);
+		return err;
+	}
+
+	int ret = xklib_dev_create();
+	if (ret) {
+		dbg_msg("Could not create /dev/%s: %d", DEVICE_NAME, ret);
+		mm_destroy();
+		debugfs_remove_recursive(xklib_debugfs);
+		return ret;
+	}
 
 	bXklibInit = true;
 
-	return err;
+	return 0;
 }
 
 static void __exit ModuleExit(void)
 {
+	xklib_dev_destroy();
 	mm_destroy();
+	debugfs_remove_recursive(xklib_debugfs);
 
 	dbg_msg("XKLib exiting");
 }
@@ -30,4 +282,4 @@ module_exit(ModuleExit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("cutecatsandvirtualmachines");
-MODULE_DESCRIPTION("~");
\ No newline at end of file
+MODULE_DESCRIPTION("~");
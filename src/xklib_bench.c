@@ -0,0 +1,1119 @@
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/task.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/tsc.h>
+#endif
+
+#include "chashmap.h"
+#include "debug.h"
+#include "hashmap.h"
+#include "lat_hist.h"
+#include "memory.h"
+#include "pcpu_hashmap.h"
+#include "ring.h"
+#include "xk_hashmap.h"
+
+/*
+ * Microbenchmarks of the mapper and of the hashmaps, run on load with
+ * run_on_load=1 or by writing a suite name to xklib_bench/run in debugfs:
+ *
+ *   echo all > /sys/kernel/debug/xklib_bench/run
+ *
+ * Every benchmark runs on 1, 2, 4... pinned kthreads up to bench_threads
+ * and times each operation on its own. Lookups and read/write mixes share
+ * one map between the threads, adds and deletes give each thread a slice
+ * of the keys and a map of its own. results has one line per run with
+ * the throughput and percentiles, histograms the non empty buckets of the
+ * latency histogram of every run, both with a header line naming the
+ * columns, and info the timing unit and the state of the Spectre v2
+ * mitigations. Windows are mapped in the mm of the process that started
+ * the run, the kthreads borrow it. The ring benchmark runs on read of
+ * xklib_bench/ring_bench.
+ */
+
+static bool run_on_load;
+module_param(run_on_load, bool, 0444);
+MODULE_PARM_DESC(run_on_load, "Run every benchmark when the module loads");
+
+static unsigned int bench_threads;
+module_param(bench_threads, uint, 0644);
+MODULE_PARM_DESC(bench_threads, "Most threads per run, 0 for every online cpu");
+
+static unsigned long bench_max_size = 10000000;
+module_param(bench_max_size, ulong, 0644);
+MODULE_PARM_DESC(bench_max_size, "Largest map, runs go 1K, 64K, 1M, 10M");
+
+static unsigned long bench_ops = 1UL << 16;
+module_param(bench_ops, ulong, 0644);
+MODULE_PARM_DESC(bench_ops,
+		 "Operations per thread of the lookup, mix and mapper runs");
+
+static bool bench_ktime;
+module_param(bench_ktime, bool, 0644);
+MODULE_PARM_DESC(bench_ktime, "Time operations with ktime_get_ns, not rdtsc");
+
+/* windows shared by the walks and reads, and mapped per map/unmap round */
+#define BENCH_WINDOWS 256
+/* keys per hashmap__find_batch and hashmap__insert_batch call */
+#define BENCH_BATCH 64
+
+static const size_t bench_sizes[] = { 1UL << 10, 1UL << 16, 1UL << 20,
+				      10000000 };
+
+enum bench_op {
+	BENCH_HASHMAP_ADD,
+	BENCH_HASHMAP_HIT,
+	BENCH_HASHMAP_MISS,
+	/* hits and misses half and half */
+	BENCH_HASHMAP_MIXED,
+	BENCH_HASHMAP_DELETE,
+	/* hits and adds BENCH_BATCH keys at a time, timed per key */
+	BENCH_HASHMAP_FIND_BATCH,
+	BENCH_HASHMAP_INSERT_BATCH,
+	/* chained adds with every resize migrated at once, not incrementally */
+	BENCH_HASHMAP_ADD_ONESHOT,
+	/* same keys in a DEFINE_XK_HASHMAP, hash and equal inlined */
+	BENCH_XK_HIT,
+	BENCH_XK_MISS,
+	/* lookups and writes in the proportions of run->mix */
+	BENCH_CHASHMAP_MIX,
+	BENCH_PCPU_MIX,
+	BENCH_WALK,
+	BENCH_WINDOW_FIND,
+	/* qword read through a window, and through the direct map */
+	BENCH_READ_WINDOW,
+	BENCH_READ_DIRECT,
+	/* map_physical, read and unmap_physical, all of it timed */
+	BENCH_READ_MAP,
+	BENCH_MAP,
+	BENCH_UNMAP,
+	BENCH_OPS,
+};
+
+static const char *const bench_op_names[] = {
+	[BENCH_HASHMAP_ADD] = "hashmap_add",
+	[BENCH_HASHMAP_HIT] = "hashmap_hit",
+	[BENCH_HASHMAP_MISS] = "hashmap_miss",
+	[BENCH_HASHMAP_MIXED] = "hashmap_mixed",
+	[BENCH_HASHMAP_DELETE] = "hashmap_delete",
+	[BENCH_HASHMAP_FIND_BATCH] = "hashmap_find_batch",
+	[BENCH_HASHMAP_INSERT_BATCH] = "hashmap_insert_batch",
+	[BENCH_HASHMAP_ADD_ONESHOT] = "hashmap_add_oneshot",
+	[BENCH_XK_HIT] = "xk_hashmap_hit",
+	[BENCH_XK_MISS] = "xk_hashmap_miss",
+	[BENCH_CHASHMAP_MIX] = "chashmap",
+	[BENCH_PCPU_MIX] = "pcpu_hashmap",
+	[BENCH_WALK] = "get_last_pt",
+	[BENCH_WINDOW_FIND] = "mm_window_find",
+	[BENCH_READ_WINDOW] = "read_window",
+	[BENCH_READ_DIRECT] = "read_direct",
+	[BENCH_READ_MAP] = "read_map",
+	[BENCH_MAP] = "map_physical",
+	[BENCH_UNMAP] = "unmap_physical",
+};
+
+static const char *const bench_layouts[] = {
+	[HASHMAP_CHAINED] = "chained",
+	[HASHMAP_OPEN] = "open",
+	[HASHMAP_DENSE] = "dense",
+};
+
+struct bench_mix {
+	/* percentage of lookups, the rest are writes */
+	unsigned int reads;
+	const char *name;
+};
+
+static const struct bench_mix bench_mixes[] = {
+	{ 100, "100:0" },
+	{ 95, "95:5" },
+	{ 50, "50:50" },
+	{ 0, "0:100" },
+};
+
+DEFINE_XK_HASHMAP(bench_xk, long, long, long_hash, long_cmp)
+
+struct bench_window {
+	void *page;
+	void *va;
+};
+
+struct bench_result {
+	struct list_head list;
+	enum bench_op op;
+	const char *layout;
+	const char *mix;
+	size_t size;
+	unsigned int threads;
+	u64 ns;
+	struct lat_hist hist;
+};
+
+struct bench_run {
+	enum bench_op op;
+	enum hashmap_layout layout;
+	const struct bench_mix *mix;
+	/* keys in the maps, or shared windows */
+	size_t size;
+	size_t ops;
+	unsigned int threads;
+	/* odd, so their even neighbours are all misses */
+	long *keys;
+	/* shared by the threads of the lookup and mix runs */
+	struct hashmap *map;
+	struct bench_xk *xk;
+	struct chashmap *cmap;
+	struct pcpu_hashmap *pmap;
+	struct mm_struct *mm;
+	struct bench_window *windows;
+
+	bool go;
+	/* threads in setup, and threads still timing, plus the caller's bias */
+	atomic_t pending;
+	atomic_t running;
+	struct completion ready;
+	struct completion done;
+	u64 end;
+};
+
+struct bench_thread {
+	struct bench_run *run;
+	struct task_struct *task;
+	unsigned int id;
+	u64 seed;
+	/* slice of run->keys added to or deleted from a map of its own */
+	struct hashmap map;
+	long *keys;
+	size_t nr;
+	/* arguments and results of one batch call */
+	long batch_keys[BENCH_BATCH];
+	long batch_values[BENCH_BATCH];
+	size_t batch_errs[BENCH_BATCH];
+	bool batch_found[BENCH_BATCH];
+	void *vas[BENCH_WINDOWS];
+	bool failed;
+	struct lat_hist hist;
+};
+
+/* the copy of the core puts its own debugfs files under xklib_bench/ */
+struct dentry *xklib_debugfs;
+static DEFINE_MUTEX(bench_lock);
+static LIST_HEAD(bench_results);
+/* cost of an empty timed section, taken off every sample */
+static u64 bench_overhead;
+
+static inline u64 bench_now(void)
+{
+#ifdef CONFIG_X86
+	if (!bench_ktime)
+		return rdtsc_ordered();
+#endif
+	return ktime_get_ns();
+}
+
+static const char *bench_unit(void)
+{
+	return IS_ENABLED(CONFIG_X86) && !bench_ktime ? "cycles" : "ns";
+}
+
+static inline void bench_record(struct bench_thread *t, u64 start)
+{
+	u64 d = bench_now() - start;
+
+	lat_hist_record(&t->hist, d > bench_overhead ? d - bench_overhead : 0);
+}
+
+/* a call on nr keys gives each of them an equal share of its time */
+static inline void bench_record_batch(struct bench_thread *t, u64 start,
+				      size_t nr)
+{
+	u64 d = bench_now() - start;
+
+	d = d > bench_overhead ? d - bench_overhead : 0;
+	for (size_t i = 0; i < nr; i++)
+		lat_hist_record(&t->hist, div64_u64(d, nr));
+}
+
+static void bench_calibrate(void)
+{
+	u64 start, d;
+
+	bench_overhead = ~0ULL;
+	for (int i = 0; i < 1024; i++) {
+		start = bench_now();
+		d = bench_now() - start;
+		bench_overhead = min(bench_overhead, d);
+	}
+}
+
+/* xorshift, get_random_u32 would dominate the cheaper operations */
+static inline u32 bench_rand(struct bench_thread *t)
+{
+	t->seed ^= t->seed << 13;
+	t->seed ^= t->seed >> 7;
+	t->seed ^= t->seed << 17;
+	return t->seed >> 32;
+}
+
+static size_t bench_hash(long key, void *ctx)
+{
+	return long_hash(key);
+}
+
+static bool bench_equal(long key1, long key2, void *ctx)
+{
+	return key1 == key2;
+}
+
+static inline bool bench_writer(const struct bench_run *run)
+{
+	return run->op == BENCH_HASHMAP_ADD ||
+	       run->op == BENCH_HASHMAP_DELETE ||
+	       run->op == BENCH_HASHMAP_INSERT_BATCH ||
+	       run->op == BENCH_HASHMAP_ADD_ONESHOT;
+}
+
+/* untimed, runs on the cpu the thread is pinned to */
+static int bench_setup(struct bench_thread *t)
+{
+	struct bench_run *run = t->run;
+	size_t first;
+
+	if (!bench_writer(run))
+		return 0;
+
+	first = run->size * t->id / run->threads;
+	t->keys = run->keys + first;
+	t->nr = run->size * (t->id + 1) / run->threads - first;
+
+	hashmap__init(&t->map, bench_hash, bench_equal, NULL);
+	if (hashmap__set_layout(&t->map, run->layout))
+		return -EINVAL;
+	if (run->op != BENCH_HASHMAP_DELETE)
+		return 0;
+
+	for (size_t i = 0; i < t->nr; i++) {
+		if (hashmap__add(&t->map, t->keys[i], i))
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static void bench_teardown(struct bench_thread *t)
+{
+	if (bench_writer(t->run))
+		hashmap__clear(&t->map);
+}
+
+static void bench_hashmap_loop(struct bench_thread *t)
+{
+	struct bench_run *run = t->run;
+	u64 start;
+
+	for (size_t i = 0; i < t->nr; i++) {
+		start = bench_now();
+		if (run->op == BENCH_HASHMAP_DELETE)
+			hashmap__delete(&t->map, t->keys[i], NULL, NULL);
+		else
+			hashmap__add(&t->map, t->keys[i], i);
+		bench_record(t, start);
+	}
+}
+
+/* the slice of the thread, added BENCH_BATCH keys at a time */
+static void bench_insert_batch_loop(struct bench_thread *t)
+{
+	size_t nr;
+	u64 start;
+
+	for (size_t i = 0; i < t->nr; i += nr) {
+		nr = min_t(size_t, t->nr - i, BENCH_BATCH);
+		for (size_t j = 0; j < nr; j++)
+			t->batch_values[j] = i + j;
+
+		start = bench_now();
+		hashmap__insert_batch(&t->map, &t->keys[i], t->batch_values,
+				      nr, HASHMAP_ADD, t->batch_errs);
+		bench_record_batch(t, start, nr);
+	}
+}
+
+/* the same random hits as hashmap_hit, BENCH_BATCH keys at a time */
+static void bench_find_batch_loop(struct bench_thread *t)
+{
+	struct bench_run *run = t->run;
+	size_t nr;
+	u64 start;
+
+	for (size_t i = 0; i < run->ops; i += nr) {
+		nr = min_t(size_t, run->ops - i, BENCH_BATCH);
+		for (size_t j = 0; j < nr; j++)
+			t->batch_keys[j] = run->keys[bench_rand(t) % run->size];
+
+		start = bench_now();
+		hashmap__find_batch(run->map, t->batch_keys, t->batch_values,
+				    t->batch_found, nr);
+		bench_record_batch(t, start, nr);
+	}
+}
+
+/* random keys of run->keys, hits or their misses, in the shared map */
+static void bench_lookup_loop(struct bench_thread *t)
+{
+	struct bench_run *run = t->run;
+	long key, value;
+	u64 start;
+
+	for (size_t i = 0; i < run->ops; i++) {
+		key = run->keys[bench_rand(t) % run->size];
+		if (run->op == BENCH_HASHMAP_MISS || run->op == BENCH_XK_MISS ||
+		    (run->op == BENCH_HASHMAP_MIXED && (bench_rand(t) & 1)))
+			key--;
+
+		start = bench_now();
+		if (run->op >= BENCH_XK_HIT)
+			bench_xk_find(run->xk, key, &value);
+		else
+			hashmap__find(run->map, key, &value);
+		bench_record(t, start);
+	}
+}
+
+static void bench_window_loop(struct bench_thread *t)
+{
+	struct bench_run *run = t->run;
+	struct bench_window *w;
+	u64 start, pa;
+
+	for (size_t i = 0; i < run->ops; i++) {
+		w = &run->windows[bench_rand(t) % run->size];
+		start = bench_now();
+		switch (run->op) {
+		case BENCH_WALK:
+			get_last_pt((unsigned long)w->va);
+			break;
+		case BENCH_WINDOW_FIND:
+			mm_window_find((unsigned long)w->va, &pa);
+			break;
+		case BENCH_READ_WINDOW:
+			READ_ONCE(*(u64 *)w->va);
+			break;
+		default:
+			READ_ONCE(*(u64 *)w->page);
+			break;
+		}
+		bench_record(t, start);
+	}
+}
+
+/*
+ * Maps and unmaps BENCH_WINDOWS windows of the first page at a time, an mm
+ * has no room for many more
+ */
+static void bench_map_loop(struct bench_thread *t)
+{
+	struct pt_permissions perms = { .read = 1 };
+	struct bench_run *run = t->run;
+	u64 pa = virt_to_phys(run->windows[0].page);
+	void **vas = t->vas;
+	size_t done = 0, nr;
+	u64 start;
+
+	while (done < run->ops) {
+		nr = min_t(size_t, run->ops - done, BENCH_WINDOWS);
+		for (size_t i = 0; i < nr; i++) {
+			start = bench_now();
+			vas[i] = map_physical(pa, perms);
+			if (run->op == BENCH_MAP)
+				bench_record(t, start);
+			if (!vas[i]) {
+				t->failed = true;
+				nr = i;
+				break;
+			}
+		}
+		for (size_t i = 0; i < nr; i++) {
+			start = bench_now();
+			unmap_physical(vas[i]);
+			if (run->op == BENCH_UNMAP)
+				bench_record(t, start);
+		}
+		if (t->failed)
+			return;
+		done += nr;
+	}
+}
+
+static void bench_read_map_loop(struct bench_thread *t)
+{
+	struct pt_permissions perms = { .read = 1 };
+	struct bench_run *run = t->run;
+	struct bench_window *w;
+	u64 start;
+	void *va;
+
+	for (size_t i = 0; i < run->ops; i++) {
+		w = &run->windows[bench_rand(t) % run->size];
+		start = bench_now();
+		va = map_physical(virt_to_phys(w->page), perms);
+		if (va) {
+			READ_ONCE(*(u64 *)va);
+			unmap_physical(va);
+		}
+		bench_record(t, start);
+		if (!va) {
+			t->failed = true;
+			return;
+		}
+	}
+}
+
+/*
+ * Lookups and writes of random keys in the shared map. A chashmap write
+ * deletes the key, or adds it back if it was gone, a pcpu_hashmap write
+ * adds one to its counter.
+ */
+static void bench_mix_loop(struct bench_thread *t)
+{
+	struct bench_run *run = t->run;
+	long key, value;
+	bool read;
+	u64 start;
+
+	for (size_t i = 0; i < run->ops; i++) {
+		key = run->keys[bench_rand(t) % run->size];
+		read = bench_rand(t) % 100 < run->mix->reads;
+
+		start = bench_now();
+		if (run->op == BENCH_PCPU_MIX) {
+			if (read)
+				pcpu_hashmap__find(run->pmap, key, &value);
+			else
+				pcpu_hashmap__add(run->pmap, key, 1);
+		} else if (read) {
+			chashmap__find(run->cmap, key, &value);
+		} else if (!chashmap__delete(run->cmap, key, NULL, NULL)) {
+			chashmap__add(run->cmap, key, i);
+		}
+		bench_record(t, start);
+	}
+}
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_thread *t = data;
+	struct bench_run *run = t->run;
+
+	if (run->mm)
+		kthread_use_mm(run->mm);
+
+	t->failed = bench_setup(t) != 0;
+	if (atomic_dec_and_test(&run->pending))
+		complete(&run->ready);
+	while (!smp_load_acquire(&run->go))
+		cond_resched();
+
+	if (!t->failed) {
+		switch (run->op) {
+		case BENCH_HASHMAP_ADD:
+		case BENCH_HASHMAP_DELETE:
+		case BENCH_HASHMAP_ADD_ONESHOT:
+			bench_hashmap_loop(t);
+			break;
+		case BENCH_HASHMAP_FIND_BATCH:
+			bench_find_batch_loop(t);
+			break;
+		case BENCH_HASHMAP_INSERT_BATCH:
+			bench_insert_batch_loop(t);
+			break;
+		case BENCH_HASHMAP_HIT ... BENCH_HASHMAP_MIXED:
+		case BENCH_XK_HIT ... BENCH_XK_MISS:
+			bench_lookup_loop(t);
+			break;
+		case BENCH_CHASHMAP_MIX ... BENCH_PCPU_MIX:
+			bench_mix_loop(t);
+			break;
+		case BENCH_WALK ... BENCH_READ_DIRECT:
+			bench_window_loop(t);
+			break;
+		case BENCH_READ_MAP:
+			bench_read_map_loop(t);
+			break;
+		default:
+			bench_map_loop(t);
+			break;
+		}
+	}
+	if (atomic_dec_and_test(&run->running)) {
+		run->end = ktime_get_ns();
+		complete(&run->done);
+	}
+
+	bench_teardown(t);
+	if (run->mm)
+		kthread_unuse_mm(run->mm);
+	return 0;
+}
+
+static const char *bench_layout(const struct bench_run *run)
+{
+	if (run->op <= BENCH_HASHMAP_ADD_ONESHOT)
+		return bench_layouts[run->layout];
+	/* DEFINE_XK_HASHMAP tables are chained */
+	if (run->op <= BENCH_XK_MISS)
+		return bench_layouts[HASHMAP_CHAINED];
+	return "-";
+}
+
+/*
+ * Starts run->threads threads pinned round robin on cpus, lets them go
+ * together once all of them are set up and collects their histograms in
+ * a new result
+ */
+static int bench_run(struct bench_run *run, const int *cpus, int nr_cpus)
+{
+	struct bench_thread *threads, *t;
+	struct bench_result *res;
+	unsigned int i, nr = 0;
+	bool failed = false;
+	u64 start;
+	int ret = 0;
+
+	res = kvzalloc(sizeof(*res), GFP_KERNEL);
+	threads = kvcalloc(run->threads, sizeof(*threads), GFP_KERNEL);
+	if (!res || !threads) {
+		kvfree(threads);
+		kvfree(res);
+		return -ENOMEM;
+	}
+
+	run->go = false;
+	atomic_set(&run->pending, 1);
+	atomic_set(&run->running, 1);
+	init_completion(&run->ready);
+	init_completion(&run->done);
+
+	for (i = 0; i < run->threads; i++) {
+		t = &threads[i];
+		t->run = run;
+		t->id = i;
+		t->seed = get_random_u64() | 1;
+		lat_hist_reset(&t->hist);
+		t->task = kthread_create(bench_thread_fn, t, "xklib_bench/%u",
+					 i);
+		if (IS_ERR(t->task)) {
+			ret = PTR_ERR(t->task);
+			t->task = NULL;
+			break;
+		}
+
+		get_task_struct(t->task);
+		kthread_bind(t->task, cpus[i % nr_cpus]);
+		atomic_inc(&run->pending);
+		atomic_inc(&run->running);
+		wake_up_process(t->task);
+		nr++;
+	}
+
+	if (!atomic_dec_and_test(&run->pending))
+		wait_for_completion(&run->ready);
+	start = ktime_get_ns();
+	smp_store_release(&run->go, true);
+	if (atomic_dec_and_test(&run->running))
+		run->end = start;
+	else
+		wait_for_completion(&run->done);
+
+	for (i = 0; i < nr; i++) {
+		kthread_stop(threads[i].task);
+		put_task_struct(threads[i].task);
+		failed |= threads[i].failed;
+	}
+
+	if (!ret && failed)
+		ret = -ENOMEM;
+	if (!ret) {
+		res->op = run->op;
+		res->layout = bench_layout(run);
+		res->mix = run->mix ? run->mix->name : "-";
+		res->size = run->size;
+		res->threads = run->threads;
+		res->ns = run->end - start;
+		lat_hist_reset(&res->hist);
+		for (i = 0; i < nr; i++)
+			lat_hist_merge(&res->hist, &threads[i].hist);
+		list_add_tail(&res->list, &bench_results);
+		res = NULL;
+	}
+
+	kvfree(threads);
+	kvfree(res);
+	return ret;
+}
+
+/* runs op with 1, 2, 4... threads */
+static void bench_scale(struct bench_run *run, const int *cpus, int nr_cpus,
+			unsigned int max_threads)
+{
+	int ret;
+
+	for (run->threads = 1; run->threads <= max_threads;
+	     run->threads *= 2) {
+		ret = bench_run(run, cpus, nr_cpus);
+		if (ret) {
+			dbg_msg("Benchmark %s with %u threads failed: %d",
+				bench_op_names[run->op], run->threads, ret);
+			return;
+		}
+	}
+}
+
+/* odd, so their even neighbours are all misses */
+static long *bench_keys_new(size_t size)
+{
+	long *keys = kvmalloc_array(size, sizeof(*keys), GFP_KERNEL);
+
+	if (!keys)
+		return NULL;
+	for (size_t i = 0; i < size; i++)
+		keys[i] = get_random_u64() | 1;
+	return keys;
+}
+
+static int bench_hashmap_fill(struct bench_run *run, struct hashmap *map)
+{
+	hashmap__init(map, bench_hash, bench_equal, NULL);
+	if (hashmap__set_layout(map, run->layout))
+		return -EINVAL;
+
+	for (size_t i = 0; i < run->size; i++) {
+		if (hashmap__add(map, run->keys[i], i))
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static int bench_xk_fill(struct bench_run *run)
+{
+	run->xk = bench_xk_new(NUMA_NO_NODE);
+	if (!run->xk)
+		return -ENOMEM;
+
+	for (size_t i = 0; i < run->size; i++) {
+		if (bench_xk_add(run->xk, run->keys[i], i))
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Every layout of struct hashmap, then the same keys in a
+ * DEFINE_XK_HASHMAP: both chained tables hash with long_hash, so the
+ * difference between hashmap_hit and xk_hashmap_hit is the cost of the
+ * indirect calls, retpolines included when info says they are on. The
+ * batch runs count keys, not calls, so their ops_per_sec compare with
+ * those of hashmap_hit and hashmap_add, on maps up to far past the LLC.
+ * Chained maps add the same keys once more with one-shot rehashing, the
+ * p999 and max of hashmap_add_oneshot against those of hashmap_add show
+ * what incremental rehashing does to the tail.
+ */
+static void bench_hashmaps(const int *cpus, int nr_cpus,
+			   unsigned int max_threads)
+{
+	struct bench_run run = { .ops = bench_ops };
+	struct hashmap map;
+
+	for (int i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+		run.size = bench_sizes[i];
+		if (run.size > bench_max_size)
+			break;
+
+		run.keys = bench_keys_new(run.size);
+		if (!run.keys) {
+			dbg_msg("No memory for %zu benchmark keys", run.size);
+			return;
+		}
+
+		run.map = &map;
+		for (run.layout = HASHMAP_CHAINED;
+		     run.layout <= HASHMAP_DENSE; run.layout++) {
+			if (bench_hashmap_fill(&run, &map)) {
+				dbg_msg("Could not fill a %s hashmap of %zu keys",
+					bench_layouts[run.layout], run.size);
+				hashmap__clear(&map);
+				continue;
+			}
+			for (run.op = BENCH_HASHMAP_ADD;
+			     run.op <= BENCH_HASHMAP_INSERT_BATCH; run.op++)
+				bench_scale(&run, cpus, nr_cpus, max_threads);
+			hashmap__clear(&map);
+
+			if (run.layout != HASHMAP_CHAINED)
+				continue;
+			run.op = BENCH_HASHMAP_ADD_ONESHOT;
+			hashmap_rehash_oneshot = true;
+			bench_scale(&run, cpus, nr_cpus, max_threads);
+			hashmap_rehash_oneshot = false;
+		}
+		run.map = NULL;
+
+		if (!bench_xk_fill(&run)) {
+			for (run.op = BENCH_XK_HIT; run.op <= BENCH_XK_MISS;
+			     run.op++)
+				bench_scale(&run, cpus, nr_cpus, max_threads);
+		} else {
+			dbg_msg("Could not fill an xk_hashmap of %zu keys",
+				run.size);
+		}
+		bench_xk_free(run.xk);
+		run.xk = NULL;
+
+		kvfree(run.keys);
+	}
+}
+
+/* puts back the keys earlier writes took out */
+static int bench_chashmap_fill(struct bench_run *run)
+{
+	size_t err;
+
+	for (size_t i = 0; i < run->size; i++) {
+		err = chashmap__add(run->cmap, run->keys[i], i);
+		if (err && err != XKLIB_EEXIST)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static int bench_pcpu_fill(struct bench_run *run)
+{
+	for (size_t i = 0; i < run->size; i++) {
+		if (pcpu_hashmap__add(run->pmap, run->keys[i], 1))
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/* chashmap and pcpu_hashmap under every mix, each map shared by all */
+static void bench_concurrent(const int *cpus, int nr_cpus,
+			     unsigned int max_threads)
+{
+	struct bench_run run = { .ops = bench_ops };
+
+	for (int i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+		run.size = bench_sizes[i];
+		if (run.size > bench_max_size)
+			break;
+
+		run.keys = bench_keys_new(run.size);
+		run.cmap = chashmap__new(bench_hash, bench_equal, NULL,
+					 NUMA_NO_NODE);
+		run.pmap = pcpu_hashmap__new(bench_hash, bench_equal,
+					     pcpu_hashmap_sum, NULL);
+		if (!run.keys || !run.cmap || !run.pmap) {
+			dbg_msg("No memory for maps of %zu keys", run.size);
+			goto next;
+		}
+
+		run.op = BENCH_CHASHMAP_MIX;
+		for (int j = 0; j < ARRAY_SIZE(bench_mixes); j++) {
+			run.mix = &bench_mixes[j];
+			if (bench_chashmap_fill(&run))
+				break;
+			bench_scale(&run, cpus, nr_cpus, max_threads);
+		}
+
+		run.op = BENCH_PCPU_MIX;
+		if (!bench_pcpu_fill(&run)) {
+			for (int j = 0; j < ARRAY_SIZE(bench_mixes); j++) {
+				run.mix = &bench_mixes[j];
+				bench_scale(&run, cpus, nr_cpus, max_threads);
+			}
+		}
+		run.mix = NULL;
+
+next:
+		pcpu_hashmap__free(run.pmap);
+		chashmap__free(run.cmap);
+		kvfree(run.keys);
+	}
+}
+
+static void bench_windows_free(struct bench_window *windows)
+{
+	for (size_t i = 0; i < BENCH_WINDOWS; i++) {
+		if (windows[i].va)
+			unmap_physical(windows[i].va);
+		kfree(windows[i].page);
+	}
+	kvfree(windows);
+}
+
+/* kmalloc'd pages, see memory.h, mapped once each in the current mm */
+static struct bench_window *bench_windows_new(void)
+{
+	struct pt_permissions perms = { .read = 1 };
+	struct bench_window *windows;
+
+	windows = kvcalloc(BENCH_WINDOWS, sizeof(*windows), GFP_KERNEL);
+	if (!windows)
+		return NULL;
+
+	for (size_t i = 0; i < BENCH_WINDOWS; i++) {
+		windows[i].page = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!windows[i].page)
+			goto fail;
+		memset(windows[i].page, i, PAGE_SIZE);
+		windows[i].va = map_physical(virt_to_phys(windows[i].page),
+					     perms);
+		if (!windows[i].va)
+			goto fail;
+	}
+	return windows;
+
+fail:
+	bench_windows_free(windows);
+	return NULL;
+}
+
+/*
+ * Walks and reads scale with the threads, map_physical and
+ * unmap_physical pick slots without a lock and only run on one
+ */
+static void bench_mapper(const int *cpus, int nr_cpus,
+			 unsigned int max_threads)
+{
+	struct bench_run run = { .size = BENCH_WINDOWS, .ops = bench_ops };
+
+	if (!current->mm) {
+		dbg_msg("No mm to map the benchmark windows in");
+		return;
+	}
+
+	run.mm = current->mm;
+	run.windows = bench_windows_new();
+	if (!run.windows) {
+		dbg_msg("Could not map %d benchmark windows", BENCH_WINDOWS);
+		return;
+	}
+
+	for (run.op = BENCH_WALK; run.op <= BENCH_READ_DIRECT; run.op++)
+		bench_scale(&run, cpus, nr_cpus, max_threads);
+	for (run.op = BENCH_READ_MAP; run.op <= BENCH_UNMAP; run.op++)
+		bench_scale(&run, cpus, nr_cpus, 1);
+
+	bench_windows_free(run.windows);
+}
+
+static void bench_results_free(void)
+{
+	struct bench_result *res, *tmp;
+
+	list_for_each_entry_safe(res, tmp, &bench_results, list) {
+		list_del(&res->list);
+		kvfree(res);
+	}
+}
+
+enum bench_suite {
+	BENCH_SUITE_HASHMAP = 1,
+	BENCH_SUITE_CONCURRENT = 2,
+	BENCH_SUITE_MAPPER = 4,
+	BENCH_SUITE_ALL = BENCH_SUITE_HASHMAP | BENCH_SUITE_CONCURRENT |
+			  BENCH_SUITE_MAPPER,
+};
+
+static int bench_run_suite(enum bench_suite suite)
+{
+	unsigned int max_threads;
+	int *cpus, nr_cpus = 0, cpu;
+
+	cpus = kcalloc(nr_cpu_ids, sizeof(*cpus), GFP_KERNEL);
+	if (!cpus)
+		return -ENOMEM;
+
+	mutex_lock(&bench_lock);
+	bench_results_free();
+	bench_calibrate();
+
+	cpus_read_lock();
+	for_each_online_cpu(cpu)
+		cpus[nr_cpus++] = cpu;
+	max_threads = bench_threads ? bench_threads : nr_cpus;
+
+	if (suite & BENCH_SUITE_HASHMAP)
+		bench_hashmaps(cpus, nr_cpus, max_threads);
+	if (suite & BENCH_SUITE_CONCURRENT)
+		bench_concurrent(cpus, nr_cpus, max_threads);
+	if (suite & BENCH_SUITE_MAPPER)
+		bench_mapper(cpus, nr_cpus, max_threads);
+	cpus_read_unlock();
+
+	mutex_unlock(&bench_lock);
+	kfree(cpus);
+	return 0;
+}
+
+static ssize_t bench_run_write(struct file *file, const char __user *ubuf,
+			       size_t len, loff_t *ppos)
+{
+	enum bench_suite suite;
+	char buf[16];
+	int ret;
+
+	if (len >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = '\0';
+
+	if (sysfs_streq(buf, "all"))
+		suite = BENCH_SUITE_ALL;
+	else if (sysfs_streq(buf, "hashmap"))
+		suite = BENCH_SUITE_HASHMAP;
+	else if (sysfs_streq(buf, "concurrent"))
+		suite = BENCH_SUITE_CONCURRENT;
+	else if (sysfs_streq(buf, "mapper"))
+		suite = BENCH_SUITE_MAPPER;
+	else
+		return -EINVAL;
+
+	ret = bench_run_suite(suite);
+	return ret ? ret : len;
+}
+
+static const struct file_operations bench_run_fops = {
+	.owner = THIS_MODULE,
+	.write = bench_run_write,
+};
+
+static int bench_results_show(struct seq_file *m, void *v)
+{
+	struct bench_result *res;
+	struct lat_hist *h;
+
+	mutex_lock(&bench_lock);
+	seq_printf(m, "op layout mix size threads ops ns ops_per_sec unit "
+		      "mean min p50 p90 p99 p999 max\n");
+	list_for_each_entry(res, &bench_results, list) {
+		h = &res->hist;
+		seq_printf(m, "%s %s %s %zu %u %llu %llu %llu %s %llu %llu ",
+			   bench_op_names[res->op], res->layout, res->mix,
+			   res->size, res->threads, h->count, res->ns,
+			   div64_u64(h->count * NSEC_PER_SEC,
+				     max_t(u64, res->ns, 1)),
+			   bench_unit(),
+			   div64_u64(h->sum, max_t(u64, h->count, 1)),
+			   h->count ? h->min : 0);
+		seq_printf(m, "%llu %llu %llu %llu %llu\n",
+			   lat_hist_percentile(h, 500),
+			   lat_hist_percentile(h, 900),
+			   lat_hist_percentile(h, 990),
+			   lat_hist_percentile(h, 999), h->max);
+	}
+	mutex_unlock(&bench_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_results);
+
+static int bench_histograms_show(struct seq_file *m, void *v)
+{
+	struct bench_result *res;
+
+	mutex_lock(&bench_lock);
+	seq_puts(m, "op layout mix size threads unit lo hi count\n");
+	list_for_each_entry(res, &bench_results, list) {
+		for (unsigned int i = 0; i < LAT_HIST_BUCKETS; i++) {
+			if (!res->hist.buckets[i])
+				continue;
+			seq_printf(m, "%s %s %s %zu %u %s %llu %llu %llu\n",
+				   bench_op_names[res->op], res->layout,
+				   res->mix, res->size, res->threads,
+				   bench_unit(),
+				   lat_hist_lower(i), lat_hist_upper(i),
+				   res->hist.buckets[i]);
+		}
+	}
+	mutex_unlock(&bench_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_histograms);
+
+/*
+ * What the results depend on beyond the code: compare a run booted with
+ * mitigations=off against the default to see what retpolines cost
+ */
+static int bench_info_show(struct seq_file *m, void *v)
+{
+	bool retpoline = false;
+
+#ifdef CONFIG_X86
+	retpoline = boot_cpu_has(X86_FEATURE_RETPOLINE);
+#endif
+	seq_printf(m, "unit %s\n", bench_unit());
+	seq_printf(m, "mitigations %s\n",
+		   cpu_mitigations_off() ? "off" : "on");
+	seq_printf(m, "retpoline %d\n", retpoline);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_info);
+
+static int __init bench_init(void)
+{
+	xklib_error err;
+
+	xklib_debugfs = debugfs_create_dir("xklib_bench", NULL);
+	err = mm_init();
+	if (err) {
+		dbg_msg("Benchmark mm_init failed: 0x%llx", err);
+		debugfs_remove_recursive(xklib_debugfs);
+		return -ENOMEM;
+	}
+
+	if (!IS_ERR_OR_NULL(xklib_debugfs)) {
+		debugfs_create_file("run", 0200, xklib_debugfs, NULL,
+				    &bench_run_fops);
+		debugfs_create_file("results", 0400, xklib_debugfs, NULL,
+				    &bench_results_fops);
+		debugfs_create_file("histograms", 0400, xklib_debugfs, NULL,
+				    &bench_histograms_fops);
+		debugfs_create_file("info", 0400, xklib_debugfs, NULL,
+				    &bench_info_fops);
+		ring_bench_debugfs_init(xklib_debugfs);
+	}
+
+	if (run_on_load)
+		bench_run_suite(BENCH_SUITE_ALL);
+	return 0;
+}
+
+static void __exit bench_exit(void)
+{
+	/* the files go away with the core's, after mm_destroy */
+	mutex_lock(&bench_lock);
+	bench_results_free();
+	mutex_unlock(&bench_lock);
+	mm_destroy();
+	debugfs_remove_recursive(xklib_debugfs);
+}
+
+module_init(bench_init);
+module_exit(bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("cutecatsandvirtualmachines");
+MODULE_DESCRIPTION("xklib microbenchmarks");
@@ -0,0 +1,261 @@
+/*
+ * Cycle counts of the hashmap layouts, the mapper and the walker, taken
+ * with rdtsc around batches of operations. Prints one line per operation:
+ * the mean, median and 99th percentile cycles per operation over all the
+ * batches of a run.
+ *
+ *   bench [max hashmap size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "memory.h"
+
+/* operations timed together, a lone rdtsc pair would dominate */
+#define BENCH_BATCH 64
+/* table slots left to map_physical in an mm, the root takes one */
+#define BENCH_WINDOWS_PER_MM (PT_MAX - 1)
+#define BENCH_MMS 16
+
+static const char *const bench_layouts[] = {
+	[HASHMAP_CHAINED] = "chained",
+	[HASHMAP_OPEN] = "open",
+	[HASHMAP_DENSE] = "dense",
+};
+
+static size_t bench_hash(long key, void *ctx)
+{
+	return long_hash(key);
+}
+
+static bool bench_equal(long key1, long key2, void *ctx)
+{
+	return key1 == key2;
+}
+
+struct bench_run {
+	double *samples;
+	size_t nr;
+	size_t cap;
+	u64 start;
+	size_t ops;
+};
+
+static inline u64 bench_cycles(void)
+{
+#if defined(__x86_64__)
+	unsigned int lo, hi;
+
+	__asm__ __volatile__("lfence; rdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+	return ((u64)hi << 32) | lo;
+#else
+	return xk_ktime_ns();
+#endif
+}
+
+static void bench_begin(struct bench_run *run, size_t total)
+{
+	run->cap = total / BENCH_BATCH + 1;
+	run->samples = realloc(run->samples, run->cap * sizeof(*run->samples));
+	if (!run->samples)
+		abort();
+	run->nr = 0;
+	run->ops = 0;
+	run->start = bench_cycles();
+}
+
+/* call after every operation, closes a sample every BENCH_BATCH of them */
+static inline void bench_tick(struct bench_run *run)
+{
+	u64 now;
+
+	if (++run->ops < BENCH_BATCH)
+		return;
+
+	now = bench_cycles();
+	if (run->nr < run->cap)
+		run->samples[run->nr++] = (double)(now - run->start) / run->ops;
+	run->ops = 0;
+	run->start = bench_cycles();
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void bench_end(struct bench_run *run, const char *what,
+		      const char *layout, size_t size)
+{
+	double sum = 0;
+
+	if (run->ops && run->nr < run->cap)
+		run->samples[run->nr++] =
+			(double)(bench_cycles() - run->start) / run->ops;
+	if (!run->nr)
+		return;
+
+	qsort(run->samples, run->nr, sizeof(*run->samples), bench_cmp);
+	for (size_t i = 0; i < run->nr; i++)
+		sum += run->samples[i];
+	printf("%-14s %-8s %8zu %9.1f %9.1f %9.1f\n", what, layout, size,
+	       sum / run->nr, run->samples[run->nr / 2],
+	       run->samples[run->nr * 99 / 100]);
+}
+
+static void bench_hashmap(struct bench_run *run, enum hashmap_layout layout,
+			  size_t size)
+{
+	const char *name = bench_layouts[layout];
+	struct hashmap map;
+	long *keys, value;
+
+	keys = malloc(size * sizeof(*keys));
+	if (!keys)
+		abort();
+	for (size_t i = 0; i < size; i++)
+		keys[i] = get_random_u64() | 1;
+
+	hashmap__init(&map, bench_hash, bench_equal, NULL);
+	hashmap__set_layout(&map, layout);
+
+	bench_begin(run, size);
+	for (size_t i = 0; i < size; i++) {
+		hashmap__add(&map, keys[i], i);
+		bench_tick(run);
+	}
+	bench_end(run, "hashmap_add", name, size);
+
+	bench_begin(run, size);
+	for (size_t i = 0; i < size; i++) {
+		hashmap__find(&map, keys[i], &value);
+		bench_tick(run);
+	}
+	bench_end(run, "hashmap_hit", name, size);
+
+	/* keys are odd, so their even neighbours are all misses */
+	bench_begin(run, size);
+	for (size_t i = 0; i < size; i++) {
+		hashmap__find(&map, keys[i] - 1, &value);
+		bench_tick(run);
+	}
+	bench_end(run, "hashmap_miss", name, size);
+
+	bench_begin(run, size);
+	for (size_t i = 0; i < size; i++) {
+		hashmap__delete(&map, keys[i], NULL, NULL);
+		bench_tick(run);
+	}
+	bench_end(run, "hashmap_delete", name, size);
+
+	hashmap__clear(&map);
+	xk_rcu_quiescent();
+	free(keys);
+}
+
+/* the mm keeps its own reference, dropped by the next switch */
+static void bench_switch_mm(struct mm_struct *mm)
+{
+	mmgrab(mm);
+	xk_set_mm(mm);
+}
+
+struct bench_window {
+	unsigned long va;
+	struct mm_struct *mm;
+};
+
+static void bench_walk(struct bench_run *run, struct bench_window *windows,
+		       size_t nr, bool registry)
+{
+	struct mm_struct *mm = NULL;
+	u64 pa;
+
+	bench_begin(run, nr);
+	for (size_t i = 0; i < nr; i++) {
+		if (windows[i].mm != mm) {
+			mm = windows[i].mm;
+			bench_switch_mm(mm);
+		}
+		if (registry)
+			mm_window_find(windows[i].va, &pa);
+		else
+			get_last_pt(windows[i].va);
+		bench_tick(run);
+	}
+	bench_end(run, registry ? "mm_window_find" : "get_last_pt", "-", nr);
+}
+
+/*
+ * Maps random RAM frames into BENCH_MMS address spaces until their tables
+ * are full, then walks the windows back through the page tables and
+ * through the window registry
+ */
+static void bench_mapper(struct bench_run *run)
+{
+	struct pt_permissions perms = { .read = 1, .write = 1 };
+	size_t nr = BENCH_MMS * BENCH_WINDOWS_PER_MM, done = 0;
+	struct bench_window *windows;
+	struct mm_struct *mm;
+	void *va;
+	u64 pa;
+
+	windows = calloc(nr, sizeof(*windows));
+	if (!windows)
+		abort();
+
+	bench_begin(run, nr);
+	for (size_t m = 0; m < BENCH_MMS; m++) {
+		mm = xk_mm_new();
+		if (!mm)
+			abort();
+		bench_switch_mm(mm);
+		for (size_t i = 0; i < BENCH_WINDOWS_PER_MM; i++) {
+			pa = (get_random_u64() % xk_arena_size) & PAGE_MASK;
+			va = map_physical(pa, perms);
+			if (va)
+				windows[done++] = (struct bench_window){
+					(unsigned long)va, mm
+				};
+			bench_tick(run);
+		}
+		mmdrop(mm);
+	}
+	bench_end(run, "map_physical", "-", done);
+
+	/* the roots hold the mms until mm_destroy */
+	bench_walk(run, windows, done, false);
+	bench_walk(run, windows, done, true);
+
+	xk_set_mm(NULL);
+	free(windows);
+}
+
+int main(int argc, char **argv)
+{
+	size_t max_size = argc > 1 ? strtoul(argv[1], NULL, 0) : 1UL << 20;
+	struct bench_run run = { 0 };
+	xklib_error err;
+
+	xk_set_cpu(0);
+	err = mm_init();
+	if (err) {
+		fprintf(stderr, "mm_init failed: 0x%llx\n", err);
+		return 1;
+	}
+
+	printf("%-14s %-8s %8s %9s %9s %9s\n", "op", "layout", "size",
+	       "mean", "p50", "p99");
+	for (size_t size = 1UL << 10; size <= max_size; size <<= 6) {
+		for (int layout = HASHMAP_CHAINED; layout <= HASHMAP_DENSE;
+		     layout++)
+			bench_hashmap(&run, layout, size);
+	}
+	bench_mapper(&run);
+
+	mm_destroy();
+	free(run.samples);
+	return 0;
+}
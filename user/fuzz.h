@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * Shared driver of the fuzz targets. Built with XK_LIBFUZZER, libFuzzer
+ * provides main() and calls LLVMFuzzerTestOneInput() itself; otherwise
+ * each file named on the command line, or stdin, is run once, which is
+ * what AFL expects.
+ */
+#include "xkshim.h"
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size);
+
+#define FUZZ_CHECK(cond)                                                 \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			abort();                                         \
+		}                                                        \
+	} while (0)
+
+#ifndef XK_LIBFUZZER
+static int fuzz_run(FILE *f)
+{
+	static u8 buf[1 << 20];
+	size_t size = fread(buf, 1, sizeof(buf), f);
+
+	return LLVMFuzzerTestOneInput(buf, size);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+
+	if (argc < 2)
+		return fuzz_run(stdin);
+
+	for (int i = 1; i < argc; i++) {
+		f = fopen(argv[i], "rb");
+		if (!f) {
+			perror(argv[i]);
+			return 1;
+		}
+		fuzz_run(f);
+		fclose(f);
+	}
+	return 0;
+}
+#endif
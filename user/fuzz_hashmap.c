@@ -0,0 +1,281 @@
+/*
+ * Runs the operations encoded in the input against a hashmap and against
+ * a plain array indexed by key, and aborts as soon as the two disagree.
+ * The first byte picks the layout, then every operation takes 5 bytes:
+ * opcode, 16 bit key and 16 bit value. Keys are spread over the whole
+ * long range but only FUZZ_KEYS of them exist, so most operations hit.
+ */
+#include "memory.h"
+#include "reserve.h"
+#include "fuzz.h"
+
+#define FUZZ_KEYS (1 << 16)
+#define FUZZ_OP_SIZE 5
+#define FUZZ_BATCH 8
+
+enum fuzz_op {
+	FUZZ_ADD,
+	FUZZ_SET,
+	FUZZ_UPDATE,
+	FUZZ_ADD_ATOMIC,
+	FUZZ_DELETE,
+	FUZZ_FIND,
+	FUZZ_FIND_RCU,
+	FUZZ_FIND_BATCH,
+	FUZZ_INSERT_BATCH,
+	FUZZ_RESERVE,
+	FUZZ_COMPACT,
+	FUZZ_CLEAR,
+	FUZZ_QUIESCENT,
+	FUZZ_OPS,
+};
+
+struct fuzz_ref {
+	bool present;
+	long value;
+};
+
+static struct fuzz_ref fuzz_ref[FUZZ_KEYS];
+static size_t fuzz_nr;
+
+static size_t fuzz_hash(long key, void *ctx)
+{
+	return long_hash(key);
+}
+
+static bool fuzz_equal(long key1, long key2, void *ctx)
+{
+	return key1 == key2;
+}
+
+static inline long fuzz_key(u16 k)
+{
+	return (long)k * 0x9e3779b97f4a7c15UL;
+}
+
+static void fuzz_ref_set(u16 k, long value)
+{
+	fuzz_nr += !fuzz_ref[k].present;
+	fuzz_ref[k].present = true;
+	fuzz_ref[k].value = value;
+}
+
+static void fuzz_insert(struct hashmap *map, u16 k, long value,
+			enum hashmap_insert_strategy strategy)
+{
+	struct fuzz_ref *ref = &fuzz_ref[k];
+	long old_key = 0, old_value = 0;
+	size_t err;
+
+	err = hashmap__insert(map, fuzz_key(k), value, strategy, &old_key,
+			      &old_value);
+	switch (strategy) {
+	case HASHMAP_ADD:
+		FUZZ_CHECK(ref->present ? err == XKLIB_EEXIST : !err);
+		break;
+	case HASHMAP_UPDATE:
+		FUZZ_CHECK(ref->present ? !err : err == XKLIB_ENOENT);
+		break;
+	default:
+		FUZZ_CHECK(!err);
+		break;
+	}
+
+	if (!err && ref->present && strategy != HASHMAP_ADD)
+		FUZZ_CHECK(old_key == fuzz_key(k) && old_value == ref->value);
+	if (!err)
+		fuzz_ref_set(k, value);
+}
+
+/* atomic inserts may run out of reserve, a success must still stick */
+static void fuzz_add_atomic(struct hashmap *map, u16 k, long value)
+{
+	size_t err = hashmap__add_atomic(map, fuzz_key(k), value);
+
+	if (fuzz_ref[k].present)
+		FUZZ_CHECK(err == XKLIB_EEXIST);
+	else if (!err)
+		fuzz_ref_set(k, value);
+}
+
+static void fuzz_find(struct hashmap *map, u16 k, bool rcu)
+{
+	long value = 0;
+	bool found;
+
+	/* only chained maps keep their pairs in place for lockless readers */
+	if (rcu && map->layout == HASHMAP_CHAINED) {
+		rcu_read_lock();
+		found = hashmap__find_rcu(map, fuzz_key(k), &value);
+		rcu_read_unlock();
+	} else {
+		found = hashmap__find(map, fuzz_key(k), &value);
+	}
+
+	FUZZ_CHECK(found == fuzz_ref[k].present);
+	if (found)
+		FUZZ_CHECK(value == fuzz_ref[k].value);
+}
+
+static void fuzz_batch(struct hashmap *map, u16 k, long value, bool insert)
+{
+	long keys[FUZZ_BATCH], values[FUZZ_BATCH];
+	size_t errs[FUZZ_BATCH], nr = 0, done;
+	bool found[FUZZ_BATCH];
+
+	for (int i = 0; i < FUZZ_BATCH; i++) {
+		keys[i] = fuzz_key(k + i);
+		values[i] = value + i;
+	}
+
+	if (!insert) {
+		done = hashmap__find_batch(map, keys, values, found,
+					   FUZZ_BATCH);
+		for (u16 i = 0; i < FUZZ_BATCH; i++) {
+			FUZZ_CHECK(found[i] == fuzz_ref[(u16)(k + i)].present);
+			if (found[i])
+				FUZZ_CHECK(values[i] ==
+					   fuzz_ref[(u16)(k + i)].value);
+			nr += found[i];
+		}
+		FUZZ_CHECK(done == nr);
+		return;
+	}
+
+	done = hashmap__insert_batch(map, keys, values, FUZZ_BATCH,
+				     HASHMAP_SET, errs);
+	FUZZ_CHECK(done == FUZZ_BATCH);
+	for (u16 i = 0; i < FUZZ_BATCH; i++) {
+		FUZZ_CHECK(!errs[i]);
+		fuzz_ref_set(k + i, values[i]);
+	}
+}
+
+static void fuzz_delete(struct hashmap *map, u16 k)
+{
+	long old_key = 0, old_value = 0;
+	bool found;
+
+	found = hashmap__delete(map, fuzz_key(k), &old_key, &old_value);
+	FUZZ_CHECK(found == fuzz_ref[k].present);
+	if (found) {
+		FUZZ_CHECK(old_key == fuzz_key(k) &&
+			   old_value == fuzz_ref[k].value);
+		fuzz_ref[k].present = false;
+		fuzz_nr--;
+	}
+}
+
+/* every entry of the map is in the reference, and as many of them */
+static void fuzz_compare(struct hashmap *map)
+{
+	struct hashmap_entry *cur;
+	size_t bkt, nr = 0;
+	long k;
+
+	hashmap__for_each_entry(map, cur, bkt) {
+		k = cur->key;
+		for (u16 i = 0;; i++) {
+			if (fuzz_key(i) == k) {
+				FUZZ_CHECK(fuzz_ref[i].present &&
+					   fuzz_ref[i].value == cur->value);
+				break;
+			}
+			FUZZ_CHECK(i != FUZZ_KEYS - 1);
+		}
+		nr++;
+	}
+	FUZZ_CHECK(nr == fuzz_nr);
+}
+
+/*
+ * Old bucket arrays wait in the deferred batch, free them, and top the
+ * entry reserve up so that atomic inserts leave no trace in the count
+ */
+static void fuzz_settle(void)
+{
+	mm_flush_deferred();
+	rcu_barrier();
+	schedule_work(&mm_reserve_entries.refill);
+	flush_work(&mm_reserve_entries.refill);
+}
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+	static bool ready;
+	struct hashmap map;
+	size_t baseline;
+	long value;
+	u16 k;
+
+	if (!ready) {
+		xk_poison = true;
+		FUZZ_CHECK(mm_init() == XKLIB_SUCCESS);
+		ready = true;
+	}
+	if (!size)
+		return 0;
+
+	fuzz_settle();
+	baseline = xk_kmalloc_bytes();
+	memset(fuzz_ref, 0, sizeof(fuzz_ref));
+	fuzz_nr = 0;
+	hashmap__init(&map, fuzz_hash, fuzz_equal, NULL);
+	FUZZ_CHECK(!hashmap__set_layout(&map, data[0] % (HASHMAP_DENSE + 1)));
+
+	for (size_t i = 1; i + FUZZ_OP_SIZE <= size; i += FUZZ_OP_SIZE) {
+		k = data[i + 1] | data[i + 2] << 8;
+		value = data[i + 3] | data[i + 4] << 8;
+
+		switch (data[i] % FUZZ_OPS) {
+		case FUZZ_ADD:
+			fuzz_insert(&map, k, value, HASHMAP_ADD);
+			break;
+		case FUZZ_SET:
+			fuzz_insert(&map, k, value, HASHMAP_SET);
+			break;
+		case FUZZ_UPDATE:
+			fuzz_insert(&map, k, value, HASHMAP_UPDATE);
+			break;
+		case FUZZ_ADD_ATOMIC:
+			fuzz_add_atomic(&map, k, value);
+			break;
+		case FUZZ_DELETE:
+			fuzz_delete(&map, k);
+			break;
+		case FUZZ_FIND:
+			fuzz_find(&map, k, false);
+			break;
+		case FUZZ_FIND_RCU:
+			fuzz_find(&map, k, true);
+			break;
+		case FUZZ_FIND_BATCH:
+			fuzz_batch(&map, k, value, false);
+			break;
+		case FUZZ_INSERT_BATCH:
+			fuzz_batch(&map, k, value, true);
+			break;
+		case FUZZ_RESERVE:
+			hashmap__reserve(&map, value);
+			break;
+		case FUZZ_COMPACT:
+			FUZZ_CHECK(!hashmap__compact(&map));
+			break;
+		case FUZZ_CLEAR:
+			hashmap__clear(&map);
+			memset(fuzz_ref, 0, sizeof(fuzz_ref));
+			fuzz_nr = 0;
+			break;
+		case FUZZ_QUIESCENT:
+			xk_rcu_quiescent();
+			break;
+		}
+		FUZZ_CHECK(hashmap__size(&map) == fuzz_nr);
+	}
+
+	fuzz_compare(&map);
+	hashmap__clear(&map);
+	fuzz_settle();
+	FUZZ_CHECK(xk_kmalloc_bytes() == baseline);
+	return 0;
+}
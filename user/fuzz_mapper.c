@@ -0,0 +1,149 @@
+/*
+ * Maps the physical addresses encoded in the input and checks every window
+ * map_physical hands out against the page tables and the window registry.
+ * Every operation takes 6 bytes: a selector, a 32 bit page index and a
+ * byte of page offset. The selector picks the region the page index is
+ * folded into (RAM, reserved, MMIO or anywhere, mostly holes) and, now and
+ * then, unmaps one of the windows of the mm instead or moves on to a fresh
+ * mm, after the process of the current one exited and took its windows
+ * down. Each input runs between mm_init and mm_destroy, which must give
+ * back everything the run allocated.
+ */
+#include "memory.h"
+#include "fuzz.h"
+
+#define FUZZ_OP_SIZE 6
+#define FUZZ_OP_UNMAP 0xf0
+#define FUZZ_OP_SWITCH 0xf8
+/* physical address width the fourth region spreads over */
+#define FUZZ_PA_MASK ((1ULL << 46) - 1)
+
+/* the resource pa lies in, NULL for holes */
+static const struct resource *fuzz_resource(u64 pa)
+{
+	for (size_t i = 0; i < xk_nr_iomem; i++) {
+		if (pa >= xk_iomem[i].start && pa <= xk_iomem[i].end)
+			return &xk_iomem[i];
+	}
+	return NULL;
+}
+
+static u64 fuzz_pa(const u8 *op)
+{
+	u64 page = op[1] | op[2] << 8 | op[3] << 16 | (u64)op[4] << 24;
+	u64 off = op[5] << 4;
+	const struct resource *res;
+
+	if ((op[0] & 3) == 3)
+		return ((page << PAGE_SHIFT) | off) & FUZZ_PA_MASK;
+
+	res = &xk_iomem[op[0] & 3];
+	page %= (res->end + 1 - res->start) >> PAGE_SHIFT;
+	return res->start + (page << PAGE_SHIFT) + off;
+}
+
+struct fuzz_window {
+	void *va;
+	u64 pa;
+};
+
+/* windows of the current mm, one per pud slot */
+static struct fuzz_window fuzz_windows[PT_MAX];
+static size_t fuzz_nr;
+
+static void fuzz_switch_mm(void)
+{
+	struct mm_struct *mm = xk_mm_new();
+	unsigned long va;
+
+	FUZZ_CHECK(mm);
+	/* none once the previous input dropped its mm */
+	if (current->mm) {
+		xk_mm_exit(current->mm);
+		for (size_t i = 0; i < fuzz_nr; i++) {
+			va = (unsigned long)fuzz_windows[i].va;
+			FUZZ_CHECK(!page_mapping_exist(va & PAGE_MASK));
+			FUZZ_CHECK(!mm_window_find(va, NULL));
+			FUZZ_CHECK(unmap_physical((void *)va) == XKLIB_ENOENT);
+		}
+	}
+	xk_set_mm(mm);
+	fuzz_nr = 0;
+}
+
+/* the window keeps the page offset of pa */
+static void fuzz_check_window(void *va, u64 pa)
+{
+	unsigned long page = (unsigned long)va & PAGE_MASK;
+	last_pt_t last_pt = get_last_pt(page);
+	u64 found;
+
+	FUZZ_CHECK(((unsigned long)va & ~PAGE_MASK) == (pa & ~PAGE_MASK));
+	FUZZ_CHECK(last_pt.pt_type == pt_type_pte);
+	FUZZ_CHECK(pte_pfn(last_pt.pte) == pa >> PAGE_SHIFT);
+	FUZZ_CHECK(page_mapping_exist(page));
+
+	FUZZ_CHECK(mm_window_find((unsigned long)va, &found));
+	FUZZ_CHECK(found == pa);
+	FUZZ_CHECK(mm_window_find(page + PAGE_SIZE - 1, &found));
+	FUZZ_CHECK(found == (pa | ~PAGE_MASK));
+}
+
+static void fuzz_unmap(const u8 *op)
+{
+	struct fuzz_window *w;
+	u64 found;
+
+	if (!fuzz_nr) {
+		FUZZ_CHECK(unmap_physical((void *)0x1000) == XKLIB_EINVAL);
+		return;
+	}
+
+	w = &fuzz_windows[op[1] % fuzz_nr];
+	FUZZ_CHECK(unmap_physical(w->va) == XKLIB_SUCCESS);
+	FUZZ_CHECK(!page_mapping_exist((unsigned long)w->va));
+	FUZZ_CHECK(!mm_window_find((unsigned long)w->va, &found));
+	FUZZ_CHECK(unmap_physical(w->va) == XKLIB_ENOENT);
+	*w = fuzz_windows[--fuzz_nr];
+}
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+	struct pt_permissions perms = { .read = 1, .write = 1 };
+	size_t baseline;
+	void *va;
+	u64 pa;
+
+	xk_poison = true;
+	baseline = xk_kmalloc_bytes();
+	fuzz_switch_mm();
+	FUZZ_CHECK(mm_init() == XKLIB_SUCCESS);
+
+	for (size_t i = 0; i + FUZZ_OP_SIZE <= size; i += FUZZ_OP_SIZE) {
+		if (data[i] >= FUZZ_OP_SWITCH) {
+			fuzz_switch_mm();
+		} else if (data[i] >= FUZZ_OP_UNMAP) {
+			fuzz_unmap(&data[i]);
+			continue;
+		}
+
+		pa = fuzz_pa(&data[i]);
+		va = map_physical(pa, perms);
+		if (!fuzz_resource(pa)) {
+			FUZZ_CHECK(!va);
+			continue;
+		}
+		/* a full mm is the only reason to turn a valid page down */
+		if (!va)
+			continue;
+		fuzz_check_window(va, pa);
+		FUZZ_CHECK(fuzz_nr < PT_MAX);
+		fuzz_windows[fuzz_nr++] = (struct fuzz_window){ va, pa };
+	}
+
+	xk_set_mm(NULL);
+	mm_destroy();
+	rcu_barrier();
+	FUZZ_CHECK(xk_kmalloc_bytes() == baseline);
+	return 0;
+}
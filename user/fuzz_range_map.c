@@ -0,0 +1,274 @@
+/*
+ * Runs the operations encoded in the input against a range map and against
+ * a plain array of ranges searched linearly, and aborts as soon as the two
+ * disagree. Every operation takes 6 bytes: opcode, two 16 bit operands and
+ * a byte of count. Ranges are short and packed in a small address space so
+ * that most of them nest in or overlap others, and the same range is often
+ * inserted several times.
+ */
+#include "range_map.h"
+#include "memory.h"
+#include "fuzz.h"
+
+#define FUZZ_OP_SIZE 6
+#define FUZZ_SPACE 1024
+#define FUZZ_LEN 128
+#define FUZZ_MAX 1024
+
+enum fuzz_op {
+	FUZZ_INSERT,
+	FUZZ_INSERT_DUP,
+	FUZZ_DELETE,
+	FUZZ_DELETE_DUP,
+	FUZZ_FIND,
+	FUZZ_OVERLAP,
+	FUZZ_REBUILD,
+	FUZZ_BUILD,
+	FUZZ_BUILD_UNSORTED,
+	FUZZ_CLEAR,
+	FUZZ_QUIESCENT,
+	FUZZ_OPS,
+};
+
+/*
+ * Sorted by start, a range goes after those with the same start, which is
+ * the order range_map_insert keeps too
+ */
+static struct range_map_range fuzz_ref[FUZZ_MAX];
+static size_t fuzz_nr;
+static long fuzz_value;
+
+static void fuzz_ref_insert(u64 start, u64 end, long value)
+{
+	size_t pos = fuzz_nr;
+
+	while (pos && fuzz_ref[pos - 1].start > start)
+		pos--;
+	memmove(&fuzz_ref[pos + 1], &fuzz_ref[pos],
+		(fuzz_nr - pos) * sizeof(fuzz_ref[0]));
+	fuzz_ref[pos].start = start;
+	fuzz_ref[pos].end = end;
+	fuzz_ref[pos].value = value;
+	fuzz_nr++;
+}
+
+static void fuzz_insert(struct range_map *map, u64 start, u64 end)
+{
+	size_t err;
+
+	if (fuzz_nr == FUZZ_MAX)
+		return;
+
+	err = range_map__insert(map, start, end, ++fuzz_value, GFP_KERNEL);
+	if (start >= end) {
+		FUZZ_CHECK(err == XKLIB_EINVAL);
+		return;
+	}
+	FUZZ_CHECK(!err);
+	fuzz_ref_insert(start, end, fuzz_value);
+}
+
+/* the last of the copies of [start, end) goes, as it has the same rank */
+static void fuzz_delete(struct range_map *map, u64 start, u64 end)
+{
+	long value = 0;
+	size_t err, pos;
+
+	err = range_map_delete(map, start, end, &value, GFP_KERNEL);
+	for (pos = fuzz_nr; pos-- > 0;) {
+		if (fuzz_ref[pos].start == start && fuzz_ref[pos].end == end)
+			break;
+	}
+	if (pos == (size_t)-1) {
+		FUZZ_CHECK(err == XKLIB_ENOENT);
+		return;
+	}
+
+	FUZZ_CHECK(!err && value == fuzz_ref[pos].value);
+	memmove(&fuzz_ref[pos], &fuzz_ref[pos + 1],
+		(fuzz_nr - pos - 1) * sizeof(fuzz_ref[0]));
+	fuzz_nr--;
+}
+
+/* the innermost range containing addr, i.e. the last one in the array */
+static void fuzz_find(struct range_map *map, u64 addr)
+{
+	struct range_map_range range;
+	size_t pos;
+	bool found;
+
+	found = range_map_find(map, addr, &range);
+	for (pos = fuzz_nr; pos-- > 0;) {
+		if (fuzz_ref[pos].start <= addr && addr < fuzz_ref[pos].end)
+			break;
+	}
+
+	FUZZ_CHECK(found == (pos != (size_t)-1));
+	if (found)
+		FUZZ_CHECK(range.start == fuzz_ref[pos].start &&
+			   range.end == fuzz_ref[pos].end &&
+			   range.value == fuzz_ref[pos].value);
+}
+
+struct fuzz_overlap {
+	size_t pos;
+	size_t limit;
+	u64 start;
+	u64 end;
+};
+
+/* ranges come by decreasing position among those overlapping */
+static bool fuzz_overlap_fn(const struct range_map_range *range, void *data)
+{
+	struct fuzz_overlap *o = data;
+
+	while (o->pos-- > 0) {
+		if (fuzz_ref[o->pos].start < o->end &&
+		    fuzz_ref[o->pos].end > o->start)
+			break;
+	}
+	FUZZ_CHECK(o->pos != (size_t)-1);
+	FUZZ_CHECK(range->start == fuzz_ref[o->pos].start &&
+		   range->end == fuzz_ref[o->pos].end &&
+		   range->value == fuzz_ref[o->pos].value);
+	return --o->limit;
+}
+
+static void fuzz_overlap(struct range_map *map, u64 start, u64 end,
+			 size_t limit)
+{
+	struct fuzz_overlap o = {
+		.pos = fuzz_nr,
+		.limit = limit,
+		.start = start,
+		.end = end,
+	};
+	size_t n, expected = 0;
+
+	n = range_map_for_each_overlap(map, start, end, fuzz_overlap_fn, &o);
+	for (size_t i = 0; start < end && i < fuzz_nr; i++)
+		expected += fuzz_ref[i].start < end && fuzz_ref[i].end > start;
+	FUZZ_CHECK(n == min(expected, limit));
+}
+
+/*
+ * Replaces the content with n ranges drawn from seed, sorted. Unsorted
+ * tables must be refused and leave the map alone.
+ */
+static void fuzz_build(struct range_map *map, u32 seed, size_t n,
+		       bool sorted)
+{
+	static struct range_map_range saved[FUZZ_MAX];
+	size_t nr = fuzz_nr;
+
+	memcpy(saved, fuzz_ref, nr * sizeof(saved[0]));
+	fuzz_nr = 0;
+	for (size_t i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		fuzz_ref_insert((seed >> 8) % FUZZ_SPACE,
+				(seed >> 8) % FUZZ_SPACE + 1 +
+					(seed >> 20) % FUZZ_LEN,
+				++fuzz_value);
+	}
+
+	if (sorted) {
+		FUZZ_CHECK(!range_map_build(map, fuzz_ref, n, GFP_KERNEL));
+		return;
+	}
+
+	/* the first and last starts differ, so swapping them unsorts */
+	if (n > 1 && fuzz_ref[0].start != fuzz_ref[n - 1].start) {
+		swap(fuzz_ref[0], fuzz_ref[n - 1]);
+		FUZZ_CHECK(range_map_build(map, fuzz_ref, n, GFP_KERNEL) ==
+			   XKLIB_EINVAL);
+	}
+	memcpy(fuzz_ref, saved, nr * sizeof(saved[0]));
+	fuzz_nr = nr;
+}
+
+/* every address of the space, every range of the map */
+static void fuzz_compare(struct range_map *map)
+{
+	for (u64 addr = 0; addr < FUZZ_SPACE + FUZZ_LEN; addr++)
+		fuzz_find(map, addr);
+	fuzz_overlap(map, 0, U64_MAX, U64_MAX);
+}
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+	static bool ready;
+	struct range_map map;
+	size_t baseline;
+	u16 a, b;
+	u8 c;
+
+	if (!ready) {
+		xk_poison = true;
+		FUZZ_CHECK(mm_init() == XKLIB_SUCCESS);
+		ready = true;
+	}
+
+	rcu_barrier();
+	baseline = xk_kmalloc_bytes();
+	fuzz_nr = 0;
+	range_map__init(&map, NUMA_NO_NODE);
+
+	for (size_t i = 0; i + FUZZ_OP_SIZE <= size; i += FUZZ_OP_SIZE) {
+		a = data[i + 1] | data[i + 2] << 8;
+		b = data[i + 3] | data[i + 4] << 8;
+		c = data[i + 5];
+
+		switch (data[i] % FUZZ_OPS) {
+		case FUZZ_INSERT:
+			fuzz_insert(&map, a % FUZZ_SPACE,
+				    a % FUZZ_SPACE + b % FUZZ_LEN);
+			break;
+		case FUZZ_INSERT_DUP:
+			if (fuzz_nr)
+				fuzz_insert(&map, fuzz_ref[a % fuzz_nr].start,
+					    fuzz_ref[a % fuzz_nr].end);
+			break;
+		case FUZZ_DELETE:
+			fuzz_delete(&map, a % FUZZ_SPACE,
+				    a % FUZZ_SPACE + 1 + b % FUZZ_LEN);
+			break;
+		case FUZZ_DELETE_DUP:
+			if (fuzz_nr)
+				fuzz_delete(&map, fuzz_ref[a % fuzz_nr].start,
+					    fuzz_ref[a % fuzz_nr].end);
+			break;
+		case FUZZ_FIND:
+			fuzz_find(&map, a % (FUZZ_SPACE + FUZZ_LEN));
+			break;
+		case FUZZ_OVERLAP:
+			fuzz_overlap(&map, a % (FUZZ_SPACE + FUZZ_LEN),
+				     a % (FUZZ_SPACE + FUZZ_LEN) + b % FUZZ_LEN,
+				     c ? c : U64_MAX);
+			break;
+		case FUZZ_REBUILD:
+			FUZZ_CHECK(!range_map_build(&map, fuzz_ref, fuzz_nr,
+						    GFP_KERNEL));
+			break;
+		case FUZZ_BUILD:
+			fuzz_build(&map, a | b << 16, c * 4 % FUZZ_MAX, true);
+			break;
+		case FUZZ_BUILD_UNSORTED:
+			fuzz_build(&map, a | b << 16, c * 4 % FUZZ_MAX, false);
+			break;
+		case FUZZ_CLEAR:
+			range_map__clear(&map);
+			fuzz_nr = 0;
+			break;
+		case FUZZ_QUIESCENT:
+			xk_rcu_quiescent();
+			break;
+		}
+		FUZZ_CHECK(range_map__size(&map) == fuzz_nr);
+	}
+
+	fuzz_compare(&map);
+	range_map__clear(&map);
+	rcu_barrier();
+	FUZZ_CHECK(xk_kmalloc_bytes() == baseline);
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * Runs the operations encoded in the input against a snap map and against
+ * a plain array indexed by key, and aborts as soon as the two disagree.
+ * Every operation takes 5 bytes: opcode, 16 bit key and 16 bit value. Only
+ * FUZZ_KEYS keys exist, spread over the whole long range, so updates often
+ * replace the value of a key already there.
+ */
+#include "snap_map.h"
+#include "memory.h"
+#include "fuzz.h"
+
+#define FUZZ_KEYS (1 << 12)
+#define FUZZ_OP_SIZE 5
+
+enum fuzz_op {
+	FUZZ_UPDATE,
+	FUZZ_UPDATE_EXISTING,
+	FUZZ_DELETE,
+	FUZZ_DELETE_ALL,
+	FUZZ_FIND,
+	FUZZ_BUILD,
+	FUZZ_BUILD_DUP,
+	FUZZ_CLEAR,
+	FUZZ_QUIESCENT,
+	FUZZ_OPS,
+};
+
+struct fuzz_ref {
+	bool present;
+	long value;
+	/* position in fuzz_keys */
+	u32 pos;
+};
+
+static struct fuzz_ref fuzz_ref[FUZZ_KEYS];
+/* the keys present, in no particular order */
+static u16 fuzz_keys[FUZZ_KEYS];
+static size_t fuzz_nr;
+
+static inline long fuzz_key(u16 k)
+{
+	return (long)k * 0x9e3779b97f4a7c15UL;
+}
+
+static void fuzz_ref_set(u16 k, long value)
+{
+	if (!fuzz_ref[k].present) {
+		fuzz_ref[k].present = true;
+		fuzz_ref[k].pos = fuzz_nr;
+		fuzz_keys[fuzz_nr++] = k;
+	}
+	fuzz_ref[k].value = value;
+}
+
+static void fuzz_ref_del(u16 k)
+{
+	u16 last = fuzz_keys[--fuzz_nr];
+
+	fuzz_keys[fuzz_ref[k].pos] = last;
+	fuzz_ref[last].pos = fuzz_ref[k].pos;
+	fuzz_ref[k].present = false;
+}
+
+static void fuzz_ref_clear(void)
+{
+	memset(fuzz_ref, 0, sizeof(fuzz_ref));
+	fuzz_nr = 0;
+}
+
+static void fuzz_update(struct snap_map *map, u16 k, long value)
+{
+	FUZZ_CHECK(!snap_map__update(map, fuzz_key(k), value, GFP_KERNEL));
+	fuzz_ref_set(k, value);
+}
+
+static void fuzz_delete(struct snap_map *map, u16 k)
+{
+	long value = 0;
+	size_t err;
+
+	err = snap_map_delete(map, fuzz_key(k), &value, GFP_KERNEL);
+	if (!fuzz_ref[k].present) {
+		FUZZ_CHECK(err == XKLIB_ENOENT);
+		return;
+	}
+
+	FUZZ_CHECK(!err && value == fuzz_ref[k].value);
+	fuzz_ref_del(k);
+}
+
+static void fuzz_find(struct snap_map *map, u16 k)
+{
+	long value = 0;
+	bool found;
+
+	found = snap_map__find(map, fuzz_key(k), &value);
+	FUZZ_CHECK(found == fuzz_ref[k].present);
+	if (found)
+		FUZZ_CHECK(value == fuzz_ref[k].value);
+	FUZZ_CHECK(snap_map__contains(map, fuzz_key(k)) == found);
+}
+
+/* down to an empty table, which must still answer and take new keys */
+static void fuzz_delete_all(struct snap_map *map, u16 k)
+{
+	while (fuzz_nr) {
+		u16 victim = fuzz_keys[k % fuzz_nr];
+
+		fuzz_delete(map, victim);
+		fuzz_find(map, victim);
+	}
+
+	FUZZ_CHECK(!snap_map__size(map));
+	fuzz_find(map, k % FUZZ_KEYS);
+	FUZZ_CHECK(snap_map_delete(map, fuzz_key(k % FUZZ_KEYS), NULL,
+				   GFP_KERNEL) == XKLIB_ENOENT);
+}
+
+/*
+ * Replaces the content with n distinct keys drawn from seed. With dup, the
+ * last pair repeats the key of an earlier one, the build must be refused
+ * and leave the map alone.
+ */
+static void fuzz_build(struct snap_map *map, u32 seed, size_t n, bool dup)
+{
+	static struct snap_map_pair pairs[FUZZ_KEYS];
+	static bool taken[FUZZ_KEYS];
+	static u16 keys[FUZZ_KEYS];
+	size_t nr = 0;
+	u16 k;
+
+	memset(taken, 0, sizeof(taken));
+	for (size_t i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		k = (seed >> 8) % FUZZ_KEYS;
+		if (taken[k])
+			continue;
+		taken[k] = true;
+		keys[nr] = k;
+		pairs[nr].key = fuzz_key(k);
+		pairs[nr].value = seed >> 16;
+		nr++;
+	}
+
+	if (dup) {
+		if (!nr)
+			return;
+		pairs[nr] = pairs[(seed >> 4) % nr];
+		pairs[nr].value++;
+		FUZZ_CHECK(snap_map_build(map, pairs, nr + 1, GFP_KERNEL) ==
+			   XKLIB_EEXIST);
+		return;
+	}
+
+	FUZZ_CHECK(!snap_map_build(map, pairs, nr, GFP_KERNEL));
+	fuzz_ref_clear();
+	for (size_t i = 0; i < nr; i++)
+		fuzz_ref_set(keys[i], pairs[i].value);
+}
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+	static bool ready;
+	struct snap_map map;
+	size_t baseline;
+	long value;
+	u16 k;
+
+	if (!ready) {
+		xk_poison = true;
+		FUZZ_CHECK(mm_init() == XKLIB_SUCCESS);
+		ready = true;
+	}
+
+	rcu_barrier();
+	baseline = xk_kmalloc_bytes();
+	fuzz_ref_clear();
+	snap_map__init(&map, NUMA_NO_NODE);
+
+	for (size_t i = 0; i + FUZZ_OP_SIZE <= size; i += FUZZ_OP_SIZE) {
+		k = data[i + 1] | data[i + 2] << 8;
+		value = data[i + 3] | data[i + 4] << 8;
+
+		switch (data[i] % FUZZ_OPS) {
+		case FUZZ_UPDATE:
+			fuzz_update(&map, k % FUZZ_KEYS, value);
+			break;
+		case FUZZ_UPDATE_EXISTING:
+			if (fuzz_nr)
+				fuzz_update(&map, fuzz_keys[k % fuzz_nr], value);
+			break;
+		case FUZZ_DELETE:
+			fuzz_delete(&map, k % FUZZ_KEYS);
+			break;
+		case FUZZ_DELETE_ALL:
+			fuzz_delete_all(&map, k);
+			break;
+		case FUZZ_FIND:
+			fuzz_find(&map, k % FUZZ_KEYS);
+			break;
+		case FUZZ_BUILD:
+			fuzz_build(&map, k | value << 16, k % 512, false);
+			break;
+		case FUZZ_BUILD_DUP:
+			fuzz_build(&map, k | value << 16, k % 512, true);
+			break;
+		case FUZZ_CLEAR:
+			snap_map__clear(&map);
+			fuzz_ref_clear();
+			break;
+		case FUZZ_QUIESCENT:
+			xk_rcu_quiescent();
+			break;
+		}
+		FUZZ_CHECK(snap_map__size(&map) == fuzz_nr);
+	}
+
+	for (u32 i = 0; i < FUZZ_KEYS; i++)
+		fuzz_find(&map, i);
+	snap_map__clear(&map);
+	rcu_barrier();
+	FUZZ_CHECK(xk_kmalloc_bytes() == baseline);
+	return 0;
+}
@@ -0,0 +1,1007 @@
+#pragma once
+
+/*
+ * Userspace model of the kernel API used by the xklib core, so that the
+ * hashmaps, the mapper and the walker build unmodified into libxkcore.a.
+ * Every <linux/...> and <asm/...> header of this directory forwards here.
+ *
+ * - kmalloc memory comes out of one arena standing in for physical memory:
+ *   virt_to_phys() is the offset into it, so page tables built by the
+ *   mapper can be walked back through phys_to_virt()
+ * - each thread is a cpu of its own, see xk_set_cpu(), and has its own
+ *   current task and mm, see xk_set_mm()
+ * - RCU readers are tracked per thread and call_rcu() only queues, the
+ *   callbacks run from rcu_barrier() or xk_rcu_quiescent()
+ * - work items run on a single worker thread
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef XK_NR_CPUS
+#define XK_NR_CPUS 64
+#endif
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef signed char s8;
+typedef short s16;
+typedef int s32;
+typedef long long s64;
+typedef unsigned int gfp_t;
+typedef u64 phys_addr_t;
+typedef u64 resource_size_t;
+typedef unsigned short umode_t;
+
+/* compiler */
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
+#define noinline __attribute__((noinline))
+#define __maybe_unused __attribute__((unused))
+#define __must_check __attribute__((warn_unused_result))
+#define __read_mostly
+#define __percpu
+#define __rcu
+#define __init
+#define __exit
+#define EXPORT_SYMBOL(sym)
+#define EXPORT_SYMBOL_GPL(sym)
+
+#define barrier() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BUILD_BUG_ON(cond)                       \
+	do {                                     \
+		_Static_assert(!(cond), #cond);  \
+	} while (0)
+
+#define WARN_ON(cond)                                                   \
+	({                                                              \
+		bool __xk_warn = !!(cond);                              \
+		if (unlikely(__xk_warn))                                \
+			fprintf(stderr, "WARNING: %s:%d: %s\n",         \
+				__FILE__, __LINE__, #cond);             \
+		__xk_warn;                                              \
+	})
+#define WARN_ON_ONCE(cond)                                              \
+	({                                                              \
+		static bool __xk_warned;                                \
+		bool __xk_warn = !!(cond);                              \
+		if (unlikely(__xk_warn) && !__xk_warned) {              \
+			__xk_warned = true;                             \
+			fprintf(stderr, "WARNING: %s:%d: %s\n",         \
+				__FILE__, __LINE__, #cond);             \
+		}                                                       \
+		__xk_warn;                                              \
+	})
+#define BUG_ON(cond)                  \
+	do {                          \
+		if (unlikely(cond))   \
+			abort();      \
+	} while (0)
+
+/* arithmetic */
+
+#define min(a, b)                                   \
+	({                                          \
+		__typeof__(a) __xk_a = (a);         \
+		__typeof__(b) __xk_b = (b);         \
+		__xk_a < __xk_b ? __xk_a : __xk_b;  \
+	})
+#define max(a, b)                                   \
+	({                                          \
+		__typeof__(a) __xk_a = (a);         \
+		__typeof__(b) __xk_b = (b);         \
+		__xk_a > __xk_b ? __xk_a : __xk_b;  \
+	})
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define max_t(type, a, b) max((type)(a), (type)(b))
+#define clamp(val, lo, hi) min(max(val, lo), hi)
+#define swap(a, b)                          \
+	do {                                \
+		__typeof__(a) __xk_t = (a); \
+		(a) = (b);                  \
+		(b) = __xk_t;               \
+	} while (0)
+
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define __ALIGN_MASK(x, mask) (((x) + (mask)) & ~(mask))
+#define ALIGN(x, a) __ALIGN_MASK(x, (__typeof__(x))(a) - 1)
+#define IS_ALIGNED(x, a) (((x) & ((__typeof__(x))(a) - 1)) == 0)
+#define BIT(nr) (1UL << (nr))
+#define BITS_PER_LONG 64
+#define BITS_TO_LONGS(nr) DIV_ROUND_UP(nr, BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+#define U32_MAX ((u32)~0U)
+#define U64_MAX ((u64)~0ULL)
+#define S64_MAX ((s64)(U64_MAX >> 1))
+
+#define struct_size(p, member, n) \
+	(sizeof(*(p)) + sizeof((p)->member[0]) * (size_t)(n))
+
+#define __ffs(x) ((unsigned long)__builtin_ctzl(x))
+#define fls64(x) ((x) ? 64 - __builtin_clzll(x) : 0)
+#define ilog2(n) (63 - __builtin_clzll(n))
+#define is_power_of_2(n) ((n) != 0 && (((n) & ((n) - 1)) == 0))
+
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+	return n <= 1 ? 1 : 1UL << (64 - __builtin_clzl(n - 1));
+}
+
+static inline unsigned long rounddown_pow_of_two(unsigned long n)
+{
+	return 1UL << (63 - __builtin_clzl(n));
+}
+
+static inline void set_bit(long nr, volatile unsigned long *addr)
+{
+	__atomic_fetch_or(&addr[nr / BITS_PER_LONG], BIT(nr % BITS_PER_LONG),
+			  __ATOMIC_RELAXED);
+}
+
+static inline void clear_bit(long nr, volatile unsigned long *addr)
+{
+	__atomic_fetch_and(&addr[nr / BITS_PER_LONG],
+			   ~BIT(nr % BITS_PER_LONG), __ATOMIC_RELAXED);
+}
+
+static inline bool test_bit(long nr, const volatile unsigned long *addr)
+{
+	return (__atomic_load_n(&addr[nr / BITS_PER_LONG], __ATOMIC_RELAXED) >>
+		(nr % BITS_PER_LONG)) & 1;
+}
+
+/* errors */
+
+#define MAX_ERRNO 4095
+#define IS_ERR_VALUE(x) ((unsigned long)(x) >= (unsigned long)-MAX_ERRNO)
+#define ERR_PTR(err) ((void *)(long)(err))
+#define PTR_ERR(ptr) ((long)(ptr))
+#define IS_ERR(ptr) IS_ERR_VALUE(ptr)
+#define IS_ERR_OR_NULL(ptr) (!(ptr) || IS_ERR_VALUE(ptr))
+
+/* barriers and atomics */
+
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_mb__before_atomic() smp_mb()
+#define smp_mb__after_atomic() smp_mb()
+#define smp_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+#define xchg(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define cmpxchg(p, old, new)                                               \
+	({                                                                 \
+		__typeof__(*(p)) __xk_old = (old);                         \
+		__atomic_compare_exchange_n((p), &__xk_old, (new), false,  \
+					    __ATOMIC_SEQ_CST,              \
+					    __ATOMIC_SEQ_CST);             \
+		__xk_old;                                                  \
+	})
+#define try_cmpxchg(p, pold, new)                                        \
+	__atomic_compare_exchange_n((p), (pold), (new), false,           \
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+typedef struct {
+	int counter;
+} atomic_t;
+typedef struct {
+	s64 counter;
+} atomic64_t;
+typedef struct {
+	long counter;
+} atomic_long_t;
+
+#define ATOMIC_INIT(i) { (i) }
+#define ATOMIC64_INIT(i) { (i) }
+#define ATOMIC_LONG_INIT(i) { (i) }
+
+#define XK_ATOMIC_OPS(pfx, atype, type)                                       \
+	static inline type pfx##_read(const atype *v)                        \
+	{                                                                     \
+		return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);        \
+	}                                                                     \
+	static inline void pfx##_set(atype *v, type i)                       \
+	{                                                                     \
+		__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);           \
+	}                                                                     \
+	static inline void pfx##_add(type i, atype *v)                       \
+	{                                                                     \
+		__atomic_fetch_add(&v->counter, i, __ATOMIC_RELAXED);         \
+	}                                                                     \
+	static inline void pfx##_sub(type i, atype *v)                       \
+	{                                                                     \
+		__atomic_fetch_sub(&v->counter, i, __ATOMIC_RELAXED);         \
+	}                                                                     \
+	static inline void pfx##_inc(atype *v)                               \
+	{                                                                     \
+		pfx##_add(1, v);                                              \
+	}                                                                     \
+	static inline void pfx##_dec(atype *v)                               \
+	{                                                                     \
+		pfx##_sub(1, v);                                              \
+	}                                                                     \
+	static inline type pfx##_fetch_add(type i, atype *v)                 \
+	{                                                                     \
+		return __atomic_fetch_add(&v->counter, i, __ATOMIC_SEQ_CST);  \
+	}                                                                     \
+	static inline type pfx##_add_return(type i, atype *v)                \
+	{                                                                     \
+		return __atomic_add_fetch(&v->counter, i, __ATOMIC_SEQ_CST);  \
+	}                                                                     \
+	static inline type pfx##_sub_return(type i, atype *v)                \
+	{                                                                     \
+		return __atomic_sub_fetch(&v->counter, i, __ATOMIC_SEQ_CST);  \
+	}                                                                     \
+	static inline type pfx##_inc_return(atype *v)                        \
+	{                                                                     \
+		return pfx##_add_return(1, v);                                \
+	}                                                                     \
+	static inline type pfx##_dec_return(atype *v)                        \
+	{                                                                     \
+		return pfx##_sub_return(1, v);                                \
+	}                                                                     \
+	static inline bool pfx##_dec_and_test(atype *v)                      \
+	{                                                                     \
+		return pfx##_sub_return(1, v) == 0;                           \
+	}                                                                     \
+	static inline type pfx##_xchg(atype *v, type i)                      \
+	{                                                                     \
+		return xchg(&v->counter, i);                                  \
+	}                                                                     \
+	static inline type pfx##_cmpxchg(atype *v, type old, type new)      \
+	{                                                                     \
+		return cmpxchg(&v->counter, old, new);                        \
+	}                                                                     \
+	static inline bool pfx##_try_cmpxchg(atype *v, type *old, type new) \
+	{                                                                     \
+		return try_cmpxchg(&v->counter, old, new);                    \
+	}
+
+XK_ATOMIC_OPS(atomic, atomic_t, int)
+XK_ATOMIC_OPS(atomic64, atomic64_t, s64)
+XK_ATOMIC_OPS(atomic_long, atomic_long_t, long)
+
+/* cpus, nodes and scheduling */
+
+#define NUMA_NO_NODE (-1)
+#define MAX_NUMNODES 4
+#define nr_cpu_ids XK_NR_CPUS
+#define nr_node_ids 1
+
+extern __thread int xk_cpu_id;
+int xk_cpu_assign(void);
+/* pins the calling thread to cpu, threads get distinct cpus otherwise */
+void xk_set_cpu(int cpu);
+
+static inline int smp_processor_id(void)
+{
+	return likely(xk_cpu_id >= 0) ? xk_cpu_id : xk_cpu_assign();
+}
+
+#define raw_smp_processor_id() smp_processor_id()
+#define get_cpu() smp_processor_id()
+#define put_cpu() do { } while (0)
+#define numa_node_id() 0
+#define cpu_to_node(cpu) ((void)(cpu), 0)
+#define num_possible_cpus() XK_NR_CPUS
+#define num_online_cpus() XK_NR_CPUS
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < XK_NR_CPUS; (cpu)++)
+#define for_each_online_cpu(cpu) for_each_possible_cpu(cpu)
+#define for_each_online_node(nid) for ((nid) = 0; (nid) < nr_node_ids; (nid)++)
+#define for_each_node(nid) for_each_online_node(nid)
+
+#define preempt_disable() barrier()
+#define preempt_enable() barrier()
+#define local_irq_save(flags) ((flags) = 0, barrier())
+#define local_irq_restore(flags) ((void)(flags), barrier())
+#define local_irq_disable() barrier()
+#define local_irq_enable() barrier()
+#define local_bh_disable() barrier()
+#define local_bh_enable() barrier()
+#define in_nmi() false
+#define in_interrupt() false
+#define in_task() true
+#define might_sleep() do { } while (0)
+#define cond_resched() sched_yield()
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	barrier();
+#endif
+}
+
+/* spins a little, then yields the cpu to whoever holds what we wait for */
+static inline void xk_spin_wait(unsigned int *spins)
+{
+	if (++*spins < 128)
+		cpu_relax();
+	else
+		sched_yield();
+}
+
+/*
+ * Static per-cpu variables live in the xk_percpu section, of which every
+ * cpu gets a copy, and alloc_percpu() hands out XK_NR_CPUS objects in a
+ * row. per_cpu_ptr() tells them apart by address.
+ */
+#define DEFINE_PER_CPU(type, name) \
+	__typeof__(type) name __attribute__((section("xk_percpu")))
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) name
+
+extern char __start_xk_percpu[] __attribute__((weak));
+extern char __stop_xk_percpu[] __attribute__((weak));
+extern char *xk_percpu_area;
+extern size_t xk_percpu_unit;
+
+static inline void *xk_per_cpu_ptr(const void *ptr, size_t size, int cpu)
+{
+	const char *p = ptr;
+
+	if (p >= __start_xk_percpu && p < __stop_xk_percpu)
+		return xk_percpu_area + cpu * xk_percpu_unit +
+		       (p - __start_xk_percpu);
+	return (char *)ptr + cpu * size;
+}
+
+#define per_cpu_ptr(ptr, cpu) \
+	((__typeof__(ptr))xk_per_cpu_ptr((ptr), sizeof(*(ptr)), (cpu)))
+#define this_cpu_ptr(ptr) per_cpu_ptr(ptr, smp_processor_id())
+#define raw_cpu_ptr(ptr) this_cpu_ptr(ptr)
+#define get_cpu_ptr(ptr) this_cpu_ptr(ptr)
+#define put_cpu_ptr(ptr) do { } while (0)
+#define per_cpu(var, cpu) (*per_cpu_ptr(&(var), cpu))
+#define this_cpu_read(var) (*this_cpu_ptr(&(var)))
+#define this_cpu_write(var, val) (*this_cpu_ptr(&(var)) = (val))
+#define this_cpu_add(var, val) (*this_cpu_ptr(&(var)) += (val))
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+#define this_cpu_xchg(var, val) xchg(this_cpu_ptr(&(var)), val)
+
+#define alloc_percpu(type) \
+	((type *)xk_alloc_percpu(sizeof(type), __alignof__(type)))
+#define alloc_percpu_gfp(type, gfp) alloc_percpu(type)
+void *xk_alloc_percpu(size_t size, size_t align);
+void free_percpu(void *ptr);
+
+/* locks */
+
+typedef struct {
+	int locked;
+} spinlock_t;
+
+#define __SPIN_LOCK_UNLOCKED(name) { 0 }
+#define DEFINE_SPINLOCK(name) spinlock_t name = __SPIN_LOCK_UNLOCKED(name)
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+	__atomic_store_n(&lock->locked, 0, __ATOMIC_RELAXED);
+}
+
+static inline bool spin_trylock(spinlock_t *lock)
+{
+	return !__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) &&
+	       !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	unsigned int spins = 0;
+
+	while (!spin_trylock(lock))
+		xk_spin_wait(&spins);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	__atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+#define spin_lock_irq(lock) spin_lock(lock)
+#define spin_unlock_irq(lock) spin_unlock(lock)
+#define spin_lock_bh(lock) spin_lock(lock)
+#define spin_unlock_bh(lock) spin_unlock(lock)
+#define spin_lock_irqsave(lock, flags) ((flags) = 0, spin_lock(lock))
+#define spin_unlock_irqrestore(lock, flags) ((void)(flags), spin_unlock(lock))
+#define spin_trylock_irqsave(lock, flags) ((flags) = 0, spin_trylock(lock))
+
+struct mutex {
+	pthread_mutex_t lock;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(m) pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_destroy(m) pthread_mutex_destroy(&(m)->lock)
+#define mutex_lock(m) pthread_mutex_lock(&(m)->lock)
+#define mutex_unlock(m) pthread_mutex_unlock(&(m)->lock)
+#define mutex_trylock(m) (pthread_mutex_trylock(&(m)->lock) == 0)
+
+#define lockdep_is_held(lock) ((void)(lock), 1)
+#define lockdep_assert_held(lock) do { } while (0)
+
+typedef struct {
+	unsigned int sequence;
+} seqcount_t;
+
+#define seqcount_init(s) ((s)->sequence = 0)
+
+static inline unsigned int read_seqcount_begin(const seqcount_t *s)
+{
+	unsigned int seq, spins = 0;
+
+	while ((seq = smp_load_acquire(&s->sequence)) & 1)
+		xk_spin_wait(&spins);
+	return seq;
+}
+
+static inline bool read_seqcount_retry(const seqcount_t *s, unsigned int start)
+{
+	smp_rmb();
+	return READ_ONCE(s->sequence) != start;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+	WRITE_ONCE(s->sequence, s->sequence + 1);
+	smp_wmb();
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+	smp_wmb();
+	WRITE_ONCE(s->sequence, s->sequence + 1);
+}
+
+/* rcu */
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+/* outermost read side sections make ctr odd, then even again */
+struct xk_rcu_reader {
+	unsigned long ctr;
+	unsigned int nest;
+	struct xk_rcu_reader *next;
+};
+
+extern __thread struct xk_rcu_reader *xk_rcu_self;
+struct xk_rcu_reader *xk_rcu_register(void);
+
+static inline void rcu_read_lock(void)
+{
+	struct xk_rcu_reader *r = xk_rcu_self;
+
+	if (unlikely(!r))
+		r = xk_rcu_register();
+	if (!r->nest++) {
+		__atomic_store_n(&r->ctr, r->ctr + 1, __ATOMIC_RELAXED);
+		smp_mb();
+	}
+}
+
+static inline void rcu_read_unlock(void)
+{
+	struct xk_rcu_reader *r = xk_rcu_self;
+
+	if (!--r->nest)
+		__atomic_store_n(&r->ctr, r->ctr + 1, __ATOMIC_RELEASE);
+}
+
+void call_rcu(struct rcu_head *head, rcu_callback_t func);
+void synchronize_rcu(void);
+void rcu_barrier(void);
+/* runs the callbacks queued so far, outside of any read side section */
+void xk_rcu_quiescent(void);
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_dereference_raw(p) rcu_dereference(p)
+#define rcu_dereference_check(p, c) rcu_dereference(p)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_access_pointer(p) READ_ONCE(p)
+#define rcu_assign_pointer(p, v) smp_store_release(&(p), (v))
+#define RCU_INIT_POINTER(p, v) WRITE_ONCE(p, v)
+/* the offset of the rcu_head stands in for the callback, as in the kernel */
+#define kfree_rcu(ptr, rhf)                                        \
+	call_rcu(&(ptr)->rhf,                                      \
+		 (rcu_callback_t)offsetof(__typeof__(*(ptr)), rhf))
+
+/* lists */
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+}
+
+static inline bool list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline void list_splice_init(struct list_head *list,
+				    struct list_head *head)
+{
+	if (list_empty(list))
+		return;
+	list->next->prev = head;
+	list->prev->next = head->next;
+	head->next->prev = list->prev;
+	head->next = list->next;
+	INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_for_each(pos, head) \
+	for ((pos) = (head)->next; (pos) != (head); (pos) = (pos)->next)
+#define list_for_each_entry(pos, head, member)                            \
+	for ((pos) = list_entry((head)->next, __typeof__(*(pos)), member); \
+	     &(pos)->member != (head);                                    \
+	     (pos) = list_entry((pos)->member.next, __typeof__(*(pos)),  \
+				member))
+
+/* memory */
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+#define PAGE_ALIGN(addr) ALIGN(addr, PAGE_SIZE)
+#define PMD_SHIFT 21
+#define PUD_SHIFT 30
+#define PGDIR_SHIFT 39
+#define L1_CACHE_BYTES 64
+#define SMP_CACHE_BYTES L1_CACHE_BYTES
+#define ____cacheline_aligned __attribute__((aligned(L1_CACHE_BYTES)))
+#define ____cacheline_aligned_in_smp ____cacheline_aligned
+
+#define GFP_KERNEL 0x1u
+#define GFP_ATOMIC 0x2u
+#define GFP_NOWAIT 0x4u
+#define __GFP_ZERO 0x8u
+#define __GFP_NOWARN 0x10u
+#define __GFP_THISNODE 0x20u
+#define __GFP_NORETRY 0x40u
+
+/* largest kmalloc, as on x86 */
+#define KMALLOC_MAX_SIZE (1UL << 22)
+
+void *kmalloc(size_t size, gfp_t gfp);
+void kfree(const void *p);
+size_t ksize(const void *p);
+void *vmalloc(size_t size);
+void vfree(const void *p);
+void kvfree(const void *p);
+
+static inline void *kzalloc(size_t size, gfp_t gfp)
+{
+	return kmalloc(size, gfp | __GFP_ZERO);
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t gfp)
+{
+	size_t bytes;
+
+	if (__builtin_mul_overflow(n, size, &bytes))
+		return NULL;
+	return kmalloc(bytes, gfp);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp)
+{
+	return kmalloc_array(n, size, gfp | __GFP_ZERO);
+}
+
+#define kmalloc_node(size, gfp, node) kmalloc(size, gfp)
+#define kzalloc_node(size, gfp, node) kzalloc(size, gfp)
+#define kcalloc_node(n, size, gfp, node) kcalloc(n, size, gfp)
+#define kmalloc_array_node(n, size, gfp, node) kmalloc_array(n, size, gfp)
+
+static inline void *vzalloc(size_t size)
+{
+	void *p = vmalloc(size);
+
+	if (p)
+		memset(p, 0, size);
+	return p;
+}
+
+/* kvmalloc memory is never handed to virt_to_phys, keep it off the arena */
+static inline void *kvmalloc(size_t size, gfp_t gfp)
+{
+	return gfp & __GFP_ZERO ? vzalloc(size) : vmalloc(size);
+}
+
+static inline void *kvmalloc_array(size_t n, size_t size, gfp_t gfp)
+{
+	size_t bytes;
+
+	if (__builtin_mul_overflow(n, size, &bytes))
+		return NULL;
+	return kvmalloc(bytes, gfp);
+}
+
+#define kvzalloc(size, gfp) kvmalloc(size, (gfp) | __GFP_ZERO)
+#define kvcalloc(n, size, gfp) kvmalloc_array(n, size, (gfp) | __GFP_ZERO)
+#define kvmalloc_node(size, gfp, node) kvmalloc(size, gfp)
+#define kvzalloc_node(size, gfp, node) kvzalloc(size, gfp)
+
+#define SLAB_HWCACHE_ALIGN 0x1UL
+#define SLAB_TYPESAFE_BY_RCU 0x2UL
+#define SLAB_ACCOUNT 0x4UL
+#define SLAB_PANIC 0x8UL
+
+struct kmem_cache {
+	const char *name;
+	size_t size;
+	void (*ctor)(void *obj);
+};
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+				     unsigned int align, unsigned long flags,
+				     void (*ctor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *cache);
+void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t gfp);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+#define KMEM_CACHE(s, flags)                                             \
+	kmem_cache_create(#s, sizeof(struct s), __alignof__(struct s), \
+			  (flags), NULL)
+#define kmem_cache_alloc_node(cache, gfp, node) kmem_cache_alloc(cache, gfp)
+#define kmem_cache_zalloc(cache, gfp) \
+	kmem_cache_alloc(cache, (gfp) | __GFP_ZERO)
+
+/* the arena standing in for physical memory, pa 0 at xk_arena */
+extern char *xk_arena;
+extern size_t xk_arena_size;
+/* bytes currently handed out by kmalloc, for leak checks */
+size_t xk_kmalloc_bytes(void);
+/* kfree() fills blocks with 0x6b, off by default as it costs time */
+extern bool xk_poison;
+
+static inline phys_addr_t virt_to_phys(const volatile void *p)
+{
+	return (const char *)p - xk_arena;
+}
+
+static inline void *phys_to_virt(phys_addr_t pa)
+{
+	return xk_arena + pa;
+}
+
+struct page;
+
+#define virt_to_page(p) \
+	((struct page *)((unsigned long)(p) & PAGE_MASK))
+#define page_address(page) ((void *)(page))
+#define page_to_nid(page) ((void)(page), 0)
+
+/* kvmalloc memory lives outside the arena */
+static inline bool is_vmalloc_addr(const void *p)
+{
+	return (const char *)p < xk_arena ||
+	       (const char *)p >= xk_arena + xk_arena_size;
+}
+
+#define vmalloc_to_page(p) virt_to_page(p)
+
+/* x86-64 4-level page tables, the p4d level folded into the pgd */
+
+typedef struct {
+	unsigned long pgd;
+} pgd_t;
+typedef struct {
+	unsigned long pud;
+} pud_t;
+typedef struct {
+	unsigned long pmd;
+} pmd_t;
+typedef struct {
+	unsigned long pte;
+} pte_t;
+
+#define _PAGE_PRESENT 0x1UL
+#define _PAGE_PSE 0x80UL
+#define PTE_PFN_MASK 0x000ffffffffff000UL
+#define PTRS_PER_TABLE 512
+#define PTRS_PER_PUD PTRS_PER_TABLE
+#define PUD_SIZE (1UL << PUD_SHIFT)
+#define PUD_MASK (~(PUD_SIZE - 1))
+
+#define pgd_index(addr) (((addr) >> PGDIR_SHIFT) & (PTRS_PER_TABLE - 1))
+#define pud_index(addr) (((addr) >> PUD_SHIFT) & (PTRS_PER_TABLE - 1))
+#define pmd_index(addr) (((addr) >> PMD_SHIFT) & (PTRS_PER_TABLE - 1))
+#define pte_index(addr) (((addr) >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1))
+
+#define XK_TABLE_PFN(level)                                            \
+	static inline unsigned long level##_pfn(level##_t entry)      \
+	{                                                              \
+		return (entry.level & PTE_PFN_MASK) >> PAGE_SHIFT;     \
+	}
+
+XK_TABLE_PFN(pgd)
+XK_TABLE_PFN(pud)
+XK_TABLE_PFN(pmd)
+XK_TABLE_PFN(pte)
+
+struct mmu_notifier;
+
+struct mm_struct {
+	pgd_t *pgd;
+	atomic_t mm_count;
+	/* under xk_mm_lock in shim.c */
+	struct mmu_notifier *notifiers;
+};
+
+struct task_struct {
+	struct mm_struct *mm;
+	int pid;
+};
+
+static inline pgd_t *pgd_offset(struct mm_struct *mm, unsigned long addr)
+{
+	return mm->pgd + pgd_index(addr);
+}
+
+static inline pud_t *pud_offset(pgd_t *pgd, unsigned long addr)
+{
+	return (pud_t *)phys_to_virt(pgd->pgd & PTE_PFN_MASK) +
+	       pud_index(addr);
+}
+
+static inline pmd_t *pmd_offset(pud_t *pud, unsigned long addr)
+{
+	return (pmd_t *)phys_to_virt(pud->pud & PTE_PFN_MASK) +
+	       pmd_index(addr);
+}
+
+static inline pte_t *pte_offset_kernel(pmd_t *pmd, unsigned long addr)
+{
+	return (pte_t *)phys_to_virt(pmd->pmd & PTE_PFN_MASK) +
+	       pte_index(addr);
+}
+
+static inline bool pmd_trans_huge(pmd_t pmd)
+{
+	return (pmd.pmd & (_PAGE_PRESENT | _PAGE_PSE)) ==
+	       (_PAGE_PRESENT | _PAGE_PSE);
+}
+
+#define flush_tlb_all() barrier()
+#define flush_tlb_mm(mm) barrier()
+#define flush_tlb_mm_range(mm, start, end, stride_shift, freed_tables) \
+	barrier()
+
+struct task_struct *xk_current(void);
+#define current xk_current()
+
+/* a new mm with an empty pgd and one reference */
+struct mm_struct *xk_mm_new(void);
+/* gives the calling thread mm, dropping its previous one; NULL for none */
+void xk_set_mm(struct mm_struct *mm);
+void mmdrop(struct mm_struct *mm);
+
+static inline void mmgrab(struct mm_struct *mm)
+{
+	atomic_inc(&mm->mm_count);
+}
+
+/* the process of mm exits: its notifiers are released, as exit_mmap does */
+void xk_mm_exit(struct mm_struct *mm);
+
+/*
+ * mmu notifiers, get/put flavour only. A notifier pins its mm and is
+ * freed from an rcu callback, where the kernel uses srcu.
+ */
+
+struct mmu_notifier_ops {
+	void (*release)(struct mmu_notifier *subscription,
+			struct mm_struct *mm);
+	struct mmu_notifier *(*alloc_notifier)(struct mm_struct *mm);
+	void (*free_notifier)(struct mmu_notifier *subscription);
+};
+
+struct mmu_notifier {
+	struct mmu_notifier *next;
+	const struct mmu_notifier_ops *ops;
+	struct mm_struct *mm;
+	struct rcu_head rcu;
+	unsigned int users;
+};
+
+struct mmu_notifier *mmu_notifier_get(const struct mmu_notifier_ops *ops,
+				      struct mm_struct *mm);
+void mmu_notifier_put(struct mmu_notifier *subscription);
+#define mmu_notifier_synchronize() rcu_barrier()
+
+/* physical resources, see xk_resources in shim.c for the layout */
+
+struct resource {
+	resource_size_t start;
+	resource_size_t end;
+	const char *name;
+	unsigned long flags;
+	unsigned long desc;
+};
+
+#define IORESOURCE_MEM 0x00000200UL
+#define IORESOURCE_SYSTEM_RAM 0x01000200UL
+#define IORESOURCE_BUSY 0x80000000UL
+#define IORES_DESC_NONE 0
+#define IORES_DESC_RESERVED 7
+
+extern struct resource xk_iomem[];
+extern const size_t xk_nr_iomem;
+
+int walk_iomem_res_desc(unsigned long desc, unsigned long flags, u64 start,
+			u64 end, void *arg,
+			int (*func)(struct resource *res, void *arg));
+int walk_system_ram_res(u64 start, u64 end, void *arg,
+			int (*func)(struct resource *res, void *arg));
+
+/* work items */
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	work_func_t func;
+	struct work_struct *xk_next;
+	u64 xk_due;
+	bool xk_pending;
+};
+
+struct delayed_work {
+	struct work_struct work;
+};
+
+struct workqueue_struct;
+extern struct workqueue_struct *system_wq;
+
+#define HZ 1000
+#define jiffies (xk_ktime_ns() / (1000000000ULL / HZ))
+#define msecs_to_jiffies(ms) ((unsigned long)(ms))
+
+#define INIT_WORK(w, f)                 \
+	do {                            \
+		(w)->func = (f);        \
+		(w)->xk_next = NULL;    \
+		(w)->xk_pending = false; \
+	} while (0)
+#define INIT_DELAYED_WORK(dw, f) INIT_WORK(&(dw)->work, f)
+#define DECLARE_WORK(n, f) struct work_struct n = { .func = (f) }
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+
+/* queues w to run delay jiffies from now, unless it is pending already */
+bool xk_queue_work(struct work_struct *w, unsigned long delay, bool mod);
+bool cancel_work_sync(struct work_struct *w);
+void flush_work(struct work_struct *w);
+
+#define schedule_work(w) xk_queue_work(w, 0, false)
+#define schedule_delayed_work(dw, delay) \
+	xk_queue_work(&(dw)->work, delay, false)
+#define mod_delayed_work(wq, dw, delay) \
+	((void)(wq), xk_queue_work(&(dw)->work, delay, true))
+#define cancel_delayed_work_sync(dw) cancel_work_sync(&(dw)->work)
+
+/* time and randomness */
+
+static inline u64 xk_ktime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef s64 ktime_t;
+#define ktime_get_ns() xk_ktime_ns()
+#define ktime_get() ((ktime_t)xk_ktime_ns())
+#define ktime_sub(a, b) ((a) - (b))
+#define ktime_to_ns(kt) (kt)
+
+u64 get_random_u64(void);
+#define get_random_u32() ((u32)get_random_u64())
+void get_random_bytes(void *buf, size_t len);
+
+#define prefetch(p) __builtin_prefetch(p)
+#define prefetchw(p) __builtin_prefetch(p, 1)
+
+/* logging, quiet unless XK_VERBOSE is set in the environment */
+
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define KERN_INFO ""
+#define KERN_WARNING ""
+#define KERN_ERR ""
+#define pr_info(fmt, ...) printk(fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...) printk(fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...) printk(fmt, ##__VA_ARGS__)
+
+/*
+ * debugfs files are kept in a table instead, xk_debugfs_show() runs the
+ * show callback of one of them by path, e.g. "xklib/hashmap/hash_quality"
+ */
+
+struct dentry;
+struct seq_file {
+	FILE *out;
+	void *private;
+};
+
+struct file_operations {
+	int (*show)(struct seq_file *m, void *v);
+};
+
+#define DEFINE_SHOW_ATTRIBUTE(name)                               \
+	static const struct file_operations name##_fops = {        \
+		.show = name##_show,                              \
+	}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops);
+void debugfs_remove(struct dentry *dentry);
+void debugfs_remove_recursive(struct dentry *dentry);
+int xk_debugfs_show(const char *path, FILE *out);
+
+#define seq_printf(m, fmt, ...) fprintf((m)->out, fmt, ##__VA_ARGS__)
+#define seq_puts(m, s) fputs(s, (m)->out)
+#define seq_putc(m, c) fputc(c, (m)->out)
@@ -0,0 +1,874 @@
+#include <stdarg.h>
+#include <sys/mman.h>
+
+#include "xkshim.h"
+
+/*
+ * Arena allocator behind kmalloc: power of two size classes from 16 bytes
+ * to KMALLOC_MAX_SIZE, naturally aligned like the kernel's. Blocks of a
+ * page or more are carved from the arena one by one, smaller ones out of
+ * 64 KiB slabs. Every arena page remembers the class of the blocks it
+ * holds, so kfree() needs no header. Memory is never given back.
+ */
+#define XK_MIN_SHIFT 4
+#define XK_MAX_SHIFT 22
+#define XK_SLAB_SHIFT 16
+#define XK_ARENA_MB 1024
+
+struct xk_free {
+	struct xk_free *next;
+};
+
+struct xk_class {
+	pthread_mutex_t lock;
+	struct xk_free *free;
+};
+
+char *xk_arena;
+size_t xk_arena_size;
+static u8 *xk_page_class;
+static struct xk_class xk_classes[XK_MAX_SHIFT + 1];
+static pthread_mutex_t xk_brk_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t xk_brk;
+static size_t xk_used;
+bool xk_poison;
+
+static bool xk_in_arena(const void *p)
+{
+	return (const char *)p >= xk_arena &&
+	       (const char *)p < xk_arena + xk_arena_size;
+}
+
+static void *xk_carve(unsigned int shift, unsigned int class)
+{
+	size_t size = 1UL << shift, off;
+
+	pthread_mutex_lock(&xk_brk_lock);
+	off = ALIGN(xk_brk, size);
+	if (off + size > xk_arena_size) {
+		pthread_mutex_unlock(&xk_brk_lock);
+		return NULL;
+	}
+	xk_brk = off + size;
+	pthread_mutex_unlock(&xk_brk_lock);
+
+	memset(&xk_page_class[off >> PAGE_SHIFT], class, size >> PAGE_SHIFT);
+	return xk_arena + off;
+}
+
+void *kmalloc(size_t size, gfp_t gfp)
+{
+	unsigned int shift = XK_MIN_SHIFT;
+	struct xk_class *c;
+	struct xk_free *p;
+	char *slab;
+
+	if (size > KMALLOC_MAX_SIZE)
+		return NULL;
+	while ((1UL << shift) < size)
+		shift++;
+
+	c = &xk_classes[shift];
+	pthread_mutex_lock(&c->lock);
+	p = c->free;
+	if (p)
+		c->free = p->next;
+	pthread_mutex_unlock(&c->lock);
+
+	if (!p && shift >= PAGE_SHIFT) {
+		p = xk_carve(shift, shift);
+	} else if (!p) {
+		slab = xk_carve(XK_SLAB_SHIFT, shift);
+		if (!slab)
+			return NULL;
+
+		/* first block is ours, the others go on the free list */
+		p = (struct xk_free *)slab;
+		pthread_mutex_lock(&c->lock);
+		for (size_t off = 1UL << shift; off < 1UL << XK_SLAB_SHIFT;
+		     off += 1UL << shift) {
+			((struct xk_free *)(slab + off))->next = c->free;
+			c->free = (struct xk_free *)(slab + off);
+		}
+		pthread_mutex_unlock(&c->lock);
+	}
+	if (!p)
+		return NULL;
+
+	__atomic_fetch_add(&xk_used, 1UL << shift, __ATOMIC_RELAXED);
+	if (gfp & __GFP_ZERO)
+		memset(p, 0, 1UL << shift);
+	return p;
+}
+
+size_t ksize(const void *p)
+{
+	if (!p)
+		return 0;
+	return 1UL << xk_page_class[((const char *)p - xk_arena) >> PAGE_SHIFT];
+}
+
+void kfree(const void *p)
+{
+	struct xk_free *f = (struct xk_free *)p;
+	struct xk_class *c;
+	size_t size;
+
+	if (!p)
+		return;
+	if (!xk_in_arena(p)) {
+		free(f);
+		return;
+	}
+
+	size = ksize(p);
+	c = &xk_classes[__builtin_ctzl(size)];
+	/* like slab poisoning, stale readers see 0x6b instead of old data */
+	if (xk_poison)
+		memset(f, 0x6b, size);
+	__atomic_fetch_sub(&xk_used, size, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&c->lock);
+	f->next = c->free;
+	c->free = f;
+	pthread_mutex_unlock(&c->lock);
+}
+
+size_t xk_kmalloc_bytes(void)
+{
+	return __atomic_load_n(&xk_used, __ATOMIC_RELAXED);
+}
+
+void *vmalloc(size_t size)
+{
+	return malloc(size ? size : 1);
+}
+
+void vfree(const void *p)
+{
+	free((void *)p);
+}
+
+void kvfree(const void *p)
+{
+	if (xk_in_arena(p))
+		kfree(p);
+	else
+		free((void *)p);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+				     unsigned int align, unsigned long flags,
+				     void (*ctor)(void *obj))
+{
+	struct kmem_cache *cache = calloc(1, sizeof(*cache));
+
+	if (!cache)
+		return NULL;
+	if (flags & SLAB_HWCACHE_ALIGN)
+		align = max(align, (unsigned int)L1_CACHE_BYTES);
+	cache->name = name;
+	cache->size = align ? ALIGN((size_t)size, align) : size;
+	cache->ctor = ctor;
+	return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+	free(cache);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t gfp)
+{
+	void *obj = kmalloc(cache->size, gfp);
+
+	if (obj && cache->ctor)
+		cache->ctor(obj);
+	return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	kfree(obj);
+}
+
+/* cpus */
+
+__thread int xk_cpu_id = -1;
+static int xk_next_cpu;
+char *xk_percpu_area;
+size_t xk_percpu_unit;
+
+int xk_cpu_assign(void)
+{
+	xk_cpu_id = __atomic_fetch_add(&xk_next_cpu, 1, __ATOMIC_RELAXED) %
+		    XK_NR_CPUS;
+	return xk_cpu_id;
+}
+
+void xk_set_cpu(int cpu)
+{
+	xk_cpu_id = cpu % XK_NR_CPUS;
+}
+
+void *xk_alloc_percpu(size_t size, size_t align)
+{
+	size_t bytes = ALIGN(size * XK_NR_CPUS, align);
+	void *p = aligned_alloc(align, bytes);
+
+	if (p)
+		memset(p, 0, bytes);
+	return p;
+}
+
+void free_percpu(void *ptr)
+{
+	free(ptr);
+}
+
+/* rcu */
+
+__thread struct xk_rcu_reader *xk_rcu_self;
+static struct xk_rcu_reader *xk_rcu_readers;
+static pthread_mutex_t xk_rcu_readers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct rcu_head *xk_rcu_head;
+static struct rcu_head **xk_rcu_tail = &xk_rcu_head;
+static size_t xk_rcu_pending;
+static pthread_mutex_t xk_rcu_cb_lock = PTHREAD_MUTEX_INITIALIZER;
+/* serializes callback runs, so rcu_barrier() waits for a running one */
+static pthread_mutex_t xk_rcu_run_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* callbacks queued before the worker runs them on its own */
+#define XK_RCU_BATCH 1024
+
+static void xk_work_kick(void);
+
+/* records of exited threads stay on the list, with an even ctr */
+struct xk_rcu_reader *xk_rcu_register(void)
+{
+	struct xk_rcu_reader *r = calloc(1, sizeof(*r));
+
+	if (!r)
+		abort();
+	pthread_mutex_lock(&xk_rcu_readers_lock);
+	r->next = xk_rcu_readers;
+	xk_rcu_readers = r;
+	pthread_mutex_unlock(&xk_rcu_readers_lock);
+
+	xk_rcu_self = r;
+	return r;
+}
+
+void synchronize_rcu(void)
+{
+	struct xk_rcu_reader *r;
+	unsigned int spins;
+	unsigned long ctr;
+
+	if (xk_rcu_self && xk_rcu_self->nest) {
+		fprintf(stderr, "synchronize_rcu() in a read side section\n");
+		abort();
+	}
+
+	smp_mb();
+	pthread_mutex_lock(&xk_rcu_readers_lock);
+	for (r = xk_rcu_readers; r; r = r->next) {
+		ctr = smp_load_acquire(&r->ctr);
+		spins = 0;
+		while ((ctr & 1) && smp_load_acquire(&r->ctr) == ctr)
+			xk_spin_wait(&spins);
+	}
+	pthread_mutex_unlock(&xk_rcu_readers_lock);
+	smp_mb();
+}
+
+void call_rcu(struct rcu_head *head, rcu_callback_t func)
+{
+	bool kick;
+
+	head->func = func;
+	head->next = NULL;
+
+	pthread_mutex_lock(&xk_rcu_cb_lock);
+	*xk_rcu_tail = head;
+	xk_rcu_tail = &head->next;
+	kick = ++xk_rcu_pending == XK_RCU_BATCH;
+	pthread_mutex_unlock(&xk_rcu_cb_lock);
+
+	if (kick)
+		xk_work_kick();
+}
+
+void xk_rcu_quiescent(void)
+{
+	struct rcu_head *head, *next;
+	unsigned long off;
+
+	pthread_mutex_lock(&xk_rcu_run_lock);
+	pthread_mutex_lock(&xk_rcu_cb_lock);
+	head = xk_rcu_head;
+	xk_rcu_head = NULL;
+	xk_rcu_tail = &xk_rcu_head;
+	xk_rcu_pending = 0;
+	pthread_mutex_unlock(&xk_rcu_cb_lock);
+
+	if (head)
+		synchronize_rcu();
+	for (; head; head = next) {
+		next = head->next;
+		off = (unsigned long)head->func;
+		if (off < PAGE_SIZE)
+			kfree((char *)head - off);
+		else
+			head->func(head);
+	}
+	pthread_mutex_unlock(&xk_rcu_run_lock);
+}
+
+void rcu_barrier(void)
+{
+	xk_rcu_quiescent();
+}
+
+/*
+ * Work items, run one at a time on a worker started on first use. The
+ * worker also runs the RCU callbacks once XK_RCU_BATCH are queued, it
+ * never is in a read side section itself.
+ */
+
+struct workqueue_struct *system_wq;
+
+static pthread_mutex_t xk_work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t xk_work_cond;
+static pthread_cond_t xk_work_done;
+static struct work_struct *xk_work_list;
+static struct work_struct *xk_work_running;
+static bool xk_work_started;
+static bool xk_work_rcu;
+
+static void *xk_worker(void *arg)
+{
+	struct work_struct **pw, **first;
+	struct timespec ts;
+	u64 now;
+
+	pthread_mutex_lock(&xk_work_lock);
+	for (;;) {
+		if (xk_work_rcu) {
+			xk_work_rcu = false;
+			pthread_mutex_unlock(&xk_work_lock);
+			xk_rcu_quiescent();
+			pthread_mutex_lock(&xk_work_lock);
+			continue;
+		}
+
+		first = NULL;
+		for (pw = &xk_work_list; *pw; pw = &(*pw)->xk_next) {
+			if (!first || (*pw)->xk_due < (*first)->xk_due)
+				first = pw;
+		}
+		if (!first) {
+			pthread_cond_wait(&xk_work_cond, &xk_work_lock);
+			continue;
+		}
+
+		now = xk_ktime_ns();
+		if ((*first)->xk_due > now) {
+			ts.tv_sec = (*first)->xk_due / 1000000000ULL;
+			ts.tv_nsec = (*first)->xk_due % 1000000000ULL;
+			pthread_cond_timedwait(&xk_work_cond, &xk_work_lock,
+					       &ts);
+			continue;
+		}
+
+		xk_work_running = *first;
+		*first = xk_work_running->xk_next;
+		xk_work_running->xk_pending = false;
+		pthread_mutex_unlock(&xk_work_lock);
+
+		xk_work_running->func(xk_work_running);
+
+		pthread_mutex_lock(&xk_work_lock);
+		xk_work_running = NULL;
+		pthread_cond_broadcast(&xk_work_done);
+	}
+
+	return NULL;
+}
+
+/* xk_work_lock held */
+static void xk_work_start(void)
+{
+	pthread_condattr_t attr;
+	pthread_t thread;
+
+	if (xk_work_started)
+		return;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&xk_work_cond, &attr);
+	pthread_cond_init(&xk_work_done, NULL);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&thread, NULL, xk_worker, NULL))
+		abort();
+	pthread_detach(thread);
+	xk_work_started = true;
+}
+
+static void xk_work_kick(void)
+{
+	pthread_mutex_lock(&xk_work_lock);
+	xk_work_start();
+	xk_work_rcu = true;
+	pthread_cond_signal(&xk_work_cond);
+	pthread_mutex_unlock(&xk_work_lock);
+}
+
+bool xk_queue_work(struct work_struct *w, unsigned long delay, bool mod)
+{
+	u64 due = xk_ktime_ns() + delay * (1000000000ULL / HZ);
+	bool queued;
+
+	pthread_mutex_lock(&xk_work_lock);
+	xk_work_start();
+	queued = !w->xk_pending;
+	if (queued) {
+		w->xk_pending = true;
+		w->xk_due = due;
+		w->xk_next = xk_work_list;
+		xk_work_list = w;
+	} else if (mod) {
+		w->xk_due = due;
+	}
+	pthread_cond_signal(&xk_work_cond);
+	pthread_mutex_unlock(&xk_work_lock);
+
+	return queued || mod;
+}
+
+/* xk_work_lock held */
+static bool xk_work_unlink(struct work_struct *w)
+{
+	struct work_struct **pw;
+
+	if (!w->xk_pending)
+		return false;
+	for (pw = &xk_work_list; *pw != w; pw = &(*pw)->xk_next)
+		;
+	*pw = w->xk_next;
+	w->xk_pending = false;
+	return true;
+}
+
+/* also catches a work item that queues itself again while running */
+bool cancel_work_sync(struct work_struct *w)
+{
+	bool was = false;
+
+	pthread_mutex_lock(&xk_work_lock);
+	do {
+		was |= xk_work_unlink(w);
+		while (xk_work_running == w)
+			pthread_cond_wait(&xk_work_done, &xk_work_lock);
+	} while (w->xk_pending);
+	pthread_mutex_unlock(&xk_work_lock);
+
+	return was;
+}
+
+void flush_work(struct work_struct *w)
+{
+	pthread_mutex_lock(&xk_work_lock);
+	while (w->xk_pending || xk_work_running == w)
+		pthread_cond_wait(&xk_work_done, &xk_work_lock);
+	pthread_mutex_unlock(&xk_work_lock);
+}
+
+/* tasks and mms, one task per thread */
+
+static __thread struct task_struct xk_task;
+static __thread bool xk_task_init;
+static int xk_next_pid = 1;
+
+struct mm_struct *xk_mm_new(void)
+{
+	struct mm_struct *mm = calloc(1, sizeof(*mm));
+
+	if (!mm)
+		return NULL;
+	mm->pgd = kzalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!mm->pgd) {
+		free(mm);
+		return NULL;
+	}
+	atomic_set(&mm->mm_count, 1);
+	return mm;
+}
+
+void mmdrop(struct mm_struct *mm)
+{
+	if (!atomic_dec_and_test(&mm->mm_count))
+		return;
+	kfree(mm->pgd);
+	free(mm);
+}
+
+struct task_struct *xk_current(void)
+{
+	if (unlikely(!xk_task_init)) {
+		xk_task_init = true;
+		xk_task.pid = __atomic_fetch_add(&xk_next_pid, 1,
+						 __ATOMIC_RELAXED);
+		xk_task.mm = xk_mm_new();
+	}
+	return &xk_task;
+}
+
+void xk_set_mm(struct mm_struct *mm)
+{
+	struct mm_struct *old = xk_current()->mm;
+
+	xk_task.mm = mm;
+	if (old)
+		mmdrop(old);
+}
+
+static pthread_mutex_t xk_mm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void xk_mm_exit(struct mm_struct *mm)
+{
+	struct mmu_notifier *sub, *next;
+
+	pthread_mutex_lock(&xk_mm_lock);
+	sub = mm->notifiers;
+	mm->notifiers = NULL;
+	pthread_mutex_unlock(&xk_mm_lock);
+
+	for (; sub; sub = next) {
+		next = sub->next;
+		sub->next = NULL;
+		if (sub->ops->release)
+			sub->ops->release(sub, mm);
+	}
+}
+
+struct mmu_notifier *mmu_notifier_get(const struct mmu_notifier_ops *ops,
+				      struct mm_struct *mm)
+{
+	struct mmu_notifier *sub;
+
+	pthread_mutex_lock(&xk_mm_lock);
+	for (sub = mm->notifiers; sub; sub = sub->next) {
+		if (sub->ops == ops) {
+			sub->users++;
+			goto out;
+		}
+	}
+
+	sub = ops->alloc_notifier(mm);
+	if (IS_ERR(sub))
+		goto out;
+	sub->ops = ops;
+	sub->mm = mm;
+	sub->users = 1;
+	sub->next = mm->notifiers;
+	mm->notifiers = sub;
+	mmgrab(mm);
+out:
+	pthread_mutex_unlock(&xk_mm_lock);
+	return sub;
+}
+
+static void xk_mmu_notifier_free(struct rcu_head *rcu)
+{
+	struct mmu_notifier *sub = container_of(rcu, struct mmu_notifier, rcu);
+	struct mm_struct *mm = sub->mm;
+
+	sub->ops->free_notifier(sub);
+	mmdrop(mm);
+}
+
+void mmu_notifier_put(struct mmu_notifier *subscription)
+{
+	struct mmu_notifier **p;
+
+	pthread_mutex_lock(&xk_mm_lock);
+	if (--subscription->users) {
+		pthread_mutex_unlock(&xk_mm_lock);
+		return;
+	}
+	/* not there anymore once the mm exited */
+	for (p = &subscription->mm->notifiers; *p; p = &(*p)->next) {
+		if (*p == subscription) {
+			*p = subscription->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&xk_mm_lock);
+
+	call_rcu(&subscription->rcu, xk_mmu_notifier_free);
+}
+
+/*
+ * Physical layout: the arena is system RAM from 0, followed by 16 MiB of
+ * reserved memory, a hole and a 256 MiB MMIO window on the next GiB but
+ * one. Anything else is a hole.
+ */
+struct resource xk_iomem[3];
+const size_t xk_nr_iomem = ARRAY_SIZE(xk_iomem);
+
+static void xk_iomem_init(void)
+{
+	u64 mmio = ALIGN(xk_arena_size + (16ULL << 20), 1ULL << 30) +
+		   (1ULL << 30);
+
+	xk_iomem[0] = (struct resource){
+		.start = 0,
+		.end = xk_arena_size - 1,
+		.name = "System RAM",
+		.flags = IORESOURCE_SYSTEM_RAM | IORESOURCE_BUSY,
+		.desc = IORES_DESC_NONE,
+	};
+	xk_iomem[1] = (struct resource){
+		.start = xk_arena_size,
+		.end = xk_arena_size + (16ULL << 20) - 1,
+		.name = "Reserved",
+		.flags = IORESOURCE_MEM | IORESOURCE_BUSY,
+		.desc = IORES_DESC_RESERVED,
+	};
+	xk_iomem[2] = (struct resource){
+		.start = mmio,
+		.end = mmio + (256ULL << 20) - 1,
+		.name = "PCI Bus 0000:00",
+		.flags = IORESOURCE_MEM,
+		.desc = IORES_DESC_NONE,
+	};
+}
+
+int walk_iomem_res_desc(unsigned long desc, unsigned long flags, u64 start,
+			u64 end, void *arg,
+			int (*func)(struct resource *res, void *arg))
+{
+	struct resource res;
+	int ret = -EINVAL;
+
+	for (size_t i = 0; i < xk_nr_iomem; i++) {
+		res = xk_iomem[i];
+		if ((res.flags & flags) != flags ||
+		    (desc != IORES_DESC_NONE && res.desc != desc) ||
+		    res.end < start || res.start > end)
+			continue;
+
+		res.start = max(res.start, start);
+		res.end = min(res.end, end);
+		ret = func(&res, arg);
+		if (ret)
+			return ret;
+	}
+
+	return ret;
+}
+
+int walk_system_ram_res(u64 start, u64 end, void *arg,
+			int (*func)(struct resource *res, void *arg))
+{
+	return walk_iomem_res_desc(IORES_DESC_NONE,
+				   IORESOURCE_SYSTEM_RAM | IORESOURCE_BUSY,
+				   start, end, arg, func);
+}
+
+/* xorshift64*, seeded per thread so that runs are reproducible */
+static __thread u64 xk_rand_state;
+static u64 xk_rand_seed = 0x9e3779b97f4a7c15ULL;
+
+u64 get_random_u64(void)
+{
+	u64 x = xk_rand_state;
+
+	if (unlikely(!x))
+		x = __atomic_add_fetch(&xk_rand_seed, 0x9e3779b97f4a7c15ULL,
+				       __ATOMIC_RELAXED);
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	xk_rand_state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+void get_random_bytes(void *buf, size_t len)
+{
+	u64 r;
+
+	for (size_t i = 0; i < len; i += sizeof(r)) {
+		r = get_random_u64();
+		memcpy((char *)buf + i, &r, min(sizeof(r), len - i));
+	}
+}
+
+int printk(const char *fmt, ...)
+{
+	static int verbose = -1;
+	va_list args;
+	int ret;
+
+	if (verbose < 0)
+		verbose = getenv("XK_VERBOSE") != NULL;
+	if (!verbose)
+		return 0;
+
+	va_start(args, fmt);
+	ret = vfprintf(stderr, fmt, args);
+	va_end(args);
+	return ret;
+}
+
+/* debugfs */
+
+struct dentry {
+	char name[64];
+	struct dentry *parent;
+	void *data;
+	const struct file_operations *fops;
+	struct dentry *next;
+};
+
+static struct dentry *xk_dentries;
+static pthread_mutex_t xk_dentries_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* created by the module entry point in the kernel, on startup here */
+struct dentry *xklib_debugfs;
+
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops)
+{
+	struct dentry *d = calloc(1, sizeof(*d));
+
+	if (!d)
+		return ERR_PTR(-ENOMEM);
+	snprintf(d->name, sizeof(d->name), "%s", name);
+	d->parent = IS_ERR(parent) ? NULL : parent;
+	d->data = data;
+	d->fops = fops;
+
+	pthread_mutex_lock(&xk_dentries_lock);
+	d->next = xk_dentries;
+	xk_dentries = d;
+	pthread_mutex_unlock(&xk_dentries_lock);
+	return d;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	return debugfs_create_file(name, 0, parent, NULL, NULL);
+}
+
+static bool xk_dentry_under(const struct dentry *d, const struct dentry *top)
+{
+	for (; d; d = d->parent) {
+		if (d == top)
+			return true;
+	}
+	return false;
+}
+
+void debugfs_remove_recursive(struct dentry *top)
+{
+	struct dentry **pd, *d;
+
+	if (IS_ERR_OR_NULL(top))
+		return;
+
+	pthread_mutex_lock(&xk_dentries_lock);
+	/* children are always created after, so come first on the list */
+	for (pd = &xk_dentries; (d = *pd);) {
+		if (xk_dentry_under(d, top)) {
+			*pd = d->next;
+			free(d);
+		} else {
+			pd = &d->next;
+		}
+	}
+	pthread_mutex_unlock(&xk_dentries_lock);
+}
+
+void debugfs_remove(struct dentry *dentry)
+{
+	debugfs_remove_recursive(dentry);
+}
+
+static bool xk_dentry_match(const struct dentry *d, const char *path,
+			    size_t len)
+{
+	size_t n = strlen(d->name);
+
+	if (n > len || strncmp(path + len - n, d->name, n))
+		return false;
+	if (!d->parent)
+		return n == len;
+	return len > n && path[len - n - 1] == '/' &&
+	       xk_dentry_match(d->parent, path, len - n - 1);
+}
+
+int xk_debugfs_show(const char *path, FILE *out)
+{
+	struct seq_file m = { .out = out };
+	struct dentry *d;
+	int ret = -ENOENT;
+
+	pthread_mutex_lock(&xk_dentries_lock);
+	for (d = xk_dentries; d; d = d->next) {
+		if (d->fops && xk_dentry_match(d, path, strlen(path)))
+			break;
+	}
+	pthread_mutex_unlock(&xk_dentries_lock);
+
+	if (d) {
+		m.private = d->data;
+		ret = d->fops->show(&m, NULL);
+	}
+	return ret;
+}
+
+__attribute__((constructor)) static void xk_shim_init(void)
+{
+	const char *mb = getenv("XK_ARENA_MB");
+	size_t unit = __stop_xk_percpu - __start_xk_percpu;
+	char *map;
+
+	xk_arena_size = (mb ? strtoul(mb, NULL, 0) : XK_ARENA_MB) << 20;
+	xk_arena_size = ALIGN(max(xk_arena_size, 1UL << XK_MAX_SHIFT),
+			      1UL << XK_MAX_SHIFT);
+
+	/* aligned on the largest class, so blocks are naturally aligned */
+	map = mmap(NULL, xk_arena_size + (1UL << XK_MAX_SHIFT),
+		   PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	xk_page_class = calloc(xk_arena_size >> PAGE_SHIFT, 1);
+	if (map == MAP_FAILED || !xk_page_class) {
+		fprintf(stderr, "xkshim: no room for a %zu MiB arena\n",
+			xk_arena_size >> 20);
+		abort();
+	}
+	xk_arena = (char *)ALIGN((unsigned long)map, 1UL << XK_MAX_SHIFT);
+
+	for (size_t i = 0; i <= XK_MAX_SHIFT; i++)
+		pthread_mutex_init(&xk_classes[i].lock, NULL);
+
+	if (unit) {
+		xk_percpu_unit = ALIGN(unit, L1_CACHE_BYTES);
+		xk_percpu_area = aligned_alloc(L1_CACHE_BYTES,
+					       xk_percpu_unit * XK_NR_CPUS);
+		if (!xk_percpu_area)
+			abort();
+		for (int cpu = 0; cpu < XK_NR_CPUS; cpu++)
+			memcpy(xk_percpu_area + cpu * xk_percpu_unit,
+			       __start_xk_percpu, unit);
+	}
+
+	xk_iomem_init();
+	xklib_debugfs = debugfs_create_dir("xklib", NULL);
+}
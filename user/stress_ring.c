@@ -0,0 +1,232 @@
+/*
+ * Stress driver of the rings: producer threads, each on a cpu of its own,
+ * push tagged objects while one consumer drains them, then the consumer
+ * checks that every object came out exactly once and, per producer, in
+ * the order it went in. Producers and the consumer mix single and batch
+ * operations, and a small ring keeps both sides hitting full and empty.
+ *
+ *   stress_ring [spsc|mpsc|pcpu|all] [producers] [objects per producer]
+ *
+ * spsc always runs a single producer.
+ */
+#include "ring.h"
+#include "xkshim.h"
+
+#define STRESS_RING_SIZE 64
+#define STRESS_BATCH 16
+#define STRESS_MAX_PRODUCERS 32
+
+enum stress_queue {
+	STRESS_SPSC,
+	STRESS_MPSC,
+	STRESS_PCPU,
+	STRESS_QUEUES,
+};
+
+static const char *const stress_names[] = {
+	[STRESS_SPSC] = "spsc",
+	[STRESS_MPSC] = "mpsc",
+	[STRESS_PCPU] = "pcpu",
+};
+
+struct stress_run {
+	enum stress_queue queue;
+	size_t producers;
+	size_t objs;
+	struct ring_spsc *spsc;
+	struct ring_mpsc *mpsc;
+	struct ring_pcpu *pcpu;
+};
+
+struct stress_thread {
+	struct stress_run *run;
+	pthread_t thread;
+	size_t id;
+};
+
+/* never NULL: producer in the top bits, 1 + sequence number below */
+static inline void *stress_obj(size_t producer, size_t seq)
+{
+	return (void *)((producer << 40) | (seq + 1));
+}
+
+static size_t stress_push(struct stress_run *run, void **objs, size_t n)
+{
+	switch (run->queue) {
+	case STRESS_SPSC:
+		return ring_spsc_enqueue_batch(run->spsc, objs, n);
+	case STRESS_MPSC:
+		return ring_mpsc_enqueue_batch(run->mpsc, objs, n);
+	default:
+		return ring_pcpu_enqueue_batch(run->pcpu, objs, n);
+	}
+}
+
+static size_t stress_pop(struct stress_run *run, void **objs, size_t n)
+{
+	if (n == 1) {
+		switch (run->queue) {
+		case STRESS_SPSC:
+			objs[0] = ring_spsc_dequeue(run->spsc);
+			break;
+		case STRESS_MPSC:
+			objs[0] = ring_mpsc_dequeue(run->mpsc);
+			break;
+		default:
+			objs[0] = ring_pcpu_dequeue(run->pcpu);
+			break;
+		}
+		return objs[0] != NULL;
+	}
+
+	switch (run->queue) {
+	case STRESS_SPSC:
+		return ring_spsc_dequeue_batch(run->spsc, objs, n);
+	case STRESS_MPSC:
+		return ring_mpsc_dequeue_batch(run->mpsc, objs, n);
+	default:
+		return ring_pcpu_dequeue_batch(run->pcpu, objs, n);
+	}
+}
+
+static void *stress_producer(void *data)
+{
+	struct stress_thread *t = data;
+	struct stress_run *run = t->run;
+	void *objs[STRESS_BATCH];
+	size_t seq = 0, n, done;
+
+	/* cpu 0 is the consumer's */
+	xk_set_cpu(t->id + 1);
+	while (seq < run->objs) {
+		n = 1 + get_random_u32() % STRESS_BATCH;
+		n = min(n, run->objs - seq);
+		for (size_t i = 0; i < n; i++)
+			objs[i] = stress_obj(t->id, seq + i);
+
+		for (done = 0; done < n;) {
+			done += stress_push(run, &objs[done], n - done);
+			if (done < n)
+				sched_yield();
+		}
+		seq += n;
+	}
+
+	return NULL;
+}
+
+static int stress_consume(struct stress_run *run)
+{
+	size_t next[STRESS_MAX_PRODUCERS] = { 0 };
+	size_t total = run->producers * run->objs, seen = 0, n, p, seq;
+	void *objs[STRESS_BATCH];
+
+	while (seen < total) {
+		n = stress_pop(run, objs, 1 + get_random_u32() % STRESS_BATCH);
+		if (!n)
+			sched_yield();
+
+		for (size_t i = 0; i < n; i++) {
+			p = (unsigned long)objs[i] >> 40;
+			seq = ((unsigned long)objs[i] & ((1UL << 40) - 1)) - 1;
+			if (p >= run->producers || seq != next[p]) {
+				fprintf(stderr,
+					"%s: producer %zu object %zu out of order, expected %zu\n",
+					stress_names[run->queue], p, seq,
+					p < run->producers ? next[p] : 0);
+				return -1;
+			}
+			next[p]++;
+		}
+		seen += n;
+	}
+
+	/* nothing may be left behind */
+	if (stress_pop(run, objs, STRESS_BATCH)) {
+		fprintf(stderr, "%s: objects past the end\n",
+			stress_names[run->queue]);
+		return -1;
+	}
+	return 0;
+}
+
+static int stress_run(struct stress_run *run)
+{
+	struct stress_thread threads[STRESS_MAX_PRODUCERS];
+	int err = -ENOMEM;
+
+	switch (run->queue) {
+	case STRESS_SPSC:
+		run->spsc = ring_spsc__new(STRESS_RING_SIZE, NUMA_NO_NODE,
+					   GFP_KERNEL);
+		if (!run->spsc)
+			return err;
+		break;
+	case STRESS_MPSC:
+		run->mpsc = ring_mpsc__new(STRESS_RING_SIZE, NUMA_NO_NODE,
+					   GFP_KERNEL);
+		if (!run->mpsc)
+			return err;
+		break;
+	default:
+		run->pcpu = ring_pcpu__new(STRESS_RING_SIZE, GFP_KERNEL);
+		if (!run->pcpu)
+			return err;
+		break;
+	}
+
+	for (size_t i = 0; i < run->producers; i++) {
+		threads[i].run = run;
+		threads[i].id = i;
+		if (pthread_create(&threads[i].thread, NULL, stress_producer,
+				   &threads[i]))
+			abort();
+	}
+
+	err = stress_consume(run);
+	for (size_t i = 0; i < run->producers; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	ring_spsc__free(run->spsc);
+	ring_mpsc__free(run->mpsc);
+	ring_pcpu__free(run->pcpu);
+	run->spsc = NULL;
+	run->mpsc = NULL;
+	run->pcpu = NULL;
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	const char *which = argc > 1 ? argv[1] : "all";
+	size_t producers = argc > 2 ? strtoul(argv[2], NULL, 0) : 4;
+	size_t objs = argc > 3 ? strtoul(argv[3], NULL, 0) : 1UL << 20;
+	struct stress_run run = { .objs = objs };
+	bool any = false;
+
+	producers = clamp(producers, 1UL, (size_t)STRESS_MAX_PRODUCERS);
+	xk_set_cpu(0);
+
+	for (run.queue = 0; run.queue < STRESS_QUEUES; run.queue++) {
+		if (strcmp(which, "all") &&
+		    strcmp(which, stress_names[run.queue]))
+			continue;
+
+		any = true;
+		run.producers = run.queue == STRESS_SPSC ? 1 : producers;
+		if (stress_run(&run)) {
+			fprintf(stderr, "%s: failed\n",
+				stress_names[run.queue]);
+			return 1;
+		}
+		printf("%s: %zu producers, %zu objects, ok\n",
+		       stress_names[run.queue], run.producers,
+		       run.producers * run.objs);
+	}
+
+	if (!any) {
+		fprintf(stderr, "unknown ring %s\n", which);
+		return 1;
+	}
+	return 0;
+}